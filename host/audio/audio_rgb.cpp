@@ -0,0 +1,851 @@
+/** @file audio_rgb.cpp
+*
+* @brief Turn live or recorded audio into RGB frames for the lights
+*
+* Native replacement for projects/audio_serial. Audio comes from a 16-bit PCM
+* WAV file, or raw signed 16-bit little endian PCM on stdin (for example
+* arecord -t raw -f S16_LE -r 44100 -c 2). Channels are mixed down to mono.
+*
+* Every hop (-s samples), the last -n samples are Hann windowed and run
+* through an FFT. Each band (-b, in Hz) becomes one output value: the band's
+* power in dB, mapped from the floor (-f) up to 0 dBFS onto 0-255, falling
+* back slowly when the music gets quieter. Beats are picked out of the first
+* band's power and flash every channel towards full brightness.
+*
+* Frames go straight to the serial port, and only when they change:
+*   default:  [0][values...]   rgb_controller, three values per fixture
+*   -a addr:  [addr][r][g][b]  bridge, same packets audio_serial sent
+* The port is non-blocking and a frame that doesn't fit is dropped instead of
+* queued, so a slow link can't add latency.
+*
+* Latency from the newest sample to its frame being written is one hop plus
+* the processing time, 2.9ms plus a few microseconds with the defaults at
+* 44.1kHz (~344 updates per second). -l runs a recording through as fast as
+* it can and reports processing time percentiles and the resulting latency.
+*
+* WAV files are played back in real time when there's a serial port to send
+* to, so they can stand in for live audio.
+*
+* @author Alvaro Prieto
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+#include "../serial/frame.h"
+#include "../serial/serial_port.h"
+
+#define DEFAULT_FFT_SIZE (512)
+#define DEFAULT_HOP (128)
+#define MIN_FFT_SIZE (64)
+#define MAX_FFT_SIZE (8192)
+
+// Raw PCM on stdin
+#define DEFAULT_RATE (44100)
+#define DEFAULT_CHANNELS (2)
+
+// Roughly the FFT bins audio_serial added up for red, green and blue
+#define DEFAULT_BANDS "260-1200,1460-2500,2750-3800"
+#define MAX_BANDS (48)
+
+#define DEFAULT_FLOOR_DB (-60.0)
+
+// How fast a band's level falls back when it gets quieter
+#define RELEASE_DB_PER_SECOND (40.0)
+
+// A beat is first band power over threshold times its running average, at
+// most one every BEAT_HOLDOFF_SECONDS. The flash fades over
+// BEAT_FLASH_SECONDS.
+#define DEFAULT_BEAT_THRESHOLD (1.6)
+#define BEAT_AVERAGE_SECONDS (1.0)
+#define BEAT_HOLDOFF_SECONDS (0.12)
+#define BEAT_FLASH_SECONDS (0.1)
+
+// Serial bits per byte (start, 8 data, stop), for latency estimates
+#define BITS_PER_BYTE (10)
+
+typedef struct
+{
+  uint32_t size;
+  std::vector<uint32_t> reverse;    // Bit reversed position of every input
+  std::vector<float> window;
+  // Twiddle factors for every stage, the stage with butterflies half apart
+  // starts at index half - 1, so they're contiguous within a stage
+  std::vector<float> twiddle_re;
+  std::vector<float> twiddle_im;
+  std::vector<float> re;
+  std::vector<float> im;
+} fft_t;
+
+typedef struct
+{
+  uint32_t first_bin;
+  uint32_t last_bin;
+} band_t;
+
+typedef struct
+{
+  fft_t fft;
+  std::vector<band_t> bands;
+  std::vector<double> level_db;
+  double floor_db;
+  double release_db;          // Per hop
+  double power_scale;         // Full scale sine at its peak bin -> 1.0
+  double beat_threshold;      // 0 turns beat detection off
+  double beat_average;
+  double beat_alpha;          // Per hop
+  uint32_t beat_holdoff;      // In hops
+  uint32_t hops_since_beat;
+  double flash;
+  double flash_decay;         // Per hop
+  uint64_t beats;
+} engine_t;
+
+typedef struct
+{
+  int fd;
+  uint32_t rate;
+  uint16_t channels;
+  uint64_t data_left;         // Bytes left in the WAV data chunk
+  std::vector<uint8_t> buffer;
+} source_t;
+
+typedef struct
+{
+  int fd;                     // -1 to only encode (benchmark)
+  int address;                // -1 for rgb_controller frames
+  std::vector<uint8_t> last;
+  uint64_t frames;
+  uint64_t unchanged;
+  uint64_t dropped;
+  size_t longest;             // Longest encoded frame, in bytes
+} output_t;
+
+static volatile sig_atomic_t running = 1;
+
+/*******************************************************************************
+ * @fn     void fft_init( fft_t* fft, uint32_t size )
+ * @brief  Precompute the window, bit reversal and twiddles for a power of two
+ *         size
+ * ****************************************************************************/
+static void fft_init( fft_t* fft, uint32_t size )
+{
+  uint32_t bits = __builtin_ctz( size );
+
+  fft->size = size;
+  fft->reverse.resize( size );
+  fft->window.resize( size );
+  fft->twiddle_re.resize( size );
+  fft->twiddle_im.resize( size );
+  fft->re.resize( size );
+  fft->im.resize( size );
+
+  for( uint32_t index = 0; index < size; index++ )
+  {
+    uint32_t reversed = 0;
+
+    for( uint32_t bit = 0; bit < bits; bit++ )
+    {
+      reversed |= ( ( index >> bit ) & 1 ) << ( bits - 1 - bit );
+    }
+
+    fft->reverse[index] = reversed;
+    fft->window[index] = 0.5 - 0.5 * cos( 2.0 * M_PI * index / size );
+  }
+
+  for( uint32_t half = 1; half < size; half <<= 1 )
+  {
+    for( uint32_t k = 0; k < half; k++ )
+    {
+      fft->twiddle_re[half - 1 + k] = cos( -M_PI * k / half );
+      fft->twiddle_im[half - 1 + k] = sin( -M_PI * k / half );
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void fft_forward( fft_t* fft, const float* samples )
+ * @brief  Window samples and transform them into fft->re/im. Iterative radix-2,
+ *         four butterflies at a time with SSE once they're at least four apart
+ * ****************************************************************************/
+static void fft_forward( fft_t* fft, const float* samples )
+{
+  const uint32_t size = fft->size;
+  float* re = fft->re.data();
+  float* im = fft->im.data();
+
+  for( uint32_t index = 0; index < size; index++ )
+  {
+    re[fft->reverse[index]] = samples[index] * fft->window[index];
+    im[index] = 0;
+  }
+
+  for( uint32_t half = 1; half < size; half <<= 1 )
+  {
+    const float* w_re = &fft->twiddle_re[half - 1];
+    const float* w_im = &fft->twiddle_im[half - 1];
+
+    for( uint32_t group = 0; group < size; group += 2 * half )
+    {
+      float* a_re = &re[group];
+      float* a_im = &im[group];
+      float* b_re = &re[group + half];
+      float* b_im = &im[group + half];
+      uint32_t k = 0;
+
+#if defined(__SSE__)
+      for( ; k + 4 <= half; k += 4 )
+      {
+        __m128 wr = _mm_loadu_ps( &w_re[k] );
+        __m128 wi = _mm_loadu_ps( &w_im[k] );
+        __m128 br = _mm_loadu_ps( &b_re[k] );
+        __m128 bi = _mm_loadu_ps( &b_im[k] );
+        __m128 ar = _mm_loadu_ps( &a_re[k] );
+        __m128 ai = _mm_loadu_ps( &a_im[k] );
+
+        __m128 tr = _mm_sub_ps( _mm_mul_ps( wr, br ), _mm_mul_ps( wi, bi ) );
+        __m128 ti = _mm_add_ps( _mm_mul_ps( wr, bi ), _mm_mul_ps( wi, br ) );
+
+        _mm_storeu_ps( &a_re[k], _mm_add_ps( ar, tr ) );
+        _mm_storeu_ps( &a_im[k], _mm_add_ps( ai, ti ) );
+        _mm_storeu_ps( &b_re[k], _mm_sub_ps( ar, tr ) );
+        _mm_storeu_ps( &b_im[k], _mm_sub_ps( ai, ti ) );
+      }
+#endif
+
+      for( ; k < half; k++ )
+      {
+        float tr = w_re[k] * b_re[k] - w_im[k] * b_im[k];
+        float ti = w_re[k] * b_im[k] + w_im[k] * b_re[k];
+
+        b_re[k] = a_re[k] - tr;
+        b_im[k] = a_im[k] - ti;
+        a_re[k] += tr;
+        a_im[k] += ti;
+      }
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     bool parse_bands( engine_t* engine, const char* list, uint32_t rate )
+ * @brief  Turn "low-high,low-high,..." (Hz) into FFT bin ranges. A band
+ *         narrower than a bin gets the bin nearest to its center.
+ * ****************************************************************************/
+static bool parse_bands( engine_t* engine, const char* list, uint32_t rate )
+{
+  double bin_width = (double)rate / engine->fft.size;
+  uint32_t last_bin = engine->fft.size / 2;
+  const char* position = list;
+
+  engine->bands.clear();
+
+  while( *position )
+  {
+    char* end;
+    double low;
+    double high;
+    band_t band;
+
+    low = strtod( position, &end );
+    if( ( end == position ) || ( '-' != *end ) )
+    {
+      return false;
+    }
+    position = end + 1;
+
+    high = strtod( position, &end );
+    if( ( end == position ) || ( high <= low ) || ( low < 0 ) )
+    {
+      return false;
+    }
+    position = end;
+
+    band.first_bin = std::max( 1.0, ceil( low / bin_width ) );
+    band.last_bin = std::min( (double)last_bin, floor( high / bin_width ) );
+    if( band.first_bin > band.last_bin )
+    {
+      band.first_bin = std::min( (double)last_bin,
+                          std::max( 1.0, round( ( low + high ) / 2 / bin_width ) ) );
+      band.last_bin = band.first_bin;
+    }
+
+    if( engine->bands.size() == MAX_BANDS )
+    {
+      return false;
+    }
+    engine->bands.push_back( band );
+
+    if( ',' == *position )
+    {
+      position++;
+    }
+    else if( *position )
+    {
+      return false;
+    }
+  }
+
+  return !engine->bands.empty();
+}
+
+/*******************************************************************************
+ * @fn     void engine_init( engine_t* engine, uint32_t size, uint32_t hop,
+ *                           uint32_t rate, double floor_db, double threshold )
+ * @brief  Set up the FFT and the per hop constants. Bands are set separately.
+ * ****************************************************************************/
+static void engine_init( engine_t* engine, uint32_t size, uint32_t hop,
+                            uint32_t rate, double floor_db, double threshold )
+{
+  double hop_seconds = (double)hop / rate;
+
+  fft_init( &engine->fft, size );
+
+  // Hann window coherent gain is 0.5, so a full scale sine peaks at size / 4
+  engine->power_scale = 1.0 / ( ( size / 4.0 ) * ( size / 4.0 ) );
+
+  engine->floor_db = floor_db;
+  engine->release_db = RELEASE_DB_PER_SECOND * hop_seconds;
+
+  engine->beat_threshold = threshold;
+  engine->beat_average = 0;
+  engine->beat_alpha = std::min( 1.0, hop_seconds / BEAT_AVERAGE_SECONDS );
+  engine->beat_holdoff = ceil( BEAT_HOLDOFF_SECONDS / hop_seconds );
+  engine->hops_since_beat = engine->beat_holdoff;
+  engine->flash = 0;
+  engine->flash_decay = hop_seconds / BEAT_FLASH_SECONDS;
+  engine->beats = 0;
+}
+
+/*******************************************************************************
+ * @fn     void engine_process( engine_t* engine, const float* samples,
+ *                                                        uint8_t* values )
+ * @brief  Analyze the last fft.size samples into one 0-255 value per band
+ * ****************************************************************************/
+static void engine_process( engine_t* engine, const float* samples,
+                                                              uint8_t* values )
+{
+  const float* re = engine->fft.re.data();
+  const float* im = engine->fft.im.data();
+  double first_power = 0;
+
+  fft_forward( &engine->fft, samples );
+
+  for( size_t band = 0; band < engine->bands.size(); band++ )
+  {
+    double power = 0;
+    double db;
+
+    for( uint32_t bin = engine->bands[band].first_bin;
+                                  bin <= engine->bands[band].last_bin; bin++ )
+    {
+      power += re[bin] * re[bin] + im[bin] * im[bin];
+    }
+    power *= engine->power_scale;
+
+    if( 0 == band )
+    {
+      first_power = power;
+    }
+
+    // Instant attack, slow release
+    db = 10.0 * log10( power + 1e-20 );
+    engine->level_db[band] = std::max( db,
+                                  engine->level_db[band] - engine->release_db );
+
+    db = ( engine->level_db[band] - engine->floor_db ) / -engine->floor_db;
+    values[band] = std::min( 1.0, std::max( 0.0, db ) ) * 255.0 + 0.5;
+  }
+
+  if( engine->beat_threshold > 0 )
+  {
+    engine->hops_since_beat++;
+
+    if( ( first_power > engine->beat_threshold * engine->beat_average ) &&
+        ( 10.0 * log10( first_power + 1e-20 ) > engine->floor_db ) &&
+        ( engine->hops_since_beat >= engine->beat_holdoff ) )
+    {
+      engine->hops_since_beat = 0;
+      engine->flash = 1.0;
+      engine->beats++;
+    }
+
+    engine->beat_average += ( first_power - engine->beat_average ) *
+                                                          engine->beat_alpha;
+
+    if( engine->flash > 0 )
+    {
+      for( size_t band = 0; band < engine->bands.size(); band++ )
+      {
+        values[band] += ( 255 - values[band] ) * engine->flash;
+      }
+
+      engine->flash = std::max( 0.0, engine->flash - engine->flash_decay );
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     size_t read_full( int fd, void* buffer, size_t length )
+ * @brief  read() until length bytes arrive or the input ends. Returns the
+ *         number of bytes read.
+ * ****************************************************************************/
+static size_t read_full( int fd, void* buffer, size_t length )
+{
+  size_t total = 0;
+  ssize_t result;
+
+  while( total < length )
+  {
+    result = read( fd, (uint8_t*)buffer + total, length - total );
+    if( result <= 0 )
+    {
+      if( ( result < 0 ) && ( EINTR == errno ) && running )
+      {
+        continue;
+      }
+      break;
+    }
+    total += result;
+  }
+
+  return total;
+}
+
+/*******************************************************************************
+ * @fn     bool skip_bytes( int fd, uint64_t length )
+ * @brief  Skip a chunk, by reading it since the input might be a pipe
+ * ****************************************************************************/
+static bool skip_bytes( int fd, uint64_t length )
+{
+  uint8_t buffer[4096];
+  size_t chunk;
+
+  while( length )
+  {
+    chunk = std::min( (uint64_t)sizeof(buffer), length );
+    if( read_full( fd, buffer, chunk ) != chunk )
+    {
+      return false;
+    }
+    length -= chunk;
+  }
+
+  return true;
+}
+
+/*******************************************************************************
+ * @fn     uint16_t le16( const uint8_t* data )
+ * @brief  Little endian 16-bit value, WAV files are little endian
+ * ****************************************************************************/
+static uint16_t le16( const uint8_t* data )
+{
+  return data[0] | ( data[1] << 8 );
+}
+
+/*******************************************************************************
+ * @fn     uint32_t le32( const uint8_t* data )
+ * @brief  Little endian 32-bit value
+ * ****************************************************************************/
+static uint32_t le32( const uint8_t* data )
+{
+  return le16( data ) | ( (uint32_t)le16( &data[2] ) << 16 );
+}
+
+/*******************************************************************************
+ * @fn     bool wav_open( source_t* source, const char* path )
+ * @brief  Open a 16-bit PCM WAV file and skip to its samples
+ * ****************************************************************************/
+static bool wav_open( source_t* source, const char* path )
+{
+  uint8_t header[16];
+  uint32_t chunk_length;
+  bool have_format = false;
+
+  source->fd = open( path, O_RDONLY );
+  if( source->fd < 0 )
+  {
+    fprintf( stderr, "audio_rgb: can't open %s: %s\n", path,
+                                                          strerror( errno ) );
+    return false;
+  }
+
+  if( ( read_full( source->fd, header, 12 ) != 12 ) ||
+      memcmp( header, "RIFF", 4 ) || memcmp( &header[8], "WAVE", 4 ) )
+  {
+    fprintf( stderr, "audio_rgb: %s is not a WAV file\n", path );
+    return false;
+  }
+
+  for(;;)
+  {
+    if( read_full( source->fd, header, 8 ) != 8 )
+    {
+      fprintf( stderr, "audio_rgb: %s has no samples\n", path );
+      return false;
+    }
+    chunk_length = le32( &header[4] );
+
+    if( !memcmp( header, "data", 4 ) && have_format )
+    {
+      source->data_left = chunk_length;
+      return true;
+    }
+
+    if( !memcmp( header, "fmt ", 4 ) && ( chunk_length >= 16 ) )
+    {
+      if( read_full( source->fd, header, 16 ) != 16 )
+      {
+        return false;
+      }
+
+      // PCM or WAVE_FORMAT_EXTENSIBLE, only 16-bit samples
+      if( ( ( 1 != le16( header ) ) && ( 0xFFFE != le16( header ) ) ) ||
+          ( 16 != le16( &header[14] ) ) || ( 0 == le16( &header[2] ) ) )
+      {
+        fprintf( stderr, "audio_rgb: %s is not 16-bit PCM\n", path );
+        return false;
+      }
+
+      source->channels = le16( &header[2] );
+      source->rate = le32( &header[4] );
+      have_format = true;
+      chunk_length -= 16;
+    }
+
+    // Chunks are padded to an even length
+    if( !skip_bytes( source->fd, chunk_length + ( chunk_length & 1 ) ) )
+    {
+      return false;
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     size_t source_read( source_t* source, float* samples, size_t count )
+ * @brief  Read up to count sample frames, mixed down to mono floats. Returns
+ *         the number of frames read, less than count at the end of the input.
+ * ****************************************************************************/
+static size_t source_read( source_t* source, float* samples, size_t count )
+{
+  size_t frame_length = 2 * source->channels;
+  size_t length = std::min( (uint64_t)( count * frame_length ),
+                                                          source->data_left );
+  size_t frames;
+  const uint8_t* data;
+
+  source->buffer.resize( count * frame_length );
+  length = read_full( source->fd, source->buffer.data(), length );
+  source->data_left -= length;
+
+  frames = length / frame_length;
+  data = source->buffer.data();
+
+  for( size_t frame = 0; frame < frames; frame++ )
+  {
+    int32_t sum = 0;
+
+    for( uint16_t channel = 0; channel < source->channels; channel++ )
+    {
+      sum += (int16_t)le16( data );
+      data += 2;
+    }
+
+    samples[frame] = sum / ( 32768.0f * source->channels );
+  }
+
+  return frames;
+}
+
+/*******************************************************************************
+ * @fn     void output_write( output_t* output, const uint8_t* values,
+ *                                                        size_t count )
+ * @brief  Frame and send a set of values, unless they're the same as last
+ *         time. Counts frames that didn't fit in the port's buffer as dropped.
+ * ****************************************************************************/
+static void output_write( output_t* output, const uint8_t* values,
+                                                                  size_t count )
+{
+  uint8_t payload[1 + MAX_BANDS + 2];
+  uint8_t encoded[FRAME_ENCODED_LENGTH( sizeof(payload) )];
+  size_t length;
+  size_t encoded_length;
+
+  // rgb_controller frames start at fixture 0 and need whole fixtures
+  payload[0] = ( output->address < 0 ) ? 0 : output->address;
+  memcpy( &payload[1], values, count );
+  length = 1 + count;
+  while( ( output->address < 0 ) && ( ( length - 1 ) % 3 ) )
+  {
+    payload[length++] = 0;
+  }
+
+  if( ( output->last.size() == length ) &&
+                              !memcmp( output->last.data(), payload, length ) )
+  {
+    output->unchanged++;
+    return;
+  }
+  output->last.assign( payload, payload + length );
+
+  encoded_length = frame_encode( payload, length, encoded );
+  output->longest = std::max( output->longest, encoded_length );
+  output->frames++;
+
+  if( output->fd < 0 )
+  {
+    return;
+  }
+
+  if( write( output->fd, encoded, encoded_length ) != (ssize_t)encoded_length )
+  {
+    // A partial frame is resynced by the next START_BYTE
+    output->dropped++;
+  }
+}
+
+/*******************************************************************************
+ * @fn     double elapsed_us( const struct timespec* start,
+ *                                              const struct timespec* end )
+ * @brief  Microseconds between two CLOCK_MONOTONIC times
+ * ****************************************************************************/
+static double elapsed_us( const struct timespec* start,
+                                                    const struct timespec* end )
+{
+  return ( end->tv_sec - start->tv_sec ) * 1e6 +
+                                      ( end->tv_nsec - start->tv_nsec ) / 1e3;
+}
+
+/*******************************************************************************
+ * @fn     void print_benchmark( std::vector<float>& times, ... )
+ * @brief  Print the processing time distribution and the latency it adds up
+ *         to
+ * ****************************************************************************/
+static void print_benchmark( std::vector<float>& times, const engine_t* engine,
+                      const output_t* output, uint32_t hop, uint32_t rate,
+                      int baud )
+{
+  double hop_ms = 1e3 * hop / rate;
+  double serial_ms = 1e3 * output->longest * BITS_PER_BYTE / baud;
+  double p99;
+
+  if( times.empty() )
+  {
+    fprintf( stderr, "audio_rgb: not enough audio for one update\n" );
+    return;
+  }
+
+  std::sort( times.begin(), times.end() );
+  p99 = times[( times.size() - 1 ) * 99 / 100];
+
+  fprintf( stderr, "%zu updates (%.1f per second), %llu beats, "
+                    "%llu frames sent, %llu unchanged\n",
+                    times.size(), (double)rate / hop,
+                    (unsigned long long)engine->beats,
+                    (unsigned long long)output->frames,
+                    (unsigned long long)output->unchanged );
+  fprintf( stderr, "processing us: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+                    times[( times.size() - 1 ) / 2],
+                    times[( times.size() - 1 ) * 9 / 10], p99, times.back() );
+  fprintf( stderr, "latency ms: hop %.2f + processing p99 %.3f + serial %.2f "
+                    "(%zu bytes at %d) = %.2f\n", hop_ms, p99 / 1e3,
+                    serial_ms, output->longest, baud,
+                    hop_ms + p99 / 1e3 + serial_ms );
+}
+
+/*******************************************************************************
+ * @fn     void stop( int signal_number )
+ * @brief  SIGINT/SIGTERM handler, ends the processing loop
+ * ****************************************************************************/
+static void stop( int )
+{
+  running = 0;
+}
+
+int main( int argc, char** argv )
+{
+  static engine_t engine;
+  source_t source;
+  output_t output;
+  const char* bands = DEFAULT_BANDS;
+  const char* port = NULL;
+  uint32_t size = DEFAULT_FFT_SIZE;
+  uint32_t hop = DEFAULT_HOP;
+  double floor_db = DEFAULT_FLOOR_DB;
+  double threshold = DEFAULT_BEAT_THRESHOLD;
+  int baud = SERIAL_DEFAULT_BAUD;
+  bool benchmark = false;
+  bool pace;
+  std::vector<float> window;
+  std::vector<uint8_t> values;
+  std::vector<float> times;
+  struct timespec start;
+  struct timespec before;
+  struct timespec after;
+  uint64_t consumed = 0;
+  int option;
+
+  source.fd = STDIN_FILENO;
+  source.rate = DEFAULT_RATE;
+  source.channels = DEFAULT_CHANNELS;
+  source.data_left = UINT64_MAX;
+
+  output.fd = -1;
+  output.address = -1;
+  output.frames = 0;
+  output.unchanged = 0;
+  output.dropped = 0;
+  output.longest = 0;
+
+  while( ( option = getopt( argc, argv, "n:s:b:f:t:a:o:B:r:c:l" ) ) != -1 )
+  {
+    switch( option )
+    {
+      case 'n': size = strtoul( optarg, NULL, 0 ); break;
+      case 's': hop = strtoul( optarg, NULL, 0 ); break;
+      case 'b': bands = optarg; break;
+      case 'f': floor_db = strtod( optarg, NULL ); break;
+      case 't': threshold = strtod( optarg, NULL ); break;
+      case 'a': output.address = strtoul( optarg, NULL, 0 ) & 0xFF; break;
+      case 'o': port = optarg; break;
+      case 'B': baud = strtoul( optarg, NULL, 0 ); break;
+      case 'r': source.rate = strtoul( optarg, NULL, 0 ); break;
+      case 'c': source.channels = strtoul( optarg, NULL, 0 ); break;
+      case 'l': benchmark = true; break;
+      default: optind = argc; break;
+    }
+  }
+
+  if( ( optind != argc - 1 ) || ( size < MIN_FFT_SIZE ) ||
+      ( size > MAX_FFT_SIZE ) || ( size & ( size - 1 ) ) ||
+      ( 0 == hop ) || ( hop > size ) || ( floor_db >= 0 ) || ( baud <= 0 ) )
+  {
+    fprintf( stderr,
+      "usage: %s [options] <file.wav|->\n"
+      "  -n size    FFT size, power of two (%d)\n"
+      "  -s hop     samples between updates (%d)\n"
+      "  -b bands   low-high Hz list, one output value each (%s)\n"
+      "  -f dB      level shown as 0, below 0 dBFS (%.0f)\n"
+      "  -t ratio   beat threshold over average power, 0 is off (%.1f)\n"
+      "  -a addr    send [addr][r][g][b] through the bridge instead of\n"
+      "             rgb_controller frames\n"
+      "  -o port    serial port to send frames to\n"
+      "  -B baud    serial baud rate (%d)\n"
+      "  -r rate    raw PCM sample rate (%d)\n"
+      "  -c count   raw PCM channels (%d)\n"
+      "  -l         latency benchmark, process as fast as possible\n",
+      argv[0], DEFAULT_FFT_SIZE, DEFAULT_HOP, DEFAULT_BANDS,
+      DEFAULT_FLOOR_DB, DEFAULT_BEAT_THRESHOLD, SERIAL_DEFAULT_BAUD,
+      DEFAULT_RATE, DEFAULT_CHANNELS );
+    return 1;
+  }
+
+  if( strcmp( argv[optind], "-" ) && !wav_open( &source, argv[optind] ) )
+  {
+    return 1;
+  }
+
+  if( ( 0 == source.rate ) || ( 0 == source.channels ) )
+  {
+    fprintf( stderr, "audio_rgb: bad sample rate or channel count\n" );
+    return 1;
+  }
+
+  engine_init( &engine, size, hop, source.rate, floor_db, threshold );
+  if( !parse_bands( &engine, bands, source.rate ) )
+  {
+    fprintf( stderr, "audio_rgb: bad band list %s\n", bands );
+    return 1;
+  }
+  engine.level_db.assign( engine.bands.size(), floor_db );
+
+  if( ( output.address >= 0 ) && ( 3 != engine.bands.size() ) )
+  {
+    fprintf( stderr, "audio_rgb: bridge packets need exactly 3 bands\n" );
+    return 1;
+  }
+
+  if( NULL != port )
+  {
+    output.fd = serial_open( port, baud );
+    if( output.fd < 0 )
+    {
+      fprintf( stderr, "audio_rgb: can't open %s: %s\n", port,
+                                                          strerror( errno ) );
+      return 1;
+    }
+  }
+
+  // Recordings play in real time when someone is watching the lights
+  pace = ( output.fd >= 0 ) && !benchmark && ( STDIN_FILENO != source.fd );
+
+  struct sigaction action;
+  memset( &action, 0, sizeof(action) );
+  action.sa_handler = stop;
+  sigaction( SIGINT, &action, NULL );
+  sigaction( SIGTERM, &action, NULL );
+
+  window.assign( size, 0 );
+  values.resize( engine.bands.size() );
+  clock_gettime( CLOCK_MONOTONIC, &start );
+
+  while( running )
+  {
+    // New samples go at the end of the window
+    memmove( window.data(), &window[hop], ( size - hop ) * sizeof(float) );
+    if( source_read( &source, &window[size - hop], hop ) != hop )
+    {
+      break;
+    }
+    consumed += hop;
+
+    if( pace )
+    {
+      struct timespec due = start;
+      uint64_t ns = consumed * 1000000000ULL / source.rate;
+
+      due.tv_sec += ns / 1000000000ULL;
+      due.tv_nsec += ns % 1000000000ULL;
+      if( due.tv_nsec >= 1000000000L )
+      {
+        due.tv_sec++;
+        due.tv_nsec -= 1000000000L;
+      }
+      clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL );
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &before );
+    engine_process( &engine, window.data(), values.data() );
+    output_write( &output, values.data(), values.size() );
+    clock_gettime( CLOCK_MONOTONIC, &after );
+
+    if( benchmark )
+    {
+      times.push_back( elapsed_us( &before, &after ) );
+    }
+  }
+
+  if( benchmark )
+  {
+    print_benchmark( times, &engine, &output, hop, source.rate, baud );
+  }
+
+  if( output.dropped )
+  {
+    fprintf( stderr, "%llu frames dropped, the serial port was full\n",
+                                        (unsigned long long)output.dropped );
+  }
+
+  return 0;
+}
@@ -0,0 +1,608 @@
+/** @file gateway.cpp
+*
+* @brief Linux gateway daemon for one or more cc2500 bridge dongles
+*
+* Opens every bridge serial port given on the command line, decodes the
+* escaped frames coming from them in a single epoll loop and exposes a local
+* datagram API (Unix socket or UDP on localhost).
+*
+* Datagram API:
+*   client -> gateway: [address][payload...]  Sent out through the bridge that
+*                      owns address. An empty datagram only subscribes.
+*   gateway -> client: [bridge][address][payload...]  Every frame received by
+*                      any bridge, sent to every client that has talked to us.
+*
+* Nodes are sharded across bridges by address. By default address % N picks
+* the bridge. Address ranges can be pinned to a bridge with -r (for example
+* when each bridge listens on its own channel), and -l learns the route from
+* the source address of every received frame that carries one.
+*
+* Any tty works as a bridge, so a socat/openpty pair can stand in for a real
+* dongle.
+*
+* @author Alvaro Prieto
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include "../serial/frame.h"
+#include "../serial/serial_port.h"
+#include "../../lib/packet.h"
+
+// The bridge firmware drops anything that doesn't fit in its serial buffer
+// (SERIAL_BUFFER_SIZE in projects/bridge/main.c)
+#define BRIDGE_MAX_FRAME (31)
+
+#define MAX_CLIENTS (32)
+#define MAX_EVENTS (16)
+#define READ_SIZE (4096)
+
+#define DEFAULT_SOCKET_PATH "/tmp/cc2500-gateway.sock"
+
+// packet_header_t fields, offsets in the bridge frame (the address byte is
+// the destination)
+#define SOURCE_FIELD (1)
+#define TYPE_FIELD (2)
+#define PACKET_HEADER_LENGTH (4)
+
+// Packets that start with their type right after the address, like
+// RATE_SWITCH, put the source (if they have one) after the type
+#define SHORT_TYPE_FIELD (1)
+#define SHORT_SOURCE_FIELD (2)
+
+typedef struct
+{
+  const char* path;
+  int fd;
+  frame_decoder_t decoder;
+  std::deque<uint8_t> tx_pending;   // Encoded bytes the tty didn't take yet
+  uint64_t rx_frames;
+  uint64_t tx_frames;
+  uint64_t rx_bytes;
+} bridge_t;
+
+typedef struct
+{
+  struct sockaddr_storage address;
+  socklen_t length;
+} client_t;
+
+static std::vector<bridge_t> bridges;
+static client_t clients[MAX_CLIENTS];
+static uint8_t total_clients;
+
+static int epoll_fd;
+static int api_fd;
+
+// Address to bridge routing table, 0xFF means use the default shard
+static uint8_t routes[256];
+static bool learn_routes;
+
+static uint64_t api_dropped;
+
+/*******************************************************************************
+ * @fn     void usage( const char* name )
+ * @brief  Print command line help
+ * ****************************************************************************/
+static void usage( const char* name )
+{
+  fprintf( stderr,
+    "usage: %s [-s socket_path | -u udp_port] [-b baud] [-r lo-hi:bridge]...\n"
+    "          [-l] device [device...]\n"
+    "  -s  Unix datagram socket path (default " DEFAULT_SOCKET_PATH ")\n"
+    "  -u  Listen on 127.0.0.1:udp_port instead of a Unix socket\n"
+    "  -b  Serial baud rate (default %d)\n"
+    "  -r  Route addresses lo-hi (hex) to bridge index\n"
+    "  -l  Learn routes from the source address of received packets\n",
+    name, SERIAL_DEFAULT_BAUD );
+}
+
+/*******************************************************************************
+ * @fn     uint8_t bridge_for_address( uint8_t address )
+ * @brief  Pick which bridge a frame for address goes out on
+ * ****************************************************************************/
+static uint8_t bridge_for_address( uint8_t address )
+{
+  if( routes[address] < bridges.size() )
+  {
+    return routes[address];
+  }
+
+  return address % bridges.size();
+}
+
+/*******************************************************************************
+ * @fn     void bridge_flush( bridge_t* bridge )
+ * @brief  Write as much pending data as the tty takes. Waits for EPOLLOUT
+ *         when the kernel buffer is full.
+ * ****************************************************************************/
+static void bridge_flush( bridge_t* bridge )
+{
+  struct epoll_event event;
+  uint8_t buffer[READ_SIZE];
+  size_t length;
+  ssize_t written;
+
+  while( !bridge->tx_pending.empty() )
+  {
+    length = bridge->tx_pending.size();
+    if( length > sizeof(buffer) )
+    {
+      length = sizeof(buffer);
+    }
+    std::copy( bridge->tx_pending.begin(), bridge->tx_pending.begin() + length,
+                                                                    buffer );
+
+    written = write( bridge->fd, buffer, length );
+    if( written <= 0 )
+    {
+      break;
+    }
+    bridge->tx_pending.erase( bridge->tx_pending.begin(),
+                                      bridge->tx_pending.begin() + written );
+  }
+
+  event.data.ptr = bridge;
+  event.events = EPOLLIN;
+  if( !bridge->tx_pending.empty() )
+  {
+    event.events |= EPOLLOUT;
+  }
+  epoll_ctl( epoll_fd, EPOLL_CTL_MOD, bridge->fd, &event );
+}
+
+/*******************************************************************************
+ * @fn     void bridge_send( bridge_t* bridge, const uint8_t* frame,
+ *                                                            size_t length )
+ * @brief  Escape frame and queue it for the bridge
+ * ****************************************************************************/
+static void bridge_send( bridge_t* bridge, const uint8_t* frame, size_t length )
+{
+  uint8_t encoded[FRAME_ENCODED_LENGTH(BRIDGE_MAX_FRAME)];
+  size_t encoded_length;
+
+  encoded_length = frame_encode( frame, length, encoded );
+  bridge->tx_pending.insert( bridge->tx_pending.end(), encoded,
+                                                  encoded + encoded_length );
+  bridge->tx_frames++;
+
+  bridge_flush( bridge );
+}
+
+/*******************************************************************************
+ * @fn     void bridge_close( bridge_t* bridge )
+ * @brief  Stop using a bridge after an I/O error (unplugged dongle, closed
+ *         pty master, etc.)
+ * ****************************************************************************/
+static void bridge_close( bridge_t* bridge )
+{
+  fprintf( stderr, "gateway: lost bridge %s\n", bridge->path );
+  epoll_ctl( epoll_fd, EPOLL_CTL_DEL, bridge->fd, NULL );
+  close( bridge->fd );
+  bridge->fd = -1;
+  bridge->tx_pending.clear();
+}
+
+/*******************************************************************************
+ * @fn     void client_add( const struct sockaddr_storage* address,
+ *                                                      socklen_t length )
+ * @brief  Remember a client so it gets every received frame
+ * ****************************************************************************/
+static void client_add( const struct sockaddr_storage* address,
+                                                            socklen_t length )
+{
+  uint8_t index;
+
+  // Unbound Unix sockets have no address we could reply to
+  if( length <= sizeof(sa_family_t) )
+  {
+    return;
+  }
+
+  for( index = 0; index < total_clients; index++ )
+  {
+    if( ( clients[index].length == length ) &&
+                      !memcmp( &clients[index].address, address, length ) )
+    {
+      return;
+    }
+  }
+
+  if( total_clients < MAX_CLIENTS )
+  {
+    memcpy( &clients[total_clients].address, address, length );
+    clients[total_clients].length = length;
+    total_clients++;
+  }
+}
+
+/*******************************************************************************
+ * @fn     bool frame_source( const uint8_t* frame, size_t length,
+ *                                                          uint8_t* source )
+ * @brief  Find the source address of a bridge frame, for the packet types
+ *         that carry one (see lib/packet.h). Broadcast types like
+ *         RGB_UNIVERSE or TIME_BEACON only come from the coordinator and
+ *         have none.
+ * ****************************************************************************/
+static bool frame_source( const uint8_t* frame, size_t length, uint8_t* source )
+{
+  if( ( length >= PACKET_HEADER_LENGTH ) && ( IO_CHANGE == frame[TYPE_FIELD] ) )
+  {
+    *source = frame[SOURCE_FIELD];
+    return true;
+  }
+
+  if( ( length >= ( 1 + RATE_SWITCH_LENGTH ) ) &&
+                                  ( RATE_SWITCH == frame[SHORT_TYPE_FIELD] ) )
+  {
+    *source = frame[SHORT_SOURCE_FIELD];
+    return true;
+  }
+
+  return false;
+}
+
+/*******************************************************************************
+ * @fn     void frame_received( void* context, const uint8_t* frame,
+ *                                                            size_t length )
+ * @brief  Decoder callback. Forwards a bridge frame to every client.
+ * ****************************************************************************/
+static void frame_received( void* context, const uint8_t* frame, size_t length )
+{
+  bridge_t* bridge = (bridge_t*)context;
+  uint8_t datagram[FRAME_MAX_LENGTH + 1];
+  uint8_t bridge_index = bridge - bridges.data();
+  uint8_t index = 0;
+  uint8_t source;
+
+  if( 0 == length )
+  {
+    return;
+  }
+
+  bridge->rx_frames++;
+
+  if( learn_routes && frame_source( frame, length, &source ) )
+  {
+    routes[source] = bridge_index;
+  }
+
+  datagram[0] = bridge_index;
+  memcpy( &datagram[1], frame, length );
+
+  while( index < total_clients )
+  {
+    if( ( sendto( api_fd, datagram, length + 1, MSG_DONTWAIT,
+                      (struct sockaddr*)&clients[index].address,
+                      clients[index].length ) < 0 ) &&
+        ( ( ECONNREFUSED == errno ) || ( ENOENT == errno ) ) )
+    {
+      // Client went away, replace it with the last one
+      clients[index] = clients[--total_clients];
+    }
+    else
+    {
+      index++;
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void bridge_read( bridge_t* bridge )
+ * @brief  Drain the tty and run everything through the frame decoder
+ * ****************************************************************************/
+static void bridge_read( bridge_t* bridge )
+{
+  uint8_t buffer[READ_SIZE];
+  ssize_t length;
+
+  for(;;)
+  {
+    length = read( bridge->fd, buffer, sizeof(buffer) );
+    if( length > 0 )
+    {
+      bridge->rx_bytes += length;
+      frame_decode( &bridge->decoder, buffer, length, frame_received, bridge );
+    }
+    else if( ( length < 0 ) && ( EAGAIN == errno ) )
+    {
+      return;
+    }
+    else if( ( length < 0 ) && ( EINTR == errno ) )
+    {
+      continue;
+    }
+    else
+    {
+      bridge_close( bridge );
+      return;
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void api_read( void )
+ * @brief  Handle datagrams from clients
+ * ****************************************************************************/
+static void api_read( void )
+{
+  uint8_t buffer[FRAME_MAX_LENGTH];
+  struct sockaddr_storage address;
+  socklen_t address_length;
+  ssize_t length;
+  bridge_t* bridge;
+
+  for(;;)
+  {
+    address_length = sizeof(address);
+    length = recvfrom( api_fd, buffer, sizeof(buffer), MSG_DONTWAIT,
+                                (struct sockaddr*)&address, &address_length );
+    if( length < 0 )
+    {
+      return;
+    }
+
+    client_add( &address, address_length );
+
+    if( 0 == length )
+    {
+      continue;
+    }
+
+    bridge = &bridges[bridge_for_address( buffer[0] )];
+    if( ( length > BRIDGE_MAX_FRAME ) || ( bridge->fd < 0 ) )
+    {
+      api_dropped++;
+      continue;
+    }
+
+    bridge_send( bridge, buffer, length );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void print_stats( void )
+ * @brief  Dump per-bridge counters to stderr (SIGUSR1)
+ * ****************************************************************************/
+static void print_stats( void )
+{
+  size_t index;
+
+  for( index = 0; index < bridges.size(); index++ )
+  {
+    fprintf( stderr, "bridge %zu %s: rx %llu frames (%llu bytes, %u dropped)"
+                                                      " tx %llu frames\n",
+              index, bridges[index].path,
+              (unsigned long long)bridges[index].rx_frames,
+              (unsigned long long)bridges[index].rx_bytes,
+              bridges[index].decoder.dropped,
+              (unsigned long long)bridges[index].tx_frames );
+  }
+  fprintf( stderr, "api: %u clients, %llu datagrams dropped\n",
+                          total_clients, (unsigned long long)api_dropped );
+}
+
+/*******************************************************************************
+ * @fn     int open_api( const char* socket_path, int udp_port )
+ * @brief  Create the client facing socket
+ * ****************************************************************************/
+static int open_api( const char* socket_path, int udp_port )
+{
+  int fd;
+
+  if( udp_port )
+  {
+    struct sockaddr_in address;
+
+    fd = socket( AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    memset( &address, 0, sizeof(address) );
+    address.sin_family = AF_INET;
+    address.sin_port = htons( udp_port );
+    address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    if( ( fd < 0 ) ||
+          bind( fd, (struct sockaddr*)&address, sizeof(address) ) < 0 )
+    {
+      return -1;
+    }
+  }
+  else
+  {
+    struct sockaddr_un address;
+
+    fd = socket( AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    memset( &address, 0, sizeof(address) );
+    address.sun_family = AF_UNIX;
+    strncpy( address.sun_path, socket_path, sizeof(address.sun_path) - 1 );
+    unlink( socket_path );
+    if( ( fd < 0 ) ||
+          bind( fd, (struct sockaddr*)&address, sizeof(address) ) < 0 )
+    {
+      return -1;
+    }
+  }
+
+  return fd;
+}
+
+/*******************************************************************************
+ * @fn     bool parse_route( const char* route )
+ * @brief  Parse a lo-hi:bridge route argument
+ * ****************************************************************************/
+static bool parse_route( const char* route )
+{
+  unsigned int low, high, bridge, address;
+
+  if( sscanf( route, "%x-%x:%u", &low, &high, &bridge ) != 3 )
+  {
+    if( sscanf( route, "%x:%u", &low, &bridge ) != 2 )
+    {
+      return false;
+    }
+    high = low;
+  }
+
+  if( ( low > high ) || ( high > 0xFF ) || ( bridge >= 0xFF ) )
+  {
+    return false;
+  }
+
+  for( address = low; address <= high; address++ )
+  {
+    routes[address] = bridge;
+  }
+
+  return true;
+}
+
+int main( int argc, char** argv )
+{
+  const char* socket_path = DEFAULT_SOCKET_PATH;
+  struct epoll_event events[MAX_EVENTS];
+  struct epoll_event event;
+  struct signalfd_siginfo signal_info;
+  sigset_t signals;
+  int signal_fd;
+  int udp_port = 0;
+  int baud = SERIAL_DEFAULT_BAUD;
+  int option;
+  int index;
+  int total_events;
+  bool running = true;
+
+  memset( routes, 0xFF, sizeof(routes) );
+
+  while( ( option = getopt( argc, argv, "s:u:b:r:lh" ) ) != -1 )
+  {
+    switch( option )
+    {
+      case 's': socket_path = optarg; break;
+      case 'u': udp_port = atoi( optarg ); break;
+      case 'b': baud = atoi( optarg ); break;
+      case 'l': learn_routes = true; break;
+      case 'r':
+        if( !parse_route( optarg ) )
+        {
+          fprintf( stderr, "gateway: bad route '%s'\n", optarg );
+          return 1;
+        }
+        break;
+      default:
+        usage( argv[0] );
+        return 1;
+    }
+  }
+
+  if( ( optind >= argc ) || ( argc - optind > 0xFF ) )
+  {
+    usage( argv[0] );
+    return 1;
+  }
+
+  epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+
+  // Reserve up front so bridge pointers handed to epoll stay valid
+  bridges.resize( argc - optind );
+  for( index = 0; index < argc - optind; index++ )
+  {
+    bridge_t* bridge = &bridges[index];
+
+    bridge->path = argv[optind + index];
+    bridge->fd = serial_open( bridge->path, baud );
+    if( bridge->fd < 0 )
+    {
+      fprintf( stderr, "gateway: can't open %s: %s\n", bridge->path,
+                                                          strerror( errno ) );
+      return 1;
+    }
+    frame_decoder_init( &bridge->decoder );
+
+    event.events = EPOLLIN;
+    event.data.ptr = bridge;
+    epoll_ctl( epoll_fd, EPOLL_CTL_ADD, bridge->fd, &event );
+  }
+
+  api_fd = open_api( socket_path, udp_port );
+  if( api_fd < 0 )
+  {
+    fprintf( stderr, "gateway: can't open api socket: %s\n", strerror( errno ) );
+    return 1;
+  }
+  event.events = EPOLLIN;
+  event.data.ptr = &api_fd;
+  epoll_ctl( epoll_fd, EPOLL_CTL_ADD, api_fd, &event );
+
+  // Handle signals in the event loop instead of in async handlers
+  sigemptyset( &signals );
+  sigaddset( &signals, SIGINT );
+  sigaddset( &signals, SIGTERM );
+  sigaddset( &signals, SIGUSR1 );
+  sigprocmask( SIG_BLOCK, &signals, NULL );
+  signal( SIGPIPE, SIG_IGN );
+  signal_fd = signalfd( -1, &signals, SFD_NONBLOCK | SFD_CLOEXEC );
+  event.events = EPOLLIN;
+  event.data.ptr = &signal_fd;
+  epoll_ctl( epoll_fd, EPOLL_CTL_ADD, signal_fd, &event );
+
+  while( running )
+  {
+    total_events = epoll_wait( epoll_fd, events, MAX_EVENTS, -1 );
+
+    for( index = 0; index < total_events; index++ )
+    {
+      if( events[index].data.ptr == &api_fd )
+      {
+        api_read();
+      }
+      else if( events[index].data.ptr == &signal_fd )
+      {
+        while( read( signal_fd, &signal_info, sizeof(signal_info) ) > 0 )
+        {
+          if( SIGUSR1 == signal_info.ssi_signo )
+          {
+            print_stats();
+          }
+          else
+          {
+            running = false;
+          }
+        }
+      }
+      else
+      {
+        bridge_t* bridge = (bridge_t*)events[index].data.ptr;
+
+        if( ( bridge->fd >= 0 ) && ( events[index].events & EPOLLOUT ) )
+        {
+          bridge_flush( bridge );
+        }
+        if( ( bridge->fd >= 0 ) &&
+                    ( events[index].events & ( EPOLLIN | EPOLLHUP | EPOLLERR ) ) )
+        {
+          bridge_read( bridge );
+        }
+      }
+    }
+  }
+
+  print_stats();
+
+  if( !udp_port )
+  {
+    unlink( socket_path );
+  }
+
+  return 0;
+}
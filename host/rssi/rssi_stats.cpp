@@ -0,0 +1,288 @@
+/** @file rssi_stats.cpp
+*
+* @brief Turn the rssi-logger record stream into per-node RSSI time series
+*
+* Reads batches of rssi_record_t from a serial port, a capture file or stdin.
+* Every record is written as a CSV line (time in seconds, source, RSSI in dBm,
+* LQI, CRC_OK), either to stdout or to one node_<source>.csv file per node
+* with -d. When the input ends (or on Ctrl-C) a per-node summary with RSSI
+* percentiles is printed to stderr.
+*
+* @author Alvaro Prieto
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include "../serial/frame.h"
+#include "../serial/serial_port.h"
+
+// Must match rssi_record_t in projects/rssi-logger/main.c
+#define RECORD_LENGTH (8)
+#define RECORD_TIMESTAMP (0)
+#define RECORD_SOURCE (4)
+#define RECORD_RSSI (5)
+#define RECORD_LQI (6)
+#define RECORD_DROPPED (7)
+
+#define TICKS_PER_SECOND (2000000.0)
+
+// Same conversion as rssi_to_dbm() in projects/friendfinder
+#define RSSI_OFFSET (72)
+
+typedef struct
+{
+  std::vector<int16_t> rssi;
+  FILE* csv;
+  uint32_t bad_crc;
+} node_t;
+
+typedef struct
+{
+  node_t nodes[256];
+  const char* directory;
+  FILE* csv;
+  bool started;
+  uint64_t ticks;
+  uint32_t last_timestamp;
+  uint64_t dropped;
+} logger_t;
+
+static volatile sig_atomic_t running = 1;
+
+/*******************************************************************************
+ * @fn     int16_t rssi_to_dbm( uint8_t rssi )
+ * @brief  Convert the raw RSSI status byte to dBm
+ * ****************************************************************************/
+static int16_t rssi_to_dbm( uint8_t rssi )
+{
+  return (int8_t)rssi / 2 - RSSI_OFFSET;
+}
+
+/*******************************************************************************
+ * @fn     FILE* node_csv( logger_t* logger, uint8_t source )
+ * @brief  Pick the CSV output for a node, opening its file the first time
+ * ****************************************************************************/
+static FILE* node_csv( logger_t* logger, uint8_t source )
+{
+  char path[4096];
+  node_t* node = &logger->nodes[source];
+
+  if( NULL == logger->directory )
+  {
+    return logger->csv;
+  }
+
+  if( NULL == node->csv )
+  {
+    snprintf( path, sizeof(path), "%s/node_%02X.csv", logger->directory,
+                                                                    source );
+    node->csv = fopen( path, "w" );
+    if( NULL == node->csv )
+    {
+      fprintf( stderr, "rssi_stats: can't open %s: %s\n", path,
+                                                          strerror( errno ) );
+      exit( 1 );
+    }
+    fprintf( node->csv, "time,source,rssi_dbm,lqi,crc_ok\n" );
+  }
+
+  return node->csv;
+}
+
+/*******************************************************************************
+ * @fn     void batch_received( void* context, const uint8_t* batch,
+ *                                                            size_t length )
+ * @brief  Decoder callback, handles one batch of records
+ * ****************************************************************************/
+static void batch_received( void* context, const uint8_t* batch, size_t length )
+{
+  logger_t* logger = (logger_t*)context;
+  const uint8_t* record;
+  uint32_t timestamp;
+  uint8_t source;
+  int16_t rssi;
+  size_t offset;
+
+  if( length % RECORD_LENGTH )
+  {
+    fprintf( stderr, "rssi_stats: ignoring %zu byte frame\n", length );
+    return;
+  }
+
+  for( offset = 0; offset < length; offset += RECORD_LENGTH )
+  {
+    record = &batch[offset];
+
+    timestamp = record[RECORD_TIMESTAMP] |
+                ( record[RECORD_TIMESTAMP + 1] << 8 ) |
+                ( record[RECORD_TIMESTAMP + 2] << 16 ) |
+                ( (uint32_t)record[RECORD_TIMESTAMP + 3] << 24 );
+
+    // Unsigned subtraction takes care of the 32-bit wrap
+    if( logger->started )
+    {
+      logger->ticks += (uint32_t)( timestamp - logger->last_timestamp );
+    }
+    logger->started = true;
+    logger->last_timestamp = timestamp;
+
+    source = record[RECORD_SOURCE];
+    rssi = rssi_to_dbm( record[RECORD_RSSI] );
+
+    logger->nodes[source].rssi.push_back( rssi );
+    logger->dropped += record[RECORD_DROPPED];
+    if( !( record[RECORD_LQI] & 0x80 ) )
+    {
+      logger->nodes[source].bad_crc++;
+    }
+
+    fprintf( node_csv( logger, source ), "%.6f,%u,%d,%u,%u\n",
+              logger->ticks / TICKS_PER_SECOND, source, rssi,
+              record[RECORD_LQI] & 0x7F, record[RECORD_LQI] >> 7 );
+  }
+}
+
+/*******************************************************************************
+ * @fn     int16_t percentile( const std::vector<int16_t>& sorted,
+ *                                                          unsigned int pct )
+ * @brief  Nearest-rank percentile of an already sorted series
+ * ****************************************************************************/
+static int16_t percentile( const std::vector<int16_t>& sorted, unsigned int pct )
+{
+  size_t rank = ( pct * sorted.size() + 99 ) / 100;
+
+  return sorted[ rank ? rank - 1 : 0 ];
+}
+
+/*******************************************************************************
+ * @fn     void print_summary( logger_t* logger )
+ * @brief  Per-node RSSI statistics
+ * ****************************************************************************/
+static void print_summary( logger_t* logger )
+{
+  unsigned int source;
+  double sum;
+
+  fprintf( stderr, "node  samples  badcrc   min   p10   p50   p90   max   mean\n" );
+
+  for( source = 0; source < 256; source++ )
+  {
+    std::vector<int16_t>& rssi = logger->nodes[source].rssi;
+
+    if( rssi.empty() )
+    {
+      continue;
+    }
+
+    std::sort( rssi.begin(), rssi.end() );
+    sum = 0;
+    for( size_t index = 0; index < rssi.size(); index++ )
+    {
+      sum += rssi[index];
+    }
+
+    fprintf( stderr, "0x%02X %8zu %7u %5d %5d %5d %5d %5d %6.1f\n",
+              source, rssi.size(), logger->nodes[source].bad_crc,
+              rssi.front(), percentile( rssi, 10 ), percentile( rssi, 50 ),
+              percentile( rssi, 90 ), rssi.back(), sum / rssi.size() );
+  }
+
+  fprintf( stderr, "%llu records dropped by the logger\n",
+                                    (unsigned long long)logger->dropped );
+}
+
+/*******************************************************************************
+ * @fn     void stop( int signal_number )
+ * @brief  SIGINT/SIGTERM handler, ends the capture loop
+ * ****************************************************************************/
+static void stop( int )
+{
+  running = 0;
+}
+
+int main( int argc, char** argv )
+{
+  static logger_t logger;
+  frame_decoder_t decoder;
+  uint8_t buffer[4096];
+  ssize_t length;
+  int option;
+  int fd;
+
+  while( ( option = getopt( argc, argv, "d:" ) ) != -1 )
+  {
+    if( 'd' == option )
+    {
+      logger.directory = optarg;
+    }
+    else
+    {
+      optind = argc;
+      break;
+    }
+  }
+
+  if( optind != argc - 1 )
+  {
+    fprintf( stderr, "usage: %s [-d output_directory] "
+                              "<serial port|capture file|->\n", argv[0] );
+    return 1;
+  }
+
+  if( !strcmp( argv[optind], "-" ) )
+  {
+    fd = STDIN_FILENO;
+  }
+  else
+  {
+    fd = open( argv[optind], O_RDONLY );
+    if( ( fd >= 0 ) && isatty( fd ) )
+    {
+      close( fd );
+      fd = serial_open( argv[optind], SERIAL_DEFAULT_BAUD );
+      if( fd >= 0 )
+      {
+        fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) & ~O_NONBLOCK );
+      }
+    }
+  }
+
+  if( fd < 0 )
+  {
+    fprintf( stderr, "rssi_stats: can't open %s: %s\n", argv[optind],
+                                                          strerror( errno ) );
+    return 1;
+  }
+
+  logger.csv = stdout;
+  if( NULL == logger.directory )
+  {
+    fprintf( logger.csv, "time,source,rssi_dbm,lqi,crc_ok\n" );
+  }
+
+  // Print the summary when a live capture is stopped with Ctrl-C. No
+  // SA_RESTART, so the blocking read() returns
+  struct sigaction action;
+  memset( &action, 0, sizeof(action) );
+  action.sa_handler = stop;
+  sigaction( SIGINT, &action, NULL );
+  sigaction( SIGTERM, &action, NULL );
+
+  frame_decoder_init( &decoder );
+
+  while( running && ( ( length = read( fd, buffer, sizeof(buffer) ) ) > 0 ) )
+  {
+    frame_decode( &decoder, buffer, length, batch_received, &logger );
+  }
+
+  print_summary( &logger );
+
+  return 0;
+}
@@ -0,0 +1,251 @@
+/** @file scan2csv.cpp
+*
+* @brief Export rssi-logger spectrum sweeps (SCANNER_MODE) as CSV
+*
+* Reads sweep frames from a serial port, a capture file or stdin and writes
+* one CSV row per sweep: host time in seconds followed by the RSSI in dBm of
+* every swept channel. The header row has the channel frequencies in MHz.
+*
+* With -s, a per-channel summary (average, peak hold) is printed to stderr at
+* the end, quietest channels first, to help pick a channel.
+*
+* @author Alvaro Prieto
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <vector>
+#include <algorithm>
+#include "../serial/frame.h"
+#include "../serial/serial_port.h"
+
+// Must match sweep_header_t in projects/rssi-logger/main.c
+#define RECORD_SWEEP ('S')
+#define SWEEP_HEADER_LENGTH (4)
+#define SWEEP_TYPE (0)
+#define SWEEP_FIRST (1)
+#define SWEEP_STEP (2)
+#define SWEEP_COUNT (3)
+
+// Base frequency and channel spacing set in writeRFSettings()
+#define BASE_FREQUENCY_MHZ (2433.0)
+#define CHANNEL_SPACING_MHZ (0.19995)
+
+#define RSSI_OFFSET (72)
+
+typedef struct
+{
+  uint8_t first;
+  uint8_t step;
+  uint8_t count;
+  uint64_t sweeps;
+  struct timeval start;
+  std::vector<double> sum;
+  std::vector<int16_t> peak;
+} scanner_t;
+
+static volatile sig_atomic_t running = 1;
+
+/*******************************************************************************
+ * @fn     int16_t rssi_to_dbm( uint8_t rssi )
+ * @brief  Convert the raw RSSI status byte to dBm
+ * ****************************************************************************/
+static int16_t rssi_to_dbm( uint8_t rssi )
+{
+  return (int8_t)rssi / 2 - RSSI_OFFSET;
+}
+
+/*******************************************************************************
+ * @fn     double channel_mhz( uint8_t channel )
+ * @brief  Channel number to center frequency
+ * ****************************************************************************/
+static double channel_mhz( uint8_t channel )
+{
+  return BASE_FREQUENCY_MHZ + channel * CHANNEL_SPACING_MHZ;
+}
+
+/*******************************************************************************
+ * @fn     void sweep_received( void* context, const uint8_t* sweep,
+ *                                                            size_t length )
+ * @brief  Decoder callback, writes one sweep as a CSV row
+ * ****************************************************************************/
+static void sweep_received( void* context, const uint8_t* sweep, size_t length )
+{
+  scanner_t* scanner = (scanner_t*)context;
+  struct timeval now;
+  uint8_t index;
+  int16_t rssi;
+
+  if( ( length < SWEEP_HEADER_LENGTH ) ||
+      ( RECORD_SWEEP != sweep[SWEEP_TYPE] ) ||
+      ( length != (size_t)( SWEEP_HEADER_LENGTH + sweep[SWEEP_COUNT] ) ) )
+  {
+    return;
+  }
+
+  // New sweep layout (first sweep, or the scanner was rebuilt), new header
+  if( ( scanner->first != sweep[SWEEP_FIRST] ) ||
+      ( scanner->step != sweep[SWEEP_STEP] ) ||
+      ( scanner->count != sweep[SWEEP_COUNT] ) )
+  {
+    scanner->first = sweep[SWEEP_FIRST];
+    scanner->step = sweep[SWEEP_STEP];
+    scanner->count = sweep[SWEEP_COUNT];
+    scanner->sweeps = 0;
+    scanner->sum.assign( scanner->count, 0 );
+    scanner->peak.assign( scanner->count, INT16_MIN );
+    gettimeofday( &scanner->start, NULL );
+
+    printf( "time" );
+    for( index = 0; index < scanner->count; index++ )
+    {
+      printf( ",%.3f", channel_mhz( scanner->first + index * scanner->step ) );
+    }
+    printf( "\n" );
+  }
+
+  gettimeofday( &now, NULL );
+  printf( "%.3f", ( now.tv_sec - scanner->start.tv_sec ) +
+                          ( now.tv_usec - scanner->start.tv_usec ) / 1e6 );
+
+  for( index = 0; index < scanner->count; index++ )
+  {
+    rssi = rssi_to_dbm( sweep[SWEEP_HEADER_LENGTH + index] );
+    scanner->sum[index] += rssi;
+    scanner->peak[index] = std::max( scanner->peak[index], rssi );
+    printf( ",%d", rssi );
+  }
+  printf( "\n" );
+  fflush( stdout );
+
+  scanner->sweeps++;
+}
+
+/*******************************************************************************
+ * @fn     void print_summary( scanner_t* scanner )
+ * @brief  Per-channel average and peak, quietest (by average) first
+ * ****************************************************************************/
+static void print_summary( scanner_t* scanner )
+{
+  std::vector<uint8_t> order;
+  uint8_t index;
+
+  if( 0 == scanner->sweeps )
+  {
+    return;
+  }
+
+  for( index = 0; index < scanner->count; index++ )
+  {
+    order.push_back( index );
+  }
+  std::sort( order.begin(), order.end(), [scanner]( uint8_t a, uint8_t b )
+                              { return scanner->sum[a] < scanner->sum[b]; } );
+
+  fprintf( stderr, "%llu sweeps\nchannel       MHz   avg dBm  peak dBm\n",
+                                      (unsigned long long)scanner->sweeps );
+  for( index = 0; index < scanner->count; index++ )
+  {
+    uint8_t point = order[index];
+    uint8_t channel = scanner->first + point * scanner->step;
+
+    fprintf( stderr, "%7u  %8.3f  %8.1f  %8d\n", channel, channel_mhz( channel ),
+              scanner->sum[point] / scanner->sweeps, scanner->peak[point] );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void stop( int signal_number )
+ * @brief  SIGINT/SIGTERM handler, ends the capture loop
+ * ****************************************************************************/
+static void stop( int )
+{
+  running = 0;
+}
+
+int main( int argc, char** argv )
+{
+  scanner_t scanner;
+  frame_decoder_t decoder;
+  struct sigaction action;
+  uint8_t buffer[4096];
+  ssize_t length;
+  bool summary = false;
+  int option;
+  int fd;
+
+  while( ( option = getopt( argc, argv, "s" ) ) != -1 )
+  {
+    if( 's' == option )
+    {
+      summary = true;
+    }
+    else
+    {
+      optind = argc;
+      break;
+    }
+  }
+
+  if( optind != argc - 1 )
+  {
+    fprintf( stderr, "usage: %s [-s] <serial port|capture file|->\n", argv[0] );
+    return 1;
+  }
+
+  if( !strcmp( argv[optind], "-" ) )
+  {
+    fd = STDIN_FILENO;
+  }
+  else
+  {
+    fd = open( argv[optind], O_RDONLY );
+    if( ( fd >= 0 ) && isatty( fd ) )
+    {
+      close( fd );
+      fd = serial_open( argv[optind], SERIAL_DEFAULT_BAUD );
+      if( fd >= 0 )
+      {
+        fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) & ~O_NONBLOCK );
+      }
+    }
+  }
+
+  if( fd < 0 )
+  {
+    fprintf( stderr, "scan2csv: can't open %s: %s\n", argv[optind],
+                                                          strerror( errno ) );
+    return 1;
+  }
+
+  // Print the summary when a live capture is stopped with Ctrl-C. No
+  // SA_RESTART, so the blocking read() returns
+  memset( &action, 0, sizeof(action) );
+  action.sa_handler = stop;
+  sigaction( SIGINT, &action, NULL );
+  sigaction( SIGTERM, &action, NULL );
+
+  scanner.first = 0;
+  scanner.step = 0;
+  scanner.count = 0;
+  scanner.sweeps = 0;
+  frame_decoder_init( &decoder );
+
+  while( running && ( ( length = read( fd, buffer, sizeof(buffer) ) ) > 0 ) )
+  {
+    frame_decode( &decoder, buffer, length, sweep_received, &scanner );
+  }
+
+  if( summary )
+  {
+    print_summary( &scanner );
+  }
+
+  return 0;
+}
@@ -0,0 +1,214 @@
+/** @file frame.cpp
+*
+* @brief Host side encoder/decoder for the bridge serial framing
+*
+* @author Alvaro Prieto
+*/
+#include "frame.h"
+#include <string.h>
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/*******************************************************************************
+ * @fn     void frame_decoder_init( frame_decoder_t* decoder )
+ * @brief  Reset decoder state
+ * ****************************************************************************/
+void frame_decoder_init( frame_decoder_t* decoder )
+{
+  decoder->length = 0;
+  decoder->receiving = false;
+  decoder->escape_next = false;
+  decoder->frames = 0;
+  decoder->dropped = 0;
+}
+
+/*******************************************************************************
+ * @fn     size_t find_special( const uint8_t* data, size_t length )
+ * @brief  Return the index of the first ESCAPE_BYTE, START_BYTE or END_BYTE in
+ *         data, or length if there is none. The three special bytes are
+ *         consecutive, so a single unsigned range check (byte - ESCAPE_BYTE
+ *         <= 2) finds all of them. Scans 32 bytes at a time with AVX2, 16 with
+ *         SSE2, and falls back to a plain loop elsewhere.
+ * ****************************************************************************/
+static size_t find_special( const uint8_t* data, size_t length )
+{
+  size_t index = 0;
+
+#if defined(__AVX2__)
+  const __m256i offset32 = _mm256_set1_epi8( (char)ESCAPE_BYTE );
+  const __m256i limit32 = _mm256_set1_epi8( END_BYTE - ESCAPE_BYTE );
+
+  for( ; index + 32 <= length; index += 32 )
+  {
+    __m256i value = _mm256_loadu_si256( (const __m256i*)&data[index] );
+    __m256i shifted = _mm256_sub_epi8( value, offset32 );
+
+    // min(x, 2) == x  <=>  x <= 2 (unsigned)
+    uint32_t mask = _mm256_movemask_epi8( _mm256_cmpeq_epi8(
+                        _mm256_min_epu8( shifted, limit32 ), shifted ) );
+    if( mask )
+    {
+      return index + __builtin_ctz( mask );
+    }
+  }
+#endif
+
+#if defined(__SSE2__)
+  const __m128i offset16 = _mm_set1_epi8( (char)ESCAPE_BYTE );
+  const __m128i limit16 = _mm_set1_epi8( END_BYTE - ESCAPE_BYTE );
+
+  for( ; index + 16 <= length; index += 16 )
+  {
+    __m128i value = _mm_loadu_si128( (const __m128i*)&data[index] );
+    __m128i shifted = _mm_sub_epi8( value, offset16 );
+
+    uint32_t mask = _mm_movemask_epi8( _mm_cmpeq_epi8(
+                        _mm_min_epu8( shifted, limit16 ), shifted ) );
+    if( mask )
+    {
+      return index + __builtin_ctz( mask );
+    }
+  }
+#endif
+
+  for( ; index < length; index++ )
+  {
+    if( (uint8_t)( data[index] - ESCAPE_BYTE ) <= ( END_BYTE - ESCAPE_BYTE ) )
+    {
+      break;
+    }
+  }
+
+  return index;
+}
+
+/*******************************************************************************
+ * @fn     void decode_byte( frame_decoder_t* decoder, uint8_t rx_byte,
+ *                              frame_callback_t callback, void* context )
+ * @brief  Run a single byte through the decoder state machine
+ * ****************************************************************************/
+static inline void decode_byte( frame_decoder_t* decoder, uint8_t rx_byte,
+                                    frame_callback_t callback, void* context )
+{
+  if( START_BYTE == rx_byte )
+  {
+    decoder->receiving = true;
+    decoder->escape_next = false;
+    decoder->length = 0;
+  }
+  else if( !decoder->receiving )
+  {
+    // Ignore everything outside of a frame
+  }
+  else if( END_BYTE == rx_byte )
+  {
+    decoder->receiving = false;
+    decoder->frames++;
+    callback( context, decoder->buffer, decoder->length );
+  }
+  else if( ESCAPE_BYTE == rx_byte )
+  {
+    decoder->escape_next = true;
+  }
+  else if( decoder->length == FRAME_MAX_LENGTH )
+  {
+    // Frame too long, drop it and wait for the next start byte
+    decoder->receiving = false;
+    decoder->dropped++;
+  }
+  else
+  {
+    if( decoder->escape_next )
+    {
+      decoder->escape_next = false;
+      rx_byte ^= 0x20;
+    }
+    decoder->buffer[decoder->length++] = rx_byte;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void frame_decode( frame_decoder_t* decoder, const uint8_t* data,
+ *                  size_t length, frame_callback_t callback, void* context )
+ * @brief  Feed raw serial bytes into the decoder. callback is called once for
+ *         every complete frame. Unlike the firmware, a START_BYTE in the middle
+ *         of a frame restarts it, so the decoder resyncs after line noise.
+ *
+ *         Runs of ordinary bytes are located with find_special() and copied
+ *         (or skipped, outside of a frame) in one go. Only the special bytes
+ *         and the byte following an escape go through decode_byte().
+ * ****************************************************************************/
+void frame_decode( frame_decoder_t* decoder, const uint8_t* data, size_t length,
+                                    frame_callback_t callback, void* context )
+{
+  size_t index = 0;
+  size_t run;
+  size_t space;
+
+  while( index < length )
+  {
+    if( decoder->escape_next )
+    {
+      decode_byte( decoder, data[index++], callback, context );
+      continue;
+    }
+
+    run = find_special( &data[index], length - index );
+
+    if( decoder->receiving )
+    {
+      space = FRAME_MAX_LENGTH - decoder->length;
+      if( run > space )
+      {
+        // Frame too long. Keep what fits, drop it on the byte after, and
+        // skip ahead until the next start byte like decode_byte() would
+        decoder->receiving = false;
+        decoder->dropped++;
+        index += space + 1;
+        continue;
+      }
+
+      memcpy( &decoder->buffer[decoder->length], &data[index], run );
+      decoder->length += run;
+    }
+
+    index += run;
+
+    if( index < length )
+    {
+      decode_byte( decoder, data[index++], callback, context );
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     size_t frame_encode( const uint8_t* data, size_t length,
+ *                                                              uint8_t* out )
+ * @brief  Escape and frame a buffer. out must hold FRAME_ENCODED_LENGTH(length)
+ *         bytes. Returns the number of bytes written.
+ * ****************************************************************************/
+size_t frame_encode( const uint8_t* data, size_t length, uint8_t* out )
+{
+  size_t index;
+  size_t out_length = 0;
+
+  out[out_length++] = START_BYTE;
+
+  for( index = 0; index < length; index++ )
+  {
+    if( (data[index] >= ESCAPE_BYTE) && (data[index] <= END_BYTE) )
+    {
+      out[out_length++] = ESCAPE_BYTE;
+      out[out_length++] = data[index] ^ 0x20;
+    }
+    else
+    {
+      out[out_length++] = data[index];
+    }
+  }
+
+  out[out_length++] = END_BYTE;
+
+  return out_length;
+}
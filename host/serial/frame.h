@@ -0,0 +1,54 @@
+/** @file frame.h
+*
+* @brief Host side encoder/decoder for the bridge serial framing
+*
+* Frames are sent as START_BYTE, payload, END_BYTE. Payload bytes from
+* ESCAPE_BYTE to END_BYTE are sent as ESCAPE_BYTE followed by the byte XOR
+* 0x20. This matches uart_write_escaped() and uart_rx_callback() in the
+* bridge firmware.
+*
+* Decoding scans 16 (SSE2) or 32 (AVX2, build with -mavx2 or -march=native)
+* bytes at a time for the special bytes, since several bridges can share one
+* gateway process.
+*
+* @author Alvaro Prieto
+*/
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ESCAPE_BYTE 0x7D
+#define START_BYTE 0x7E
+#define END_BYTE 0x7F
+
+#define FRAME_MAX_LENGTH 255
+
+// Worst case encoded size: every byte escaped plus start and end bytes
+#define FRAME_ENCODED_LENGTH(length) ( 2 * (length) + 2 )
+
+typedef void (*frame_callback_t)( void*, const uint8_t*, size_t );
+
+/**
+ * Decoder state. One per byte stream, since frames can be split across
+ * reads.
+ */
+typedef struct
+{
+  uint8_t buffer[FRAME_MAX_LENGTH];
+  size_t length;
+  bool receiving;
+  bool escape_next;
+  uint32_t frames;      // Frames decoded
+  uint32_t dropped;     // Frames discarded because they were too long
+} frame_decoder_t;
+
+void frame_decoder_init( frame_decoder_t* );
+
+void frame_decode( frame_decoder_t*, const uint8_t*, size_t,
+                                                  frame_callback_t, void* );
+
+size_t frame_encode( const uint8_t*, size_t, uint8_t* );
+
+#endif /* _FRAME_H */
@@ -0,0 +1,62 @@
+/** @file serial_port.cpp
+*
+* @brief Raw serial port access for talking to the bridge
+*
+* @author Alvaro Prieto
+*/
+#include "serial_port.h"
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+/*******************************************************************************
+ * @fn     speed_t baud_to_speed( int baud )
+ * @brief  Convert a numeric baud rate into a termios speed
+ * ****************************************************************************/
+static speed_t baud_to_speed( int baud )
+{
+  switch( baud )
+  {
+    case 9600:    return B9600;
+    case 19200:   return B19200;
+    case 38400:   return B38400;
+    case 57600:   return B57600;
+    case 230400:  return B230400;
+    case 460800:  return B460800;
+    case 921600:  return B921600;
+    default:      return B115200;
+  }
+}
+
+/*******************************************************************************
+ * @fn     int serial_open( const char* path, int baud )
+ * @brief  Open a serial device in raw, non-blocking mode. Works the same on
+ *         real dongles and on pseudo terminals. Returns -1 on failure.
+ * ****************************************************************************/
+int serial_open( const char* path, int baud )
+{
+  struct termios tio;
+  int fd;
+
+  fd = open( path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC );
+  if( fd < 0 )
+  {
+    return -1;
+  }
+
+  // Pseudo terminals accept the same settings, so no special case is needed
+  if( tcgetattr( fd, &tio ) == 0 )
+  {
+    cfmakeraw( &tio );
+    cfsetispeed( &tio, baud_to_speed( baud ) );
+    cfsetospeed( &tio, baud_to_speed( baud ) );
+    tio.c_cflag |= CLOCAL | CREAD;
+    // VMIN must be nonzero, otherwise an empty non-blocking read returns 0
+    // (which looks like end of file) instead of EAGAIN
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    tcsetattr( fd, TCSANOW, &tio );
+  }
+
+  return fd;
+}
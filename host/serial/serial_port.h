@@ -0,0 +1,14 @@
+/** @file serial_port.h
+*
+* @brief Raw serial port access for talking to the bridge
+*
+* @author Alvaro Prieto
+*/
+#ifndef _SERIAL_PORT_H
+#define _SERIAL_PORT_H
+
+#define SERIAL_DEFAULT_BAUD 115200
+
+int serial_open( const char*, int );
+
+#endif /* _SERIAL_PORT_H */
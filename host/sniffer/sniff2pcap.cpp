@@ -0,0 +1,228 @@
+/** @file sniff2pcap.cpp
+*
+* @brief Convert the rssi-logger sniffer stream (SNIFFER_MODE) to pcap
+*
+* Reads escaped sniffer records from a serial port, a capture file or stdin
+* and writes a pcap file with link type LINKTYPE_USER0 (147). Each pcap
+* packet is:
+*
+*   byte 0    channel
+*   byte 1    raw RSSI (two's complement, dBm = rssi / 2 - 72)
+*   byte 2    LQI in bits 6:0, CRC_OK in bit 7
+*   byte 3    length byte as sent on air
+*   byte 4..  frame, starting at the address byte
+*
+* Frames longer than the sniffer's SNIFFER_SNAPLEN are truncated; the pcap
+* original length still reflects the length on air.
+*
+* Timestamps come from the sniffer's Timer_A (0.5us ticks), anchored to the
+* host clock when the first record arrives.
+*
+* @author Alvaro Prieto
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "../serial/frame.h"
+#include "../serial/serial_port.h"
+
+#define LINKTYPE_USER0 (147)
+#define PCAP_MAGIC (0xA1B2C3D4)
+#define PCAP_SNAPLEN (65535)
+
+// Must match sniffer_record_t in projects/rssi-logger/main.c
+#define RECORD_PACKET ('P')
+#define RECORD_HEADER_LENGTH (10)
+#define RECORD_TYPE (0)
+#define RECORD_CHANNEL (1)
+#define RECORD_RSSI (2)
+#define RECORD_LQI (3)
+#define RECORD_TIMESTAMP (4)
+#define RECORD_LENGTH (8)
+#define RECORD_DROPPED (9)
+
+#define TICKS_PER_SECOND (2000000)
+
+#define PSEUDO_HEADER_LENGTH (4)
+
+typedef struct
+{
+  FILE* out;
+  bool started;
+  uint64_t ticks;           // Unwrapped sniffer time
+  uint32_t last_timestamp;
+  struct timeval start;     // Host time at the first record
+  uint64_t packets;
+  uint64_t bad_crc;
+  uint64_t dropped;
+} converter_t;
+
+/*******************************************************************************
+ * @fn     void write_u32( FILE* out, uint32_t value )
+ * @brief  Write a 32-bit value in host byte order (pcap readers detect it
+ *         from the magic number)
+ * ****************************************************************************/
+static void write_u32( FILE* out, uint32_t value )
+{
+  fwrite( &value, sizeof(value), 1, out );
+}
+
+/*******************************************************************************
+ * @fn     void write_pcap_header( FILE* out )
+ * @brief  Write the pcap global header
+ * ****************************************************************************/
+static void write_pcap_header( FILE* out )
+{
+  uint16_t version[2] = { 2, 4 };
+
+  write_u32( out, PCAP_MAGIC );
+  fwrite( version, sizeof(version), 1, out );
+  write_u32( out, 0 );              // thiszone
+  write_u32( out, 0 );              // sigfigs
+  write_u32( out, PCAP_SNAPLEN );
+  write_u32( out, LINKTYPE_USER0 );
+}
+
+/*******************************************************************************
+ * @fn     void record_received( void* context, const uint8_t* record,
+ *                                                            size_t length )
+ * @brief  Decoder callback, converts one sniffer record to a pcap packet
+ * ****************************************************************************/
+static void record_received( void* context, const uint8_t* record,
+                                                                size_t length )
+{
+  converter_t* converter = (converter_t*)context;
+  uint8_t pseudo_header[PSEUDO_HEADER_LENGTH];
+  uint32_t timestamp;
+  uint64_t microseconds;
+  size_t captured;
+
+  if( ( length < RECORD_HEADER_LENGTH ) ||
+                                      ( RECORD_PACKET != record[RECORD_TYPE] ) )
+  {
+    return;
+  }
+
+  // Records are little endian, like the MSP430
+  timestamp = record[RECORD_TIMESTAMP] |
+              ( record[RECORD_TIMESTAMP + 1] << 8 ) |
+              ( record[RECORD_TIMESTAMP + 2] << 16 ) |
+              ( (uint32_t)record[RECORD_TIMESTAMP + 3] << 24 );
+
+  if( !converter->started )
+  {
+    converter->started = true;
+    gettimeofday( &converter->start, NULL );
+  }
+  else
+  {
+    // Unsigned subtraction takes care of the 32-bit wrap (every ~35 minutes)
+    converter->ticks += (uint32_t)( timestamp - converter->last_timestamp );
+  }
+  converter->last_timestamp = timestamp;
+
+  microseconds = converter->start.tv_usec + converter->ticks /
+                                              ( TICKS_PER_SECOND / 1000000 );
+  captured = length - RECORD_HEADER_LENGTH;
+
+  pseudo_header[0] = record[RECORD_CHANNEL];
+  pseudo_header[1] = record[RECORD_RSSI];
+  pseudo_header[2] = record[RECORD_LQI];
+  pseudo_header[3] = record[RECORD_LENGTH];
+
+  write_u32( converter->out, converter->start.tv_sec + microseconds / 1000000 );
+  write_u32( converter->out, microseconds % 1000000 );
+  write_u32( converter->out, PSEUDO_HEADER_LENGTH + captured );
+  write_u32( converter->out, PSEUDO_HEADER_LENGTH + record[RECORD_LENGTH] );
+  fwrite( pseudo_header, sizeof(pseudo_header), 1, converter->out );
+  fwrite( &record[RECORD_HEADER_LENGTH], captured, 1, converter->out );
+  fflush( converter->out );
+
+  converter->packets++;
+  converter->dropped += record[RECORD_DROPPED];
+  if( !( record[RECORD_LQI] & 0x80 ) )
+  {
+    converter->bad_crc++;
+  }
+}
+
+int main( int argc, char** argv )
+{
+  frame_decoder_t decoder;
+  converter_t converter;
+  uint8_t buffer[4096];
+  ssize_t length;
+  int fd;
+
+  if( argc != 3 )
+  {
+    fprintf( stderr, "usage: %s <serial port|capture file|-> <out.pcap|->\n",
+                                                                    argv[0] );
+    return 1;
+  }
+
+  if( !strcmp( argv[1], "-" ) )
+  {
+    fd = STDIN_FILENO;
+  }
+  else
+  {
+    fd = open( argv[1], O_RDONLY );
+    if( ( fd >= 0 ) && isatty( fd ) )
+    {
+      close( fd );
+      fd = serial_open( argv[1], SERIAL_DEFAULT_BAUD );
+      if( fd >= 0 )
+      {
+        fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) & ~O_NONBLOCK );
+      }
+    }
+  }
+
+  if( fd < 0 )
+  {
+    fprintf( stderr, "sniff2pcap: can't open %s: %s\n", argv[1],
+                                                          strerror( errno ) );
+    return 1;
+  }
+
+  memset( &converter, 0, sizeof(converter) );
+  converter.out = strcmp( argv[2], "-" ) ? fopen( argv[2], "wb" ) : stdout;
+  if( NULL == converter.out )
+  {
+    fprintf( stderr, "sniff2pcap: can't open %s: %s\n", argv[2],
+                                                          strerror( errno ) );
+    return 1;
+  }
+
+  write_pcap_header( converter.out );
+  frame_decoder_init( &decoder );
+
+  while( ( length = read( fd, buffer, sizeof(buffer) ) ) != 0 )
+  {
+    if( length < 0 )
+    {
+      if( EINTR == errno )
+      {
+        continue;
+      }
+      break;
+    }
+    frame_decode( &decoder, buffer, length, record_received, &converter );
+  }
+
+  fprintf( stderr, "sniff2pcap: %llu packets (%llu bad CRC), %llu dropped by "
+                                                            "the sniffer\n",
+            (unsigned long long)converter.packets,
+            (unsigned long long)converter.bad_crc,
+            (unsigned long long)converter.dropped );
+
+  fclose( converter.out );
+
+  return 0;
+}
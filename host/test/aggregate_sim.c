@@ -0,0 +1,405 @@
+/** @file aggregate_sim.c
+*
+* @brief Goodput and latency of lib/aggregate.c on a simulated link, for a
+*        range of deadlines and message rates
+*
+* A node sends three kinds of short messages, at random times:
+*
+*   IO_CHANGE     doorbell events to DOORBELL_ADDRESS, 4 bytes
+*   RGB_UNIVERSE  color triplets to FIXTURE_ADDRESS, 6 bytes
+*   TIME_BEACON   beacons to BROADCAST_ADDRESS, 3 bytes
+*
+* each one [type][id][id][data...]. Three destinations for the default two
+* AGGREGATE_DESTINATIONS, so packets also go out early to make room.
+*
+* The main loop passes messages to aggregate_send() as they come and calls
+* aggregate_poll() every POLL_US. cc2500_tx_packet() takes the packet's
+* airtime (preamble, sync word, header, CRC and a turnaround), and messages
+* that arrive meanwhile wait for the main loop. Every bit on the air is
+* wrong with a chance of BER, and a packet with any wrong bit is lost, so
+* longer packets lose more. The receiver unpacks what arrives with
+* aggregate_unpack() (or takes it as it is, for a bare message) and checks
+* every message comes out whole and in order.
+*
+* Goodput counts the message bytes delivered per second, latency is from
+* the message to the end of the packet that delivered it. A deadline of 0
+* is sending every message in its own packet.
+*
+* Passes if every delivered message is intact and in order, a deadline of 0
+* never aggregates, the p99 latency is within a few packets of the deadline
+* while the link is idle most of the time, and at the highest rate
+* aggregating delivers more than sending each message on its own.
+*
+* usage: aggregate_sim [-v]
+*   -v  Print goodput and latency for every rate and deadline
+*
+* @author Alvaro Prieto
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "aggregate.h"
+#include "cc2500.h"
+
+// Preamble, sync word, length, address and CRC
+#define OVERHEAD_BYTES (4 + 4 + 1 + 1 + 2)
+#define BYTE_US (32.0)
+
+// Idle to TX, with the calibration, per packet
+#define TURNAROUND_US (800.0)
+
+#define BER (1e-4)
+
+#define POLL_US (100)
+
+// Longest packets a message can queue behind at low load, for the p99
+#define BURST_PACKETS (3)
+
+#define SECONDS (10)
+
+#define DOORBELL_ADDRESS (0x10)
+#define FIXTURE_ADDRESS (0x20)
+
+#define KINDS (3)
+#define MAX_MESSAGES (65536)
+
+typedef struct
+{
+  uint8_t type;
+  uint8_t destination;
+  uint8_t length;
+  uint8_t share;            // Percent of the messages
+} kind_t;
+
+typedef struct
+{
+  uint32_t messages;
+  uint32_t delivered;
+  uint32_t packets;
+  uint32_t aggregated;      // Packets with more than one message
+  uint32_t lost;            // Packets lost on the air
+  uint32_t bytes;           // Message bytes delivered
+  uint32_t corrupted;       // Delivered wrong or out of order
+  double airtime_us;
+  double latencies[MAX_MESSAGES];
+} result_t;
+
+static const kind_t kinds[KINDS] =
+{
+  { IO_CHANGE,    DOORBELL_ADDRESS,   4, 20 },
+  { RGB_UNIVERSE, FIXTURE_ADDRESS,    6, 60 },
+  { TIME_BEACON,  BROADCAST_ADDRESS,  3, 20 },
+};
+
+static uint32_t failures;
+
+static double now_us;
+static double next_arrival_us;
+static double rate;
+static uint32_t next_id;
+static double created_us[MAX_MESSAGES];
+static uint8_t contents[MAX_MESSAGES][8];
+static uint32_t last_id[KINDS];
+
+static result_t result;
+
+/*******************************************************************************
+ * @fn     uint32_t random_next( uint32_t* state )
+ * @brief  xorshift32. The traffic and the channel have a state each, so
+ *         every deadline sees the same messages however many packets they
+ *         take.
+ * ****************************************************************************/
+static uint32_t traffic_state;
+static uint32_t channel_state;
+
+static uint32_t random_next( uint32_t* state )
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+
+  return *state;
+}
+
+/*******************************************************************************
+ * @fn     double uniform( uint32_t* state )
+ * @brief  Random number in (0, 1)
+ * ****************************************************************************/
+static double uniform( uint32_t* state )
+{
+  return ( random_next( state ) + 0.5 ) / 4294967296.0;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t handler( uint8_t* buffer, uint8_t length )
+ * @brief  [address][type][id][id][data...][RSSI][LQI], one message
+ * ****************************************************************************/
+static uint8_t handler( uint8_t* buffer, uint8_t length )
+{
+  uint32_t id = ( buffer[2] << 8 ) | buffer[3];
+  uint8_t kind;
+
+  for( kind = 0; kind < KINDS; kind++ )
+  {
+    if( kinds[kind].type == buffer[1] )
+    {
+      break;
+    }
+  }
+
+  // Ids are 16 bits on the air, never more than MAX_MESSAGES per run
+  if( ( KINDS == kind ) || ( id >= next_id ) ||
+      ( length != 1 + kinds[kind].length ) ||
+      ( kinds[kind].destination != buffer[0] ) ||
+      memcmp( &buffer[1], contents[id], kinds[kind].length ) ||
+      ( last_id[kind] && ( id < last_id[kind] ) ) )
+  {
+    result.corrupted++;
+    return 0;
+  }
+
+  last_id[kind] = id + 1;
+
+  result.latencies[result.delivered++] = now_us - created_us[id];
+  result.bytes += kinds[kind].length;
+
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     void cc2500_tx_packet( uint8_t* buffer, uint8_t length,
+ *                                                    uint8_t destination )
+ * @brief  Takes the packet's airtime, then the receiver gets it unless a bit
+ *         went wrong
+ * ****************************************************************************/
+void cc2500_tx_packet( uint8_t* buffer, uint8_t length, uint8_t destination )
+{
+  uint8_t packet[CC2500_BUFFER_LENGTH];
+  double airtime_us = ( OVERHEAD_BYTES + length ) * BYTE_US + TURNAROUND_US;
+
+  now_us += airtime_us;
+  result.airtime_us += airtime_us;
+  result.packets++;
+
+  if( uniform( &channel_state ) >
+                            pow( 1.0 - BER, ( OVERHEAD_BYTES + length ) * 8 ) )
+  {
+    result.lost++;
+    return;
+  }
+
+  // As rx_callback gets it
+  packet[0] = destination;
+  memcpy( &packet[1], buffer, length );
+  packet[1 + length] = 0x40;
+  packet[2 + length] = 0x80 | 20;
+
+  if( AGGREGATE == buffer[0] )
+  {
+    result.aggregated++;
+    aggregate_unpack( packet, 1 + length, handler );
+  }
+  else
+  {
+    handler( packet, 1 + length );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void arrive( void )
+ * @brief  The next message, to aggregate_send() as soon as the main loop
+ *         gets to it
+ * ****************************************************************************/
+static void arrive( void )
+{
+  uint8_t pick = random_next( &traffic_state ) % 100;
+  uint8_t kind;
+  uint8_t index;
+  uint8_t* message;
+
+  for( kind = 0; kind < KINDS - 1; kind++ )
+  {
+    if( pick < kinds[kind].share )
+    {
+      break;
+    }
+    pick -= kinds[kind].share;
+  }
+
+  message = contents[next_id];
+  message[0] = kinds[kind].type;
+  message[1] = next_id >> 8;
+  message[2] = next_id & 0xFF;
+  for( index = 3; index < kinds[kind].length; index++ )
+  {
+    message[index] = random_next( &traffic_state );
+  }
+
+  created_us[next_id] = next_arrival_us;
+  next_id++;
+  result.messages++;
+
+  aggregate_send( message, kinds[kind].length, kinds[kind].destination,
+                                                      (uint32_t)now_us );
+
+  next_arrival_us += -log( uniform( &traffic_state ) ) * 1e6 / rate;
+}
+
+/*******************************************************************************
+ * @fn     void run( double messages_per_second, uint32_t deadline_us )
+ * @brief  SECONDS of messages through aggregate.c, into result
+ * ****************************************************************************/
+static void run( double messages_per_second, uint32_t deadline_us )
+{
+  double next_poll_us = 0;
+
+  memset( &result, 0, sizeof(result) );
+  memset( last_id, 0, sizeof(last_id) );
+  traffic_state = 2463534242u;
+  channel_state = 88675123u;
+  rate = messages_per_second;
+  next_id = 0;
+  now_us = 0;
+  next_arrival_us = -log( uniform( &traffic_state ) ) * 1e6 / rate;
+
+  aggregate_setup( deadline_us );
+
+  // The main loop
+  while( now_us < SECONDS * 1e6 )
+  {
+    if( next_arrival_us <= now_us )
+    {
+      arrive();
+    }
+    else if( next_poll_us <= now_us )
+    {
+      aggregate_poll( (uint32_t)now_us );
+      next_poll_us += POLL_US;
+    }
+    else
+    {
+      now_us = ( next_arrival_us < next_poll_us ) ? next_arrival_us :
+                                                                next_poll_us;
+    }
+  }
+
+  aggregate_flush();
+}
+
+/*******************************************************************************
+ * @fn     int compare( const void* a, const void* b )
+ * @brief  qsort() order of latencies
+ * ****************************************************************************/
+static int compare( const void* a, const void* b )
+{
+  double difference = *(const double*)a - *(const double*)b;
+
+  return ( difference > 0 ) - ( difference < 0 );
+}
+
+/*******************************************************************************
+ * @fn     double percentile( double fraction )
+ * @brief  Latency at a fraction of the sorted latencies, 0 without any
+ * ****************************************************************************/
+static double percentile( double fraction )
+{
+  if( 0 == result.delivered )
+  {
+    return 0;
+  }
+
+  return result.latencies[(uint32_t)( fraction * ( result.delivered - 1 ) +
+                                                                      0.5 )];
+}
+
+int main( int argc, char** argv )
+{
+  static const double rates[] = { 50, 200, 500, 1000 };
+  static const uint32_t deadlines[] = { 0, 1000, 2000, 5000, 10000, 20000 };
+  double goodput[sizeof(deadlines) / sizeof(deadlines[0])];
+  double utilization;
+  double longest_us = ( OVERHEAD_BYTES + AGGREGATE_PAYLOAD ) * BYTE_US +
+                                                              TURNAROUND_US;
+  uint8_t rate_index;
+  uint8_t index;
+  int verbose = ( argc > 1 ) && !strcmp( argv[1], "-v" );
+
+  if( verbose )
+  {
+    printf( "BER %.0e, poll every %dus, latency in ms\n", BER, POLL_US );
+    printf( "%6s %8s %8s %8s %8s %6s %10s %6s %8s %8s %8s\n", "msg/s",
+            "deadline", "messages", "packets", "msg/pkt", "lost",
+            "goodput", "air", "p50", "p99", "max" );
+  }
+
+  for( rate_index = 0; rate_index < sizeof(rates) / sizeof(rates[0]);
+                                                                rate_index++ )
+  {
+    for( index = 0; index < sizeof(deadlines) / sizeof(deadlines[0]);
+                                                                    index++ )
+    {
+      run( rates[rate_index], deadlines[index] );
+
+      qsort( result.latencies, result.delivered, sizeof(double), compare );
+
+      goodput[index] = result.bytes / ( now_us / 1e6 );
+      utilization = result.airtime_us / now_us;
+
+      if( verbose )
+      {
+        printf( "%6.0f %8.1f %8u %8u %8.2f %5.1f%% %8.0fB/s %5.0f%% %8.2f "
+                "%8.2f %8.2f\n", rates[rate_index], deadlines[index] / 1000.0,
+                result.messages, result.packets,
+                (double)( result.messages ) / result.packets,
+                100.0 * result.lost / result.packets, goodput[index],
+                100.0 * utilization, percentile( 0.5 ) / 1000,
+                percentile( 0.99 ) / 1000, percentile( 1.0 ) / 1000 );
+      }
+
+      if( result.corrupted )
+      {
+        fprintf( stderr, "FAIL: %.0f msg/s, deadline %uus: %u messages "
+                  "corrupted or out of order\n", rates[rate_index],
+                                      deadlines[index], result.corrupted );
+        failures++;
+      }
+
+      if( ( 0 == deadlines[index] ) &&
+          ( result.aggregated || ( result.packets != result.messages ) ) )
+      {
+        fprintf( stderr, "FAIL: %.0f msg/s: %u packets for %u messages "
+                  "without a deadline\n", rates[rate_index], result.packets,
+                                                          result.messages );
+        failures++;
+      }
+
+      // Until the link is busy most of the time, nearly every message only
+      // waits for its deadline and a burst of a few packets
+      if( ( utilization < 0.5 ) && ( percentile( 0.99 ) > deadlines[index] +
+                                      POLL_US + BURST_PACKETS * longest_us ) )
+      {
+        fprintf( stderr, "FAIL: %.0f msg/s, deadline %uus: p99 latency "
+                  "%.0fus\n", rates[rate_index], deadlines[index],
+                                                      percentile( 0.99 ) );
+        failures++;
+      }
+    }
+
+    if( ( rate_index == sizeof(rates) / sizeof(rates[0]) - 1 ) &&
+        ( goodput[sizeof(deadlines) / sizeof(deadlines[0]) - 1] <=
+                                                              goodput[0] ) )
+    {
+      fprintf( stderr, "FAIL: %.0f msg/s: goodput %.0fB/s aggregated, "
+                "%.0fB/s without\n", rates[rate_index],
+                goodput[sizeof(deadlines) / sizeof(deadlines[0]) - 1],
+                                                                goodput[0] );
+      failures++;
+    }
+  }
+
+  printf( "aggregate_sim: %s\n", failures ? "FAILED" : "passed" );
+
+  return failures ? 1 : 0;
+}
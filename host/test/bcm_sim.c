@@ -0,0 +1,167 @@
+/** @file bcm_sim.c
+*
+* @brief Runs lib/pwm/ti/timera_bcm.c on the Timer_A model and checks the
+*        on time of every channel and the interrupts per frame
+*
+* Over a frame, a channel should be on for its gamma corrected value times
+* BCM_BASE_TICKS cycles. The model charges BCM_ISR_ENTRY cycles to get into
+* the ISR, the count in the timera_bcm.c header, so a slot boundary that the
+* early compare doesn't cover shows up as a slot that is too short or too
+* long. The inline loop itself only costs its timer reads here, its cycle
+* count is in timera_bcm.c.
+*
+* usage: bcm_sim [-v]
+*   -v  Print the numbers for every duty set
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Built in, for gamma_table and the BCM_ constants
+#include "pwm/ti/timera_bcm.c"
+
+#define FRAME ( BCM_BASE_TICKS * ( ( 1 << BCM_BITS ) - 1 ) )
+#define FRAMES (16)
+
+// Interrupt accept, ISR pushes, TA0IV dispatch and loading the locals, less
+// the TA0IV read the model charges separately
+#define BCM_ISR_ENTRY (75 - 3)
+
+// Every boundary is polled for, 6 cycles a poll on the hardware
+#define MAX_ERROR (12)
+
+static uint32_t on_cycles[PWM_CHANNELS];
+static uint32_t failures;
+static int verbose;
+
+/*******************************************************************************
+ * @fn     void sample_pins( void )
+ * @brief  Cycle hook, counts the cycles each channel is on
+ * ****************************************************************************/
+static void sample_pins( void )
+{
+  uint8_t channel;
+
+  for( channel = 0; channel < PWM_CHANNELS; channel++ )
+  {
+#ifdef PWM_ACTIVE_LOW
+    if( !( P2OUT & pwm_pins[channel] ) )
+#else
+    if( P2OUT & pwm_pins[channel] )
+#endif
+    {
+      on_cycles[channel]++;
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void run_frames( const uint8_t* values, const char* what )
+ * @brief  Show one set of values for FRAMES frames and check the result
+ * ****************************************************************************/
+static void run_frames( const uint8_t* values, const char* what )
+{
+  uint32_t isrs;
+  uint32_t expected;
+  int32_t error;
+  uint8_t channel;
+
+  sim_reset();
+  sim_timer_isr[1] = pwm_plane_isr;
+  sim_isr_entry = BCM_ISR_ENTRY;
+
+  pwm_setup();
+  for( channel = 0; channel < PWM_CHANNELS; channel++ )
+  {
+    pwm_set( channel, values[channel] );
+  }
+  pwm_update();
+  __enable_interrupt();
+
+  sim_run( 2 * FRAME );
+
+  memset( on_cycles, 0, sizeof(on_cycles) );
+  memset( sim_isr_count, 0, sizeof(sim_isr_count) );
+  sim_isr_busy = 0;
+  sim_cycle_hook = sample_pins;
+
+  sim_run( FRAMES * FRAME );
+
+  isrs = sim_isr_count[1];
+  if( verbose )
+  {
+    printf( "%-24s %5.2f isr/frame, %4.2f%% of the CPU in isr entry, exit "
+            "and waits\n", what, isrs / (double)FRAMES,
+            100.0 * sim_isr_busy / ( FRAMES * FRAME ) );
+  }
+
+  // Slots timed by interrupt, the frame start and two timer overflows
+  if( isrs > FRAMES * ( BCM_SLOTS - BCM_INLINE_SLOTS + 2 ) + 1 )
+  {
+    fprintf( stderr, "FAIL: %s, %u interrupts in %u frames\n", what, isrs,
+                                                                    FRAMES );
+    failures++;
+  }
+
+  for( channel = 0; channel < PWM_CHANNELS; channel++ )
+  {
+    expected = (uint32_t)gamma_table[values[channel]] * BCM_BASE_TICKS;
+    error = (int32_t)( on_cycles[channel] / FRAMES ) - (int32_t)expected;
+
+    if( verbose )
+    {
+      printf( "  channel %u: %3u -> %6u cycles on, %+d\n", channel,
+                        values[channel], on_cycles[channel] / FRAMES, error );
+    }
+
+    if( ( error > MAX_ERROR ) || ( error < -MAX_ERROR ) )
+    {
+      fprintf( stderr, "FAIL: %s, channel %u on for %u cycles, expected %u\n",
+                      what, channel, on_cycles[channel] / FRAMES, expected );
+      failures++;
+    }
+  }
+}
+
+int main( int argc, char** argv )
+{
+  static const struct
+  {
+    uint8_t values[3];
+    const char* what;
+  } sets[] =
+  {
+    { { 0, 0, 0 }, "all off" },
+    { { 255, 255, 255 }, "all full" },
+    { { 5, 6, 7 }, "darkest steps" },
+    { { 17, 18, 19 }, "dark, short slots" },
+    { { 128, 192, 254 }, "bright" },
+    { { 0, 77, 0 }, "one channel" },
+  };
+  uint8_t values[3];
+  uint32_t index;
+  char what[32];
+
+  verbose = ( argc > 1 ) && !strcmp( argv[1], "-v" );
+
+  for( index = 0; index < sizeof(sets) / sizeof(sets[0]); index++ )
+  {
+    run_frames( sets[index].values, sets[index].what );
+  }
+
+  srand( 1 );
+  for( index = 0; index < 16; index++ )
+  {
+    values[0] = rand();
+    values[1] = rand();
+    values[2] = rand();
+    snprintf( what, sizeof(what), "random %u", index );
+    run_frames( values, what );
+  }
+
+  printf( "bcm_sim: %s\n", failures ? "FAILED" : "passed" );
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,403 @@
+/** @file delta_test.cpp
+*
+* @brief Round trip tests for lib/delta.c, and the bytes it puts on the air
+*        for audio visualizer streams
+*
+* The traces are frames like the ones msgeq7_interface (3 channels, ~30 per
+* second) and audio_rgb (3 channels through the bridge, or a few fixtures'
+* worth for rgb_controller, ~344 per second) send. They're synthesized: beats
+* on the low bands, hi-hats on the high ones, a noise floor, quiet passages,
+* and audio_rgb's slow fall back. Captures of audio_rgb's real serial output
+* can be given too (audio_rgb -o on a pty, or the bridge's serial port), and
+* their frames are measured as they are.
+*
+* Bytes on air count the whole cc2500 packet: 4 preamble bytes, 2 sync bytes,
+* length, address, the packet type byte and 2 CRC bytes on top of the
+* payload. The codec is measured against sending every frame in full.
+*
+* usage: delta_test [-b [capture...]]
+*   -b  Print bytes on air for the traces and any captures given
+*
+* @author Alvaro Prieto
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+// Built in, lib/ has no C++ guards
+#include "delta.c"
+#include "../serial/frame.cpp"
+
+typedef std::vector<uint8_t> bytes_t;
+
+typedef struct
+{
+  const char* what;
+  std::vector<bytes_t> frames;
+  double fps;
+} trace_t;
+
+// Preamble, sync, length, address and CRC
+#define PACKET_OVERHEAD (4 + 2 + 1 + 1 + 2)
+
+#define GUARD (0xA5)
+
+static uint32_t failures;
+
+/*******************************************************************************
+ * @fn     uint32_t random_next( void )
+ * @brief  xorshift32, so every run tests the same streams
+ * ****************************************************************************/
+static uint32_t random_state = 2463534242u;
+
+static uint32_t random_next( void )
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+
+  return random_state;
+}
+
+/*******************************************************************************
+ * @fn     double uniform( void )
+ * @brief  Random number in [0, 1)
+ * ****************************************************************************/
+static double uniform( void )
+{
+  return random_next() / 4294967296.0;
+}
+
+/*******************************************************************************
+ * @fn     trace_t visualizer( const char* what, uint8_t channels, double fps,
+ *                                                    bool fall_back )
+ * @brief  A minute of music, as frames of channels values. Channels go from
+ *         bass to treble. fall_back is audio_rgb's slow decay, otherwise
+ *         values follow the signal like the MSGEQ7 averages do.
+ * ****************************************************************************/
+static trace_t visualizer( const char* what, uint8_t channels, double fps,
+                                                              bool fall_back )
+{
+  trace_t trace;
+  std::vector<double> envelope( channels, 0 );
+  bytes_t frame( channels, 0 );
+  double beat = 60.0 / 124;
+  double time;
+  double target;
+  double level;
+  uint32_t index;
+  uint8_t channel;
+
+  trace.what = what;
+  trace.fps = fps;
+
+  for( index = 0; index < 60 * fps; index++ )
+  {
+    time = index / fps;
+
+    for( channel = 0; channel < channels; channel++ )
+    {
+      // Kick on the beat down low, hi-hats on the eighths up high, a pad in
+      // between. Quiet for 8 of every 32 beats.
+      target = 30 + 20 * uniform();
+      if( fmod( time, 32 * beat ) < 24 * beat )
+      {
+        if( ( channel < channels / 3 ) && ( fmod( time, beat ) < 0.03 ) )
+        {
+          target = 255;
+        }
+        else if( ( channel >= 2 * channels / 3 ) &&
+                                    ( fmod( time, beat / 2 ) < 0.02 ) )
+        {
+          target = 200;
+        }
+        else
+        {
+          target += 60 + 40 * sin( time * 0.7 + channel );
+        }
+      }
+      else
+      {
+        target = 10 * uniform();
+      }
+
+      // Attack right away, decay over ~150ms
+      envelope[channel] = fmax( target,
+                          envelope[channel] * pow( 0.01, 1 / ( 0.15 * fps ) ) );
+      level = envelope[channel];
+
+      if( fall_back )
+      {
+        // Falls back at most 2 steps a frame
+        level = fmax( level, frame[channel] - 2.0 );
+      }
+      else if( level < 40 )
+      {
+        // msgeq7_interface's RGB_MIN
+        level = 0;
+      }
+
+      frame[channel] = (uint8_t)fmin( 255, level );
+    }
+
+    trace.frames.push_back( frame );
+  }
+
+  return trace;
+}
+
+/*******************************************************************************
+ * @fn     void capture_frame( void* context, const uint8_t* frame,
+ *                                                          size_t length )
+ * @brief  Decoder callback for captures. [addr][r][g][b] bridge frames and
+ *         [0][values...] rgb_controller frames both lose their first byte.
+ * ****************************************************************************/
+static void capture_frame( void* context, const uint8_t* frame, size_t length )
+{
+  trace_t* trace = (trace_t*)context;
+
+  if( ( length > 1 ) && ( length - 1 <= DELTA_MAX_CHANNELS ) &&
+      ( trace->frames.empty() || ( trace->frames[0].size() == length - 1 ) ) )
+  {
+    trace->frames.push_back( bytes_t( frame + 1, frame + length ) );
+  }
+}
+
+/*******************************************************************************
+ * @fn     bool load_capture( trace_t* trace, const char* path )
+ * @brief  Frames from a raw capture of audio_rgb's serial output, assumed to
+ *         be at its default ~344 per second
+ * ****************************************************************************/
+static bool load_capture( trace_t* trace, const char* path )
+{
+  frame_decoder_t decoder;
+  uint8_t buffer[4096];
+  size_t length;
+  FILE* file = fopen( path, "rb" );
+
+  if( 0 == file )
+  {
+    perror( path );
+    return false;
+  }
+
+  trace->what = path;
+  trace->fps = 44100.0 / 128;
+  frame_decoder_init( &decoder );
+
+  while( ( length = fread( buffer, 1, sizeof(buffer), file ) ) > 0 )
+  {
+    frame_decode( &decoder, buffer, length, capture_frame, trace );
+  }
+  fclose( file );
+
+  return !trace->frames.empty();
+}
+
+/*******************************************************************************
+ * @fn     void round_trip( const trace_t& trace, uint32_t loss_percent )
+ * @brief  Encode the trace and decode it with loss_percent of the packets
+ *         lost. Every packet the decoder takes must leave it showing exactly
+ *         the frame that was sent, and without loss that's every frame.
+ * ****************************************************************************/
+static void round_trip( const trace_t& trace, uint32_t loss_percent )
+{
+  uint8_t channels = trace.frames[0].size();
+  delta_encoder_t encoder;
+  delta_decoder_t decoder;
+  bytes_t previous( channels );
+  bytes_t values( channels + 1, 0 );
+  bytes_t packet( DELTA_MAX_ENCODED_LENGTH( channels ) + 1 );
+  uint8_t shown = 0;
+  uint32_t index;
+  uint8_t length;
+
+  delta_encoder_init( &encoder, previous.data(), channels );
+  delta_decoder_init( &decoder, values.data(), channels );
+  values[channels] = GUARD;
+
+  for( index = 0; index < trace.frames.size(); index++ )
+  {
+    packet[packet.size() - 1] = GUARD;
+    length = delta_encode( &encoder, trace.frames[index].data(),
+                                                              packet.data() );
+
+    if( ( length > DELTA_MAX_ENCODED_LENGTH( channels ) ) ||
+                                      ( GUARD != packet[packet.size() - 1] ) )
+    {
+      fprintf( stderr, "FAIL: %s, frame %u encoded to %u bytes\n",
+                                                  trace.what, index, length );
+      failures++;
+      return;
+    }
+
+    if( length && ( random_next() % 100 >= loss_percent ) )
+    {
+      shown = delta_decode( &decoder, packet.data(), length );
+    }
+    else
+    {
+      // Nothing sent (so the decoder is still right) or lost
+      shown = ( 0 == length ) && shown;
+    }
+
+    if( ( shown || ( 0 == loss_percent ) ) &&
+        memcmp( values.data(), trace.frames[index].data(), channels ) )
+    {
+      fprintf( stderr, "FAIL: %s, %u%% loss, frame %u decoded wrong\n",
+                                          trace.what, loss_percent, index );
+      failures++;
+      return;
+    }
+
+    if( GUARD != values[channels] )
+    {
+      fprintf( stderr, "FAIL: %s, decoder wrote past the values\n",
+                                                                trace.what );
+      failures++;
+      return;
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void test_garbage( void )
+ * @brief  Random and truncated packets must be dropped without touching
+ *         anything past the values
+ * ****************************************************************************/
+static void test_garbage( void )
+{
+  delta_decoder_t decoder;
+  uint8_t values[DELTA_MAX_CHANNELS + 1];
+  uint8_t packet[64];
+  uint8_t channels;
+  uint8_t length;
+  uint32_t round;
+  uint32_t index;
+
+  for( round = 0; round < 200000; round++ )
+  {
+    channels = 1 + random_next() % DELTA_MAX_CHANNELS;
+    delta_decoder_init( &decoder, values, channels );
+    values[channels] = GUARD;
+
+    // A keyframe first half the time, so deltas get looked at too
+    if( round & 1 )
+    {
+      packet[0] = 0x80;
+      packet[1] = 0x80 | ( channels - 3 );
+      packet[2] = 0;
+      if( channels >= 3 )
+      {
+        delta_decode( &decoder, packet, 3 );
+      }
+    }
+
+    length = random_next() % sizeof(packet);
+    for( index = 0; index < length; index++ )
+    {
+      packet[index] = random_next();
+    }
+    packet[0] &= ( round & 2 ) ? 0xFF : 0x7F;
+    packet[0] = ( packet[0] & 0xC0 ) | decoder.sequence;
+
+    delta_decode( &decoder, packet, length );
+
+    if( GUARD != values[channels] )
+    {
+      fprintf( stderr, "FAIL: garbage packet wrote past %u values\n",
+                                                                  channels );
+      failures++;
+      return;
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void bytes_on_air( const trace_t& trace )
+ * @brief  Print what the trace costs on the air, in full and delta coded
+ * ****************************************************************************/
+static void bytes_on_air( const trace_t& trace )
+{
+  uint8_t channels = trace.frames[0].size();
+  delta_encoder_t encoder;
+  bytes_t previous( channels );
+  bytes_t packet( DELTA_MAX_ENCODED_LENGTH( channels ) );
+  double seconds = trace.frames.size() / trace.fps;
+  uint64_t full = 0;
+  uint64_t delta = 0;
+  uint32_t packets = 0;
+  uint32_t index;
+  uint8_t length;
+
+  delta_encoder_init( &encoder, previous.data(), channels );
+
+  for( index = 0; index < trace.frames.size(); index++ )
+  {
+    full += PACKET_OVERHEAD + 1 + channels;
+
+    length = delta_encode( &encoder, trace.frames[index].data(),
+                                                              packet.data() );
+    if( length )
+    {
+      delta += PACKET_OVERHEAD + 1 + length;
+      packets++;
+    }
+  }
+
+  printf( "%-34s %2u ch %5.1f/s: full %6.0f B/s, delta %6.0f B/s (%3.0f%%), "
+          "%3.0f%% of frames sent\n", trace.what, channels, trace.fps,
+          full / seconds, delta / seconds, 100.0 * delta / full,
+          100.0 * packets / trace.frames.size() );
+}
+
+int main( int argc, char** argv )
+{
+  std::vector<trace_t> traces;
+  trace_t capture;
+  bool bench = ( argc > 1 ) && !strcmp( argv[1], "-b" );
+  uint32_t index;
+  int arg;
+
+  traces.push_back( visualizer( "msgeq7_interface", 3, 30, false ) );
+  traces.push_back( visualizer( "audio_rgb -a, through the bridge", 3,
+                                                      44100.0 / 128, true ) );
+  traces.push_back( visualizer( "audio_rgb, 8 fixtures", 24,
+                                                      44100.0 / 128, true ) );
+  traces.push_back( visualizer( "32 channels, no fall back",
+                                            DELTA_MAX_CHANNELS, 30, false ) );
+
+  if( bench )
+  {
+    for( index = 0; index < traces.size(); index++ )
+    {
+      bytes_on_air( traces[index] );
+    }
+
+    for( arg = 2; arg < argc; arg++ )
+    {
+      capture = trace_t();
+      if( load_capture( &capture, argv[arg] ) )
+      {
+        bytes_on_air( capture );
+      }
+    }
+
+    return 0;
+  }
+
+  for( index = 0; index < traces.size(); index++ )
+  {
+    round_trip( traces[index], 0 );
+    round_trip( traces[index], 10 );
+    round_trip( traces[index], 50 );
+  }
+  test_garbage();
+
+  printf( "delta_test: %s\n", failures ? "FAILED" : "passed" );
+
+  return failures ? 1 : 0;
+}
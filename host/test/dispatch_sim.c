@@ -0,0 +1,332 @@
+/** @file dispatch_sim.c
+*
+* @brief lib/dispatch.c as the radio's rx_callback, on a scripted sequence
+*        of packets
+*
+* lib/cc2500/cc2500.c and lib/dispatch.c run against the radio model in
+* test/msp430/radio.c on the MSP430 model, with the default DISPATCH_TYPES,
+* DISPATCH_QUEUE_LENGTH and DISPATCH_PAYLOAD. TIME_BEACON has a DISPATCH_ISR
+* handler and RGB_UNIVERSE a DISPATCH_DEFERRED one. The main loop sleeps in
+* LPM3 and calls dispatch_poll() whenever it wakes up, except while a step
+* holds it off to fill the queue.
+*
+* Every step sends a few packets and checks which handlers ran, where (in
+* the ISR, with GIE clear, or from dispatch_poll() in the main loop), with
+* what, and the counters afterwards:
+*
+*   ISR handler       a beacon is handled in the ISR, as it was sent
+*   deferred handler  an RGB packet is handled from the main loop
+*   queue full        two RGB packets while the main loop is busy, the
+*                     second one is dropped
+*   too long          an RGB packet longer than DISPATCH_PAYLOAD is dropped
+*   no handler        a SERVO_COMMAND, a type past DISPATCH_TYPES and a
+*                     packet with no type byte count as unhandled
+*   removed           a beacon after its handler is removed is unhandled
+*   cleared           dispatch_clear_counts() zeroes every counter
+*
+* usage: dispatch_sim [-v]
+*   -v  Print every handler call
+*
+* @author Alvaro Prieto
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cc2500.h"
+#include "dispatch.h"
+#include "device.h"
+#include "spi.h"
+#include "radio.h"
+
+// Frames start once the node is set up and the radio calibrated
+#define START_CYCLES (64000)
+
+// Between frames, long enough for the ISR and the main loop to be done
+#define GAP_CYCLES (8000)
+
+#define MAX_FRAMES (4)
+#define MAX_CALLS (8)
+
+typedef struct
+{
+  uint8_t type;
+  uint8_t length;           // From the address on
+} frame_t;
+
+typedef struct
+{
+  uint8_t type;
+  uint8_t in_isr;
+  uint8_t length;
+  uint8_t intact;           // Same bytes as sent
+} call_t;
+
+typedef struct
+{
+  const char* what;
+  frame_t frames[MAX_FRAMES];
+  uint8_t frame_count;
+  uint8_t hold;             // Main loop doesn't poll until the last frame
+  call_t calls[MAX_CALLS];  // Expected, in order
+  uint8_t call_count;
+  uint16_t beacons;         // Counters afterwards
+  uint16_t rgb;
+  uint16_t unhandled;
+  uint16_t dropped;
+} step_t;
+
+void port2_isr( void );
+
+static uint32_t failures;
+static int verbose;
+
+static const step_t* step;
+static uint8_t sent;
+static uint64_t next_at;
+static uint64_t last_at;
+
+static call_t calls[MAX_CALLS];
+static uint8_t call_count;
+
+/*******************************************************************************
+ * @fn     void fill( uint8_t* buffer, uint8_t type, uint8_t length )
+ * @brief  [address][type][payload...] for a frame of step
+ * ****************************************************************************/
+static void fill( uint8_t* buffer, uint8_t type, uint8_t length )
+{
+  uint8_t index;
+
+  buffer[0] = DEVICE_ADDRESS;
+
+  for( index = 1; index < length; index++ )
+  {
+    buffer[index] = ( 1 == index ) ? type : (uint8_t)( type * 31 + index );
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t record( uint8_t* buffer, uint8_t length )
+ * @brief  Both handlers. Note where they ran and whether the packet came
+ *         through as it was sent.
+ * ****************************************************************************/
+static uint8_t record( uint8_t* buffer, uint8_t length )
+{
+  uint8_t expected[CC2500_BUFFER_LENGTH];
+  call_t* call;
+
+  if( call_count == MAX_CALLS )
+  {
+    return 0;
+  }
+
+  call = &calls[call_count++];
+  call->type = buffer[1];
+  call->in_isr = !( __get_SR_register() & GIE );
+  call->length = length;
+
+  fill( expected, buffer[1], length );
+  call->intact = !memcmp( buffer, expected, length );
+
+  if( verbose )
+  {
+    printf( "  type %u, %u bytes, %s%s\n", call->type, length,
+            call->in_isr ? "in the ISR" : "from dispatch_poll()",
+            call->intact ? "" : ", corrupted" );
+  }
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t air( radio_frame_t* frame )
+ * @brief  The next frame of step
+ * ****************************************************************************/
+static uint8_t air( radio_frame_t* frame )
+{
+  const frame_t* next;
+
+  if( sent == step->frame_count )
+  {
+    return 0;
+  }
+
+  next = &step->frames[sent++];
+
+  memset( frame, 0, sizeof(*frame) );
+  frame->sync_at = next_at;
+  frame->sync = ( radio_register( TI_CCxxx0_SYNC1 ) << 8 ) |
+                                        radio_register( TI_CCxxx0_SYNC0 );
+  frame->crc_ok = 1;
+  frame->rssi = -60;
+  frame->length = 1 + next->length;
+  frame->data[0] = next->length;
+  fill( &frame->data[1], next->type, next->length );
+
+  // Length byte, packet and CRC after the sync word
+  last_at = next_at + ( next->length + 3 ) * radio_byte_cycles;
+  next_at = last_at + GAP_CYCLES;
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     void run_step( const step_t* which )
+ * @brief  Send the frames of which to a fresh MCU and radio, then check the
+ *         calls and counters. The dispatch table, queue and counters carry
+ *         over from the steps before.
+ * ****************************************************************************/
+static void run_step( const step_t* which )
+{
+  uint8_t index;
+  const call_t* expected;
+
+  step = which;
+  sent = 0;
+  call_count = 0;
+  next_at = START_CYCLES;
+  last_at = 0;
+
+  sim_reset();
+  sim_port2_isr = port2_isr;
+  radio_air = air;
+  radio_reset();
+
+  setup_cc2500( dispatch_callback );
+
+  if( verbose )
+  {
+    printf( "%s\n", step->what );
+  }
+
+  // Wait for the last frame to be over, sleeping like a main loop would
+  sim_stop_cycles = next_at + ( step->frame_count + 1 ) *
+                    ( ( CC2500_MAX_PACKET_LENGTH + 4 ) * radio_byte_cycles +
+                                                                GAP_CYCLES );
+  if( 0 == setjmp( sim_stop ) )
+  {
+    for( ;; )
+    {
+      __bis_SR_register( LPM3_bits + GIE );
+
+      if( !step->hold ||
+          ( ( sent == step->frame_count ) && ( sim_cycles >= last_at ) ) )
+      {
+        dispatch_poll();
+      }
+    }
+  }
+
+  radio_finish();
+
+  if( call_count != step->call_count )
+  {
+    fprintf( stderr, "FAIL: %s: %u handler calls, expected %u\n", step->what,
+                                              call_count, step->call_count );
+    failures++;
+  }
+
+  for( index = 0; ( index < call_count ) && ( index < step->call_count );
+                                                                    index++ )
+  {
+    expected = &step->calls[index];
+
+    if( ( calls[index].type != expected->type ) ||
+        ( calls[index].in_isr != expected->in_isr ) ||
+        ( calls[index].length != expected->length ) || !calls[index].intact )
+    {
+      fprintf( stderr, "FAIL: %s: call %u was type %u, %u bytes, %s%s\n",
+                step->what, index, calls[index].type, calls[index].length,
+                calls[index].in_isr ? "in the ISR" : "deferred",
+                calls[index].intact ? "" : ", corrupted" );
+      failures++;
+    }
+  }
+
+  if( ( dispatch_count( TIME_BEACON ) != step->beacons ) ||
+      ( dispatch_count( RGB_UNIVERSE ) != step->rgb ) ||
+      ( dispatch_unhandled() != step->unhandled ) ||
+      ( dispatch_dropped() != step->dropped ) )
+  {
+    fprintf( stderr, "FAIL: %s: counted %u beacons, %u RGB, %u unhandled, "
+            "%u dropped, expected %u, %u, %u, %u\n", step->what,
+            dispatch_count( TIME_BEACON ), dispatch_count( RGB_UNIVERSE ),
+            dispatch_unhandled(), dispatch_dropped(), step->beacons,
+            step->rgb, step->unhandled, step->dropped );
+    failures++;
+  }
+}
+
+int main( int argc, char** argv )
+{
+  static const step_t steps[] =
+  {
+    { "ISR handler",
+      { { TIME_BEACON, 1 + TIME_BEACON_LENGTH } }, 1, 0,
+      { { TIME_BEACON, 1, 1 + TIME_BEACON_LENGTH, 1 } }, 1,
+      1, 0, 0, 0 },
+    { "deferred handler",
+      { { RGB_UNIVERSE, 12 } }, 1, 0,
+      { { RGB_UNIVERSE, 0, 12, 1 } }, 1,
+      1, 1, 0, 0 },
+    { "queue full",
+      { { RGB_UNIVERSE, 8 }, { RGB_UNIVERSE, 9 } }, 2, 1,
+      { { RGB_UNIVERSE, 0, 8, 1 } }, 1,
+      1, 3, 0, 1 },
+    { "too long",
+      { { RGB_UNIVERSE, 1 + DISPATCH_PAYLOAD + 1 },
+        { RGB_UNIVERSE, 1 + DISPATCH_PAYLOAD } }, 2, 0,
+      { { RGB_UNIVERSE, 0, 1 + DISPATCH_PAYLOAD, 1 } }, 1,
+      1, 5, 0, 2 },
+    { "no handler",
+      { { SERVO_COMMAND, 6 }, { DISPATCH_TYPES, 6 }, { 0xF0, 6 }, { 0, 1 } },
+      4, 0,
+      { { 0 } }, 0,
+      1, 5, 4, 2 },
+  };
+  static const step_t removed =
+  {
+    "removed",
+    { { TIME_BEACON, 1 + TIME_BEACON_LENGTH } }, 1, 0,
+    { { 0 } }, 0,
+    1, 5, 5, 2
+  };
+  static const step_t cleared =
+  {
+    "cleared",
+    { { 0 } }, 0, 0,
+    { { 0 } }, 0,
+    0, 0, 0, 0
+  };
+  uint8_t index;
+
+  verbose = ( argc > 1 ) && !strcmp( argv[1], "-v" );
+
+  dispatch_setup();
+  dispatch_register( TIME_BEACON, record, DISPATCH_ISR );
+  dispatch_register( RGB_UNIVERSE, record, DISPATCH_DEFERRED );
+
+  // Past the end of the table, ignored
+  dispatch_register( DISPATCH_TYPES, record, DISPATCH_ISR );
+
+  for( index = 0; index < sizeof(steps) / sizeof(steps[0]); index++ )
+  {
+    run_step( &steps[index] );
+  }
+
+  dispatch_register( TIME_BEACON, 0, DISPATCH_ISR );
+  run_step( &removed );
+
+  dispatch_clear_counts();
+  run_step( &cleared );
+
+  if( dispatch_count( DISPATCH_TYPES ) )
+  {
+    fprintf( stderr, "FAIL: type %u has a count\n", DISPATCH_TYPES );
+    failures++;
+  }
+
+  printf( "dispatch_sim: %s\n", failures ? "FAILED" : "passed" );
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,295 @@
+/** @file fec_test.c
+*
+* @brief Checks lib/fec.c round trips, length limits and error correction,
+*        and measures packet error rate against bit error rate
+*
+* Every length up to FEC_MAX_ENCODED_LENGTH / 2 has to round trip, and every
+* longer one (including 128-157, whose doubled length wraps in a uint8_t)
+* has to be refused. Any single bit error per codeword, and any burst no
+* longer than the number of codewords, has to be corrected.
+*
+* The PER part sends random packets through a channel with independent bit
+* errors, with and without the code. A coded packet counts as lost when
+* fec_decode() reports a codeword it couldn't fix, and as corrupted when it
+* reports none but the data is wrong anyway (three or more errors in one
+* codeword). An uncoded packet is lost on any bit error, like the radio's
+* CRC would drop it. Both go through the same channel, so the coded
+* packet, twice as long on the air, sees twice the bit errors.
+*
+* usage: fec_test [-v]
+*   -v  Print PER against BER for a few packet lengths
+*
+* @author Alvaro Prieto
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fec.h"
+
+#define PACKETS (20000)
+
+static uint32_t failures;
+
+/*******************************************************************************
+ * @fn     uint32_t random_next( void )
+ * @brief  xorshift32, so every run sees the same errors
+ * ****************************************************************************/
+static uint32_t random_state = 2463534242u;
+
+static uint32_t random_next( void )
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+
+  return random_state;
+}
+
+/*******************************************************************************
+ * @fn     void random_fill( uint8_t* buffer, uint8_t length )
+ * @brief  length random bytes
+ * ****************************************************************************/
+static void random_fill( uint8_t* buffer, uint8_t length )
+{
+  uint8_t index;
+
+  for( index = 0; index < length; index++ )
+  {
+    buffer[index] = random_next();
+  }
+}
+
+/*******************************************************************************
+ * @fn     void flip( uint8_t* encoded, uint16_t position )
+ * @brief  Flip one bit of an encoded block, in the order it goes out
+ * ****************************************************************************/
+static void flip( uint8_t* encoded, uint16_t position )
+{
+  encoded[position >> 3] ^= 0x80 >> ( position & 7 );
+}
+
+/*******************************************************************************
+ * @fn     void check_decode( const uint8_t* encoded, uint8_t words,
+ *                              const uint8_t* data, const char* what )
+ * @brief  Decode and expect every codeword corrected and data back
+ * ****************************************************************************/
+static void check_decode( const uint8_t* encoded, uint8_t words,
+                                  const uint8_t* data, const char* what )
+{
+  uint8_t decoded[FEC_MAX_ENCODED_LENGTH / 2];
+  uint8_t failed;
+
+  failed = fec_decode( encoded, words, decoded );
+
+  if( failed || memcmp( decoded, data, words / 2 ) )
+  {
+    fprintf( stderr, "FAIL: %s, %u encoded bytes: %u failed codewords%s\n",
+              what, words, failed, failed ? "" : ", wrong data" );
+    failures++;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void test_lengths( void )
+ * @brief  Every length that fits round trips, every one that doesn't is
+ *         refused without touching the output
+ * ****************************************************************************/
+static void test_lengths( void )
+{
+  uint8_t data[255];
+  uint8_t encoded[2 * 255];
+  uint8_t words;
+  uint16_t length;
+
+  random_fill( data, sizeof(data) );
+
+  for( length = 0; length <= 255; length++ )
+  {
+    memset( encoded, 0xA5, sizeof(encoded) );
+    words = fec_encode( data, length, encoded );
+
+    if( length <= FEC_MAX_ENCODED_LENGTH / 2 )
+    {
+      if( words != FEC_ENCODED_LENGTH( length ) )
+      {
+        fprintf( stderr, "FAIL: %u bytes encoded to %u, expected %u\n",
+                              length, words, FEC_ENCODED_LENGTH( length ) );
+        failures++;
+        continue;
+      }
+
+      check_decode( encoded, words, data, "no errors" );
+    }
+    else if( words || ( 0xA5 != encoded[0] ) )
+    {
+      fprintf( stderr, "FAIL: %u bytes (over the limit) encoded to %u\n",
+                                                              length, words );
+      failures++;
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void test_correction( void )
+ * @brief  One bit error in every codeword, and bursts as long as there are
+ *         codewords, at every offset
+ * ****************************************************************************/
+static void test_correction( void )
+{
+  uint8_t data[FEC_MAX_ENCODED_LENGTH / 2];
+  uint8_t encoded[FEC_MAX_ENCODED_LENGTH];
+  uint8_t corrupted[FEC_MAX_ENCODED_LENGTH];
+  uint8_t length;
+  uint8_t words;
+  uint8_t word;
+  uint16_t start;
+  uint16_t position;
+
+  for( length = 1; length <= FEC_MAX_ENCODED_LENGTH / 2; length++ )
+  {
+    random_fill( data, length );
+    words = fec_encode( data, length, encoded );
+
+    // Codeword n has its bits at n, n + words, n + 2 * words...
+    memcpy( corrupted, encoded, words );
+    for( word = 0; word < words; word++ )
+    {
+      flip( corrupted, word + ( random_next() % 8 ) * words );
+    }
+    check_decode( corrupted, words, data, "one error per codeword" );
+
+    for( start = 0; start + words <= words * 8; start++ )
+    {
+      memcpy( corrupted, encoded, words );
+      for( position = start; position < start + words; position++ )
+      {
+        flip( corrupted, position );
+      }
+      check_decode( corrupted, words, data, "burst" );
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t channel( uint8_t* buffer, uint8_t length, uint32_t ber )
+ * @brief  Flip every bit with a chance of ber in 2^32. Returns whether any
+ *         were flipped.
+ * ****************************************************************************/
+static uint8_t channel( uint8_t* buffer, uint8_t length, uint32_t ber )
+{
+  uint16_t position;
+  uint8_t errors = 0;
+
+  for( position = 0; position < length * 8; position++ )
+  {
+    if( random_next() < ber )
+    {
+      flip( buffer, position );
+      errors = 1;
+    }
+  }
+
+  return errors;
+}
+
+/*******************************************************************************
+ * @fn     void per( uint8_t length, double ber, double* uncoded,
+ *                                      double* coded, double* undetected )
+ * @brief  Packet error rates of length byte packets at a bit error rate
+ * ****************************************************************************/
+static void per( uint8_t length, double ber, double* uncoded, double* coded,
+                                                          double* undetected )
+{
+  uint8_t data[FEC_MAX_ENCODED_LENGTH / 2];
+  uint8_t encoded[FEC_MAX_ENCODED_LENGTH];
+  uint8_t decoded[FEC_MAX_ENCODED_LENGTH / 2];
+  uint32_t threshold = (uint32_t)( ber * 4294967296.0 );
+  uint32_t plain_lost = 0;
+  uint32_t coded_lost = 0;
+  uint32_t coded_wrong = 0;
+  uint32_t packet;
+  uint8_t words;
+
+  for( packet = 0; packet < PACKETS; packet++ )
+  {
+    random_fill( data, length );
+
+    memcpy( decoded, data, length );
+    plain_lost += channel( decoded, length, threshold );
+
+    words = fec_encode( data, length, encoded );
+    channel( encoded, words, threshold );
+
+    if( fec_decode( encoded, words, decoded ) )
+    {
+      coded_lost++;
+    }
+    else if( memcmp( decoded, data, length ) )
+    {
+      coded_wrong++;
+    }
+  }
+
+  *uncoded = (double)plain_lost / PACKETS;
+  *coded = (double)( coded_lost + coded_wrong ) / PACKETS;
+  *undetected = (double)coded_wrong / PACKETS;
+}
+
+/*******************************************************************************
+ * @fn     void test_per( int verbose )
+ * @brief  PER against BER. The code has to beat no code wherever there are
+ *         errors to fix.
+ * ****************************************************************************/
+static void test_per( int verbose )
+{
+  static const double bers[] = { 1e-4, 3e-4, 1e-3, 3e-3, 1e-2, 3e-2 };
+  static const uint8_t lengths[] = { 4, 20, FEC_MAX_ENCODED_LENGTH / 2 };
+  double uncoded;
+  double coded;
+  double undetected;
+  uint8_t length;
+  uint8_t index;
+
+  if( verbose )
+  {
+    printf( "%5s %8s %10s %10s %12s\n", "bytes", "BER", "PER plain",
+                                            "PER FEC", "undetected" );
+  }
+
+  for( length = 0; length < sizeof(lengths); length++ )
+  {
+    for( index = 0; index < sizeof(bers) / sizeof(bers[0]); index++ )
+    {
+      per( lengths[length], bers[index], &uncoded, &coded, &undetected );
+
+      if( verbose )
+      {
+        printf( "%5u %8.0e %10.5f %10.5f %12.5f\n", lengths[length],
+                                    bers[index], uncoded, coded, undetected );
+      }
+
+      if( ( bers[index] <= 1e-2 ) && ( coded >= uncoded ) )
+      {
+        fprintf( stderr, "FAIL: %u bytes at BER %g: PER %.5f with FEC, "
+                          "%.5f without\n", lengths[length], bers[index],
+                                                            coded, uncoded );
+        failures++;
+      }
+    }
+  }
+}
+
+int main( int argc, char** argv )
+{
+  int verbose = ( argc > 1 ) && !strcmp( argv[1], "-v" );
+
+  test_lengths();
+  test_correction();
+  test_per( verbose );
+
+  printf( "fec_test: %s\n", failures ? "FAILED" : "passed" );
+
+  return failures ? 1 : 0;
+}
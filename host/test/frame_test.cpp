@@ -0,0 +1,408 @@
+/** @file frame_test.cpp
+*
+* @brief Checks the vectorized frame decoder against decode_byte(), and
+*        benchmarks it
+*
+* frame_decode() only runs the special bytes through decode_byte() and
+* copies or skips everything in between. The tests feed the same streams,
+* split into reads in different ways, to frame_decode() and to a plain
+* loop over decode_byte(), and expect the same frames and counters. Long
+* frames around FRAME_MAX_LENGTH cover the run > space overflow path.
+*
+* Built once per code path (AVX2, SSE2 and the plain loop) by the Makefile.
+*
+* usage: frame_test [-b [capture...]]
+*   -b  Benchmark on synthetic streams and on any raw captures of a bridge
+*       serial stream given (e.g. cat /dev/ttyUSB0 > capture)
+*
+* @author Alvaro Prieto
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+// Built in, for find_special() and decode_byte()
+#include "../serial/frame.cpp"
+
+typedef std::vector<uint8_t> bytes_t;
+
+typedef struct
+{
+  std::vector<bytes_t> frames;
+  uint64_t bytes;
+} sink_t;
+
+static uint32_t failures;
+
+/*******************************************************************************
+ * @fn     uint32_t random_next( void )
+ * @brief  xorshift32, so every run tests the same streams
+ * ****************************************************************************/
+static uint32_t random_state = 2463534242u;
+
+static uint32_t random_next( void )
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+
+  return random_state;
+}
+
+/*******************************************************************************
+ * @fn     void keep_frame( void* context, const uint8_t* frame, size_t length )
+ * @brief  Decoder callback, records every frame
+ * ****************************************************************************/
+static void keep_frame( void* context, const uint8_t* frame, size_t length )
+{
+  ((sink_t*)context)->frames.push_back( bytes_t( frame, frame + length ) );
+}
+
+/*******************************************************************************
+ * @fn     void count_frame( void* context, const uint8_t* frame, size_t length )
+ * @brief  Decoder callback for the benchmark, only counts
+ * ****************************************************************************/
+static void count_frame( void* context, const uint8_t* frame, size_t length )
+{
+  ((sink_t*)context)->bytes += length;
+}
+
+/*******************************************************************************
+ * @fn     void reference_decode( frame_decoder_t* decoder, const uint8_t* data,
+ *                  size_t length, frame_callback_t callback, void* context )
+ * @brief  The decoder without the fast path, one byte at a time
+ * ****************************************************************************/
+static void reference_decode( frame_decoder_t* decoder, const uint8_t* data,
+                size_t length, frame_callback_t callback, void* context )
+{
+  size_t index;
+
+  for( index = 0; index < length; index++ )
+  {
+    decode_byte( decoder, data[index], callback, context );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void compare( const bytes_t& stream, size_t chunk, const char* what )
+ * @brief  Decode stream in reads of chunk bytes (0 for random sizes) both
+ *         ways and check they agree
+ * ****************************************************************************/
+static void compare( const bytes_t& stream, size_t chunk, const char* what )
+{
+  frame_decoder_t fast;
+  frame_decoder_t reference;
+  sink_t fast_frames;
+  sink_t reference_frames;
+  size_t index = 0;
+  size_t length;
+
+  frame_decoder_init( &fast );
+  frame_decoder_init( &reference );
+
+  while( index < stream.size() )
+  {
+    length = chunk ? chunk : 1 + random_next() % 100;
+    if( length > stream.size() - index )
+    {
+      length = stream.size() - index;
+    }
+
+    frame_decode( &fast, &stream[index], length, keep_frame, &fast_frames );
+    reference_decode( &reference, &stream[index], length, keep_frame,
+                                                          &reference_frames );
+    index += length;
+  }
+
+  // The buffer length only means something inside a frame
+  if( ( fast_frames.frames != reference_frames.frames ) ||
+      ( fast.frames != reference.frames ) ||
+      ( fast.dropped != reference.dropped ) ||
+      ( fast.receiving != reference.receiving ) ||
+      ( fast.escape_next != reference.escape_next ) ||
+      ( fast.receiving && ( fast.length != reference.length ) ) )
+  {
+    fprintf( stderr, "FAIL: %s, %zu byte reads: %zu/%u frames, %u dropped "
+                      "(expected %zu/%u, %u dropped)\n", what, chunk,
+              fast_frames.frames.size(), fast.frames, fast.dropped,
+              reference_frames.frames.size(), reference.frames,
+              reference.dropped );
+    failures++;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void compare_reads( const bytes_t& stream, const char* what )
+ * @brief  compare() with reads that split the SIMD blocks in different places
+ * ****************************************************************************/
+static void compare_reads( const bytes_t& stream, const char* what )
+{
+  static const size_t chunks[] = { 1, 7, 15, 16, 17, 31, 32, 33, 64, 4096, 0 };
+  size_t index;
+
+  for( index = 0; index < sizeof(chunks) / sizeof(chunks[0]); index++ )
+  {
+    compare( stream, chunks[index], what );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void append_frame( bytes_t* stream, const bytes_t& payload )
+ * @brief  Add an encoded frame to a stream. Payloads can be longer than
+ *         FRAME_MAX_LENGTH on purpose.
+ * ****************************************************************************/
+static void append_frame( bytes_t* stream, const bytes_t& payload )
+{
+  bytes_t encoded( FRAME_ENCODED_LENGTH( payload.size() ) );
+
+  encoded.resize( frame_encode( payload.data(), payload.size(),
+                                                          encoded.data() ) );
+  stream->insert( stream->end(), encoded.begin(), encoded.end() );
+}
+
+/*******************************************************************************
+ * @fn     void test_overflow_boundary( void )
+ * @brief  Frames of FRAME_MAX_LENGTH give or take a few bytes, with and
+ *         without escapes right at the limit, each followed by a normal one
+ * ****************************************************************************/
+static void test_overflow_boundary( void )
+{
+  bytes_t stream;
+  bytes_t payload;
+  size_t length;
+  int escape_at;
+  char what[64];
+
+  for( length = FRAME_MAX_LENGTH - 4; length <= FRAME_MAX_LENGTH + 4; length++ )
+  {
+    for( escape_at = -1; escape_at < 4; escape_at++ )
+    {
+      payload.assign( length, 0x41 );
+      if( escape_at >= 0 )
+      {
+        payload[length - 1 - escape_at] = END_BYTE;
+      }
+
+      stream.clear();
+      append_frame( &stream, payload );
+      append_frame( &stream, bytes_t{ 1, 2, 3 } );
+
+      // Overflow in the middle of an escape, and a start byte restarting
+      // a frame that's too long
+      stream.push_back( START_BYTE );
+      stream.insert( stream.end(), length, 0x42 );
+      stream.push_back( ESCAPE_BYTE );
+      stream.push_back( 0x5E );
+      append_frame( &stream, bytes_t{ 4, 5 } );
+
+      snprintf( what, sizeof(what), "%zu byte frame, escape %d from the end",
+                                                          length, escape_at );
+      compare_reads( stream, what );
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void test_random_streams( void )
+ * @brief  Random frames (some too long, some with lots of escapes) mixed with
+ *         line noise
+ * ****************************************************************************/
+static void test_random_streams( void )
+{
+  bytes_t stream;
+  bytes_t payload;
+  uint32_t frame;
+  uint32_t round;
+  size_t index;
+  uint32_t special;
+
+  for( round = 0; round < 20; round++ )
+  {
+    stream.clear();
+
+    for( frame = 0; frame < 200; frame++ )
+    {
+      payload.resize( random_next() % 300 );
+      special = random_next() % 4;
+
+      for( index = 0; index < payload.size(); index++ )
+      {
+        // From no special bytes at all to mostly special bytes
+        payload[index] = ( random_next() % 4 < special ) ?
+                          ESCAPE_BYTE + random_next() % 3 : random_next();
+      }
+
+      append_frame( &stream, payload );
+
+      if( 0 == random_next() % 8 )
+      {
+        // Noise between (or in place of the end of) frames
+        for( index = random_next() % 40; index; index-- )
+        {
+          stream.push_back( random_next() );
+        }
+      }
+    }
+
+    compare_reads( stream, "random frames" );
+  }
+
+  for( round = 0; round < 20; round++ )
+  {
+    stream.resize( 20000 );
+    for( index = 0; index < stream.size(); index++ )
+    {
+      stream[index] = random_next();
+    }
+
+    compare_reads( stream, "random bytes" );
+  }
+}
+
+/*******************************************************************************
+ * @fn     double seconds( void )
+ * @brief  Monotonic time in seconds
+ * ****************************************************************************/
+static double seconds( void )
+{
+  struct timespec time;
+
+  clock_gettime( CLOCK_MONOTONIC, &time );
+
+  return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/*******************************************************************************
+ * @fn     void bench( const bytes_t& stream, const char* what )
+ * @brief  Decode throughput of frame_decode() and of the byte loop, in reads
+ *         of 4kB like the gateway does
+ * ****************************************************************************/
+static void bench( const bytes_t& stream, const char* what )
+{
+  frame_decoder_t decoder;
+  sink_t sink;
+  double start;
+  double fast_time;
+  double reference_time;
+  size_t index;
+  size_t length;
+  uint32_t round;
+  uint32_t rounds = 1 + ( 256u << 20 ) / stream.size();
+
+  frame_decoder_init( &decoder );
+  start = seconds();
+  for( round = 0; round < rounds; round++ )
+  {
+    for( index = 0; index < stream.size(); index += length )
+    {
+      length = std::min( (size_t)4096, stream.size() - index );
+      frame_decode( &decoder, &stream[index], length, count_frame, &sink );
+    }
+  }
+  fast_time = seconds() - start;
+
+  frame_decoder_init( &decoder );
+  start = seconds();
+  for( round = 0; round < rounds; round++ )
+  {
+    reference_decode( &decoder, stream.data(), stream.size(), count_frame,
+                                                                      &sink );
+  }
+  reference_time = seconds() - start;
+
+  printf( "%-28s %8.0f MB/s (byte loop %6.0f MB/s, %.1fx)\n", what,
+          stream.size() * (double)rounds / fast_time / 1e6,
+          stream.size() * (double)rounds / reference_time / 1e6,
+          reference_time / fast_time );
+}
+
+/*******************************************************************************
+ * @fn     bytes_t synthetic( size_t length, uint32_t special_percent )
+ * @brief  1MB of bridge frames of length bytes, with about special_percent
+ *         of the payload bytes needing an escape
+ * ****************************************************************************/
+static bytes_t synthetic( size_t length, uint32_t special_percent )
+{
+  bytes_t stream;
+  bytes_t payload( length );
+  size_t index;
+
+  while( stream.size() < ( 1 << 20 ) )
+  {
+    for( index = 0; index < length; index++ )
+    {
+      payload[index] = ( random_next() % 100 < special_percent ) ?
+                            ESCAPE_BYTE + random_next() % 3 : random_next() % 0x7D;
+    }
+
+    append_frame( &stream, payload );
+  }
+
+  return stream;
+}
+
+int main( int argc, char** argv )
+{
+  const char* path = "plain";
+  bytes_t capture;
+  FILE* file;
+  int index;
+
+#if defined(__AVX2__)
+  path = "AVX2";
+  if( !__builtin_cpu_supports( "avx2" ) )
+  {
+    printf( "frame_test: no AVX2 on this CPU, skipped\n" );
+    return 0;
+  }
+#elif defined(__SSE2__)
+  path = "SSE2";
+#endif
+
+  if( ( argc > 1 ) && !strcmp( argv[1], "-b" ) )
+  {
+    printf( "frame_decode, %s path:\n", path );
+    bench( synthetic( 4, 1 ), "4 byte frames (RGB)" );
+    bench( synthetic( 31, 1 ), "31 byte frames" );
+    bench( synthetic( 255, 1 ), "255 byte frames" );
+    bench( synthetic( 255, 0 ), "255 byte frames, no escapes" );
+    bench( synthetic( 31, 50 ), "31 byte frames, 50% escaped" );
+
+    for( index = 2; index < argc; index++ )
+    {
+      file = fopen( argv[index], "rb" );
+      if( 0 == file )
+      {
+        perror( argv[index] );
+        continue;
+      }
+
+      capture.clear();
+      while( !feof( file ) )
+      {
+        uint8_t buffer[4096];
+        size_t length = fread( buffer, 1, sizeof(buffer), file );
+        capture.insert( capture.end(), buffer, buffer + length );
+      }
+      fclose( file );
+
+      if( !capture.empty() )
+      {
+        bench( capture, argv[index] );
+      }
+    }
+
+    return 0;
+  }
+
+  test_overflow_boundary();
+  test_random_streams();
+
+  printf( "frame_test (%s): %s\n", path, failures ? "FAILED" : "passed" );
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,703 @@
+/** @file gateway_test.cpp
+*
+* @brief Round trip tests and throughput benchmark for the gateway daemon,
+*        with pseudo terminal pairs standing in for bridge dongles
+*
+* Each test starts the gateway on the slave ends of a few ptys, talks to it
+* through its Unix socket like any client, and plays the dongles on the
+* master ends: frames written to a master must come out of the socket, and
+* datagrams sent to the socket must come out of the right master.
+*
+* usage: gateway_test [-b] path/to/gateway
+*   -b  Run the throughput benchmark instead of the tests
+*
+* @author Alvaro Prieto
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <vector>
+#include <algorithm>
+#include "../serial/frame.h"
+#include "../../lib/packet.h"
+
+#define MAX_BRIDGES (4)
+
+// How long to wait for something that should happen, in ms
+#define TIMEOUT_MS (2000)
+
+
+// Benchmark frames, sized like a full bridge frame
+#define BENCH_FRAMES (100000)
+#define BENCH_FRAME_LENGTH (31)
+
+typedef std::vector<uint8_t> frame_t;
+
+typedef struct
+{
+  int master;
+  int slave;
+  char path[64];
+  frame_decoder_t decoder;
+  std::vector<frame_t> frames;    // Decoded from what the gateway wrote
+} pty_t;
+
+typedef struct
+{
+  pid_t pid;
+  int client;
+  char socket_path[64];
+  char client_path[64];
+  pty_t ptys[MAX_BRIDGES];
+  uint8_t total_ptys;
+} gateway_t;
+
+static const char* gateway_path;
+static uint32_t failures;
+
+static void bridge_write( gateway_t*, uint8_t, const uint8_t*, size_t );
+static bool client_receive( gateway_t*, frame_t* );
+
+/*******************************************************************************
+ * @fn     uint64_t now_ns( void )
+ * @brief  Monotonic time in nanoseconds
+ * ****************************************************************************/
+static uint64_t now_ns( void )
+{
+  struct timespec time;
+
+  clock_gettime( CLOCK_MONOTONIC, &time );
+
+  return (uint64_t)time.tv_sec * 1000000000ULL + time.tv_nsec;
+}
+
+/*******************************************************************************
+ * @fn     void check( bool condition, const char* what )
+ * @brief  Count and report a failed expectation
+ * ****************************************************************************/
+static void check( bool condition, const char* what )
+{
+  if( !condition )
+  {
+    fprintf( stderr, "FAIL: %s\n", what );
+    failures++;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void pty_frame( void* context, const uint8_t* frame, size_t length )
+ * @brief  Decoder callback, keeps frames the gateway sent to a dongle
+ * ****************************************************************************/
+static void pty_frame( void* context, const uint8_t* frame, size_t length )
+{
+  pty_t* pty = (pty_t*)context;
+
+  pty->frames.push_back( frame_t( frame, frame + length ) );
+}
+
+/*******************************************************************************
+ * @fn     bool pty_open( pty_t* pty )
+ * @brief  Create a pty pair. The slave is made raw right away, so nothing
+ *         written before the gateway opens it gets echoed back.
+ * ****************************************************************************/
+static bool pty_open( pty_t* pty )
+{
+  struct termios tio;
+
+  pty->master = posix_openpt( O_RDWR | O_NOCTTY | O_NONBLOCK );
+  if( ( pty->master < 0 ) || grantpt( pty->master ) ||
+                                                    unlockpt( pty->master ) )
+  {
+    return false;
+  }
+
+  strncpy( pty->path, ptsname( pty->master ), sizeof(pty->path) - 1 );
+
+  // Kept open until the end, so the master never sees a hangup
+  pty->slave = open( pty->path, O_RDWR | O_NOCTTY );
+  if( ( pty->slave < 0 ) || tcgetattr( pty->slave, &tio ) )
+  {
+    return false;
+  }
+
+  cfmakeraw( &tio );
+  tcsetattr( pty->slave, TCSANOW, &tio );
+
+  frame_decoder_init( &pty->decoder );
+  pty->frames.clear();
+
+  return true;
+}
+
+/*******************************************************************************
+ * @fn     bool gateway_start( gateway_t* gateway, uint8_t bridges,
+ *                                                    const char* options[] )
+ * @brief  Run the gateway on new ptys, with extra options (null terminated),
+ *         and subscribe to it. Returns once a frame from a bridge comes up.
+ * ****************************************************************************/
+static bool gateway_start( gateway_t* gateway, uint8_t bridges,
+                                                        const char* options[] )
+{
+  const char* argv[16];
+  struct sockaddr_un address;
+  frame_t datagram;
+
+  // [address][RGB_UNIVERSE], nothing to learn a route from
+  frame_t sync = { 0x00, RGB_UNIVERSE };
+  uint8_t argc = 0;
+  uint8_t index;
+  uint64_t deadline;
+
+  gateway->total_ptys = bridges;
+  snprintf( gateway->socket_path, sizeof(gateway->socket_path),
+                                  "/tmp/gateway_test-%d.sock", (int)getpid() );
+  snprintf( gateway->client_path, sizeof(gateway->client_path),
+                            "/tmp/gateway_test-%d-client.sock", (int)getpid() );
+
+  argv[argc++] = gateway_path;
+  argv[argc++] = "-s";
+  argv[argc++] = gateway->socket_path;
+
+  while( options && *options )
+  {
+    argv[argc++] = *options++;
+  }
+
+  for( index = 0; index < bridges; index++ )
+  {
+    if( !pty_open( &gateway->ptys[index] ) )
+    {
+      perror( "gateway_test: pty" );
+      return false;
+    }
+    argv[argc++] = gateway->ptys[index].path;
+  }
+  argv[argc] = NULL;
+
+  unlink( gateway->socket_path );
+
+  gateway->pid = fork();
+  if( 0 == gateway->pid )
+  {
+    execv( gateway_path, (char* const*)argv );
+    _exit( 127 );
+  }
+
+  // Wait for the socket to show up
+  deadline = now_ns() + TIMEOUT_MS * 1000000ULL;
+  while( access( gateway->socket_path, F_OK ) && ( now_ns() < deadline ) )
+  {
+    usleep( 1000 );
+  }
+
+  gateway->client = socket( AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0 );
+  memset( &address, 0, sizeof(address) );
+  address.sun_family = AF_UNIX;
+  strncpy( address.sun_path, gateway->client_path,
+                                                sizeof(address.sun_path) - 1 );
+  unlink( gateway->client_path );
+  if( bind( gateway->client, (struct sockaddr*)&address, sizeof(address) ) )
+  {
+    return false;
+  }
+
+  strncpy( address.sun_path, gateway->socket_path,
+                                                sizeof(address.sun_path) - 1 );
+  if( connect( gateway->client, (struct sockaddr*)&address,
+                                                          sizeof(address) ) )
+  {
+    fprintf( stderr, "gateway_test: gateway didn't start\n" );
+    return false;
+  }
+
+  // An empty datagram only subscribes. The gateway could read a frame from
+  // a bridge before it, so wait for one to come up before the tests send
+  // theirs.
+  for( index = 0; index < 3; index++ )
+  {
+    if( send( gateway->client, "", 0, 0 ) )
+    {
+      return false;
+    }
+
+    bridge_write( gateway, 0, sync.data(), sync.size() );
+    if( client_receive( gateway, &datagram ) )
+    {
+      return true;
+    }
+  }
+
+  fprintf( stderr, "gateway_test: no frames from the gateway\n" );
+  return false;
+}
+
+/*******************************************************************************
+ * @fn     void gateway_stop( gateway_t* gateway )
+ * @brief  Stop the gateway and close everything
+ * ****************************************************************************/
+static void gateway_stop( gateway_t* gateway )
+{
+  uint8_t index;
+
+  kill( gateway->pid, SIGTERM );
+  waitpid( gateway->pid, NULL, 0 );
+
+  close( gateway->client );
+  unlink( gateway->client_path );
+  unlink( gateway->socket_path );
+
+  for( index = 0; index < gateway->total_ptys; index++ )
+  {
+    close( gateway->ptys[index].master );
+    close( gateway->ptys[index].slave );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void bridge_write( gateway_t* gateway, uint8_t bridge,
+ *                                      const uint8_t* frame, size_t length )
+ * @brief  Send a frame to the gateway as if bridge had received it
+ * ****************************************************************************/
+static void bridge_write( gateway_t* gateway, uint8_t bridge,
+                                        const uint8_t* frame, size_t length )
+{
+  uint8_t encoded[FRAME_ENCODED_LENGTH(FRAME_MAX_LENGTH)];
+  size_t encoded_length = frame_encode( frame, length, encoded );
+  size_t written = 0;
+  ssize_t result;
+  struct pollfd pollfd;
+
+  pollfd.fd = gateway->ptys[bridge].master;
+  pollfd.events = POLLOUT;
+
+  while( written < encoded_length )
+  {
+    result = write( pollfd.fd, &encoded[written], encoded_length - written );
+    if( result > 0 )
+    {
+      written += result;
+    }
+    else
+    {
+      poll( &pollfd, 1, TIMEOUT_MS );
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     bool client_receive( gateway_t* gateway, frame_t* datagram )
+ * @brief  Wait for a datagram from the gateway
+ * ****************************************************************************/
+static bool client_receive( gateway_t* gateway, frame_t* datagram )
+{
+  uint8_t buffer[FRAME_MAX_LENGTH + 1];
+  struct pollfd pollfd;
+  ssize_t length;
+
+  pollfd.fd = gateway->client;
+  pollfd.events = POLLIN;
+
+  if( poll( &pollfd, 1, TIMEOUT_MS ) <= 0 )
+  {
+    return false;
+  }
+
+  length = recv( gateway->client, buffer, sizeof(buffer), 0 );
+  if( length < 0 )
+  {
+    return false;
+  }
+
+  datagram->assign( buffer, buffer + length );
+
+  return true;
+}
+
+/*******************************************************************************
+ * @fn     void bridges_read( gateway_t* gateway, int timeout )
+ * @brief  Decode whatever the gateway wrote to the dongles, waiting up to
+ *         timeout ms for the first bytes
+ * ****************************************************************************/
+static void bridges_read( gateway_t* gateway, int timeout )
+{
+  struct pollfd pollfds[MAX_BRIDGES];
+  uint8_t buffer[4096];
+  ssize_t length;
+  uint8_t index;
+
+  for( index = 0; index < gateway->total_ptys; index++ )
+  {
+    pollfds[index].fd = gateway->ptys[index].master;
+    pollfds[index].events = POLLIN;
+  }
+
+  if( poll( pollfds, gateway->total_ptys, timeout ) <= 0 )
+  {
+    return;
+  }
+
+  for( index = 0; index < gateway->total_ptys; index++ )
+  {
+    pty_t* pty = &gateway->ptys[index];
+
+    while( ( length = read( pty->master, buffer, sizeof(buffer) ) ) > 0 )
+    {
+      frame_decode( &pty->decoder, buffer, length, pty_frame, pty );
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     int8_t send_and_find( gateway_t* gateway, const frame_t& frame )
+ * @brief  Send frame through the gateway and return the bridge it came out
+ *         of, -1 if none did
+ * ****************************************************************************/
+static int8_t send_and_find( gateway_t* gateway, const frame_t& frame )
+{
+  uint64_t deadline = now_ns() + TIMEOUT_MS * 1000000ULL;
+  uint8_t index;
+
+  for( index = 0; index < gateway->total_ptys; index++ )
+  {
+    gateway->ptys[index].frames.clear();
+  }
+
+  send( gateway->client, frame.data(), frame.size(), 0 );
+
+  while( now_ns() < deadline )
+  {
+    bridges_read( gateway, 10 );
+
+    for( index = 0; index < gateway->total_ptys; index++ )
+    {
+      if( !gateway->ptys[index].frames.empty() )
+      {
+        check( gateway->ptys[index].frames[0] == frame,
+                                          "frame changed on the way down" );
+        return index;
+      }
+    }
+  }
+
+  return -1;
+}
+
+/*******************************************************************************
+ * @fn     void test_round_trip( void )
+ * @brief  Frames go both ways unchanged, special bytes included, and
+ *         addresses are sharded by address % bridges
+ * ****************************************************************************/
+static void test_round_trip( void )
+{
+  gateway_t gateway;
+  frame_t up = { 0x05, 0x7D, 0x7E, 0x7F, 0x00, 0xFF };
+  frame_t datagram;
+  uint16_t address;
+  bool sharded = true;
+
+  if( !gateway_start( &gateway, 2, NULL ) )
+  {
+    check( false, "round trip: start" );
+    return;
+  }
+
+  bridge_write( &gateway, 1, up.data(), up.size() );
+  check( client_receive( &gateway, &datagram ),
+                                          "round trip: nothing came up" );
+  check( ( datagram.size() == up.size() + 1 ) && ( 1 == datagram[0] ) &&
+              std::equal( up.begin(), up.end(), datagram.begin() + 1 ),
+                                          "round trip: wrong frame came up" );
+
+  for( address = 0; address < 8; address++ )
+  {
+    frame_t down = { (uint8_t)address, 0x7E, 0x11, 0x7D };
+
+    if( send_and_find( &gateway, down ) != ( address % 2 ) )
+    {
+      sharded = false;
+    }
+  }
+  check( sharded, "round trip: address % bridges sharding" );
+
+  gateway_stop( &gateway );
+}
+
+/*******************************************************************************
+ * @fn     void test_routes( void )
+ * @brief  -r pins address ranges to a bridge
+ * ****************************************************************************/
+static void test_routes( void )
+{
+  const char* options[] = { "-r", "10-1f:1", "-r", "21:0", NULL };
+  gateway_t gateway;
+
+  if( !gateway_start( &gateway, 2, options ) )
+  {
+    check( false, "routes: start" );
+    return;
+  }
+
+  check( 1 == send_and_find( &gateway, frame_t{ 0x10, 1 } ),
+                                                  "routes: 0x10 to bridge 1" );
+  check( 1 == send_and_find( &gateway, frame_t{ 0x1E, 1 } ),
+                                                  "routes: 0x1E to bridge 1" );
+  check( 0 == send_and_find( &gateway, frame_t{ 0x21, 1 } ),
+                                                  "routes: 0x21 to bridge 0" );
+  check( 0 == send_and_find( &gateway, frame_t{ 0x20, 1 } ),
+                                              "routes: 0x20 default shard" );
+
+  gateway_stop( &gateway );
+}
+
+/*******************************************************************************
+ * @fn     void test_learning( void )
+ * @brief  -l learns routes from every packet type that has a source address
+ * ****************************************************************************/
+static void test_learning( void )
+{
+  const char* options[] = { "-l", NULL };
+  gateway_t gateway;
+  frame_t datagram;
+
+  // [destination][source][type][flags]
+  frame_t doorbell = { 0x00, 0x20, IO_CHANGE, 0x00 };
+
+  // [address][RGB_UNIVERSE][first fixture][r g b], byte 1 isn't a source
+  frame_t universe = { 0x00, RGB_UNIVERSE, 0x02, 0x10, 0x20, 0x30 };
+
+  // [address][RATE_SWITCH][source][RATE_REQUEST][profile], 0x21 would go out
+  // on bridge 1 by default
+  frame_t rate_switch = { 0x00, RATE_SWITCH, 0x21, RATE_REQUEST, 0x01 };
+
+  if( !gateway_start( &gateway, 2, options ) )
+  {
+    check( false, "learning: start" );
+    return;
+  }
+
+  bridge_write( &gateway, 1, doorbell.data(), doorbell.size() );
+  bridge_write( &gateway, 1, universe.data(), universe.size() );
+  bridge_write( &gateway, 0, rate_switch.data(), rate_switch.size() );
+  check( client_receive( &gateway, &datagram ) &&
+                                      client_receive( &gateway, &datagram ) &&
+                                      client_receive( &gateway, &datagram ),
+                                          "learning: frames didn't come up" );
+
+  check( 1 == send_and_find( &gateway, frame_t{ 0x20, 1 } ),
+                                "learning: doorbell source not learned" );
+  check( 0 == send_and_find( &gateway, frame_t{ RGB_UNIVERSE, 1 } ),
+                                "learning: learned from an RGB_UNIVERSE" );
+  check( 0 == send_and_find( &gateway, frame_t{ 0x21, 1 } ),
+                                "learning: RATE_SWITCH source not learned" );
+
+  gateway_stop( &gateway );
+}
+
+/*******************************************************************************
+ * @fn     void bench_up( uint8_t bridges )
+ * @brief  Dongles to client throughput, all bridges writing at once
+ * ****************************************************************************/
+static void bench_up( uint8_t bridges )
+{
+  gateway_t gateway;
+  uint8_t frame[BENCH_FRAME_LENGTH];
+  uint8_t encoded[FRAME_ENCODED_LENGTH(BENCH_FRAME_LENGTH)];
+  uint8_t buffer[FRAME_MAX_LENGTH + 1];
+  std::vector<uint8_t> stream;
+  size_t offsets[MAX_BRIDGES] = { 0 };
+  size_t encoded_length;
+  struct pollfd pollfds[MAX_BRIDGES + 1];
+  uint32_t received = 0;
+  uint32_t index;
+  uint64_t start;
+  uint64_t elapsed;
+  bool writing = true;
+  int socket_buffer = 4 << 20;
+
+  if( !gateway_start( &gateway, bridges, NULL ) )
+  {
+    check( false, "bench: start" );
+    return;
+  }
+
+  setsockopt( gateway.client, SOL_SOCKET, SO_RCVBUF, &socket_buffer,
+                                                      sizeof(socket_buffer) );
+
+  // Every bridge sends the same stream, BENCH_FRAMES / bridges frames each
+  for( index = 0; index < BENCH_FRAMES / bridges; index++ )
+  {
+    memset( frame, index, sizeof(frame) );
+    frame[0] = index;
+    encoded_length = frame_encode( frame, sizeof(frame), encoded );
+    stream.insert( stream.end(), encoded, encoded + encoded_length );
+  }
+
+  for( index = 0; index < bridges; index++ )
+  {
+    pollfds[index].fd = gateway.ptys[index].master;
+    pollfds[index].events = POLLOUT;
+  }
+  pollfds[bridges].fd = gateway.client;
+  pollfds[bridges].events = POLLIN;
+
+  start = now_ns();
+
+  for(;;)
+  {
+    if( poll( pollfds, bridges + 1, writing ? TIMEOUT_MS : 200 ) <= 0 )
+    {
+      break;
+    }
+
+    writing = false;
+    for( index = 0; index < bridges; index++ )
+    {
+      if( offsets[index] < stream.size() )
+      {
+        ssize_t written = write( pollfds[index].fd, &stream[offsets[index]],
+                                            stream.size() - offsets[index] );
+        if( written > 0 )
+        {
+          offsets[index] += written;
+        }
+        writing = true;
+      }
+      else
+      {
+        pollfds[index].events = 0;
+      }
+    }
+
+    while( recv( gateway.client, buffer, sizeof(buffer), MSG_DONTWAIT ) > 0 )
+    {
+      received++;
+    }
+  }
+
+  // The last 200ms waiting for stragglers don't count
+  elapsed = now_ns() - start - ( writing ? 0 : 200000000ULL );
+
+  printf( "up   %u bridges: %u/%u frames, %.0f frames/s, %.2f MB/s payload\n",
+          bridges, received, ( BENCH_FRAMES / bridges ) * bridges,
+          received * 1e9 / elapsed,
+          received * (double)BENCH_FRAME_LENGTH * 1e3 / elapsed );
+
+  gateway_stop( &gateway );
+}
+
+/*******************************************************************************
+ * @fn     void bench_down( uint8_t bridges )
+ * @brief  Client to dongles throughput, sharded across every bridge
+ * ****************************************************************************/
+static void bench_down( uint8_t bridges )
+{
+  gateway_t gateway;
+  uint8_t frame[BENCH_FRAME_LENGTH];
+  uint32_t sent;
+  uint32_t received = 0;
+  uint32_t last = 0;
+  uint64_t start;
+  uint64_t elapsed;
+  uint8_t index;
+
+  if( !gateway_start( &gateway, bridges, NULL ) )
+  {
+    check( false, "bench: start" );
+    return;
+  }
+
+  start = now_ns();
+
+  for( sent = 0; sent < BENCH_FRAMES; sent++ )
+  {
+    memset( frame, sent, sizeof(frame) );
+    frame[0] = sent;
+
+    // Unix datagrams block when the gateway falls behind, so drain the
+    // dongles in between
+    while( send( gateway.client, frame, sizeof(frame), MSG_DONTWAIT ) < 0 )
+    {
+      bridges_read( &gateway, 1 );
+    }
+
+    if( 0 == ( sent % 64 ) )
+    {
+      bridges_read( &gateway, 0 );
+    }
+  }
+
+  do
+  {
+    last = received;
+    bridges_read( &gateway, 200 );
+
+    received = 0;
+    for( index = 0; index < bridges; index++ )
+    {
+      received += gateway.ptys[index].frames.size();
+    }
+  } while( received != last );
+
+  elapsed = now_ns() - start;
+
+  printf( "down %u bridges: %u/%u frames, %.0f frames/s, %.2f MB/s payload\n",
+          bridges, received, BENCH_FRAMES, received * 1e9 / elapsed,
+          received * (double)BENCH_FRAME_LENGTH * 1e3 / elapsed );
+
+  gateway_stop( &gateway );
+}
+
+int main( int argc, char** argv )
+{
+  bool bench = false;
+  int option;
+
+  while( ( option = getopt( argc, argv, "b" ) ) != -1 )
+  {
+    switch( option )
+    {
+      case 'b': bench = true; break;
+      default:
+        fprintf( stderr, "usage: %s [-b] gateway\n", argv[0] );
+        return 1;
+    }
+  }
+
+  if( optind >= argc )
+  {
+    fprintf( stderr, "usage: %s [-b] gateway\n", argv[0] );
+    return 1;
+  }
+
+  gateway_path = argv[optind];
+  signal( SIGPIPE, SIG_IGN );
+
+  if( bench )
+  {
+    bench_up( 1 );
+    bench_up( MAX_BRIDGES );
+    bench_down( 1 );
+    bench_down( MAX_BRIDGES );
+  }
+  else
+  {
+    test_round_trip();
+    test_routes();
+    test_learning();
+
+    printf( "gateway_test: %s\n", failures ? "FAILED" : "passed" );
+  }
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,592 @@
+/** @file group_sim.c
+*
+* @brief What dropping packets for other multicast groups costs the radio ISR,
+*        and a node in a group on a busy channel, against filtering in the
+*        rx callback
+*
+* lib/cc2500/cc2500.c runs against the radio model in test/msp430/radio.c
+* on the MSP430 model, built with CC2500_GROUPS.
+*
+* The first part compares ways of getting rid of a packet the ISR doesn't
+* want, once the radio has let it into the RX FIFO. Each one is run from the
+* port ISR on a single packet, through the SPI model, for a few lengths:
+*
+*   drain       read the rest of the packet out, the radio stays in RX
+*   flush       SIDLE, wait for IDLE, SFRX, SRX, with FS_AUTOCAL
+*   flush, no autocal   the same with FS_AUTOCAL off around the SRX
+*   driver      the driver's own ISR, in group 0x80
+*
+* It reports the CPU cycles spent in the ISR and how long the radio couldn't
+* hear anything. Draining costs more SPI time the longer the packet, a flush
+* costs the same for any length but leaves the radio deaf until it's back in
+* RX, which with calibration is longer than any packet at 250kbps. The driver
+* flushes without autocal. It has to beat draining anything but short
+* packets, be deaf no longer than that flush and never calibrate.
+*
+* The second part sends random traffic to the node's address, broadcast,
+* group 0x80, group 0xFF and other addresses, with the node in no group, in
+* group 0x80 (the radio accepts everything and the ISR filters), in group
+* 0xFF (the radio filters by itself), and with address checking off and the
+* rx callback dropping what isn't for the node or group 0x80, which is how
+* it was done before the driver knew about groups. It checks that nothing
+* the node didn't ask for is delivered, that the radio never calibrates for
+* a dropped packet, that the hardware group costs less ISR time than a
+* software one and a software one less than the callback, and that every
+* wanted packet the radio received is delivered. A software group misses
+* more packets on the air than the others, since the radio receives every
+* frame to the end, more of them overlap and every flush leaves it deaf for
+* a moment.
+*
+* usage: group_sim [-v]
+*   -v  Print the numbers for every method and setup
+*
+* @author Alvaro Prieto
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "cc2500.h"
+#include "device.h"
+#include "spi.h"
+#include "radio.h"
+
+#define CPU_HZ (16000000.0)
+
+// Frames start once the node is set up
+#define START_CYCLES (16000)
+
+// MCSM0 as writeRFSettings() sets it, and without FS_AUTOCAL
+#define MCSM0_AUTOCAL (0x18)
+#define MCSM0_NO_AUTOCAL (0x08)
+
+#define MARCSTATE_IDLE (0x01)
+
+#define SOFTWARE_GROUP (0x80)
+#define HARDWARE_GROUP (0xFF)
+
+#define PACKETS_PER_SECOND (150.0)
+#define SECONDS (20)
+
+typedef enum
+{
+  DROP_DRAIN,
+  DROP_FLUSH,
+  DROP_FLUSH_NO_AUTOCAL,
+  DROP_DRIVER,
+  DROP_METHODS
+} drop_t;
+
+typedef struct
+{
+  const char* what;
+  uint8_t group;            // 0 for none
+  uint8_t callback;         // Address checking off, rx_callback() filters
+} setup_t;
+
+typedef struct
+{
+  uint32_t interrupts;
+  uint32_t wanted;          // Delivered, for this node
+  uint32_t expected;        // Sent to this node
+  uint32_t heard;           // Sent to this node and received by the radio
+  uint32_t unwanted;        // Delivered, for somebody else
+  uint32_t filtered;        // Dropped by rx_callback()
+  uint32_t missed;
+  uint32_t calibrations;    // After setup
+  double isr_ms;
+} result_t;
+
+static const char* drop_names[DROP_METHODS] =
+{
+  "drain", "flush", "flush, no autocal", "driver"
+};
+
+void port2_isr( void );
+
+static uint32_t failures;
+
+// First part
+static drop_t drop_method;
+static uint8_t drop_length;
+static uint8_t drop_sent;
+static uint64_t drop_isr_cycles;
+
+// Second part
+static uint8_t node_group;
+static uint8_t callback_filter;
+static uint64_t next_at;
+static uint64_t heard_at;
+static result_t result;
+
+/*******************************************************************************
+ * @fn     uint32_t random_next( void )
+ * @brief  xorshift32, so every setup sees the same traffic
+ * ****************************************************************************/
+static uint32_t random_state = 2463534242u;
+
+static uint32_t random_next( void )
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+
+  return random_state;
+}
+
+/*******************************************************************************
+ * @fn     double uniform( void )
+ * @brief  Random number in (0, 1)
+ * ****************************************************************************/
+static double uniform( void )
+{
+  return ( random_next() + 0.5 ) / 4294967296.0;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t wanted( uint8_t address )
+ * @brief  Whether the node asked for packets sent to address
+ * ****************************************************************************/
+static uint8_t wanted( uint8_t address )
+{
+  return ( DEVICE_ADDRESS == address ) || ( BROADCAST_ADDRESS == address ) ||
+          ( node_group && ( node_group == address ) );
+}
+
+/*******************************************************************************
+ * @fn     uint8_t rx_callback( uint8_t* buffer, uint8_t length )
+ * @brief  [address][payload...], sort by whether this node asked for it. With
+ *         callback_filter, drop what it didn't like the driver would.
+ * ****************************************************************************/
+static uint8_t rx_callback( uint8_t* buffer, uint8_t length )
+{
+  if( callback_filter && !wanted( buffer[0] ) )
+  {
+    result.filtered++;
+  }
+  else if( wanted( buffer[0] ) )
+  {
+    result.wanted++;
+  }
+  else
+  {
+    result.unwanted++;
+  }
+
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     void start( uint8_t (*frames)( radio_frame_t* ), uint8_t group,
+ *                                                        uint8_t callback )
+ * @brief  Fresh MCU and radio, with the driver set up and in group (if any).
+ *         With callback, the node joins nothing and takes every address,
+ *         and rx_callback() filters for group.
+ * ****************************************************************************/
+static void start( uint8_t (*frames)( radio_frame_t* ), uint8_t group,
+                                                            uint8_t callback )
+{
+  sim_reset();
+  sim_port2_isr = port2_isr;
+
+  next_at = START_CYCLES;
+  radio_air = frames;
+  radio_reset();
+
+  setup_cc2500( rx_callback );
+
+  // The driver's statics outlive sim_reset(), unlike the MCU's RAM
+  cc2500_leave_group( SOFTWARE_GROUP );
+  cc2500_leave_group( HARDWARE_GROUP );
+  cc2500_enable_addressing();
+
+  node_group = group;
+  callback_filter = callback;
+  if( callback )
+  {
+    cc2500_disable_addressing();
+  }
+  else if( group && !cc2500_join_group( group ) )
+  {
+    fprintf( stderr, "FAIL: couldn't join group 0x%02X\n", group );
+    failures++;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void run_until( uint64_t cycles )
+ * @brief  Sleep in LPM3, taking interrupts, until sim_cycles reaches cycles
+ * ****************************************************************************/
+static void run_until( uint64_t cycles )
+{
+  sim_stop_cycles = cycles;
+  if( 0 == setjmp( sim_stop ) )
+  {
+    for( ;; )
+    {
+      __bis_SR_register( LPM3_bits + GIE );
+    }
+  }
+
+  radio_finish();
+}
+
+/*******************************************************************************
+ * @fn     uint8_t drop_air( radio_frame_t* frame )
+ * @brief  One packet of drop_length bytes for an address nobody has
+ * ****************************************************************************/
+static uint8_t drop_air( radio_frame_t* frame )
+{
+  if( drop_sent )
+  {
+    return 0;
+  }
+
+  drop_sent = 1;
+
+  memset( frame, 0, sizeof(*frame) );
+  frame->sync_at = START_CYCLES * 4;
+  frame->sync = ( radio_register( TI_CCxxx0_SYNC1 ) << 8 ) |
+                                        radio_register( TI_CCxxx0_SYNC0 );
+  frame->crc_ok = 1;
+  frame->rssi = -60;
+  frame->length = 1 + drop_length;
+  frame->data[0] = drop_length;
+  frame->data[1] = 0x42;
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     void drop_isr( void )
+ * @brief  Get rid of the packet in the RX FIFO with drop_method
+ * ****************************************************************************/
+static void drop_isr( void )
+{
+  uint8_t buffer[CC2500_BUFFER_LENGTH];
+  uint64_t started = sim_cycles;
+  uint8_t length;
+
+  if( !( GDO0_PxIFG & GDO0_PIN ) )
+  {
+    return;
+  }
+
+  // The radio is in RX up to here, only count what the drop costs
+  radio_deaf_cycles = 0;
+
+  if( DROP_DRIVER == drop_method )
+  {
+    port2_isr();
+  }
+  else if( cc_read_status( TI_CCxxx0_RXBYTES ) & TI_CCxxx0_NUM_RXBYTES )
+  {
+    length = cc_read_reg( TI_CCxxx0_RXFIFO );
+
+    switch( drop_method )
+    {
+      case DROP_DRAIN:
+        cc_read_burst_reg( TI_CCxxx0_RXFIFO, buffer, length );
+        cc_read_burst_reg( TI_CCxxx0_RXFIFO, buffer, 2 );
+        break;
+
+      case DROP_FLUSH:
+      case DROP_FLUSH_NO_AUTOCAL:
+        // The address, to decide it isn't wanted
+        buffer[0] = cc_read_reg( TI_CCxxx0_RXFIFO );
+
+        cc_strobe( TI_CCxxx0_SIDLE );
+        while( ( cc_read_status( TI_CCxxx0_MARCSTATE ) & 0x1F ) !=
+                                                            MARCSTATE_IDLE );
+        cc_strobe( TI_CCxxx0_SFRX );
+
+        if( DROP_FLUSH_NO_AUTOCAL == drop_method )
+        {
+          cc_write_reg( TI_CCxxx0_MCSM0, MCSM0_NO_AUTOCAL );
+          cc_strobe( TI_CCxxx0_SRX );
+          cc_write_reg( TI_CCxxx0_MCSM0, MCSM0_AUTOCAL );
+        }
+        else
+        {
+          cc_strobe( TI_CCxxx0_SRX );
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  GDO0_PxIFG &= ~GDO0_PIN;
+
+  drop_isr_cycles = sim_cycles - started;
+}
+
+/*******************************************************************************
+ * @fn     void test_drops( int verbose )
+ * @brief  ISR cycles and deaf time of every way of dropping a packet
+ * ****************************************************************************/
+static void test_drops( int verbose )
+{
+  static const uint8_t lengths[] = { 4, 16, 32, CC2500_MAX_PACKET_LENGTH };
+  uint64_t isr[DROP_METHODS];
+  uint64_t deaf[DROP_METHODS];
+  uint8_t length;
+  uint8_t method;
+
+  if( verbose )
+  {
+    printf( "%-18s %6s %11s %8s %8s\n", "drop", "bytes", "ISR cycles",
+                                                      "ISR us", "deaf us" );
+  }
+
+  for( length = 0; length < sizeof(lengths); length++ )
+  {
+    for( method = 0; method < DROP_METHODS; method++ )
+    {
+      drop_method = method;
+      drop_length = lengths[length];
+      drop_sent = 0;
+      drop_isr_cycles = 0;
+
+      start( drop_air, SOFTWARE_GROUP, 0 );
+      sim_port2_isr = drop_isr;
+
+      // Well past the packet and any recalibration
+      run_until( START_CYCLES * 4 + ( drop_length + 3 ) * radio_byte_cycles +
+                                                  2 * radio_cal_cycles );
+
+      isr[method] = drop_isr_cycles;
+      deaf[method] = radio_deaf_cycles;
+
+      if( 1 != radio_packets )
+      {
+        fprintf( stderr, "FAIL: %s, %u bytes: packet never reached the FIFO\n",
+                                  drop_names[method], drop_length );
+        failures++;
+      }
+
+      if( ( DROP_DRIVER == method ) && result.unwanted )
+      {
+        fprintf( stderr, "FAIL: driver, %u bytes: packet for 0x42 delivered\n",
+                                                              drop_length );
+        failures++;
+      }
+
+      if( verbose )
+      {
+        printf( "%-18s %6u %11llu %8.1f %8.1f\n", drop_names[method],
+                drop_length, (unsigned long long)isr[method],
+                isr[method] * 1e6 / CPU_HZ, deaf[method] * 1e6 / CPU_HZ );
+      }
+    }
+
+    // Draining never takes the radio out of RX, and skipping the
+    // calibration shortens a flush
+    if( deaf[DROP_DRAIN] )
+    {
+      fprintf( stderr, "FAIL: %u bytes: radio deaf for %llu cycles on a "
+                "drain\n", lengths[length],
+                                  (unsigned long long)deaf[DROP_DRAIN] );
+      failures++;
+    }
+
+    if( deaf[DROP_FLUSH_NO_AUTOCAL] >= deaf[DROP_FLUSH] )
+    {
+      fprintf( stderr, "FAIL: %u bytes: flush without autocal deaf for as "
+                                "long as with it\n", lengths[length] );
+      failures++;
+    }
+
+    // The driver reads the address and MCSM0 and flushes without
+    // calibrating, which beats reading out anything but a short packet
+    if( ( ( lengths[length] >= 16 ) && ( isr[DROP_DRIVER] >= isr[DROP_DRAIN] ) )
+        || ( deaf[DROP_DRIVER] > deaf[DROP_FLUSH_NO_AUTOCAL] ) )
+    {
+      fprintf( stderr, "FAIL: %u bytes: driver drop takes %llu ISR cycles, "
+                "deaf for %llu\n", lengths[length],
+                (unsigned long long)isr[DROP_DRIVER],
+                (unsigned long long)deaf[DROP_DRIVER] );
+      failures++;
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t air( radio_frame_t* frame )
+ * @brief  The next frame on the channel
+ * ****************************************************************************/
+static uint8_t air( radio_frame_t* frame )
+{
+  static const uint8_t addresses[] =
+  {
+    DEVICE_ADDRESS, BROADCAST_ADDRESS, SOFTWARE_GROUP, HARDWARE_GROUP,
+    0x02, 0x03, 0x04, 0x05, 0x81, 0x82
+  };
+  uint8_t length = 4 + random_next() % 37;
+  uint8_t address = addresses[random_next() % sizeof(addresses)];
+  uint8_t index;
+
+  // Poisson arrivals
+  next_at += (uint64_t)( -log( uniform() ) * CPU_HZ / PACKETS_PER_SECOND );
+
+  memset( frame, 0, sizeof(*frame) );
+  frame->sync_at = next_at;
+  frame->sync = ( radio_register( TI_CCxxx0_SYNC1 ) << 8 ) |
+                                        radio_register( TI_CCxxx0_SYNC0 );
+  frame->crc_ok = 1;
+  frame->rssi = -50 - (int8_t)( random_next() % 40 );
+  frame->length = 1 + length;
+  frame->data[0] = length;
+  frame->data[1] = address;
+
+  for( index = 2; index <= length; index++ )
+  {
+    frame->data[index] = random_next();
+  }
+
+  if( wanted( address ) )
+  {
+    result.expected++;
+  }
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     void gdo0_isr( void )
+ * @brief  The driver's port ISR, counting the wanted packets the radio got
+ *         all of, which the driver has to deliver
+ * ****************************************************************************/
+static void gdo0_isr( void )
+{
+  const radio_frame_t* frame = radio_last_frame();
+
+  if( ( GDO0_PxIFG & GDO0_PIN ) && ( frame->sync_at != heard_at ) &&
+      wanted( frame->data[1] ) )
+  {
+    heard_at = frame->sync_at;
+    result.heard++;
+  }
+
+  port2_isr();
+}
+
+/*******************************************************************************
+ * @fn     void run( const setup_t* setup )
+ * @brief  SECONDS of traffic on the node, into result
+ * ****************************************************************************/
+static void run( const setup_t* setup )
+{
+  uint32_t calibrations;
+
+  memset( &result, 0, sizeof(result) );
+  random_state = 2463534242u;
+  node_group = setup->group;
+  start( air, setup->group, setup->callback );
+  sim_port2_isr = gdo0_isr;
+  heard_at = 0;
+
+  // Only count what the traffic costs
+  calibrations = radio_calibrations;
+  sim_isr_busy = 0;
+
+  run_until( SECONDS * CPU_HZ );
+
+  result.interrupts = sim_isr_count[2];
+  result.missed = radio_missed;
+  result.calibrations = radio_calibrations - calibrations;
+  result.isr_ms = sim_isr_busy * 1000.0 / CPU_HZ;
+}
+
+/*******************************************************************************
+ * @fn     void test_traffic( int verbose )
+ * @brief  The driver on a busy channel, in no group, a software group, the
+ *         hardware group, and taking everything with the callback filtering
+ * ****************************************************************************/
+static void test_traffic( int verbose )
+{
+  static const setup_t setups[] =
+  {
+    { "no group",       0,              0 },
+    { "group 0x80",     SOFTWARE_GROUP, 0 },
+    { "group 0xFF",     HARDWARE_GROUP, 0 },
+    { "callback",       SOFTWARE_GROUP, 1 },
+  };
+  result_t results[sizeof(setups) / sizeof(setups[0])];
+  uint32_t index;
+
+  if( verbose )
+  {
+    printf( "%.0f packets/s, %d s\n", PACKETS_PER_SECOND, SECONDS );
+    printf( "%-12s %10s %11s %6s %9s %9s %7s %12s %8s %10s\n", "",
+            "interrupts", "wanted", "heard", "unwanted", "filtered",
+                    "missed", "calibrations", "ISR ms", "ISR us/pkt" );
+  }
+
+  for( index = 0; index < sizeof(setups) / sizeof(setups[0]); index++ )
+  {
+    run( &setups[index] );
+    results[index] = result;
+
+    if( verbose )
+    {
+      printf( "%-12s %10u %5u/%-5u %6u %9u %9u %7u %12u %8.1f %10.1f\n",
+              setups[index].what, result.interrupts, result.wanted,
+              result.expected, result.heard, result.unwanted, result.filtered,
+              result.missed, result.calibrations, result.isr_ms,
+              result.isr_ms * 1000.0 / result.interrupts );
+    }
+
+    if( result.unwanted )
+    {
+      fprintf( stderr, "FAIL: %s: %u packets for other addresses delivered\n",
+                                      setups[index].what, result.unwanted );
+      failures++;
+    }
+
+    if( result.calibrations )
+    {
+      fprintf( stderr, "FAIL: %s: %u calibrations while receiving\n",
+                                    setups[index].what, result.calibrations );
+      failures++;
+    }
+
+    // Frames lost on the air (two at once) don't count, the driver has to
+    // deliver what the radio got
+    if( result.wanted < result.heard )
+    {
+      fprintf( stderr, "FAIL: %s: %u of %u wanted packets received "
+                        "delivered\n", setups[index].what, result.wanted,
+                                                              result.heard );
+      failures++;
+    }
+  }
+
+  if( results[2].isr_ms >= results[1].isr_ms )
+  {
+    fprintf( stderr, "FAIL: %.1f ms in the ISR in group 0xFF, %.1f in 0x80\n",
+                                      results[2].isr_ms, results[1].isr_ms );
+    failures++;
+  }
+
+  if( results[1].isr_ms >= results[3].isr_ms )
+  {
+    fprintf( stderr, "FAIL: %.1f ms in the ISR in group 0x80, %.1f filtering "
+                  "in the callback\n", results[1].isr_ms, results[3].isr_ms );
+    failures++;
+  }
+}
+
+int main( int argc, char** argv )
+{
+  int verbose = ( argc > 1 ) && !strcmp( argv[1], "-v" );
+
+  test_drops( verbose );
+  test_traffic( verbose );
+
+  printf( "group_sim: %s\n", failures ? "FAILED" : "passed" );
+
+  return failures ? 1 : 0;
+}
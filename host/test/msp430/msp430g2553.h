@@ -0,0 +1,132 @@
+/** @file msp430g2553.h
+*
+* @brief Host stand-in for the msp430g2553 header, so lib/ drivers build and
+*        run natively against the model in sim.c
+*
+* Ports and Timer0_A registers are plain variables. Reading TA0R or TA0IV
+* goes through the model, so busy waits on the timer make progress and
+* reading the vector clears the flag like the hardware does. Entering a low
+* power mode runs the model until an ISR clears the bits on exit.
+*
+* @author Alvaro Prieto
+*/
+#ifndef _MSP430_SIM_H
+#define _MSP430_SIM_H
+
+#include <stdint.h>
+#include <setjmp.h>
+
+#define __interrupt
+#define __no_operation() ((void)0)
+#define __delay_cycles( cycles ) sim_run( cycles )
+#define __even_in_range( value, range ) ( value )
+
+#define __get_SR_register() ( sim_sr )
+#define __enable_interrupt() ( sim_sr |= GIE )
+#define __disable_interrupt() ( sim_sr &= ~GIE )
+#define __bis_SR_register( bits ) sim_bis_sr( bits )
+#define __bic_SR_register( bits ) ( sim_sr &= ~( bits ) )
+#define __bis_SR_register_on_exit( bits ) ( sim_sr_on_exit |= ( bits ) )
+#define __bic_SR_register_on_exit( bits ) ( sim_sr_on_exit &= ~( bits ) )
+
+#define BIT0 (0x01)
+#define BIT1 (0x02)
+#define BIT2 (0x04)
+#define BIT3 (0x08)
+#define BIT4 (0x10)
+#define BIT5 (0x20)
+#define BIT6 (0x40)
+#define BIT7 (0x80)
+
+// Status register
+#define GIE    (0x0008)
+#define CPUOFF (0x0010)
+#define OSCOFF (0x0020)
+#define SCG0   (0x0040)
+#define SCG1   (0x0080)
+#define LPM0_bits (CPUOFF)
+#define LPM1_bits (SCG0 + CPUOFF)
+#define LPM2_bits (SCG1 + CPUOFF)
+#define LPM3_bits (SCG1 + SCG0 + CPUOFF)
+#define LPM4_bits (SCG1 + SCG0 + OSCOFF + CPUOFF)
+
+// Ports
+extern volatile uint8_t P1IN, P1OUT, P1DIR, P1IFG, P1IES, P1IE, P1SEL, P1SEL2,
+                                                                        P1REN;
+extern volatile uint8_t P2IN, P2OUT, P2DIR, P2IFG, P2IES, P2IE, P2SEL, P2SEL2,
+                                                                        P2REN;
+
+// Timer0_A
+extern volatile uint16_t TA0CTL, TA0CCTL0, TA0CCTL1, TA0CCTL2;
+extern volatile uint16_t TA0CCR0, TA0CCR1, TA0CCR2;
+#define TA0R  sim_timer_read()
+#define TA0IV sim_timer_iv()
+
+#define TACTL   TA0CTL
+#define TAR     TA0R
+#define TAIV    TA0IV
+#define TACCTL0 TA0CCTL0
+#define TACCTL1 TA0CCTL1
+#define TACCTL2 TA0CCTL2
+#define TACCR0  TA0CCR0
+#define TACCR1  TA0CCR1
+#define TACCR2  TA0CCR2
+
+#define TASSEL_1 (0x0100)     // ACLK
+#define TASSEL_2 (0x0200)     // SMCLK
+#define ID_3     (0x00C0)
+#define MC_0     (0x0000)
+#define MC_1     (0x0010)     // Up to CCR0
+#define MC_2     (0x0020)     // Continuous
+#define MC_MASK  (0x0030)
+#define TACLR    (0x0004)
+#define TAIE     (0x0002)
+#define TAIFG    (0x0001)
+
+#define CM_0   (0x0000)
+#define CM_1   (0x4000)
+#define CCIS_1 (0x1000)
+#define SCS    (0x0800)
+#define CAP    (0x0100)
+#define CCIE   (0x0010)
+#define COV    (0x0002)
+#define CCIFG  (0x0001)
+
+#define TA0IV_TACCR1 (0x0002)
+#define TA0IV_TACCR2 (0x0004)
+#define TA0IV_TAIFG  (0x000A)
+#define TAIV_TACCR1  TA0IV_TACCR1
+#define TAIV_TACCR2  TA0IV_TACCR2
+#define TAIV_TAIFG   TA0IV_TAIFG
+
+#define TIMER0_A0_VECTOR (9)
+#define TIMER0_A1_VECTOR (8)
+#define PORT2_VECTOR     (3)
+
+// Model state, see sim.c
+extern uint16_t sim_sr;
+extern uint16_t sim_sr_on_exit;
+extern uint64_t sim_cycles;
+extern uint64_t sim_sleep_cycles;
+extern uint64_t sim_isr_busy;
+extern uint64_t sim_stop_cycles;
+extern jmp_buf sim_stop;
+extern uint16_t sim_cycles_per_tick;
+extern uint8_t sim_read_cycles;
+extern uint8_t sim_isr_entry;
+extern uint8_t sim_isr_exit;
+extern uint32_t sim_isr_count[3];
+extern uint32_t sim_wakeups;
+extern void (*sim_timer_isr[2])( void );
+extern void (*sim_port2_isr)( void );
+extern void (*sim_cycle_hook)( void );
+extern void (*sim_event)( void );
+extern uint64_t sim_event_at;
+
+void sim_reset( void );
+void sim_run( uint32_t );
+void sim_bis_sr( uint16_t );
+uint16_t sim_timer_read( void );
+uint16_t sim_timer_iv( void );
+
+#endif /* _MSP430_SIM_H */
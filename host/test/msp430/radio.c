@@ -0,0 +1,715 @@
+/** @file radio.c
+*
+* @brief Host model of a CC2500 behind lib/spi.h, so lib/cc2500/cc2500.c runs
+*        natively against frames a test puts on the air
+*
+* Implements the lib/spi.h functions against a register file, the FIFOs and
+* the main radio state machine. Every access costs radio_spi_overhead plus
+* radio_spi_byte_cycles per byte through sim_run(), so time spent talking to
+* the radio shows up in the MSP430 model (a USCI at SMCLK/16 is 128 cycles a
+* byte). SRX from IDLE takes radio_cal_cycles with MCSM0.FS_AUTOCAL set to
+* calibrate on the way, radio_settle_cycles without, and the radio can't
+* hear anything until it's done. A calibration overwrites FSCAL3-1 with
+* results that depend on the channel, like the radio does.
+*
+* Frames come from radio_air() and are looked at when their sync word ends:
+* if the radio has been in RX for the whole sync word and it matches SYNC1
+* and SYNC0 (30 of 32 bits, or 15/16 and 16/16 by MDMCFG2.SYNC_MODE), GDO0
+* goes high. The address check (PKTCTRL1.ADR_CHK) and the length check
+* (PKTLEN) end the packet after the address byte, a good one ends after its
+* CRC. Either way GDO0 goes low, which is the edge cc2500.c interrupts on,
+* and the packet is only in the RX FIFO (with the appended status bytes) if
+* it passed the checks and the CRC (or CRC_AUTOFLUSH is off). A frame that
+* starts while another one is being received is lost.
+*
+* Built with CC2500_SHADOW, register writes also go to cc_shadow, like the
+* SPI drivers in lib/spi/ do.
+*
+* Only IOCFG0 = 0x06 drives GDO0. TX sends whatever is in the TX FIFO and
+* takes its airtime, but GDO0 doesn't follow it, so the driver's waits for
+* the sync word in transmit() time out without time passing.
+*
+* @author Alvaro Prieto
+*/
+#include <string.h>
+#include "device.h"
+#include "spi.h"
+#include "radio.h"
+
+// Main radio state machine, MARCSTATE values
+#define STATE_SLEEP     (0x00)
+#define STATE_IDLE      (0x01)
+#define STATE_CAL       (0x08)
+#define STATE_SETTLE    (0x0A)
+#define STATE_RX        (0x0D)
+#define STATE_OVERFLOW  (0x11)
+#define STATE_TX        (0x13)
+
+#define FIFO_SIZE (64)
+
+// Preamble and sync word, on the air before the length byte
+#define HEADER_BYTES (8)
+#define SYNC_BYTES (4)
+
+uint8_t (*radio_air)( radio_frame_t* );
+
+#ifdef CC2500_SHADOW
+uint8_t cc_shadow[TI_CCxxx0_CONFIG_REGISTERS];
+#endif
+
+uint32_t radio_byte_cycles;
+uint16_t radio_spi_byte_cycles;
+uint16_t radio_spi_overhead;
+uint32_t radio_cal_cycles;
+uint32_t radio_settle_cycles;
+
+uint32_t radio_spi_accesses;
+uint32_t radio_spi_bytes;
+uint32_t radio_syncs;
+uint32_t radio_packets;
+uint32_t radio_missed;
+uint32_t radio_calibrations;
+uint64_t radio_deaf_cycles;
+
+static uint8_t registers[TI_CCxxx0_CONFIG_REGISTERS];
+static uint8_t state;
+static uint8_t next_state;      // After CAL, SETTLE or TX
+static uint64_t state_since;
+static uint64_t ready_at;       // When CAL, SETTLE or TX ends
+static uint8_t counting;        // Deaf time counts from the first SRX
+
+static uint8_t rx_fifo[FIFO_SIZE];
+static uint8_t rx_first;
+static uint8_t rx_count;
+static uint8_t tx_count;
+
+static radio_frame_t next_frame;
+static uint8_t have_next;
+static radio_frame_t frame;     // Being received
+static uint8_t receiving;
+static uint8_t accepted;
+static uint64_t frame_end_at;
+
+static void radio_event( void );
+
+/*******************************************************************************
+ * @fn     void set_state( uint8_t new_state, uint64_t at )
+ * @brief  Change state at a time, counting the time spent out of RX
+ * ****************************************************************************/
+static void set_state( uint8_t new_state, uint64_t at )
+{
+  if( counting && ( STATE_RX != state ) )
+  {
+    radio_deaf_cycles += at - state_since;
+  }
+
+  state = new_state;
+  state_since = at;
+}
+
+/*******************************************************************************
+ * @fn     void update( void )
+ * @brief  Finish a calibration, settling or transmission that's run its time
+ * ****************************************************************************/
+static void update( void )
+{
+  if( ( ( STATE_CAL == state ) || ( STATE_SETTLE == state ) ||
+        ( STATE_TX == state ) ) && ( sim_cycles >= ready_at ) )
+  {
+    set_state( next_state, ready_at );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void gdo0( uint8_t level )
+ * @brief  Drive GDO0, setting the port flag on the edge the port waits for
+ * ****************************************************************************/
+static void gdo0( uint8_t level )
+{
+  if( 0x06 != registers[TI_CCxxx0_IOCFG0] )
+  {
+    return;
+  }
+
+  if( level && !( GDO0_PxIN & GDO0_PIN ) )
+  {
+    GDO0_PxIN |= GDO0_PIN;
+    if( !( GDO0_PxIES & GDO0_PIN ) )
+    {
+      GDO0_PxIFG |= GDO0_PIN;
+    }
+  }
+  else if( !level && ( GDO0_PxIN & GDO0_PIN ) )
+  {
+    GDO0_PxIN &= ~GDO0_PIN;
+    if( GDO0_PxIES & GDO0_PIN )
+    {
+      GDO0_PxIFG |= GDO0_PIN;
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void calibrate( uint8_t then )
+ * @brief  Start a synthesizer calibration, going to state then when it's done.
+ *         The results aren't the real ones, but they change with the channel
+ *         and overwrite whatever was written to FSCAL3-1.
+ * ****************************************************************************/
+static void calibrate( uint8_t then )
+{
+  uint8_t channel = registers[TI_CCxxx0_CHANNR];
+
+  radio_calibrations++;
+
+  registers[TI_CCxxx0_FSCAL3] = ( registers[TI_CCxxx0_FSCAL3] & 0xF0 ) |
+                                                    ( 0x08 | ( channel & 0x07 ) );
+  registers[TI_CCxxx0_FSCAL2] = ( registers[TI_CCxxx0_FSCAL2] & 0x20 ) | 0x0A;
+  registers[TI_CCxxx0_FSCAL1] = 0x20 | ( channel >> 3 );
+
+  set_state( STATE_CAL, sim_cycles );
+  ready_at = sim_cycles + radio_cal_cycles;
+  next_state = then;
+}
+
+/*******************************************************************************
+ * @fn     void go_rx( void )
+ * @brief  IDLE to RX, through calibration if MCSM0.FS_AUTOCAL asks for it
+ * ****************************************************************************/
+static void go_rx( void )
+{
+  counting = 1;
+
+  if( 0x10 == ( registers[TI_CCxxx0_MCSM0] & 0x30 ) )
+  {
+    calibrate( STATE_RX );
+  }
+  else
+  {
+    set_state( STATE_SETTLE, sim_cycles );
+    ready_at = sim_cycles + radio_settle_cycles;
+    next_state = STATE_RX;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void abort_rx( void )
+ * @brief  Stop receiving, whatever came in so far is dropped
+ * ****************************************************************************/
+static void abort_rx( void )
+{
+  if( receiving )
+  {
+    receiving = 0;
+    gdo0( 0 );
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t sync_match( const radio_frame_t* air )
+ * @brief  Whether the receiver syncs on a frame, by MDMCFG2.SYNC_MODE
+ * ****************************************************************************/
+static uint8_t sync_match( const radio_frame_t* air )
+{
+  uint16_t own = ( registers[TI_CCxxx0_SYNC1] << 8 ) |
+                                                registers[TI_CCxxx0_SYNC0];
+  uint8_t errors = 2 * __builtin_popcount( own ^ air->sync ) +
+                                                          air->sync_errors;
+
+  switch( registers[TI_CCxxx0_MDMCFG2] & 0x03 )
+  {
+    case 0:
+      return 1;
+
+    case 1:
+      return errors <= 3;
+
+    case 2:
+      return errors <= 1;
+
+    default:
+      return errors <= 2;
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t address_match( uint8_t address )
+ * @brief  PKTCTRL1.ADR_CHK
+ * ****************************************************************************/
+static uint8_t address_match( uint8_t address )
+{
+  switch( registers[TI_CCxxx0_PKTCTRL1] & 0x03 )
+  {
+    case 0:
+      return 1;
+
+    case 1:
+      return address == registers[TI_CCxxx0_ADDR];
+
+    case 2:
+      return ( address == registers[TI_CCxxx0_ADDR] ) || ( 0x00 == address );
+
+    default:
+      return ( address == registers[TI_CCxxx0_ADDR] ) || ( 0x00 == address ) ||
+                                                          ( 0xFF == address );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void start_frame( void )
+ * @brief  next_frame's sync word just ended
+ * ****************************************************************************/
+static void start_frame( void )
+{
+  uint8_t length = next_frame.data[0];
+
+  if( ( STATE_RX != state ) || receiving ||
+      ( state_since + SYNC_BYTES * radio_byte_cycles > next_frame.sync_at ) )
+  {
+    radio_missed++;
+    return;
+  }
+
+  if( !sync_match( &next_frame ) )
+  {
+    return;
+  }
+
+  radio_syncs++;
+  frame = next_frame;
+  receiving = 1;
+  gdo0( 1 );
+
+  // Variable length: [length][address][payload][CRC]
+  accepted = ( length <= registers[TI_CCxxx0_PKTLEN] ) &&
+                ( ( length < 1 ) || address_match( frame.data[1] ) );
+
+  if( accepted )
+  {
+    frame_end_at = frame.sync_at + ( 1 + length + 2 ) * radio_byte_cycles;
+  }
+  else
+  {
+    frame_end_at = frame.sync_at + 2 * radio_byte_cycles;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void end_frame( void )
+ * @brief  The frame being received ended, keep it if it's wanted
+ * ****************************************************************************/
+static void end_frame( void )
+{
+  uint8_t length = frame.data[0] + 1;
+  uint8_t appended = ( registers[TI_CCxxx0_PKTCTRL1] & 0x04 ) ? 2 : 0;
+  int16_t rssi = ( frame.rssi + 72 ) * 2;
+  uint8_t index;
+
+  receiving = 0;
+
+  if( accepted && ( frame.crc_ok ||
+                            !( registers[TI_CCxxx0_PKTCTRL1] & 0x08 ) ) )
+  {
+    if( rx_count + length + appended > FIFO_SIZE )
+    {
+      set_state( STATE_OVERFLOW, sim_cycles );
+    }
+    else
+    {
+      for( index = 0; index < length; index++ )
+      {
+        rx_fifo[( rx_first + rx_count++ ) % FIFO_SIZE] = frame.data[index];
+      }
+
+      if( appended )
+      {
+        rx_fifo[( rx_first + rx_count++ ) % FIFO_SIZE] =
+                    ( rssi < -128 ) ? 0x80 : ( rssi > 127 ) ? 0x7F : rssi;
+        rx_fifo[( rx_first + rx_count++ ) % FIFO_SIZE] =
+                                          ( frame.crc_ok ? 0x80 : 0x00 ) | 20;
+      }
+
+      radio_packets++;
+    }
+  }
+
+  gdo0( 0 );
+}
+
+/*******************************************************************************
+ * @fn     void schedule( void )
+ * @brief  Ask the MSP430 model to call back at the next thing on the air
+ * ****************************************************************************/
+static void schedule( void )
+{
+  uint64_t at = UINT64_MAX;
+
+  if( receiving )
+  {
+    at = frame_end_at;
+  }
+
+  if( have_next && ( next_frame.sync_at < at ) )
+  {
+    at = next_frame.sync_at;
+  }
+
+  sim_event = ( UINT64_MAX == at ) ? 0 : radio_event;
+  sim_event_at = at;
+}
+
+/*******************************************************************************
+ * @fn     void radio_event( void )
+ * @brief  A frame ended or one's sync word arrived
+ * ****************************************************************************/
+static void radio_event( void )
+{
+  update();
+
+  if( receiving && ( sim_cycles >= frame_end_at ) )
+  {
+    end_frame();
+  }
+
+  while( have_next && ( sim_cycles >= next_frame.sync_at ) )
+  {
+    start_frame();
+    have_next = radio_air && radio_air( &next_frame );
+  }
+
+  schedule();
+}
+
+/*******************************************************************************
+ * @fn     void access( uint8_t bytes )
+ * @brief  Time for an SPI access of this many bytes, address byte included
+ * ****************************************************************************/
+static void access( uint8_t bytes )
+{
+  radio_spi_accesses++;
+  radio_spi_bytes += bytes;
+
+  sim_run( radio_spi_overhead + bytes * radio_spi_byte_cycles );
+}
+
+/*******************************************************************************
+ * @fn     uint8_t pop( void )
+ * @brief  Next RX FIFO byte
+ * ****************************************************************************/
+static uint8_t pop( void )
+{
+  uint8_t value;
+
+  if( 0 == rx_count )
+  {
+    return 0;
+  }
+
+  value = rx_fifo[rx_first];
+  rx_first = ( rx_first + 1 ) % FIFO_SIZE;
+  rx_count--;
+
+  return value;
+}
+
+/*******************************************************************************
+ * @fn     void reset_registers( void )
+ * @brief  Datasheet reset values of the registers the model looks at
+ * ****************************************************************************/
+static void reset_registers( void )
+{
+  memset( registers, 0x00, sizeof(registers) );
+  registers[TI_CCxxx0_IOCFG0] = 0x3F;
+  registers[TI_CCxxx0_SYNC1] = 0xD3;
+  registers[TI_CCxxx0_SYNC0] = 0x91;
+  registers[TI_CCxxx0_PKTLEN] = 0xFF;
+  registers[TI_CCxxx0_PKTCTRL1] = 0x04;
+  registers[TI_CCxxx0_PKTCTRL0] = 0x45;
+  registers[TI_CCxxx0_MDMCFG2] = 0x13;
+  registers[TI_CCxxx0_MCSM1] = 0x30;
+  registers[TI_CCxxx0_MCSM0] = 0x04;
+
+  abort_rx();
+  set_state( STATE_IDLE, sim_cycles );
+  rx_first = 0;
+  rx_count = 0;
+  tx_count = 0;
+}
+
+/*******************************************************************************
+ * @fn     void radio_reset( void )
+ * @brief  Power up, with the timing of a 250kbps link to a G2553 at 16MHz.
+ *         Call after sim_reset() and before setup_cc2500(). Asks radio_air
+ *         for the first frame.
+ * ****************************************************************************/
+void radio_reset( void )
+{
+  radio_byte_cycles = 16000000 / ( 250000 / 8 );
+  radio_spi_byte_cycles = 16 * 8;
+  radio_spi_overhead = 20;
+  radio_cal_cycles = 16 * 809;
+  radio_settle_cycles = 16 * 88;
+
+  radio_spi_accesses = 0;
+  radio_spi_bytes = 0;
+  radio_syncs = 0;
+  radio_packets = 0;
+  radio_missed = 0;
+  radio_calibrations = 0;
+  radio_deaf_cycles = 0;
+
+  receiving = 0;
+  counting = 0;
+  state = STATE_IDLE;
+  state_since = sim_cycles;
+  reset_registers();
+
+  have_next = radio_air && radio_air( &next_frame );
+  schedule();
+}
+
+/*******************************************************************************
+ * @fn     uint8_t radio_register( uint8_t address )
+ * @brief  A configuration register, without going through SPI
+ * ****************************************************************************/
+uint8_t radio_register( uint8_t address )
+{
+  return registers[address];
+}
+
+/*******************************************************************************
+ * @fn     uint8_t radio_listening( void )
+ * @brief  Whether the radio would hear a sync word right now
+ * ****************************************************************************/
+uint8_t radio_listening( void )
+{
+  update();
+
+  return ( STATE_RX == state ) && !receiving;
+}
+
+/*******************************************************************************
+ * @fn     const radio_frame_t* radio_last_frame( void )
+ * @brief  The last frame the radio synced on
+ * ****************************************************************************/
+const radio_frame_t* radio_last_frame( void )
+{
+  return &frame;
+}
+
+/*******************************************************************************
+ * @fn     void radio_finish( void )
+ * @brief  Count the time up to now in radio_deaf_cycles
+ * ****************************************************************************/
+void radio_finish( void )
+{
+  update();
+  set_state( state, sim_cycles );
+}
+
+/*******************************************************************************
+ * lib/spi.h
+ * ****************************************************************************/
+void wait_cycles( uint16_t cycles )
+{
+  sim_run( cycles );
+}
+
+void spi_setup( void )
+{
+}
+
+void cc_powerup_reset( void )
+{
+  reset_registers();
+  access( 1 );
+}
+
+void cc_wakeup( void )
+{
+  // Crystal start up
+  sim_run( 16 * 150 );
+
+  update();
+  if( STATE_SLEEP == state )
+  {
+    set_state( STATE_IDLE, sim_cycles );
+  }
+}
+
+void cc_write_reg( uint8_t address, uint8_t value )
+{
+  cc_write_burst_reg( address, &value, 1 );
+}
+
+void cc_write_burst_reg( uint8_t address, uint8_t* buffer, uint8_t count )
+{
+  uint8_t index;
+
+  address &= 0x3F;
+  update();
+
+  for( index = 0; index < count; index++ )
+  {
+    if( TI_CCxxx0_TXFIFO == address )
+    {
+      tx_count++;
+    }
+    else if( ( address + index ) < TI_CCxxx0_CONFIG_REGISTERS )
+    {
+      registers[address + index] = buffer[index];
+#ifdef CC2500_SHADOW
+      cc_shadow[address + index] = buffer[index];
+#endif
+    }
+  }
+
+  access( 1 + count );
+}
+
+uint8_t cc_read_reg( uint8_t address )
+{
+  uint8_t value;
+
+  cc_read_burst_reg( address, &value, 1 );
+
+  return value;
+}
+
+void cc_read_burst_reg( uint8_t address, uint8_t* buffer, uint8_t count )
+{
+  uint8_t index;
+
+  address &= 0x3F;
+  update();
+
+  for( index = 0; index < count; index++ )
+  {
+    if( TI_CCxxx0_RXFIFO == address )
+    {
+      buffer[index] = pop();
+    }
+    else if( ( address + index ) < TI_CCxxx0_CONFIG_REGISTERS )
+    {
+      buffer[index] = registers[address + index];
+    }
+    else
+    {
+      buffer[index] = 0;
+    }
+  }
+
+  access( 1 + count );
+}
+
+uint8_t cc_read_status( uint8_t address )
+{
+  uint8_t value;
+
+  update();
+
+  switch( address & 0x3F )
+  {
+    case TI_CCxxx0_PARTNUM:
+      value = 0x80;
+      break;
+
+    case TI_CCxxx0_VERSION:
+      value = 0x03;
+      break;
+
+    case TI_CCxxx0_MARCSTATE:
+      value = state;
+      break;
+
+    case TI_CCxxx0_RXBYTES:
+      value = rx_count | ( ( STATE_OVERFLOW == state ) ? 0x80 : 0x00 );
+      break;
+
+    case TI_CCxxx0_TXBYTES:
+      value = tx_count;
+      break;
+
+    default:
+      value = 0;
+      break;
+  }
+
+  access( 2 );
+
+  return value;
+}
+
+void cc_strobe( uint8_t strobe )
+{
+  update();
+
+  switch( strobe )
+  {
+    case TI_CCxxx0_SRES:
+      reset_registers();
+      break;
+
+    case TI_CCxxx0_SIDLE:
+      abort_rx();
+      if( STATE_SLEEP != state )
+      {
+        set_state( STATE_IDLE, sim_cycles );
+      }
+      break;
+
+    case TI_CCxxx0_SRX:
+      if( STATE_IDLE == state )
+      {
+        go_rx();
+      }
+      break;
+
+    case TI_CCxxx0_STX:
+      if( ( STATE_IDLE == state ) || ( STATE_RX == state ) )
+      {
+        abort_rx();
+        counting = 1;
+        set_state( STATE_TX, sim_cycles );
+        ready_at = sim_cycles + ( HEADER_BYTES + tx_count + 2 ) *
+                                                          radio_byte_cycles;
+        next_state = ( 0x03 == ( registers[TI_CCxxx0_MCSM1] & 0x03 ) ) ?
+                                                      STATE_RX : STATE_IDLE;
+        tx_count = 0;
+      }
+      break;
+
+    case TI_CCxxx0_SCAL:
+      if( STATE_IDLE == state )
+      {
+        calibrate( STATE_IDLE );
+      }
+      break;
+
+    case TI_CCxxx0_SFRX:
+      if( ( STATE_IDLE == state ) || ( STATE_OVERFLOW == state ) )
+      {
+        rx_first = 0;
+        rx_count = 0;
+        if( STATE_OVERFLOW == state )
+        {
+          set_state( STATE_IDLE, sim_cycles );
+        }
+      }
+      break;
+
+    case TI_CCxxx0_SFTX:
+      tx_count = 0;
+      break;
+
+    case TI_CCxxx0_SPWD:
+    case TI_CCxxx0_SXOFF:
+      abort_rx();
+      set_state( STATE_SLEEP, sim_cycles );
+      break;
+
+    default:
+      break;
+  }
+
+  access( 1 );
+}
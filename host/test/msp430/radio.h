@@ -0,0 +1,53 @@
+/** @file radio.h
+*
+* @brief Host model of a CC2500 behind lib/spi.h, so lib/cc2500/cc2500.c runs
+*        natively against frames a test puts on the air
+*
+* @author Alvaro Prieto
+*/
+#ifndef _RADIO_H
+#define _RADIO_H
+
+#include <stdint.h>
+
+#define RADIO_FRAME_MAX (64)
+
+// A frame on the air, as the receiver gets it
+typedef struct
+{
+  uint64_t sync_at;       // sim_cycles when its last sync bit arrives
+  uint16_t sync;          // Sync word it was sent with
+  uint8_t sync_errors;    // Bits of the 32 sync bits received wrong
+  uint8_t crc_ok;
+  int8_t rssi;            // dBm
+  uint8_t length;         // Bytes in data
+  uint8_t data[RADIO_FRAME_MAX];  // What follows the sync word
+} radio_frame_t;
+
+// Called for the next frame on the air, in sync_at order. Returns 0 when
+// there are no more.
+extern uint8_t (*radio_air)( radio_frame_t* );
+
+// Timing, in CPU cycles
+extern uint32_t radio_byte_cycles;      // One byte on the air
+extern uint16_t radio_spi_byte_cycles;  // One byte over SPI
+extern uint16_t radio_spi_overhead;     // Per access (CSn, call, waits)
+extern uint32_t radio_cal_cycles;       // IDLE to RX with FS_AUTOCAL
+extern uint32_t radio_settle_cycles;    // IDLE to RX without it
+
+// Counters since radio_reset()
+extern uint32_t radio_spi_accesses;
+extern uint32_t radio_spi_bytes;
+extern uint32_t radio_syncs;            // Sync words matched, GDO0 asserted
+extern uint32_t radio_packets;          // Packets put in the RX FIFO
+extern uint32_t radio_missed;           // Frames sent while not listening
+extern uint32_t radio_calibrations;
+extern uint64_t radio_deaf_cycles;      // Time not in RX since the first SRX
+
+void radio_reset( void );
+uint8_t radio_register( uint8_t );
+uint8_t radio_listening( void );
+const radio_frame_t* radio_last_frame( void );
+void radio_finish( void );
+
+#endif /* _RADIO_H */
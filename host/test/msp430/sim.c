@@ -0,0 +1,358 @@
+/** @file sim.c
+*
+* @brief Cycle counting model of the MSP430 status register and Timer0_A, for
+*        running lib/ drivers on the host
+*
+* Time only moves when the code under test lets it: sim_run(), reads of the
+* timer (sim_read_cycles each) and low power modes. The timer follows the
+* user guide for up and continuous modes: CCIFGx is set when TAR counts to
+* TACCRx, TAIFG when it wraps to zero. Pending, enabled interrupts are taken
+* between steps while GIE is set, costing sim_isr_entry (6 to accept it) and
+* sim_isr_exit (5 for RETI) cycles. The code inside the ISRs takes no time of
+* its own except for the timer reads it does; raise sim_isr_entry to model a
+* prologue. PORT2 is taken last, while P2IFG & P2IE, and its ISR clears the
+* flags like the real one has to.
+*
+* sim_event is called once sim_cycles reaches sim_event_at, for things the
+* outside world does (a radio setting GDO0, a button). It can set the next
+* one. Sleeping with the timer on ACLK or stopped, and no cycle hook, skips
+* ahead to the next tick or event instead of counting every cycle.
+*
+* @author Alvaro Prieto
+*/
+#include <string.h>
+#include "msp430g2553.h"
+
+volatile uint8_t P1IN, P1OUT, P1DIR, P1IFG, P1IES, P1IE, P1SEL, P1SEL2, P1REN;
+volatile uint8_t P2IN, P2OUT, P2DIR, P2IFG, P2IES, P2IE, P2SEL, P2SEL2, P2REN;
+
+volatile uint16_t TA0CTL, TA0CCTL0, TA0CCTL1, TA0CCTL2;
+volatile uint16_t TA0CCR0, TA0CCR1, TA0CCR2;
+
+uint16_t sim_sr;
+uint16_t sim_sr_on_exit;
+
+uint64_t sim_cycles;          // CPU (and SMCLK) cycles since sim_reset()
+uint64_t sim_sleep_cycles;    // How many of those were spent with CPUOFF set
+uint64_t sim_isr_busy;        // And how many in ISRs, entry and exit included
+uint64_t sim_stop_cycles;     // Sleeping past this longjmp()s to sim_stop
+jmp_buf sim_stop;
+
+uint16_t sim_cycles_per_tick; // CPU cycles per ACLK tick, when TASSEL_1
+uint8_t sim_read_cycles;      // Cost of a TAR read (mov &TAR,Rn is 3)
+uint8_t sim_isr_entry;
+uint8_t sim_isr_exit;
+
+uint32_t sim_isr_count[3];    // Taken through TIMER0_A0, TIMER0_A1, PORT2
+uint32_t sim_wakeups;         // ISRs taken while the CPU was asleep
+void (*sim_timer_isr[2])( void );
+void (*sim_port2_isr)( void );
+void (*sim_cycle_hook)( void );
+void (*sim_event)( void );
+uint64_t sim_event_at;
+
+static uint16_t timer_count;
+static uint16_t tick_phase;
+static uint8_t in_isr;
+
+/*******************************************************************************
+ * @fn     void sim_reset( void )
+ * @brief  Power up state, 16MHz SMCLK and 12kHz VLO for ACLK
+ * ****************************************************************************/
+void sim_reset( void )
+{
+  P1IN = P1OUT = P1DIR = P1IFG = P1IES = P1IE = P1SEL = P1SEL2 = P1REN = 0;
+  P2IN = P2OUT = P2DIR = P2IFG = P2IES = P2IE = P2SEL = P2SEL2 = P2REN = 0;
+  TA0CTL = TA0CCTL0 = TA0CCTL1 = TA0CCTL2 = 0;
+  TA0CCR0 = TA0CCR1 = TA0CCR2 = 0;
+
+  sim_sr = 0;
+  sim_sr_on_exit = 0;
+  sim_cycles = 0;
+  sim_sleep_cycles = 0;
+  sim_isr_busy = 0;
+  sim_stop_cycles = UINT64_MAX;
+  sim_cycles_per_tick = 16000000 / 12000;
+  sim_read_cycles = 3;
+  sim_isr_entry = 6;
+  sim_isr_exit = 5;
+  memset( sim_isr_count, 0, sizeof(sim_isr_count) );
+  sim_wakeups = 0;
+  memset( sim_timer_isr, 0, sizeof(sim_timer_isr) );
+  sim_port2_isr = 0;
+  sim_cycle_hook = 0;
+  sim_event = 0;
+  sim_event_at = UINT64_MAX;
+
+  timer_count = 0;
+  tick_phase = 0;
+  in_isr = 0;
+}
+
+/*******************************************************************************
+ * @fn     void compare( volatile uint16_t* control, uint16_t value )
+ * @brief  Set CCIFG if a compare channel matches the new count
+ * ****************************************************************************/
+static void compare( volatile uint16_t* control, uint16_t value )
+{
+  if( !( *control & CAP ) && ( timer_count == value ) )
+  {
+    *control |= CCIFG;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void timer_tick( void )
+ * @brief  One count of Timer0_A
+ * ****************************************************************************/
+static void timer_tick( void )
+{
+  switch( TA0CTL & MC_MASK )
+  {
+    case MC_1:
+      if( timer_count >= TA0CCR0 )
+      {
+        timer_count = 0;
+        TA0CTL |= TAIFG;
+      }
+      else
+      {
+        timer_count++;
+      }
+      break;
+
+    case MC_2:
+      if( 0 == ++timer_count )
+      {
+        TA0CTL |= TAIFG;
+      }
+      break;
+
+    default:
+      return;
+  }
+
+  compare( &TA0CCTL0, TA0CCR0 );
+  compare( &TA0CCTL1, TA0CCR1 );
+  compare( &TA0CCTL2, TA0CCR2 );
+}
+
+/*******************************************************************************
+ * @fn     void advance( uint32_t cycles )
+ * @brief  Let cycles go by without taking interrupts
+ * ****************************************************************************/
+static void advance( uint32_t cycles )
+{
+  void (*event)( void );
+
+  while( cycles-- )
+  {
+    if( TA0CTL & TACLR )
+    {
+      TA0CTL &= ~TACLR;
+      timer_count = 0;
+      tick_phase = 0;
+    }
+
+    sim_cycles++;
+    if( sim_sr & CPUOFF )
+    {
+      sim_sleep_cycles++;
+    }
+    else if( in_isr )
+    {
+      sim_isr_busy++;
+    }
+
+    if( TA0CTL & TASSEL_1 )
+    {
+      if( ++tick_phase >= sim_cycles_per_tick )
+      {
+        tick_phase = 0;
+        timer_tick();
+      }
+    }
+    else
+    {
+      timer_tick();
+    }
+
+    if( sim_cycle_hook )
+    {
+      sim_cycle_hook();
+    }
+
+    if( sim_event && ( sim_cycles >= sim_event_at ) )
+    {
+      event = sim_event;
+      sim_event = 0;
+      event();
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void take_interrupts( void )
+ * @brief  Run the timer ISRs for as long as they're pending and enabled
+ * ****************************************************************************/
+static void take_interrupts( void )
+{
+  uint8_t vector;
+  void (*isr)( void );
+
+  while( ( sim_sr & GIE ) && !in_isr )
+  {
+    if( ( TA0CCTL0 & CCIE ) && ( TA0CCTL0 & CCIFG ) )
+    {
+      // The only flag cleared by taking the interrupt
+      TA0CCTL0 &= ~CCIFG;
+      vector = 0;
+    }
+    else if( ( ( TA0CCTL1 & CCIE ) && ( TA0CCTL1 & CCIFG ) ) ||
+             ( ( TA0CCTL2 & CCIE ) && ( TA0CCTL2 & CCIFG ) ) ||
+             ( ( TA0CTL & TAIE ) && ( TA0CTL & TAIFG ) ) )
+    {
+      vector = 1;
+    }
+    else if( P2IFG & P2IE )
+    {
+      vector = 2;
+    }
+    else
+    {
+      return;
+    }
+
+    isr = ( vector < 2 ) ? sim_timer_isr[vector] : sim_port2_isr;
+    if( 0 == isr )
+    {
+      return;
+    }
+
+    sim_isr_count[vector]++;
+
+    // SR is pushed and cleared, the ISR runs awake with interrupts off
+    if( sim_sr & CPUOFF )
+    {
+      sim_wakeups++;
+    }
+
+    sim_sr_on_exit = sim_sr;
+    sim_sr = 0;
+    in_isr = 1;
+    advance( sim_isr_entry );
+    isr();
+    advance( sim_isr_exit );
+    in_isr = 0;
+    sim_sr = sim_sr_on_exit;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void sim_run( uint32_t cycles )
+ * @brief  Let cycles go by, taking interrupts as they come up
+ * ****************************************************************************/
+void sim_run( uint32_t cycles )
+{
+  uint64_t end = sim_cycles + cycles;
+
+  // Interrupts and timer reads use up cycles too
+  while( sim_cycles < end )
+  {
+    advance( 1 );
+    take_interrupts();
+  }
+}
+
+/*******************************************************************************
+ * @fn     void sim_bis_sr( uint16_t bits )
+ * @brief  __bis_SR_register(), runs until an ISR clears CPUOFF on exit
+ * ****************************************************************************/
+void sim_bis_sr( uint16_t bits )
+{
+  uint64_t skip;
+
+  sim_sr |= bits;
+  take_interrupts();
+
+  while( sim_sr & CPUOFF )
+  {
+    if( sim_cycles >= sim_stop_cycles )
+    {
+      longjmp( sim_stop, 1 );
+    }
+
+    // Nothing but an ACLK tick (if the timer runs) or an event can wake the
+    // CPU up, skip to the cycle before whichever comes first
+    if( !sim_cycle_hook && ( !( TA0CTL & MC_MASK ) ||
+                          ( ( TA0CTL & TASSEL_1 ) && !( TA0CTL & TACLR ) ) ) )
+    {
+      skip = ( TA0CTL & MC_MASK ) ? sim_cycles_per_tick - 1 - tick_phase :
+                                                                  UINT64_MAX;
+      if( sim_event && ( sim_event_at <= sim_cycles ) )
+      {
+        skip = 0;
+      }
+      else if( sim_event && ( sim_event_at - 1 - sim_cycles < skip ) )
+      {
+        skip = sim_event_at - 1 - sim_cycles;
+      }
+      if( sim_stop_cycles - sim_cycles < skip )
+      {
+        skip = sim_stop_cycles - sim_cycles;
+      }
+
+      sim_cycles += skip;
+      sim_sleep_cycles += skip;
+      if( TA0CTL & MC_MASK )
+      {
+        tick_phase += skip;
+      }
+    }
+
+    sim_run( 1 );
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint16_t sim_timer_read( void )
+ * @brief  TA0R
+ * ****************************************************************************/
+uint16_t sim_timer_read( void )
+{
+  uint16_t count;
+
+  advance( sim_read_cycles - 1 );
+  count = timer_count;
+  advance( 1 );
+  take_interrupts();
+
+  return count;
+}
+
+/*******************************************************************************
+ * @fn     uint16_t sim_timer_iv( void )
+ * @brief  TA0IV, reading it clears the flag it reports
+ * ****************************************************************************/
+uint16_t sim_timer_iv( void )
+{
+  advance( sim_read_cycles );
+
+  if( ( TA0CCTL1 & CCIE ) && ( TA0CCTL1 & CCIFG ) )
+  {
+    TA0CCTL1 &= ~CCIFG;
+    return TA0IV_TACCR1;
+  }
+  else if( ( TA0CCTL2 & CCIE ) && ( TA0CCTL2 & CCIFG ) )
+  {
+    TA0CCTL2 &= ~CCIFG;
+    return TA0IV_TACCR2;
+  }
+  else if( ( TA0CTL & TAIE ) && ( TA0CTL & TAIFG ) )
+  {
+    TA0CTL &= ~TAIFG;
+    return TA0IV_TAIFG;
+  }
+
+  return 0;
+}
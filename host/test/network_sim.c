@@ -0,0 +1,329 @@
+/** @file network_sim.c
+*
+* @brief Installations sharing a channel, and what the others' traffic costs
+*        a node of one of them, with and without cc2500_set_network_id()
+*
+* lib/cc2500/cc2500.c runs against the radio model in test/msp430/radio.c
+* on the MSP430 model. NETWORKS installations each send PACKETS_PER_SECOND
+* packets at random times to addresses 1 to NODES (the same addresses in
+* every installation, they're compiled in) or to broadcast. The node under
+* test is address 1 of the first installation and sleeps in LPM3 between
+* packets.
+*
+* With one sync word for everybody, every frame on the channel raises GDO0,
+* and the ones for address 1 or broadcast from the other installations even
+* reach rx_callback. With a network ID per installation the radio never
+* syncs on them. Each setup reports the port interrupts taken, how many of
+* them were for frames of other networks (the spurious ones), the SPI
+* traffic and the CPU time spent in the ISR. Frames of the node's own
+* network for other addresses still interrupt, the address check comes
+* after the sync word.
+*
+* usage: network_sim [-v]
+*   -v  Print the numbers for every setup
+*
+* @author Alvaro Prieto
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "cc2500.h"
+#include "device.h"
+#include "spi.h"
+#include "radio.h"
+
+#define CPU_HZ (16000000.0)
+
+#define NETWORKS (4)
+#define NODES (4)
+#define PACKETS_PER_SECOND (25.0)
+#define BROADCAST_PERCENT (20)
+#define PAYLOAD_LENGTH (8)
+#define SECONDS (20)
+
+// Bit error rate on the sync word
+#define SYNC_BER (1e-3)
+
+// Frames start once the node is set up
+#define START_CYCLES (16000)
+
+typedef struct
+{
+  const char* what;
+  uint8_t use_ids;
+  uint8_t ids[NETWORKS];
+} setup_t;
+
+typedef struct
+{
+  uint32_t interrupts;
+  uint32_t spurious;      // Interrupts for frames of other networks
+  uint32_t own;           // Packets of the own network delivered
+  uint32_t expected;      // Sent on the own network to this node
+  uint32_t foreign;       // Packets of other networks delivered
+  uint32_t spi_accesses;
+  uint32_t spi_bytes;
+  double isr_ms;
+  uint32_t missed;
+} result_t;
+
+void port2_isr( void );
+
+static uint16_t sync_words[NETWORKS];
+static uint64_t next_at;
+static result_t result;
+static uint32_t failures;
+
+/*******************************************************************************
+ * @fn     uint32_t random_next( void )
+ * @brief  xorshift32, so every setup sees the same traffic
+ * ****************************************************************************/
+static uint32_t random_state = 2463534242u;
+
+static uint32_t random_next( void )
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+
+  return random_state;
+}
+
+/*******************************************************************************
+ * @fn     double uniform( void )
+ * @brief  Random number in (0, 1)
+ * ****************************************************************************/
+static double uniform( void )
+{
+  return ( random_next() + 0.5 ) / 4294967296.0;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t air( radio_frame_t* frame )
+ * @brief  The next frame on the channel, from any installation
+ * ****************************************************************************/
+static uint8_t air( radio_frame_t* frame )
+{
+  uint8_t network = random_next() % NETWORKS;
+  uint8_t address;
+  uint8_t bit;
+
+  // Poisson arrivals of everybody's packets together
+  next_at += (uint64_t)( -log( uniform() ) * CPU_HZ /
+                                        ( PACKETS_PER_SECOND * NETWORKS ) );
+
+  address = ( random_next() % 100 < BROADCAST_PERCENT ) ? 0x00 :
+                                                1 + random_next() % NODES;
+
+  memset( frame, 0, sizeof(*frame) );
+  frame->sync_at = next_at;
+  frame->sync = sync_words[network];
+  frame->crc_ok = 1;
+  frame->rssi = network ? -50 - (int8_t)( random_next() % 40 ) : -60;
+  frame->length = 2 + PAYLOAD_LENGTH;
+  frame->data[0] = 1 + PAYLOAD_LENGTH;
+  frame->data[1] = address;
+  frame->data[2] = network;
+
+  for( bit = 0; bit < 32; bit++ )
+  {
+    if( uniform() < SYNC_BER )
+    {
+      frame->sync_errors++;
+    }
+  }
+
+  if( ( 0 == network ) && ( ( 0x00 == address ) || ( 0x01 == address ) ) )
+  {
+    result.expected++;
+  }
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t rx_callback( uint8_t* buffer, uint8_t length )
+ * @brief  [address][network][payload...], sort by network
+ * ****************************************************************************/
+static uint8_t rx_callback( uint8_t* buffer, uint8_t length )
+{
+  if( 0 == buffer[1] )
+  {
+    result.own++;
+  }
+  else
+  {
+    result.foreign++;
+  }
+
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     void gdo0_isr( void )
+ * @brief  The driver's port ISR, counting the ones for other networks
+ * ****************************************************************************/
+static void gdo0_isr( void )
+{
+  if( ( GDO0_PxIFG & GDO0_PIN ) && radio_last_frame()->data[2] )
+  {
+    result.spurious++;
+  }
+
+  port2_isr();
+}
+
+/*******************************************************************************
+ * @fn     void start( uint8_t (*frames)( radio_frame_t* ) )
+ * @brief  Fresh MCU and radio, with the driver set up
+ * ****************************************************************************/
+static void start( uint8_t (*frames)( radio_frame_t* ) )
+{
+  sim_reset();
+  sim_port2_isr = gdo0_isr;
+
+  next_at = START_CYCLES;
+  radio_air = frames;
+  radio_reset();
+
+  setup_cc2500( rx_callback );
+}
+
+/*******************************************************************************
+ * @fn     void find_sync_words( const setup_t* setup )
+ * @brief  Sync word of every network, as cc2500_set_network_id() sets it
+ * ****************************************************************************/
+static void find_sync_words( const setup_t* setup )
+{
+  uint8_t network;
+
+  for( network = 0; network < NETWORKS; network++ )
+  {
+    start( 0 );
+
+    if( setup->use_ids && !cc2500_set_network_id( setup->ids[network] ) )
+    {
+      fprintf( stderr, "FAIL: %s: network ID %u refused\n", setup->what,
+                                                      setup->ids[network] );
+      failures++;
+    }
+
+    sync_words[network] = ( radio_register( TI_CCxxx0_SYNC1 ) << 8 ) |
+                                      radio_register( TI_CCxxx0_SYNC0 );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void run( const setup_t* setup )
+ * @brief  SECONDS of traffic on the node of network 0, into result
+ * ****************************************************************************/
+static void run( const setup_t* setup )
+{
+  find_sync_words( setup );
+
+  memset( &result, 0, sizeof(result) );
+  random_state = 2463534242u;
+  start( air );
+
+  if( setup->use_ids )
+  {
+    cc2500_set_network_id( setup->ids[0] );
+  }
+
+  // Only count what the traffic costs
+  result.spurious = 0;
+  radio_spi_accesses = 0;
+  radio_spi_bytes = 0;
+  sim_isr_busy = 0;
+
+  sim_stop_cycles = SECONDS * CPU_HZ;
+  if( 0 == setjmp( sim_stop ) )
+  {
+    for( ;; )
+    {
+      __bis_SR_register( LPM3_bits + GIE );
+    }
+  }
+
+  radio_finish();
+
+  result.interrupts = sim_isr_count[2];
+  result.spi_accesses = radio_spi_accesses;
+  result.spi_bytes = radio_spi_bytes;
+  result.isr_ms = sim_isr_busy * 1000.0 / CPU_HZ;
+  result.missed = radio_missed;
+}
+
+int main( int argc, char** argv )
+{
+  static const setup_t setups[] =
+  {
+    { "one sync word",  0, { 0 } },
+    { "network IDs",    1, { 0x12, 0x34, 0x56, 0x78 } },
+  };
+  result_t results[sizeof(setups) / sizeof(setups[0])];
+  uint32_t index;
+  int verbose = ( argc > 1 ) && !strcmp( argv[1], "-v" );
+
+  if( verbose )
+  {
+    printf( "%d networks, %.0f packets/s each, %d s\n", NETWORKS,
+                                                PACKETS_PER_SECOND, SECONDS );
+    printf( "%-16s %10s %9s %9s %9s %10s %10s %8s\n", "", "interrupts",
+            "spurious", "own", "foreign", "SPI reads", "SPI bytes", "ISR ms" );
+  }
+
+  for( index = 0; index < sizeof(setups) / sizeof(setups[0]); index++ )
+  {
+    run( &setups[index] );
+    results[index] = result;
+
+    if( verbose )
+    {
+      printf( "%-16s %10u %9u %4u/%-4u %9u %10u %10u %8.1f\n",
+              setups[index].what, result.interrupts, result.spurious,
+              result.own,
+              result.expected, result.foreign, result.spi_accesses,
+              result.spi_bytes, result.isr_ms );
+    }
+  }
+
+  // Network IDs: nothing from the other installations gets through or
+  // interrupts, and the own network's packets still do
+  if( results[1].foreign )
+  {
+    fprintf( stderr, "FAIL: %u packets from other networks delivered\n",
+                                                        results[1].foreign );
+    failures++;
+  }
+
+  if( results[1].spurious )
+  {
+    fprintf( stderr, "FAIL: %u spurious interrupts with network IDs\n",
+                                                      results[1].spurious );
+    failures++;
+  }
+
+  if( results[1].own < results[0].own )
+  {
+    fprintf( stderr, "FAIL: %u own packets delivered with network IDs, %u "
+                      "without\n", results[1].own, results[0].own );
+    failures++;
+  }
+
+  if( verbose )
+  {
+    printf( "network IDs: %u to %u spurious interrupts, %.0f%% fewer "
+            "interrupts, %.0f%% fewer SPI bytes\n", results[0].spurious,
+            results[1].spurious, 100.0 * ( 1.0 - (double)results[1].interrupts /
+                                                  results[0].interrupts ),
+            100.0 * ( 1.0 - (double)results[1].spi_bytes /
+                                                  results[0].spi_bytes ) );
+  }
+
+  printf( "network_sim: %s\n", failures ? "FAILED" : "passed" );
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,169 @@
+/** @file pwm_sim.c
+*
+* @brief Runs lib/pwm/ti/timera.c on the Timer_A model and counts interrupts
+*        per PWM period
+*
+* The old wireless_rgb_led engine interrupted every 512 cycles and compared a
+* counter against each channel: 256 interrupts per 8-bit period, 32 in the
+* time of one 16384 cycle period here. The edge scheduled engine should take
+* at most PWM_CHANNELS + 1, fewer when channels share an edge, are off or
+* are close enough to be handled in the same interrupt. Also checks that
+* every channel is on for value << 6 cycles per period, give or take the
+* interrupt latency.
+*
+* usage: pwm_sim [-v]
+*   -v  Print the numbers for every duty set
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pwm.h"
+#include "device.h"
+
+#define PERIOD (16384)
+#define PERIODS (64)
+
+// Old engine, in the same 16384 cycles
+#define OLD_ISRS_PER_PERIOD (PERIOD / 512)
+
+// Pin changes happen a few cycles into the ISR, both at the start of the
+// period and at the edges, so most of the latency cancels out
+#define MAX_ERROR (24)
+
+void pwm_period_isr( void );
+void pwm_edge_isr( void );
+
+static const uint8_t pins[PWM_CHANNELS] = PWM_PINS;
+static uint32_t on_cycles[PWM_CHANNELS];
+static uint32_t failures;
+static int verbose;
+
+/*******************************************************************************
+ * @fn     void sample_pins( void )
+ * @brief  Cycle hook, counts the cycles each (active low) channel is on
+ * ****************************************************************************/
+static void sample_pins( void )
+{
+  uint8_t channel;
+
+  for( channel = 0; channel < PWM_CHANNELS; channel++ )
+  {
+    if( !( P2OUT & pins[channel] ) )
+    {
+      on_cycles[channel]++;
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void run_duty( const uint8_t* values, const char* what )
+ * @brief  Show one set of values for PERIODS periods and check the result
+ * ****************************************************************************/
+static void run_duty( const uint8_t* values, const char* what )
+{
+  uint32_t isrs;
+  uint32_t expected;
+  int32_t error;
+  uint8_t channel;
+
+  sim_reset();
+  sim_timer_isr[0] = pwm_period_isr;
+  sim_timer_isr[1] = pwm_edge_isr;
+
+  pwm_setup();
+  for( channel = 0; channel < PWM_CHANNELS; channel++ )
+  {
+    pwm_set( channel, values[channel] );
+  }
+  pwm_update();
+  __enable_interrupt();
+
+  // Let the new schedule get swapped in, and start counting at a period start
+  sim_run( 2 * PERIOD - 1 );
+
+  memset( on_cycles, 0, sizeof(on_cycles) );
+  memset( sim_isr_count, 0, sizeof(sim_isr_count) );
+  sim_isr_busy = 0;
+  sim_cycle_hook = sample_pins;
+
+  sim_run( PERIODS * PERIOD );
+
+  isrs = sim_isr_count[0] + sim_isr_count[1];
+  if( verbose )
+  {
+    printf( "%-24s %5.2f isr/period (old %d), %4.1f%% of the CPU in isr entry, exit and edge waits\n",
+            what, isrs / (double)PERIODS, OLD_ISRS_PER_PERIOD,
+            100.0 * sim_isr_busy / ( PERIODS * PERIOD ) );
+  }
+
+  if( isrs > PERIODS * ( PWM_CHANNELS + 1 ) )
+  {
+    fprintf( stderr, "FAIL: %s, %u interrupts in %u periods\n", what, isrs,
+                                                                    PERIODS );
+    failures++;
+  }
+
+  for( channel = 0; channel < PWM_CHANNELS; channel++ )
+  {
+    expected = (uint32_t)values[channel] << 6;
+    error = (int32_t)( on_cycles[channel] / PERIODS ) - (int32_t)expected;
+
+    if( verbose )
+    {
+      printf( "  channel %u: %3u -> %5u cycles on, %+d\n", channel,
+                        values[channel], on_cycles[channel] / PERIODS, error );
+    }
+
+    if( ( error > MAX_ERROR ) || ( error < -MAX_ERROR ) )
+    {
+      fprintf( stderr, "FAIL: %s, channel %u on for %u cycles, expected %u\n",
+                      what, channel, on_cycles[channel] / PERIODS, expected );
+      failures++;
+    }
+  }
+}
+
+int main( int argc, char** argv )
+{
+  static const struct
+  {
+    uint8_t values[3];
+    const char* what;
+  } sets[] =
+  {
+    { { 0, 0, 0 }, "all off" },
+    { { 255, 255, 255 }, "all full" },
+    { { 128, 128, 128 }, "all equal" },
+    { { 32, 128, 224 }, "spread out" },
+    { { 100, 101, 102 }, "one step apart" },
+    { { 1, 2, 3 }, "near the period start" },
+    { { 253, 254, 255 }, "near the period end" },
+    { { 0, 77, 0 }, "one channel" },
+  };
+  uint8_t values[3];
+  uint32_t index;
+  char what[32];
+
+  verbose = ( argc > 1 ) && !strcmp( argv[1], "-v" );
+
+  for( index = 0; index < sizeof(sets) / sizeof(sets[0]); index++ )
+  {
+    run_duty( sets[index].values, sets[index].what );
+  }
+
+  srand( 1 );
+  for( index = 0; index < 32; index++ )
+  {
+    values[0] = rand();
+    values[1] = rand();
+    values[2] = rand();
+    snprintf( what, sizeof(what), "random %u", index );
+    run_duty( values, what );
+  }
+
+  printf( "pwm_sim: %s\n", failures ? "FAILED" : "passed" );
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,433 @@
+/** @file rate_sim.c
+*
+* @brief A remote sending to its fixture over a fading channel with
+*        lib/rate.c picking the profile, against every fixed profile
+*
+* The remote sends DATA_LENGTH byte packets back to back and the fixture
+* ACKs them. Each exchange draws the RSSI from the scenario's mean plus
+* Gaussian fading, and a packet gets through with a chance that goes from
+* 50% at PER_HALF_DB under the profile's sensitivity to about 99% at the
+* sensitivity (the datasheet's 1% PER point) and better above it. Packets
+* only arrive if both ends are on the same profile. Airtime includes the
+* preamble, sync word, header and CRC, plus a turnaround per packet, and
+* RATE_SWITCH packets take their airtime too. Throughput is payload bytes
+* delivered over the whole run, so time spent on handshakes, on a profile
+* the link can't hold, or with the ends split counts against rate.c.
+*
+* rate.c keeps one node's neighbors in statics, so it's built in here and
+* the statics are swapped between the two nodes.
+*
+* usage: rate_sim [-v]
+*   -v  Print the throughput of every scenario
+*
+* @author Alvaro Prieto
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static uint8_t sim_address;
+#define DEVICE_ADDRESS sim_address
+
+// Built in, for its statics
+#include "rate.c"
+
+#define REMOTE_ADDRESS (0x01)
+#define FIXTURE_ADDRESS (0x02)
+
+#define DATA_LENGTH (20)
+#define ACK_LENGTH (2)
+
+// Preamble, sync word, length, address and CRC
+#define OVERHEAD_BYTES (4 + 4 + 1 + 1 + 2)
+
+// Idle to TX or RX, with the calibration, per packet
+#define TURNAROUND_S (0.0008)
+
+#define POLL_S (0.1)
+
+// 50% PER this far under the sensitivity, and how fast it falls off
+#define PER_HALF_DB (3.0)
+#define PER_SLOPE (1.5)
+
+// Fixed profile modes after these
+#define MODE_RATE (CC2500_PROFILES)
+
+typedef struct
+{
+  // rate.c statics
+  neighbor_t neighbors[RATE_NEIGHBORS];
+  uint8_t next_neighbor;
+
+  uint8_t address;
+  uint8_t profile;
+} node_t;
+
+typedef struct
+{
+  const char* what;
+  double start_dbm;   // Mean RSSI at the start...
+  double middle_dbm;  // ...halfway through...
+  double end_dbm;     // ...and at the end, linear in between
+  double fading_db;   // Standard deviation of the per exchange fading
+  double seconds;
+  double min_ratio;   // Pass if rate.c gets this much of the best fixed one
+} scenario_t;
+
+static node_t remote;
+static node_t fixture;
+static node_t* active;
+
+static double sim_time;
+static double sim_rssi;
+static uint32_t switches;
+
+static uint32_t failures;
+static int verbose;
+
+/*******************************************************************************
+ * @fn     uint32_t random_next( void )
+ * @brief  xorshift32, so every run sees the same channel
+ * ****************************************************************************/
+static uint32_t random_state = 2463534242u;
+
+static uint32_t random_next( void )
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+
+  return random_state;
+}
+
+/*******************************************************************************
+ * @fn     double uniform( void )
+ * @brief  Random number in (0, 1)
+ * ****************************************************************************/
+static double uniform( void )
+{
+  return ( random_next() + 0.5 ) / 4294967296.0;
+}
+
+/*******************************************************************************
+ * @fn     double gaussian( void )
+ * @brief  Standard normal random number (Box-Muller)
+ * ****************************************************************************/
+static double gaussian( void )
+{
+  return sqrt( -2.0 * log( uniform() ) ) * cos( 2.0 * M_PI * uniform() );
+}
+
+/*******************************************************************************
+ * @fn     node_t* node_enter( node_t* node )
+ * @brief  Make node the one rate.c and the radio stubs work on. Returns the
+ *         one that was, to go back to.
+ * ****************************************************************************/
+static node_t* node_enter( node_t* node )
+{
+  node_t* previous = active;
+
+  if( previous == node )
+  {
+    return previous;
+  }
+
+  if( previous )
+  {
+    memcpy( previous->neighbors, neighbors, sizeof(neighbors) );
+    previous->next_neighbor = next_neighbor;
+  }
+
+  memcpy( neighbors, node->neighbors, sizeof(neighbors) );
+  next_neighbor = node->next_neighbor;
+  sim_address = node->address;
+  active = node;
+
+  return previous;
+}
+
+/*******************************************************************************
+ * @fn     double airtime( uint8_t profile, uint8_t length )
+ * @brief  Seconds to send a packet with length payload bytes, turnaround
+ *         included
+ * ****************************************************************************/
+static double airtime( uint8_t profile, uint8_t length )
+{
+  return TURNAROUND_S + ( OVERHEAD_BYTES + length ) * 8.0 /
+                                            ( profile_rate[profile] * 100.0 );
+}
+
+/*******************************************************************************
+ * @fn     double delivery( uint8_t profile, double rssi )
+ * @brief  Chance of a packet getting through on profile at rssi dBm
+ * ****************************************************************************/
+static double delivery( uint8_t profile, double rssi )
+{
+  double margin = rssi - profile_sensitivity[profile] + PER_HALF_DB;
+
+  return 1.0 - 1.0 / ( 1.0 + exp( PER_SLOPE * margin ) );
+}
+
+/*******************************************************************************
+ * @fn     uint8_t received( const node_t* from, const node_t* to )
+ * @brief  Whether a packet from one node reaches the other on this exchange
+ * ****************************************************************************/
+static uint8_t received( const node_t* from, const node_t* to )
+{
+  return ( from->profile == to->profile ) &&
+                          ( uniform() < delivery( from->profile, sim_rssi ) );
+}
+
+/*******************************************************************************
+ * @fn     void status_bytes( uint8_t* status )
+ * @brief  Appended RSSI and LQI bytes for a packet at the current RSSI
+ * ****************************************************************************/
+static void status_bytes( uint8_t* status )
+{
+  int16_t raw = ( (int16_t)floor( sim_rssi ) + CC2500_RSSI_OFFSET ) * 2;
+
+  if( raw < -128 )
+  {
+    raw = -128;
+  }
+  else if( raw > 127 )
+  {
+    raw = 127;
+  }
+
+  status[0] = (uint8_t)raw;
+  status[1] = 0x80 | 20;
+}
+
+/*******************************************************************************
+ * Radio stubs for rate.c, on whichever node is active
+ * ****************************************************************************/
+uint8_t cc2500_profile( void )
+{
+  return active->profile;
+}
+
+void cc2500_set_profile( uint8_t profile )
+{
+  if( profile != active->profile )
+  {
+    switches++;
+  }
+
+  active->profile = profile;
+}
+
+int16_t cc2500_rssi_dbm( uint8_t rssi )
+{
+  return (int8_t)rssi / 2 - CC2500_RSSI_OFFSET;
+}
+
+void cc2500_tx_packet( uint8_t* buffer, uint8_t length, uint8_t address )
+{
+  uint8_t packet[1 + 255 + 2];
+  node_t* to = ( active == &remote ) ? &fixture : &remote;
+  node_t* previous;
+
+  sim_time += airtime( active->profile, length );
+
+  if( ( address != to->address ) || !received( active, to ) )
+  {
+    return;
+  }
+
+  packet[0] = address;
+  memcpy( &packet[1], buffer, length );
+  status_bytes( &packet[1 + length] );
+
+  previous = node_enter( to );
+  rate_handle_packet( packet, 1 + length );
+  node_enter( previous );
+}
+
+/*******************************************************************************
+ * @fn     void node_setup( node_t* node, uint8_t address )
+ * @brief  Fresh node on the default profile
+ * ****************************************************************************/
+static void node_setup( node_t* node, uint8_t address )
+{
+  memset( node, 0, sizeof(*node) );
+  node->address = address;
+  node->profile = CC2500_PROFILE_DEFAULT;
+
+  node_enter( node );
+  rate_setup();
+}
+
+/*******************************************************************************
+ * @fn     double mean_rssi( const scenario_t* scenario )
+ * @brief  The scenario's mean RSSI at the current simulation time
+ * ****************************************************************************/
+static double mean_rssi( const scenario_t* scenario )
+{
+  double half = scenario->seconds / 2;
+
+  if( sim_time < half )
+  {
+    return scenario->start_dbm + ( scenario->middle_dbm -
+                                    scenario->start_dbm ) * sim_time / half;
+  }
+
+  return scenario->middle_dbm + ( scenario->end_dbm - scenario->middle_dbm ) *
+                                                  ( sim_time - half ) / half;
+}
+
+/*******************************************************************************
+ * @fn     double run( const scenario_t* scenario, uint8_t mode,
+ *                                                        uint8_t* split )
+ * @brief  Throughput in kbps over the scenario with rate.c (MODE_RATE) or
+ *         with both ends on one profile. split is set if the ends are on
+ *         different profiles at the end.
+ * ****************************************************************************/
+static double run( const scenario_t* scenario, uint8_t mode, uint8_t* split )
+{
+  uint8_t status[2];
+  uint8_t data_ok;
+  uint8_t ack_ok;
+  uint64_t bytes = 0;
+  double next_poll = POLL_S;
+
+  active = 0;
+  sim_time = 0;
+  switches = 0;
+  random_state = 2463534242u;
+
+  node_setup( &fixture, FIXTURE_ADDRESS );
+  node_setup( &remote, REMOTE_ADDRESS );
+
+  if( MODE_RATE != mode )
+  {
+    remote.profile = mode;
+    fixture.profile = mode;
+  }
+
+  while( sim_time < scenario->seconds )
+  {
+    sim_rssi = mean_rssi( scenario ) + scenario->fading_db * gaussian();
+
+    sim_time += airtime( remote.profile, DATA_LENGTH );
+    data_ok = received( &remote, &fixture );
+
+    // The ACK, or the remote waiting that long for one
+    sim_time += airtime( remote.profile, ACK_LENGTH );
+    ack_ok = data_ok && received( &fixture, &remote );
+
+    if( data_ok )
+    {
+      bytes += DATA_LENGTH;
+    }
+
+    if( MODE_RATE == mode )
+    {
+      if( data_ok )
+      {
+        node_enter( &fixture );
+        status_bytes( status );
+        rate_rx_status( REMOTE_ADDRESS, status );
+      }
+
+      node_enter( &remote );
+      if( ack_ok )
+      {
+        status_bytes( status );
+        rate_rx_status( FIXTURE_ADDRESS, status );
+      }
+      rate_tx_result( FIXTURE_ADDRESS, ack_ok );
+
+      while( sim_time >= next_poll )
+      {
+        node_enter( &remote );
+        rate_poll();
+        node_enter( &fixture );
+        rate_poll();
+        next_poll += POLL_S;
+      }
+    }
+  }
+
+  *split = ( remote.profile != fixture.profile );
+
+  return bytes * 8.0 / sim_time / 1000.0;
+}
+
+/*******************************************************************************
+ * @fn     void test_scenario( const scenario_t* scenario )
+ * @brief  rate.c against every fixed profile on one scenario
+ * ****************************************************************************/
+static void test_scenario( const scenario_t* scenario )
+{
+  double fixed[CC2500_PROFILES];
+  double best = 0;
+  double adaptive;
+  uint8_t split;
+  uint8_t profile;
+
+  for( profile = 0; profile < CC2500_PROFILES; profile++ )
+  {
+    fixed[profile] = run( scenario, profile, &split );
+    if( fixed[profile] > best )
+    {
+      best = fixed[profile];
+    }
+  }
+
+  adaptive = run( scenario, MODE_RATE, &split );
+
+  if( verbose )
+  {
+    printf( "%-26s %7.2f %7.2f %7.2f %7.2f  %7.2f kbps (%3.0f%%), "
+            "%u switches\n", scenario->what, fixed[0], fixed[1], fixed[2],
+            fixed[3], adaptive, 100.0 * adaptive / best, switches );
+  }
+
+  if( adaptive < best * scenario->min_ratio )
+  {
+    fprintf( stderr, "FAIL: %s: %.2f kbps, the best fixed profile gets "
+                      "%.2f\n", scenario->what, adaptive, best );
+    failures++;
+  }
+
+  if( split )
+  {
+    fprintf( stderr, "FAIL: %s: the ends finished on different profiles\n",
+                                                            scenario->what );
+    failures++;
+  }
+}
+
+int main( int argc, char** argv )
+{
+  static const scenario_t scenarios[] =
+  {
+    { "near (-50dBm)",              -50, -50, -50, 2, 60, 0.9 },
+    { "across the room (-78dBm)",   -78, -78, -78, 3, 60, 0.9 },
+    { "far (-90dBm)",               -90, -90, -90, 3, 120, 0.9 },
+    { "fading at the edge (-84)",   -84, -84, -84, 8, 120, 0.75 },
+    { "walking away and back",      -50, -100, -50, 4, 240, 1.0 },
+    { "walking away",               -50, -75, -100, 4, 240, 1.0 },
+  };
+  uint32_t index;
+
+  verbose = ( argc > 1 ) && !strcmp( argv[1], "-v" );
+
+  if( verbose )
+  {
+    printf( "%-26s %7s %7s %7s %7s  %7s\n", "", "2K4", "10K", "250K", "500K",
+                                                                    "rate.c" );
+  }
+
+  for( index = 0; index < sizeof(scenarios) / sizeof(scenarios[0]); index++ )
+  {
+    test_scenario( &scenarios[index] );
+  }
+
+  printf( "rate_sim: %s\n", failures ? "FAILED" : "passed" );
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,409 @@
+/** @file scheduler_sim.c
+*
+* @brief Runs lib/scheduler/ti/timera.c on the Timer_A model, checks when
+*        timers and deferred work run, and estimates the energy per event
+*
+* The tests check that timers expire on the tick they're due (or the one
+* after), including delays past the 16-bit wrap of TAR, that stopped timers
+* don't run and that work deferred from a port ISR runs right away. They
+* also check the CPU only wakes up for events and timer overflows.
+*
+* The benchmark runs a few workloads for a simulated ten minutes and turns
+* the awake and asleep time into energy with the G2553 datasheet numbers at
+* 3V: 4.2mA active at 16MHz, 0.5uA in LPM3 from the VLO. Each event is
+* compared to spinning in __delay_cycles() until it's due, which is what
+* friendfinder did before the scheduler. The model only counts cycles for
+* timer reads, so ISR_CYCLES and CALLBACK_CYCLES stand in for the rest of
+* the code; they're rough counts of the listings, not measurements.
+*
+* usage: scheduler_sim [-v]
+*   -v  Print the numbers for every workload
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Built in, for its statics
+#include "scheduler/ti/timera.c"
+
+#define CPU_HZ (16000000.0)
+#define ACLK_HZ (12000)
+
+#define ACTIVE_UA (4200.0)
+#define LPM3_UA (0.5)
+#define VCC (3.0)
+
+// DCO start up for every interrupt taken in LPM3 (~1.5us)
+#define WAKE_CYCLES (24)
+
+// Prologue, list walk and 32-bit time math of the scheduler ISRs
+#define ISR_CYCLES (150)
+
+// scheduler_run() taking a function off the queue, plus a short callback
+#define CALLBACK_CYCLES (200)
+
+// A timer can run up to a tick late. Deferred work waits for the port and
+// CCR1 ISRs, and at worst for a timer's two ISRs and a callback that got
+// there first.
+#define MAX_LATE_TICKS (1)
+#define MAX_DEFER_CYCLES (4 * ( ISR_CYCLES + 16 ) + CALLBACK_CYCLES)
+
+#define SIM_SECONDS (600)
+
+static scheduler_timer_t timer_a;
+static scheduler_timer_t timer_b;
+
+static uint32_t expected_a;
+static uint32_t runs_a;
+static uint32_t runs_b;
+static uint32_t late_max;
+
+static uint32_t event_mean;
+static uint32_t events;
+static uint64_t event_cycles;
+static uint64_t defer_max;
+
+static uint32_t failures;
+static int verbose;
+
+uint32_t clock_aclk_hz( void );
+void clock_sleep( void );
+
+/*******************************************************************************
+ * @fn     uint32_t clock_aclk_hz( void )
+ * @brief  Stand-in for lib/clock, a VLO that measured exactly 12kHz
+ * ****************************************************************************/
+uint32_t clock_aclk_hz( void )
+{
+  return ACLK_HZ;
+}
+
+/*******************************************************************************
+ * @fn     void clock_sleep( void )
+ * @brief  Stand-in for lib/clock, nothing ever needs SMCLK here
+ * ****************************************************************************/
+void clock_sleep( void )
+{
+  __bis_SR_register( CLOCK_SLEEP_BITS + GIE );
+  __bic_SR_register( CLOCK_WAKE_BITS );
+}
+
+/*******************************************************************************
+ * @fn     uint32_t random_next( void )
+ * @brief  xorshift32, so every run sees the same events
+ * ****************************************************************************/
+static uint32_t random_state = 2463534242u;
+
+static uint32_t random_next( void )
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+
+  return random_state;
+}
+
+/*******************************************************************************
+ * @fn     void check_a( void )
+ * @brief  Timer A callback, checks it didn't run early or too late
+ * ****************************************************************************/
+static void check_a( void )
+{
+  int32_t late = scheduler_time() - expected_a;
+
+  if( ( late < 0 ) || ( late > MAX_LATE_TICKS ) )
+  {
+    fprintf( stderr, "FAIL: timer due at tick %u ran at %+d\n", expected_a,
+                                                                    late );
+    failures++;
+  }
+
+  if( (uint32_t)late > late_max )
+  {
+    late_max = late;
+  }
+
+  runs_a++;
+  expected_a += timer_a.period;
+  sim_run( CALLBACK_CYCLES );
+}
+
+/*******************************************************************************
+ * @fn     void count_b( void )
+ * @brief  Timer B callback
+ * ****************************************************************************/
+static void count_b( void )
+{
+  runs_b++;
+  sim_run( CALLBACK_CYCLES );
+}
+
+/*******************************************************************************
+ * @fn     void stop_b( void )
+ * @brief  Timer A callback that stops timer B
+ * ****************************************************************************/
+static void stop_b( void )
+{
+  runs_a++;
+  scheduler_timer_stop( &timer_b );
+  sim_run( CALLBACK_CYCLES );
+}
+
+/*******************************************************************************
+ * @fn     void packet( void )
+ * @brief  Work deferred by the port ISR, checks how long it waited
+ * ****************************************************************************/
+static void packet( void )
+{
+  uint64_t waited = sim_cycles - event_cycles;
+
+  if( waited > defer_max )
+  {
+    defer_max = waited;
+  }
+
+  if( waited > MAX_DEFER_CYCLES )
+  {
+    fprintf( stderr, "FAIL: deferred work waited %llu cycles\n",
+                                              (unsigned long long)waited );
+    failures++;
+  }
+
+  runs_b++;
+  sim_run( CALLBACK_CYCLES );
+}
+
+/*******************************************************************************
+ * @fn     void port2_isr( void )
+ * @brief  A radio or button ISR that leaves the work to the main loop
+ * ****************************************************************************/
+static void port2_isr( void )
+{
+  P2IFG = 0;
+  scheduler_defer( packet );
+}
+
+/*******************************************************************************
+ * @fn     void port_event( void )
+ * @brief  sim_event, a pin edge every event_mean cycles on average
+ * ****************************************************************************/
+static void port_event( void )
+{
+  P2IFG |= BIT6;
+  event_cycles = sim_cycles;
+  events++;
+
+  sim_event = port_event;
+  sim_event_at = sim_cycles + 1 + random_next() % ( 2 * event_mean );
+}
+
+/*******************************************************************************
+ * @fn     void start( void )
+ * @brief  Reset the model and the scheduler's statics, and set it up
+ * ****************************************************************************/
+static void start( void )
+{
+  sim_reset();
+  sim_timer_isr[0] = scheduler_timer_isr;
+  sim_timer_isr[1] = scheduler_overflow_isr;
+  sim_port2_isr = port2_isr;
+  P2IE = BIT6;
+  sim_isr_entry = 6 + ISR_CYCLES;
+
+  timers = 0;
+  overflows = 0;
+  queue_head = 0;
+  queue_count = 0;
+
+  runs_a = 0;
+  runs_b = 0;
+  late_max = 0;
+  events = 0;
+  defer_max = 0;
+
+  scheduler_setup();
+  scheduler_timer_init( &timer_a, check_a );
+  scheduler_timer_init( &timer_b, count_b );
+}
+
+/*******************************************************************************
+ * @fn     void run( uint32_t seconds )
+ * @brief  scheduler_run() for a while
+ * ****************************************************************************/
+static void run( uint32_t seconds )
+{
+  sim_stop_cycles = sim_cycles + (uint64_t)seconds * (uint64_t)CPU_HZ;
+
+  if( 0 == setjmp( sim_stop ) )
+  {
+    __enable_interrupt();
+    scheduler_run();
+  }
+}
+
+/*******************************************************************************
+ * @fn     void expect( const char* what, uint32_t value, uint32_t low,
+ *                                                              uint32_t high )
+ * @brief  Fail unless low <= value <= high
+ * ****************************************************************************/
+static void expect( const char* what, uint32_t value, uint32_t low,
+                                                              uint32_t high )
+{
+  if( ( value < low ) || ( value > high ) )
+  {
+    fprintf( stderr, "FAIL: %s: %u (expected %u to %u)\n", what, value, low,
+                                                                      high );
+    failures++;
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint32_t overflow_count( uint32_t seconds )
+ * @brief  TAR wraps in that many seconds
+ * ****************************************************************************/
+static uint32_t overflow_count( uint32_t seconds )
+{
+  return (uint32_t)seconds * ACLK_HZ / 0x10000;
+}
+
+/*******************************************************************************
+ * @fn     void test_timers( void )
+ * @brief  One shot, periodic, long and stopped timers
+ * ****************************************************************************/
+static void test_timers( void )
+{
+  // One shot
+  start();
+  expected_a = scheduler_time() + scheduler_ms_to_ticks( 250 );
+  scheduler_timer_start( &timer_a, 250, 0 );
+  run( 2 );
+  expect( "one shot runs", runs_a, 1, 1 );
+
+  // Periodic, like the friendfinder heartbeat. Only wakes up for the timer
+  // and the overflows.
+  start();
+  expected_a = scheduler_time() + scheduler_ms_to_ticks( 1000 );
+  scheduler_timer_start( &timer_a, 1000, 1000 );
+  run( 60 );
+  expect( "periodic runs", runs_a, 59, 60 );
+  expect( "periodic wakeups", sim_wakeups, runs_a,
+                                        runs_a + overflow_count( 60 ) + 1 );
+
+  // Past the 16-bit wrap of TAR (65536 ticks is ~5.5s)
+  start();
+  expected_a = scheduler_time() + scheduler_ms_to_ticks( 13000 );
+  scheduler_timer_start( &timer_a, 13000, 0 );
+  run( 20 );
+  expect( "13s one shot runs", runs_a, 1, 1 );
+
+  // Timer B is stopped by timer A before it's due
+  start();
+  timer_a.callback = stop_b;
+  scheduler_timer_start( &timer_b, 500, 500 );
+  scheduler_timer_start( &timer_a, 100, 0 );
+  run( 5 );
+  expect( "stopped timer runs", runs_b, 0, 0 );
+  expect( "stopping timer runs", runs_a, 1, 1 );
+
+  // Restarting a running timer pushes it back
+  start();
+  scheduler_timer_start( &timer_b, 300, 0 );
+  scheduler_timer_start( &timer_b, 2000, 0 );
+  run( 1 );
+  expect( "restarted timer runs early", runs_b, 0, 0 );
+  run( 2 );
+  expect( "restarted timer runs", runs_b, 1, 1 );
+}
+
+/*******************************************************************************
+ * @fn     void test_defer( void )
+ * @brief  Port interrupts handing work to the main loop, with a timer running
+ *         too
+ * ****************************************************************************/
+static void test_defer( void )
+{
+  start();
+  expected_a = scheduler_time() + scheduler_ms_to_ticks( 100 );
+  scheduler_timer_start( &timer_a, 100, 100 );
+
+  event_mean = CPU_HZ / 50;
+  sim_event = port_event;
+  sim_event_at = sim_cycles + event_mean;
+  run( 30 );
+
+  // The last one can still be in the queue
+  expect( "deferred runs", runs_b, events - 1, events );
+  expect( "timer runs with deferred work", runs_a, 299, 300 );
+}
+
+/*******************************************************************************
+ * @fn     void bench( const char* what, uint32_t timer_ms, uint32_t per_second )
+ * @brief  Energy per event of a periodic timer and/or random port events
+ * ****************************************************************************/
+static void bench( const char* what, uint32_t timer_ms, uint32_t per_second )
+{
+  double active;
+  double sleep;
+  double energy;
+  double busy;
+  uint32_t total;
+
+  start();
+
+  if( timer_ms )
+  {
+    timer_a.callback = count_b;
+    scheduler_timer_start( &timer_a, timer_ms, timer_ms );
+  }
+
+  if( per_second )
+  {
+    event_mean = CPU_HZ / per_second;
+    sim_event = port_event;
+    sim_event_at = sim_cycles + event_mean;
+  }
+
+  run( SIM_SECONDS );
+
+  total = runs_b;
+  active = sim_cycles - sim_sleep_cycles + (double)sim_wakeups * WAKE_CYCLES;
+  sleep = sim_cycles - active;
+
+  // uJ: uA * V * s
+  energy = ( active * ACTIVE_UA + sleep * LPM3_UA ) * VCC / CPU_HZ;
+  busy = SIM_SECONDS * ACTIVE_UA * VCC;
+
+  printf( "%-26s %6.2f %7.0f %8.2f %9.1f %8.2f\n", what,
+          (double)sim_wakeups / total, active / total, energy / total,
+          busy / total, energy / VCC / SIM_SECONDS );
+}
+
+int main( int argc, char** argv )
+{
+  verbose = ( argc > 1 ) && !strcmp( argv[1], "-v" );
+
+  test_timers();
+  test_defer();
+
+  if( verbose )
+  {
+    printf( "latest timer: %u ticks, longest defer: %llu cycles\n\n",
+                                  late_max, (unsigned long long)defer_max );
+    printf( "%-26s %6s %7s %8s %9s %8s\n", "", "wakes", "cycles",
+            "uJ", "busy uJ", "avg uA" );
+    bench( "heartbeat, 1s", 1000, 0 );
+    bench( "timer, 100ms", 100, 0 );
+    bench( "port events, 2/s", 0, 2 );
+    bench( "port events, 50/s", 0, 50 );
+    bench( "heartbeat + 20 packets/s", 1000, 20 );
+    printf( "\nper event: interrupts taken asleep, awake cycles, energy, and "
+            "energy spinning in\n__delay_cycles() (%.0fuA) instead\n",
+            ACTIVE_UA );
+  }
+
+  printf( "scheduler_sim: %s\n", failures ? "FAILED" : "passed" );
+
+  return failures ? 1 : 0;
+}
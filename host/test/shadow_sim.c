@@ -0,0 +1,490 @@
+/** @file shadow_sim.c
+*
+* @brief Checks that the CC2500_SHADOW register shadow configures the radio
+*        the same as writing every register right away
+*
+* lib/cc2500/cc2500.c runs against the radio model in test/msp430/radio.c
+* on the MSP430 model. It's built twice: shadow_sim with CC2500_SHADOW, where
+* cc2500_stage_reg() only changes the shadow and cc2500_flush_config() sends
+* everything staged in one burst, and shadow_sim_immediate without it, where
+* every staged register goes out on its own.
+*
+* Both builds run the same steps: setup, addressing, the sniffer, channel and
+* power, every modem profile, FEC, a network ID, whitening, a spectrum scan,
+* sleep, and random registers staged and flushed together. The radio model
+* overwrites FSCAL3-1 on every calibration, so a flush that put stale
+* calibration results from the shadow back into the radio shows up.
+*
+* With -d the immediate build writes the radio's registers and the SPI
+* accesses of every step to a file. shadow_sim -c compares its own steps with
+* that file: the registers have to match exactly, and no step can take more
+* SPI accesses than it did without the shadow. Without -c it only checks that
+* the shadow matches the radio after every step (but FSCAL3-1, which the radio
+* changes on its own) and that turning address checking on and off doesn't
+* read PKTCTRL1 back.
+*
+* usage: shadow_sim [-v] [-d file | -c file]
+*   -v  Print the SPI accesses and bytes of every step
+*   -d  Write the registers after every step to file
+*   -c  Compare the registers after every step with file (from -d)
+*
+* @author Alvaro Prieto
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cc2500.h"
+#include "device.h"
+#include "spi.h"
+#include "radio.h"
+
+#ifdef CC2500_SHADOW
+#define NAME "shadow_sim"
+#else
+#define NAME "shadow_sim_immediate"
+#endif
+
+// Random staging steps, and most registers staged in each one
+#define RANDOM_STEPS (24)
+#define RANDOM_REGISTERS (6)
+
+// Spectrum scan, like rssi-logger's SCANNER_MODE but shorter
+#define SCAN_FIRST (0)
+#define SCAN_STEP (8)
+#define SCAN_POINTS (8)
+
+// Longest line in a -d file: step, accesses, bytes, registers and the name
+#define LINE_LENGTH ( 32 + 2 * TI_CCxxx0_CONFIG_REGISTERS + 32 )
+
+typedef struct
+{
+  const char* what;
+  void (*run)( void );
+  uint8_t shadow_accesses;  // SPI accesses it takes with the shadow, 0 if
+                            // it depends
+} step_t;
+
+static uint32_t failures;
+
+// Registers random steps stage. The ones that change how the driver talks to
+// the radio (IOCFG0, packet handling, the state machine) are left alone.
+static const uint8_t random_registers[] =
+{
+  TI_CCxxx0_FSCTRL1,  TI_CCxxx0_FSCTRL0,  TI_CCxxx0_FREQ2,
+  TI_CCxxx0_FREQ1,    TI_CCxxx0_FREQ0,    TI_CCxxx0_MDMCFG4,
+  TI_CCxxx0_MDMCFG3,  TI_CCxxx0_DEVIATN,  TI_CCxxx0_FOCCFG,
+  TI_CCxxx0_BSCFG,    TI_CCxxx0_AGCCTRL2, TI_CCxxx0_AGCCTRL1,
+  TI_CCxxx0_AGCCTRL0, TI_CCxxx0_FREND1,   TI_CCxxx0_FREND0,
+  TI_CCxxx0_FSCAL3,   TI_CCxxx0_FSCAL2,   TI_CCxxx0_FSCAL1,
+  TI_CCxxx0_FSCAL0,   TI_CCxxx0_FSTEST
+};
+
+/*******************************************************************************
+ * @fn     uint32_t random_next( void )
+ * @brief  xorshift32, so both builds stage the same registers
+ * ****************************************************************************/
+static uint32_t random_state = 2463534242u;
+
+static uint32_t random_next( void )
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+
+  return random_state;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t rx_callback( uint8_t* buffer, uint8_t length )
+ * @brief  Nothing is on the air
+ * ****************************************************************************/
+static uint8_t rx_callback( uint8_t* buffer, uint8_t length )
+{
+  return 0;
+}
+
+/*******************************************************************************
+ * Steps
+ * ****************************************************************************/
+static void step_setup( void )
+{
+  sim_reset();
+  radio_air = NULL;
+  radio_reset();
+
+  setup_cc2500( rx_callback );
+}
+
+static void step_address( void )
+{
+  cc2500_set_address( 0x42 );
+}
+
+static void step_addressing_on( void )
+{
+  cc2500_enable_addressing();
+}
+
+static void step_addressing_off( void )
+{
+  cc2500_disable_addressing();
+}
+
+static void step_sniffer_on( void )
+{
+  cc2500_enable_sniffer();
+}
+
+static void step_sniffer_off( void )
+{
+  cc2500_disable_sniffer();
+}
+
+static void step_channel( void )
+{
+  cc2500_set_channel( 37 );
+}
+
+static void step_power( void )
+{
+  cc2500_set_power_dbm( -12 );
+}
+
+static void step_profile_2k4( void )
+{
+  cc2500_set_profile( CC2500_PROFILE_2K4 );
+}
+
+static void step_profile_10k( void )
+{
+  cc2500_set_profile( CC2500_PROFILE_10K );
+}
+
+static void step_profile_500k( void )
+{
+  cc2500_set_profile( CC2500_PROFILE_500K );
+}
+
+static void step_profile_250k( void )
+{
+  cc2500_set_profile( CC2500_PROFILE_250K );
+}
+
+static void step_fec_on( void )
+{
+  cc2500_enable_fec();
+}
+
+static void step_fec_off( void )
+{
+  cc2500_disable_fec();
+}
+
+static void step_network_id( void )
+{
+  if( !cc2500_set_network_id( 0x12 ) )
+  {
+    fprintf( stderr, "FAIL: network ID 0x12 refused\n" );
+    failures++;
+  }
+}
+
+static void step_whitening_on( void )
+{
+  cc2500_enable_whitening();
+}
+
+static void step_whitening_off( void )
+{
+  cc2500_disable_whitening();
+}
+
+static void step_scan( void )
+{
+  uint8_t fscal1[SCAN_POINTS];
+  uint8_t rssi[SCAN_POINTS];
+
+  cc2500_scan_calibrate( SCAN_FIRST, SCAN_STEP, SCAN_POINTS, fscal1 );
+  cc2500_scan( SCAN_FIRST, SCAN_STEP, SCAN_POINTS, fscal1, rssi );
+}
+
+static void step_sleep( void )
+{
+  cc2500_sleep();
+  cc2500_set_channel( 12 );
+}
+
+/*******************************************************************************
+ * @fn     void step_random( void )
+ * @brief  Stage a few random registers and flush them together. Every other
+ *         step also recalibrates first, by going through IDLE, so FSCAL3-1
+ *         in the radio and in the shadow differ.
+ * ****************************************************************************/
+static void step_random( void )
+{
+  uint8_t count = 1 + random_next() % RANDOM_REGISTERS;
+  uint8_t index;
+
+  if( random_next() & 1 )
+  {
+    cc_strobe( TI_CCxxx0_SIDLE );
+    cc_strobe( TI_CCxxx0_SRX );
+  }
+
+  for( index = 0; index < count; index++ )
+  {
+    cc2500_stage_reg( random_registers[random_next() %
+                                              sizeof(random_registers)],
+                      random_next() );
+  }
+
+  cc2500_flush_config();
+}
+
+static const step_t steps[] =
+{
+  { "setup",            step_setup,           0 },
+  { "address",          step_address,         1 },
+  { "addressing on",    step_addressing_on,   1 },
+  { "channel",          step_channel,         1 },
+  { "power",            step_power,           0 },
+  { "sniffer on",       step_sniffer_on,      1 },
+  { "sniffer off",      step_sniffer_off,     1 },
+  { "addressing on",    step_addressing_on,   1 },
+  { "profile 2.4k",     step_profile_2k4,     0 },
+  { "profile 10k",      step_profile_10k,     0 },
+  { "fec on",           step_fec_on,          0 },
+  { "network id",       step_network_id,      0 },
+  { "whitening on",     step_whitening_on,    0 },
+  { "fec off",          step_fec_off,         0 },
+  { "profile 500k",     step_profile_500k,    0 },
+  { "scan",             step_scan,            0 },
+  { "whitening off",    step_whitening_off,   0 },
+  { "profile 250k",     step_profile_250k,    0 },
+  { "sleep",            step_sleep,           0 },
+  { "addressing off",   step_addressing_off,  0 },
+};
+
+#define STEPS ( sizeof(steps) / sizeof(steps[0]) )
+
+/*******************************************************************************
+ * @fn     void check_shadow( const char* what )
+ * @brief  The shadow holds what's in the radio, but for the calibration
+ *         results
+ * ****************************************************************************/
+static void check_shadow( const char* what )
+{
+#ifdef CC2500_SHADOW
+  uint8_t address;
+
+  for( address = 0; address < TI_CCxxx0_CONFIG_REGISTERS; address++ )
+  {
+    if( ( address >= TI_CCxxx0_FSCAL3 ) && ( address <= TI_CCxxx0_FSCAL1 ) )
+    {
+      continue;
+    }
+
+    if( cc_shadow[address] != radio_register( address ) )
+    {
+      fprintf( stderr, "FAIL: %s: shadow 0x%02X, radio 0x%02X in register "
+                "0x%02X\n", what, cc_shadow[address], radio_register( address ),
+                                                                      address );
+      failures++;
+      return;
+    }
+  }
+#endif
+}
+
+/*******************************************************************************
+ * @fn     void format_registers( char* text )
+ * @brief  Every configuration register in hex
+ * ****************************************************************************/
+static void format_registers( char* text )
+{
+  uint8_t address;
+
+  for( address = 0; address < TI_CCxxx0_CONFIG_REGISTERS; address++ )
+  {
+    sprintf( &text[2 * address], "%02X", radio_register( address ) );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void compare( uint32_t index, const char* what, FILE* reference,
+ *                  const char* registers, uint32_t accesses, int verbose )
+ * @brief  Check a step against the same step without the shadow
+ * ****************************************************************************/
+static void compare( uint32_t index, const char* what, FILE* reference,
+                const char* registers, uint32_t accesses, int verbose )
+{
+  char line[LINE_LENGTH];
+  char expected[2 * TI_CCxxx0_CONFIG_REGISTERS + 1];
+  unsigned int step;
+  unsigned int expected_accesses;
+  unsigned int expected_bytes;
+
+  // %94s is 2 * TI_CCxxx0_CONFIG_REGISTERS
+  if( !fgets( line, sizeof(line), reference ) ||
+      ( 4 != sscanf( line, "%u %u %u %94s", &step, &expected_accesses,
+                                            &expected_bytes, expected ) ) ||
+      ( step != index ) )
+  {
+    fprintf( stderr, "FAIL: %s: not in the reference\n", what );
+    failures++;
+    return;
+  }
+
+  if( verbose )
+  {
+    printf( " %9u %6u", expected_accesses, expected_bytes );
+  }
+
+  if( strcmp( expected, registers ) )
+  {
+    fprintf( stderr, "FAIL: %s: registers differ\n  immediate %s\n"
+                      "  shadow    %s\n", what, expected, registers );
+    failures++;
+  }
+
+  if( accesses > expected_accesses )
+  {
+    fprintf( stderr, "FAIL: %s: %u SPI accesses, %u without the shadow\n",
+                                          what, accesses, expected_accesses );
+    failures++;
+  }
+}
+
+int main( int argc, char** argv )
+{
+  char registers[2 * TI_CCxxx0_CONFIG_REGISTERS + 1];
+  char what[32];
+  FILE* dump = NULL;
+  FILE* reference = NULL;
+  uint32_t accesses;
+  uint32_t bytes;
+  uint32_t index;
+  int verbose = 0;
+  int arg;
+
+  for( arg = 1; arg < argc; arg++ )
+  {
+    if( !strcmp( argv[arg], "-v" ) )
+    {
+      verbose = 1;
+    }
+    else if( !strcmp( argv[arg], "-d" ) && ( arg + 1 < argc ) )
+    {
+      dump = fopen( argv[++arg], "w" );
+      if( !dump )
+      {
+        perror( argv[arg] );
+        return 1;
+      }
+    }
+    else if( !strcmp( argv[arg], "-c" ) && ( arg + 1 < argc ) )
+    {
+      reference = fopen( argv[++arg], "r" );
+      if( !reference )
+      {
+        perror( argv[arg] );
+        return 1;
+      }
+    }
+    else
+    {
+      fprintf( stderr, "usage: %s [-v] [-d file | -c file]\n", argv[0] );
+      return 1;
+    }
+  }
+
+  if( verbose )
+  {
+    printf( "%s\n%-16s %6s %6s %s\n", NAME, "step", "SPI", "bytes",
+                              reference ? " immediate: SPI  bytes" : "" );
+  }
+
+  for( index = 0; index < STEPS + RANDOM_STEPS; index++ )
+  {
+    if( index < STEPS )
+    {
+      snprintf( what, sizeof(what), "%s", steps[index].what );
+    }
+    else
+    {
+      snprintf( what, sizeof(what), "random %u",
+                                            (unsigned int)( index - STEPS ) );
+    }
+
+    accesses = radio_spi_accesses;
+    bytes = radio_spi_bytes;
+
+    if( index < STEPS )
+    {
+      steps[index].run();
+    }
+    else
+    {
+      step_random();
+    }
+
+    // setup starts the counters over
+    if( 0 == index )
+    {
+      accesses = 0;
+      bytes = 0;
+    }
+    accesses = radio_spi_accesses - accesses;
+    bytes = radio_spi_bytes - bytes;
+
+    format_registers( registers );
+    check_shadow( what );
+
+    if( verbose )
+    {
+      printf( "%-16s %6u %6u", what, accesses, bytes );
+    }
+
+    if( dump )
+    {
+      fprintf( dump, "%u %u %u %s %s\n", index, accesses, bytes, registers,
+                                                                      what );
+    }
+
+    if( reference )
+    {
+      compare( index, what, reference, registers, accesses, verbose );
+    }
+
+    if( verbose )
+    {
+      printf( "\n" );
+    }
+
+#ifdef CC2500_SHADOW
+    // Read-modify-writes of a register the shadow has are a single write
+    if( ( index < STEPS ) && steps[index].shadow_accesses &&
+                                ( accesses != steps[index].shadow_accesses ) )
+    {
+      fprintf( stderr, "FAIL: %s: %u SPI accesses, %u with the shadow\n",
+                        what, accesses, steps[index].shadow_accesses );
+      failures++;
+    }
+#endif
+  }
+
+  if( dump )
+  {
+    fclose( dump );
+  }
+
+  if( reference )
+  {
+    fclose( reference );
+  }
+
+  printf( NAME ": %s\n", failures ? "FAILED" : "passed" );
+
+  return failures ? 1 : 0;
+}
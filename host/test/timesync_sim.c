@@ -0,0 +1,303 @@
+/** @file timesync_sim.c
+*
+* @brief Several nodes following one coordinator with lib/timesync.c, and
+*        how far apart they apply the same scene
+*
+* The coordinator sends a TIME_BEACON every BEACON_TICKS, like rgb_controller,
+* and RGB_SCENE packets that apply SCENE_LEAD_TICKS later. Every node has its
+* own DCO rate error, which can wander, its own receive timestamp jitter and
+* its own lost packets. Each node turns the apply time into local time with
+* timesync_to_local(), and the skew of a scene is the spread of the real
+* times at which the nodes that received it get there.
+*
+* timesync.c keeps a single node's state in statics, so it's built in here
+* and the statics are swapped for every node.
+*
+* usage: timesync_sim [-v]
+*   -v  Print the numbers for every scenario
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Built in, for its statics
+#include "timesync.c"
+
+#define NODES (8)
+
+#define TICKS_PER_US (16.0)
+
+// rgb_controller's beacon interval (24 timer overflows) and scene lead time
+#define BEACON_TICKS (24 * 65536.0)
+#define SCENE_LEAD_TICKS (480000.0)
+#define SCENES_PER_BEACON (4)
+
+#define BEACONS (20000)
+
+typedef struct
+{
+  // timesync.c statics
+  uint8_t state;
+  uint32_t anchor_network;
+  uint32_t anchor_local;
+  int16_t skew;
+  uint8_t beacon_valid;
+  uint8_t beacon_sequence;
+  uint32_t beacon_rx_time;
+
+  double local;       // Local clock at the current simulation time
+  double rate;        // Local ticks per coordinator tick, less one
+} node_t;
+
+typedef struct
+{
+  const char* what;
+  double rate_error;  // DCO rate error, +/-
+  double rate_walk;   // Rate change per beacon, +/-
+  double loss;        // Chance of losing any one packet
+  double jitter;      // Receive timestamp latency, 0 to this many ticks
+  double late;        // Chance of the timestamp being late by up to...
+  double late_ticks;  // ...this many ticks (interrupts held off)
+  double max_p99_us;  // Pass if the 99th percentile skew is under this
+} scenario_t;
+
+static node_t nodes[NODES];
+static uint32_t failures;
+static int verbose;
+
+/*******************************************************************************
+ * @fn     double uniform( void )
+ * @brief  Random number in [0, 1)
+ * ****************************************************************************/
+static double uniform( void )
+{
+  return rand() / ( RAND_MAX + 1.0 );
+}
+
+/*******************************************************************************
+ * @fn     void node_load( node_t* node )
+ * @brief  Make node the one timesync.c works on
+ * ****************************************************************************/
+static void node_load( node_t* node )
+{
+  state = node->state;
+  anchor_network = node->anchor_network;
+  anchor_local = node->anchor_local;
+  skew = node->skew;
+  beacon_valid = node->beacon_valid;
+  beacon_sequence = node->beacon_sequence;
+  beacon_rx_time = node->beacon_rx_time;
+}
+
+/*******************************************************************************
+ * @fn     void node_save( node_t* node )
+ * @brief  Keep what timesync.c learned for node
+ * ****************************************************************************/
+static void node_save( node_t* node )
+{
+  node->state = state;
+  node->anchor_network = anchor_network;
+  node->anchor_local = anchor_local;
+  node->skew = skew;
+  node->beacon_valid = beacon_valid;
+  node->beacon_sequence = beacon_sequence;
+  node->beacon_rx_time = beacon_rx_time;
+}
+
+/*******************************************************************************
+ * @fn     uint32_t local_clock( const node_t* node, double ticks )
+ * @brief  A node's 32-bit clock, ticks coordinator ticks from now
+ * ****************************************************************************/
+static uint32_t local_clock( const node_t* node, double ticks )
+{
+  return (uint32_t)(uint64_t)( node->local + ticks * ( 1.0 + node->rate ) );
+}
+
+/*******************************************************************************
+ * @fn     double rx_latency( const scenario_t* scenario )
+ * @brief  How long after the packet ends the receive timestamp is taken
+ * ****************************************************************************/
+static double rx_latency( const scenario_t* scenario )
+{
+  double latency = uniform() * scenario->jitter;
+
+  if( uniform() < scenario->late )
+  {
+    latency += uniform() * scenario->late_ticks;
+  }
+
+  return latency;
+}
+
+/*******************************************************************************
+ * @fn     int compare_doubles( const void* a, const void* b )
+ * @brief  qsort() order
+ * ****************************************************************************/
+static int compare_doubles( const void* a, const void* b )
+{
+  double difference = *(const double*)a - *(const double*)b;
+
+  return ( difference > 0 ) - ( difference < 0 );
+}
+
+/*******************************************************************************
+ * @fn     void run_scenario( const scenario_t* scenario )
+ * @brief  BEACONS beacon intervals of one scenario
+ * ****************************************************************************/
+static void run_scenario( const scenario_t* scenario )
+{
+  static double skews[BEACONS * SCENES_PER_BEACON];
+  uint32_t total_skews = 0;
+  uint32_t missed = 0;
+  uint32_t beacon;
+  uint32_t scene;
+  uint32_t index;
+  double network = uniform() * 4294967296.0;
+  double previous_tx = 0;
+  double earliest;
+  double latest;
+  double sent;
+  double at;
+  uint32_t applied;
+  uint32_t local_apply;
+  node_t* node;
+
+  srand( 1 );
+
+  for( index = 0; index < NODES; index++ )
+  {
+    node = &nodes[index];
+    memset( node, 0, sizeof(node_t) );
+    node->local = uniform() * 4294967296.0;
+    node->rate = ( uniform() * 2 - 1 ) * scenario->rate_error;
+
+    node_load( node );
+    timesync_reset();
+    node_save( node );
+  }
+
+  for( beacon = 0; beacon < BEACONS; beacon++ )
+  {
+    // Beacon goes out now, carrying the previous one's transmit time
+    for( index = 0; index < NODES; index++ )
+    {
+      node = &nodes[index];
+      if( uniform() < scenario->loss )
+      {
+        continue;
+      }
+
+      node_load( node );
+      timesync_beacon( beacon, (uint32_t)(uint64_t)previous_tx,
+                            local_clock( node, rx_latency( scenario ) ) );
+      node_save( node );
+    }
+    previous_tx = network;
+
+    // Scenes spread over the interval
+    for( scene = 0; scene < SCENES_PER_BEACON; scene++ )
+    {
+      sent = BEACON_TICKS * ( scene + 0.5 ) / SCENES_PER_BEACON;
+      earliest = INFINITY;
+      latest = -INFINITY;
+      applied = 0;
+
+      for( index = 0; index < NODES; index++ )
+      {
+        node = &nodes[index];
+        if( uniform() < scenario->loss )
+        {
+          continue;
+        }
+
+        node_load( node );
+        if( !timesync_synced() )
+        {
+          continue;
+        }
+
+        // Apply time in local ticks, and when this node's clock gets there
+        local_apply = timesync_to_local( (uint32_t)(uint64_t)( network + sent +
+                                                          SCENE_LEAD_TICKS ) );
+        at = sent + (int32_t)( local_apply - local_clock( node, sent ) ) /
+                                                          ( 1.0 + node->rate );
+
+        earliest = fmin( earliest, at );
+        latest = fmax( latest, at );
+        applied++;
+      }
+
+      if( applied > 1 )
+      {
+        skews[total_skews++] = ( latest - earliest ) / TICKS_PER_US;
+      }
+      else if( beacon > 10 )
+      {
+        missed++;
+      }
+    }
+
+    // On to the next beacon, DCOs wander a little
+    network += BEACON_TICKS;
+    for( index = 0; index < NODES; index++ )
+    {
+      node = &nodes[index];
+      node->local += BEACON_TICKS * ( 1.0 + node->rate );
+      node->rate += ( uniform() * 2 - 1 ) * scenario->rate_walk;
+    }
+  }
+
+  qsort( skews, total_skews, sizeof(double), compare_doubles );
+
+  if( verbose )
+  {
+    printf( "%-28s skew p50 %6.1fus  p99 %6.1fus  max %7.1fus "
+            "(%u scenes)\n", scenario->what, skews[total_skews / 2],
+            skews[total_skews * 99 / 100], skews[total_skews - 1],
+            total_skews );
+  }
+
+  if( ( total_skews < BEACONS * SCENES_PER_BEACON / 2 ) ||
+      ( skews[total_skews * 99 / 100] > scenario->max_p99_us ) )
+  {
+    fprintf( stderr, "FAIL: %s, p99 skew %.1fus over %u scenes, %u missed\n",
+              scenario->what, skews[total_skews * 99 / 100], total_skews,
+              missed );
+    failures++;
+  }
+}
+
+int main( int argc, char** argv )
+{
+  static const scenario_t scenarios[] =
+  {
+    // what                     rate   walk   loss  jitter late  late  p99
+    { "calibrated DCOs",        0.02,  0,     0.1,  80,    0,    0,    50 },
+    { "DCOs wandering",         0.02,  20e-6, 0.1,  80,    0,    0,    100 },
+    { "half the packets lost",  0.02,  20e-6, 0.5,  80,    0,    0,    400 },
+    { "late timestamps (5%)",   0.02,  20e-6, 0.1,  80,    0.05, 8000, 150 },
+    { "5% rate error",          0.05,  0,     0.1,  80,    0,    0,    50 },
+  };
+  uint32_t index;
+
+  verbose = ( argc > 1 ) && !strcmp( argv[1], "-v" );
+
+  if( verbose )
+  {
+    printf( "%d nodes, beacons every %.0fms, scenes %.0fms ahead\n", NODES,
+            BEACON_TICKS / TICKS_PER_US / 1000,
+            SCENE_LEAD_TICKS / TICKS_PER_US / 1000 );
+  }
+
+  for( index = 0; index < sizeof(scenarios) / sizeof(scenarios[0]); index++ )
+  {
+    run_scenario( &scenarios[index] );
+  }
+
+  printf( "timesync_sim: %s\n", failures ? "FAILED" : "passed" );
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,534 @@
+/** @file txqueue_sim.c
+*
+* @brief Queue latency percentiles of lib/txqueue.c against sending in call
+*        order, at a range of offered loads
+*
+* A controller sends three kinds of messages over one 250kbps link:
+*
+*   doorbell    TXQUEUE_URGENT, DOORBELL_PER_SECOND at random times
+*   status      TXQUEUE_NORMAL, STATUS_PER_SECOND at random times
+*   RGB         TXQUEUE_BULK, one color per fixture, keyed by fixture, every
+*               fixture updated at a rate set by the offered load
+*
+* The offered load is the airtime every message asks for over the time
+* there is, so above 1 the link can't keep up and something has to give.
+* Every packet costs its preamble, sync word, header and CRC on the air, and
+* a turnaround. Messages arrive while a packet is on the air like they would
+* from an ISR, and the main loop sends whatever is queued once it's done.
+*
+* txqueue.c is compared to a FIFO of the same length that sends in call
+* order and drops new messages when it's full, which is what calling
+* cc2500_tx_packet() as messages come amounts to once they queue up. Latency
+* is from the send call to the end of the packet on the air. RGB messages
+* replaced by a newer color for the same fixture count as superseded, not
+* lost, the fixture got a newer color instead.
+*
+* Passes if a doorbell event never waits for more than the packet on the
+* air and the doorbell events ahead of it, is never dropped, and at
+* overload waits less than in the FIFO. Before that, a keyed bulk message
+* replacing an urgent one with the same key has to go out as urgent.
+*
+* usage: txqueue_sim [-v]
+*   -v  Print the latency percentiles of every class at every load
+*
+* @author Alvaro Prieto
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "txqueue.h"
+#include "device.h"
+
+// Preamble, sync word, length, address and CRC
+#define OVERHEAD_BYTES (4 + 4 + 1 + 1 + 2)
+#define BYTE_S (8.0 / 250000.0)
+
+// Idle to TX, with the calibration, per packet
+#define TURNAROUND_S (0.0008)
+
+#define SECONDS (20.0)
+
+#define FIXTURES (8)
+#define DOORBELL_PER_SECOND (5.0)
+#define STATUS_PER_SECOND (20.0)
+
+// [id][id][data...]
+#define DOORBELL_LENGTH (4)
+#define STATUS_LENGTH (8)
+#define RGB_LENGTH (5)
+
+#define DOORBELL_ADDRESS (0x10)
+#define STATUS_ADDRESS (0x11)
+#define FIXTURE_ADDRESS (0x20)
+
+#define MAX_MESSAGES (65536)
+
+// Kinds of traffic, in TXQUEUE priority order
+#define KIND_DOORBELL (TXQUEUE_URGENT)
+#define KIND_STATUS   (TXQUEUE_NORMAL)
+#define KIND_RGB      (TXQUEUE_BULK)
+#define KINDS         (TXQUEUE_PRIORITIES)
+
+typedef struct
+{
+  const char* what;
+  uint8_t (*send)( uint8_t*, uint8_t, uint8_t, uint8_t, uint8_t );
+  void (*poll)( void );
+  uint8_t (*count)( void );
+} queue_t;
+
+typedef struct
+{
+  uint32_t offered;
+  uint32_t sent;
+  uint32_t refused;         // Send call returned 0
+  uint32_t late;            // Sent after their deadline
+  double latencies[MAX_MESSAGES];
+} kind_result_t;
+
+static const char* kind_names[KINDS] = { "doorbell", "status", "RGB" };
+
+static uint32_t failures;
+
+static double now;
+static double end;
+static double next_arrival[KINDS];
+static double rgb_period;
+static uint8_t next_fixture;
+
+static double queued_at[MAX_MESSAGES];
+static double deadline[MAX_MESSAGES];
+static uint8_t message_kind[MAX_MESSAGES];
+static uint16_t next_id;
+
+static kind_result_t results[KINDS];
+static const queue_t* queue;
+
+// Packets sent while test_replace() runs, destination and first byte
+static uint8_t capture;
+static uint8_t captured;
+static uint8_t captured_packets[TXQUEUE_LENGTH][2];
+
+/*******************************************************************************
+ * @fn     uint32_t random_next( void )
+ * @brief  xorshift32, so every queue sees the same traffic
+ * ****************************************************************************/
+static uint32_t random_state = 2463534242u;
+
+static uint32_t random_next( void )
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+
+  return random_state;
+}
+
+/*******************************************************************************
+ * @fn     double uniform( void )
+ * @brief  Random number in (0, 1)
+ * ****************************************************************************/
+static double uniform( void )
+{
+  return ( random_next() + 0.5 ) / 4294967296.0;
+}
+
+/*******************************************************************************
+ * @fn     double airtime( uint8_t length )
+ * @brief  Seconds a packet with length payload bytes takes, turnaround
+ *         included
+ * ****************************************************************************/
+static double airtime( uint8_t length )
+{
+  return ( OVERHEAD_BYTES + length ) * BYTE_S + TURNAROUND_S;
+}
+
+/*******************************************************************************
+ * @fn     void arrive( uint8_t kind )
+ * @brief  The next message of a kind, sent the way the application would
+ * ****************************************************************************/
+static void arrive( uint8_t kind )
+{
+  uint8_t buffer[TXQUEUE_PAYLOAD];
+  uint8_t length;
+  uint8_t destination;
+  uint8_t key = TXQUEUE_NO_KEY;
+  uint16_t id = next_id++;
+
+  queued_at[id] = now;
+  deadline[id] = end;
+  message_kind[id] = kind;
+
+  memset( buffer, 0, sizeof(buffer) );
+  buffer[0] = id >> 8;
+  buffer[1] = id & 0xFF;
+
+  switch( kind )
+  {
+    case KIND_DOORBELL:
+      length = DOORBELL_LENGTH;
+      destination = DOORBELL_ADDRESS;
+
+      // The longest packet that can be on the air, the doorbell events
+      // queued before this one, then this one
+      deadline[id] = now + airtime( STATUS_LENGTH ) + ( 1 +
+            results[kind].offered - results[kind].refused - results[kind].sent )
+                                                * airtime( DOORBELL_LENGTH );
+      next_arrival[kind] += -log( uniform() ) / DOORBELL_PER_SECOND;
+      break;
+
+    case KIND_STATUS:
+      length = STATUS_LENGTH;
+      destination = STATUS_ADDRESS;
+      next_arrival[kind] += -log( uniform() ) / STATUS_PER_SECOND;
+      break;
+
+    default:
+      // Fixtures in turn, each one keyed so a newer color replaces its own
+      length = RGB_LENGTH;
+      destination = FIXTURE_ADDRESS + next_fixture;
+      key = 1 + next_fixture;
+      next_fixture = ( next_fixture + 1 ) % FIXTURES;
+      next_arrival[kind] += rgb_period / FIXTURES;
+      break;
+  }
+
+  results[kind].offered++;
+
+  if( !queue->send( buffer, length, destination, kind, key ) )
+  {
+    results[kind].refused++;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void arrive_until( double until )
+ * @brief  Every message sent before until, in order
+ * ****************************************************************************/
+static void arrive_until( double until )
+{
+  uint8_t kind;
+  uint8_t next;
+
+  for( ;; )
+  {
+    next = 0;
+    for( kind = 1; kind < KINDS; kind++ )
+    {
+      if( next_arrival[kind] < next_arrival[next] )
+      {
+        next = kind;
+      }
+    }
+
+    if( ( next_arrival[next] > until ) || ( next_arrival[next] >= end ) )
+    {
+      break;
+    }
+
+    now = next_arrival[next];
+    arrive( next );
+  }
+
+  now = until;
+}
+
+/*******************************************************************************
+ * @fn     void cc2500_tx_packet( uint8_t* buffer, uint8_t length,
+ *                                                    uint8_t destination )
+ * @brief  Takes the packet's airtime, with messages arriving meanwhile
+ * ****************************************************************************/
+void cc2500_tx_packet( uint8_t* buffer, uint8_t length, uint8_t destination )
+{
+  uint16_t id;
+  kind_result_t* result;
+
+  if( capture )
+  {
+    if( captured < TXQUEUE_LENGTH )
+    {
+      captured_packets[captured][0] = destination;
+      captured_packets[captured][1] = buffer[0];
+      captured++;
+    }
+    return;
+  }
+
+  id = ( buffer[0] << 8 ) | buffer[1];
+  result = &results[message_kind[id]];
+
+  arrive_until( now + airtime( length ) );
+
+  result->latencies[result->sent++] = now - queued_at[id];
+
+  if( now > deadline[id] + 1e-9 )
+  {
+    result->late++;
+  }
+}
+
+/*******************************************************************************
+ * FIFO in call order, what sending as messages come amounts to
+ * ****************************************************************************/
+typedef struct
+{
+  uint8_t destination;
+  uint8_t length;
+  uint8_t payload[TXQUEUE_PAYLOAD];
+} fifo_entry_t;
+
+static fifo_entry_t fifo[TXQUEUE_LENGTH];
+static uint8_t fifo_first;
+static uint8_t fifo_used;
+
+static uint8_t fifo_send( uint8_t* buffer, uint8_t length,
+                          uint8_t destination, uint8_t priority, uint8_t key )
+{
+  fifo_entry_t* entry;
+
+  if( fifo_used == TXQUEUE_LENGTH )
+  {
+    return 0;
+  }
+
+  entry = &fifo[( fifo_first + fifo_used++ ) % TXQUEUE_LENGTH];
+  entry->destination = destination;
+  entry->length = length;
+  memcpy( entry->payload, buffer, length );
+
+  return 1;
+}
+
+static void fifo_poll( void )
+{
+  fifo_entry_t entry;
+
+  while( fifo_used )
+  {
+    entry = fifo[fifo_first];
+    fifo_first = ( fifo_first + 1 ) % TXQUEUE_LENGTH;
+    fifo_used--;
+
+    cc2500_tx_packet( entry.payload, entry.length, entry.destination );
+  }
+}
+
+static uint8_t fifo_count( void )
+{
+  return fifo_used;
+}
+
+/*******************************************************************************
+ * @fn     int compare( const void* a, const void* b )
+ * @brief  qsort() order of latencies
+ * ****************************************************************************/
+static int compare( const void* a, const void* b )
+{
+  double difference = *(const double*)a - *(const double*)b;
+
+  return ( difference > 0 ) - ( difference < 0 );
+}
+
+/*******************************************************************************
+ * @fn     double percentile( kind_result_t* result, double fraction )
+ * @brief  Latency at a fraction of the sorted latencies, 0 without any
+ * ****************************************************************************/
+static double percentile( kind_result_t* result, double fraction )
+{
+  uint32_t index;
+
+  if( 0 == result->sent )
+  {
+    return 0;
+  }
+
+  index = (uint32_t)( fraction * ( result->sent - 1 ) + 0.5 );
+
+  return result->latencies[index];
+}
+
+/*******************************************************************************
+ * @fn     double offered_load( double rgb_per_second )
+ * @brief  Airtime asked for per second of time
+ * ****************************************************************************/
+static double offered_load( double rgb_per_second )
+{
+  return DOORBELL_PER_SECOND * airtime( DOORBELL_LENGTH ) +
+          STATUS_PER_SECOND * airtime( STATUS_LENGTH ) +
+          rgb_per_second * airtime( RGB_LENGTH );
+}
+
+/*******************************************************************************
+ * @fn     void run( const queue_t* which, double load )
+ * @brief  SECONDS of traffic at an offered load through a queue, into
+ *         results, with the latencies sorted
+ * ****************************************************************************/
+static void run( const queue_t* which, double load )
+{
+  double rgb_per_second;
+  uint8_t kind;
+
+  // RGB takes whatever the load leaves after the other two
+  rgb_per_second = ( load - offered_load( 0 ) ) / airtime( RGB_LENGTH );
+  rgb_period = FIXTURES / rgb_per_second;
+
+  queue = which;
+  memset( results, 0, sizeof(results) );
+  random_state = 2463534242u;
+  next_id = 0;
+  next_fixture = 0;
+  now = 0;
+  end = SECONDS;
+
+  for( kind = 0; kind < KINDS; kind++ )
+  {
+    next_arrival[kind] = uniform() * 0.01;
+  }
+
+  // The main loop: send what's queued, or wait for something to be
+  while( now < end )
+  {
+    if( queue->count() )
+    {
+      queue->poll();
+    }
+    else
+    {
+      arrive_until( now + 0.0001 );
+    }
+  }
+
+  for( kind = 0; kind < KINDS; kind++ )
+  {
+    qsort( results[kind].latencies, results[kind].sent, sizeof(double),
+                                                                  compare );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void test_replace( void )
+ * @brief  An urgent keyed message, a normal one, then a bulk message with
+ *         the urgent one's destination and key. The bulk contents have to
+ *         go out first, in the urgent message's place.
+ * ****************************************************************************/
+static void test_replace( void )
+{
+  uint8_t urgent[] = { 'u' };
+  uint8_t normal[] = { 'n' };
+  uint8_t bulk[] = { 'b' };
+
+  capture = 1;
+  captured = 0;
+
+  txqueue_send( urgent, sizeof(urgent), DOORBELL_ADDRESS, TXQUEUE_URGENT, 1 );
+  txqueue_send( normal, sizeof(normal), STATUS_ADDRESS, TXQUEUE_NORMAL,
+                                                            TXQUEUE_NO_KEY );
+  txqueue_send( bulk, sizeof(bulk), DOORBELL_ADDRESS, TXQUEUE_BULK, 1 );
+  txqueue_poll();
+
+  capture = 0;
+
+  if( ( 2 != captured ) || ( DOORBELL_ADDRESS != captured_packets[0][0] ) ||
+      ( 'b' != captured_packets[0][1] ) ||
+      ( STATUS_ADDRESS != captured_packets[1][0] ) )
+  {
+    fprintf( stderr, "FAIL: a bulk message replacing an urgent one didn't "
+                                                      "go out first\n" );
+    failures++;
+  }
+}
+
+int main( int argc, char** argv )
+{
+  static const double loads[] = { 0.3, 0.6, 0.9, 1.2, 2.0 };
+  static const queue_t queues[] =
+  {
+    { "FIFO",     fifo_send,    fifo_poll,    fifo_count },
+    { "txqueue",  txqueue_send, txqueue_poll, txqueue_count },
+  };
+  double doorbell_p99[sizeof(queues) / sizeof(queues[0])];
+  kind_result_t* result;
+  uint8_t load;
+  uint8_t index;
+  uint8_t kind;
+  int verbose = ( argc > 1 ) && !strcmp( argv[1], "-v" );
+
+  sim_reset();
+
+  test_replace();
+
+  if( verbose )
+  {
+    printf( "%d fixtures, %.0f doorbell and %.0f status messages/s, "
+            "queue of %d, latency in ms\n", FIXTURES, DOORBELL_PER_SECOND,
+                                          STATUS_PER_SECOND, TXQUEUE_LENGTH );
+    printf( "%5s %-8s %-9s %8s %8s %8s %8s %8s %8s %8s\n", "load", "queue",
+            "class", "offered", "refused", "replaced", "p50", "p90", "p99",
+                                                                    "max" );
+  }
+
+  for( load = 0; load < sizeof(loads) / sizeof(loads[0]); load++ )
+  {
+    for( index = 0; index < sizeof(queues) / sizeof(queues[0]); index++ )
+    {
+      run( &queues[index], loads[load] );
+
+      for( kind = 0; kind < KINDS; kind++ )
+      {
+        result = &results[kind];
+
+        if( verbose )
+        {
+          // Neither sent nor refused: replaced, or pushed out by a more
+          // urgent message (txqueue_dropped() counts both of those)
+          printf( "%5.1f %-8s %-9s %8u %8u %8u %8.2f %8.2f %8.2f %8.2f\n",
+                  loads[load], queues[index].what, kind_names[kind],
+                  result->offered, result->refused,
+                  result->offered - result->refused - result->sent,
+                  percentile( result, 0.5 ) * 1000,
+                  percentile( result, 0.9 ) * 1000,
+                  percentile( result, 0.99 ) * 1000,
+                  percentile( result, 1.0 ) * 1000 );
+        }
+      }
+
+      doorbell_p99[index] = percentile( &results[KIND_DOORBELL], 0.99 );
+
+      if( txqueue_send != queues[index].send )
+      {
+        continue;
+      }
+
+      result = &results[KIND_DOORBELL];
+
+      if( result->refused || ( result->sent < result->offered ) )
+      {
+        fprintf( stderr, "FAIL: load %.1f: %u of %u doorbell events sent\n",
+                            loads[load], result->sent, result->offered );
+        failures++;
+      }
+
+      if( result->late )
+      {
+        fprintf( stderr, "FAIL: load %.1f: %u doorbell events waited for "
+                          "more than the packet on the air\n", loads[load],
+                                                              result->late );
+        failures++;
+      }
+    }
+
+    if( ( loads[load] > 1.0 ) && ( doorbell_p99[1] >= doorbell_p99[0] ) )
+    {
+      fprintf( stderr, "FAIL: load %.1f: doorbell p99 %.2fms with txqueue, "
+                "%.2fms in call order\n", loads[load], doorbell_p99[1] * 1000,
+                                                      doorbell_p99[0] * 1000 );
+      failures++;
+    }
+  }
+
+  printf( "txqueue_sim: %s\n", failures ? "FAILED" : "passed" );
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,265 @@
+/** @file aggregate.c
+*
+* @brief Pack short messages for the same destination into one AGGREGATE
+*        packet, up to a latency deadline
+*
+* Every packet costs the preamble, sync word, length, address, CRC and the
+* radio turnaround, which is more than a doorbell event or an RGB triplet
+* itself. aggregate_send() holds messages back and appends them to a
+* pending packet for their destination, and the packet goes out when the
+* next message doesn't fit or when aggregate_poll() finds its oldest message
+* has waited the deadline. A packet that only ever got one message goes out
+* as that message, without the AGGREGATE header.
+*
+* Times are whatever ticks the caller uses (scheduler_time(), a free running
+* timer), as long as the deadline is in the same ones. A deadline of 0 sends
+* every message right away.
+*
+* On the receiving end, pass AGGREGATE packets to aggregate_unpack(), which
+* hands each message to a handler in the order they were sent, formatted
+* like a packet of its own (address, message, RSSI and LQI), so the usual
+* rx_callback or dispatch_callback() can take them.
+*
+* @author Alvaro Prieto
+*/
+#include "aggregate.h"
+#include "cc2500.h"
+#include <string.h>
+
+// Packet byte with the type, after the address
+#define TYPE_FIELD (1)
+
+// RSSI and LQI after the packet
+#define STATUS_LENGTH (2)
+
+// Length byte before each message
+#define MESSAGE_HEADER_LENGTH (1)
+
+#if ( AGGREGATE_PAYLOAD + 1 ) > CC2500_MAX_PACKET_LENGTH
+#error AGGREGATE_PAYLOAD is too long for a packet
+#endif
+
+typedef struct
+{
+  uint8_t destination;
+  uint8_t messages;         // 0 when the slot is free
+  uint8_t length;           // Bytes used in buffer, header included
+  uint32_t since;           // When the first message was added
+  uint8_t buffer[AGGREGATE_PAYLOAD];
+} pending_t;
+
+static pending_t pending[AGGREGATE_DESTINATIONS];
+
+static uint32_t deadline = 0;
+
+// Unpacked message, as a packet of its own
+static uint8_t message_buffer[CC2500_BUFFER_LENGTH];
+
+static pending_t* find_pending( uint8_t );
+static void send_pending( pending_t* );
+
+/*******************************************************************************
+ * @fn     void aggregate_setup( uint32_t max_delay )
+ * @brief  Drop anything pending and hold messages back for at most max_delay
+ *         ticks from now on
+ * ****************************************************************************/
+void aggregate_setup( uint32_t max_delay )
+{
+  uint8_t index;
+
+  deadline = max_delay;
+
+  for( index = 0; index < AGGREGATE_DESTINATIONS; index++ )
+  {
+    pending[index].messages = 0;
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t aggregate_send( uint8_t* message, uint8_t length,
+ *                                      uint8_t destination, uint32_t now )
+ * @brief  Queue a message (starting with its type byte) for destination.
+ *         Returns 0 if it's too long to ever fit in an AGGREGATE packet,
+ *         send those with cc2500_tx_packet(). Call from the main loop.
+ * ****************************************************************************/
+uint8_t aggregate_send( uint8_t* message, uint8_t length, uint8_t destination,
+                                                                uint32_t now )
+{
+  pending_t* slot;
+
+  if( ( 0 == length ) || ( ( AGGREGATE_HEADER_LENGTH + MESSAGE_HEADER_LENGTH +
+                                            length ) > AGGREGATE_PAYLOAD ) )
+  {
+    return 0;
+  }
+
+  slot = find_pending( destination );
+
+  if( slot->messages &&
+          ( ( slot->length + MESSAGE_HEADER_LENGTH + length ) >
+                                                        AGGREGATE_PAYLOAD ) )
+  {
+    send_pending( slot );
+  }
+
+  if( 0 == slot->messages )
+  {
+    slot->destination = destination;
+    slot->since = now;
+    slot->buffer[0] = AGGREGATE;
+    slot->length = AGGREGATE_HEADER_LENGTH;
+  }
+
+  slot->buffer[slot->length] = length;
+  memcpy( &slot->buffer[slot->length + MESSAGE_HEADER_LENGTH], message, length );
+  slot->length += MESSAGE_HEADER_LENGTH + length;
+  slot->messages++;
+
+  if( 0 == deadline )
+  {
+    send_pending( slot );
+  }
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     void aggregate_poll( uint32_t now )
+ * @brief  Send the packets whose oldest message has waited the deadline.
+ *         Call it from the main loop at least that often.
+ * ****************************************************************************/
+void aggregate_poll( uint32_t now )
+{
+  uint8_t index;
+
+  for( index = 0; index < AGGREGATE_DESTINATIONS; index++ )
+  {
+    if( pending[index].messages &&
+                        ( ( now - pending[index].since ) >= deadline ) )
+    {
+      send_pending( &pending[index] );
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void aggregate_flush( void )
+ * @brief  Send everything pending now (before sleeping for a long time)
+ * ****************************************************************************/
+void aggregate_flush( void )
+{
+  uint8_t index;
+
+  for( index = 0; index < AGGREGATE_DESTINATIONS; index++ )
+  {
+    if( pending[index].messages )
+    {
+      send_pending( &pending[index] );
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t aggregate_unpack( uint8_t* buffer, uint8_t length,
+ *                                  uint8_t (*handler)( uint8_t*, uint8_t ) )
+ * @brief  Pass each message of a received AGGREGATE packet (as given to
+ *         rx_callback) to handler, in order. Returns nonzero if any handler
+ *         did. Stops at the first message that runs past the packet.
+ * ****************************************************************************/
+uint8_t aggregate_unpack( uint8_t* buffer, uint8_t length,
+                                      uint8_t (*handler)( uint8_t*, uint8_t ) )
+{
+  uint8_t index = TYPE_FIELD + AGGREGATE_HEADER_LENGTH;
+  uint8_t message_length;
+  uint8_t wake = 0;
+
+  if( ( length <= TYPE_FIELD ) || ( AGGREGATE != buffer[TYPE_FIELD] ) )
+  {
+    return 0;
+  }
+
+  while( ( index + MESSAGE_HEADER_LENGTH ) < length )
+  {
+    message_length = buffer[index];
+    index += MESSAGE_HEADER_LENGTH;
+
+    if( ( 0 == message_length ) || ( ( index + message_length ) > length ) )
+    {
+      break;
+    }
+
+    // [address][message][RSSI][LQI], like any other packet
+    message_buffer[0] = buffer[0];
+    memcpy( &message_buffer[1], &buffer[index], message_length );
+    memcpy( &message_buffer[1 + message_length], &buffer[length],
+                                                              STATUS_LENGTH );
+
+    if( handler( message_buffer, 1 + message_length ) )
+    {
+      wake = 1;
+    }
+
+    index += message_length;
+  }
+
+  return wake;
+}
+
+/*******************************************************************************
+ * @fn     pending_t* find_pending( uint8_t destination )
+ * @brief  Pending packet for destination. If there isn't one and every slot
+ *         is taken, the oldest packet is sent to make room.
+ * ****************************************************************************/
+static pending_t* find_pending( uint8_t destination )
+{
+  uint8_t index;
+  pending_t* free_slot = 0;
+  pending_t* oldest = 0;
+
+  for( index = 0; index < AGGREGATE_DESTINATIONS; index++ )
+  {
+    if( 0 == pending[index].messages )
+    {
+      free_slot = &pending[index];
+    }
+    else if( destination == pending[index].destination )
+    {
+      return &pending[index];
+    }
+    else if( ( 0 == oldest ) ||
+                  ( (int32_t)( pending[index].since - oldest->since ) < 0 ) )
+    {
+      oldest = &pending[index];
+    }
+  }
+
+  if( free_slot )
+  {
+    return free_slot;
+  }
+
+  send_pending( oldest );
+
+  return oldest;
+}
+
+/*******************************************************************************
+ * @fn     void send_pending( pending_t* slot )
+ * @brief  Send a pending packet and free its slot. A single message goes out
+ *         on its own, without the AGGREGATE header.
+ * ****************************************************************************/
+static void send_pending( pending_t* slot )
+{
+  if( 1 == slot->messages )
+  {
+    cc2500_tx_packet( &slot->buffer[AGGREGATE_HEADER_LENGTH +
+                MESSAGE_HEADER_LENGTH], slot->buffer[AGGREGATE_HEADER_LENGTH],
+                                                          slot->destination );
+  }
+  else
+  {
+    cc2500_tx_packet( slot->buffer, slot->length, slot->destination );
+  }
+
+  slot->messages = 0;
+}
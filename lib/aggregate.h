@@ -0,0 +1,31 @@
+/** @file aggregate.h
+*
+* @brief Pack short messages for the same destination into one AGGREGATE
+*        packet, up to a latency deadline
+*
+* @author Alvaro Prieto
+*/
+#ifndef _AGGREGATE_H
+#define _AGGREGATE_H
+
+#include <stdint.h>
+
+// Destinations with messages waiting at the same time, at most
+#ifndef AGGREGATE_DESTINATIONS
+#define AGGREGATE_DESTINATIONS (2)
+#endif
+
+// Largest AGGREGATE packet, without the length and address bytes. 30 fits
+// a CC2500_FEC_PACKET_LENGTH frame, up to CC2500_MAX_PACKET_LENGTH - 1
+// without FEC.
+#ifndef AGGREGATE_PAYLOAD
+#define AGGREGATE_PAYLOAD (30)
+#endif
+
+void aggregate_setup( uint32_t );
+uint8_t aggregate_send( uint8_t*, uint8_t, uint8_t, uint32_t );
+void aggregate_poll( uint32_t );
+void aggregate_flush( void );
+uint8_t aggregate_unpack( uint8_t*, uint8_t, uint8_t (*)( uint8_t*, uint8_t ) );
+
+#endif /* _AGGREGATE_H */
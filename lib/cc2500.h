@@ -9,9 +9,72 @@
 #define _CC2500_H
 
 #include <stdint.h>
+#include "packet.h"
 
 #define CC2500_BUFFER_LENGTH 64
 
+// Largest length byte the radio accepts (PKTLEN in writeRFSettings)
+#define CC2500_MAX_PACKET_LENGTH (61)
+
+// Frame size in FEC mode, from the address to the last padding byte. The
+// radio only does FEC with fixed length packets, so every packet is this
+// long on the air, with the real length in the second byte. At most 62.
+#ifndef CC2500_FEC_PACKET_LENGTH
+#define CC2500_FEC_PACKET_LENGTH (32)
+#endif
+
+// Destination that every node accepts, even with addressing enabled
+#define BROADCAST_ADDRESS (0x00)
+
+// Time to wait after entering RX on a new channel before the RSSI reading is
+// valid when sweeping (about 200us at 16MHz)
+#ifndef CC2500_SCAN_SETTLE_CYCLES
+#define CC2500_SCAN_SETTLE_CYCLES (3200)
+#endif
+
+// Entries in the PATABLE power level table, from -55dBm (level 0) to +1dBm
+#define CC2500_POWER_LEVELS (18)
+
+// Subtracted from RSSI/2 to get dBm (datasheet RSSI offset at 250kbps)
+#define CC2500_RSSI_OFFSET (72)
+
+// Modem profiles for cc2500_set_profile(), slowest (longest range) first.
+// Every node starts on CC2500_PROFILE_DEFAULT, the writeRFSettings() one.
+#define CC2500_PROFILE_2K4   (0)      // 2.4kbps 2-FSK
+#define CC2500_PROFILE_10K   (1)      // 10kbps 2-FSK
+#define CC2500_PROFILE_250K  (2)      // 250kbps MSK
+#define CC2500_PROFILE_500K  (3)      // 500kbps MSK
+#define CC2500_PROFILES      (4)
+#define CC2500_PROFILE_DEFAULT CC2500_PROFILE_250K
+
+// Status register bits cleared when rx_callback asks to wake the processor.
+// Everything by default, so it wakes from any low power mode.
+#ifndef CC2500_WAKE_BITS
+#define CC2500_WAKE_BITS (LPM4_bits)
+#endif
+
+// Radio power states, see cc2500_state() and cc2500_residency(). The radio
+// is only ever idle on the way between these.
+#define CC2500_STATE_SLEEP (0)
+#define CC2500_STATE_RX    (1)
+#define CC2500_STATE_TX    (2)
+#define CC2500_STATE_COUNT (3)
+
+// Define CC2500_RESIDENCY to count the time spent in each power state
+// (cc2500_residency()), and CC2500_IDLE_TIMEOUT for cc2500_power_poll() to
+// put the radio to sleep when nothing has been sent or received in a while.
+// Both need cc2500_set_clock(), and cost RAM and a clock read on every state
+// change and packet, so they're off by default.
+
+// Define CC2500_NESTED_RX_ISR to let other interrupts in while a packet is
+// read and handed to rx_callback, for timing critical outputs like servo
+// pulses. rx_callback must not transmit when it's defined.
+
+// Define CC2500_GROUPS to the number of multicast groups a node can join
+// (cc2500_join_group()). Each one is a byte of RAM, so it's off by default.
+// Membership is a list of that many addresses, not a 256 bit map: 4 groups
+// are 4 bytes instead of 32 on parts with 256 bytes of RAM.
+
 #ifndef DEVICE_ADDRESS
 #define DEVICE_ADDRESS 0x00
 #error Device address not set!
@@ -22,34 +85,61 @@ void cc2500_tx( uint8_t*, uint8_t );
 
 void cc2500_tx_packet( uint8_t*, uint8_t, uint8_t );
 
+void cc2500_set_clock( uint32_t (*)( void ) );
+uint32_t cc2500_rx_timestamp( );
+uint32_t cc2500_tx_timestamp( );
+
 void cc2500_set_address( uint8_t );
 void cc2500_set_channel( uint8_t );
 void cc2500_set_power( uint8_t );
+void cc2500_set_power_level( uint8_t );
+void cc2500_set_power_dbm( int8_t );
+int8_t cc2500_power_level_dbm( uint8_t );
+int16_t cc2500_rssi_dbm( uint8_t );
+
+void cc2500_set_tx_hook( void (*)( uint8_t ) );
+
+void cc2500_set_profile( uint8_t );
+uint8_t cc2500_profile( );
+
+void cc2500_enable_fec( );
+void cc2500_disable_fec( );
+
+uint8_t cc2500_set_network_id( uint8_t );
+void cc2500_enable_whitening( );
+void cc2500_disable_whitening( );
 
 void cc2500_sleep( );
+void cc2500_wakeup( );
+uint8_t cc2500_state( );
+#ifdef CC2500_IDLE_TIMEOUT
+void cc2500_set_idle_timeout( uint32_t );
+void cc2500_power_poll( );
+#endif
+#ifdef CC2500_RESIDENCY
+uint32_t cc2500_residency( uint8_t );
+void cc2500_clear_residency( );
+#endif
 
 void cc2500_enable_addressing();
 void cc2500_disable_addressing();
 
-void writeRFSettings(void);
+#ifdef CC2500_GROUPS
+uint8_t cc2500_join_group( uint8_t );
+void cc2500_leave_group( uint8_t );
+uint8_t cc2500_group_member( uint8_t );
+#endif
 
-/**
- * Packet header structure. The packet length byte is omitted, since the receive
- * function strips it away. Also, the cc2500_tx_packet function inserts it
- * automatically.
- */
-typedef struct
-{
-  uint8_t destination;  // Packet destination
-  uint8_t source;       // Packet source
-  uint8_t type;         // Packet Type
-  uint8_t flags;        // Misc flags
-} packet_header_t;
-
-//
-// Packet Type Definitions (todo)
-//
-#define IO_CHANGE (0x01)
+void cc2500_enable_sniffer();
+void cc2500_disable_sniffer();
 
+void cc2500_scan_calibrate( uint8_t, uint8_t, uint8_t, uint8_t* );
+void cc2500_scan( uint8_t, uint8_t, uint8_t, const uint8_t*, uint8_t* );
+
+void cc2500_stage_reg( uint8_t, uint8_t );
+void cc2500_flush_config( );
+uint8_t cc2500_read_config( uint8_t );
+
+void writeRFSettings(void);
 
 #endif /* _CC2500_H */
@@ -14,173 +14,1381 @@
 #define ADDRESS_FIELD (1)
 #define DATA_FIELD    (2)
 
+// MARCSTATE value when the radio is idle
+#define MARCSTATE_IDLE (0x01)
+#define MARCSTATE_MASK (0x1F)
+
+// Most MARCSTATE reads wait_idle() does. Well past a calibration (809us) at
+// any SPI clock, in case the radio never gets there.
+#define WAIT_IDLE_POLLS (1000)
+
+// MCSM0.FS_AUTOCAL bits
+#define FS_AUTOCAL_MASK (0x30)
+
+// PKTCTRL0.LENGTH_CONFIG and MDMCFG1.FEC_EN
+#define LENGTH_CONFIG_MASK (0x03)
+#define LENGTH_FIXED       (0x00)
+#define LENGTH_VARIABLE    (0x01)
+#define FEC_EN             (0x80)
+
+// PKTCTRL1.ADR_CHK
+#define ADR_CHK_MASK       (0x03)
+#define ADR_CHK_BROADCAST  (0x02)
+#define ADR_CHK_BOTH       (0x03)     // 0x00 and 0xFF broadcasts
+
+// Group the radio can check for itself, as its second broadcast address
+#define HARDWARE_GROUP     (0xFF)
+
+// PKTCTRL0.WHITE_DATA
+#define WHITE_DATA         (0x40)
+
+// Sync word for network 0, the radio's reset value
+#define BASE_SYNC          (0xD391)
+
+// Preamble bit pattern, sync words too close to it can trigger on preambles
+#define PREAMBLE_BITS      (0xAAAA)
+
+#if ( CC2500_FEC_PACKET_LENGTH > 62 ) || ( CC2500_FEC_PACKET_LENGTH < 3 )
+#error CC2500_FEC_PACKET_LENGTH must fit in the FIFO with the status bytes
+#endif
+
 static uint8_t dummy_callback( uint8_t*, uint8_t );
+static uint32_t dummy_clock( void );
+static void dummy_tx_hook( uint8_t );
+static void transmit( void );
+static void set_state( uint8_t );
+static void write_fixed( uint8_t, uint8_t*, uint8_t );
+static uint8_t receive_fixed( uint8_t*, uint8_t*, uint8_t );
+static void apply_config( void );
+static void update_address_check( void );
+static void wait_idle( void );
+#ifdef CC2500_GROUPS
+static uint8_t accept_address( uint8_t );
+static uint8_t drop_unwanted( uint8_t*, uint8_t, uint8_t );
+#endif
 uint8_t receive_packet( uint8_t*, uint8_t* );
 
-// Receive buffer
-static uint8_t p_rx_buffer[CC2500_BUFFER_LENGTH];
-static uint8_t p_tx_buffer[CC2500_BUFFER_LENGTH];
+// Receive buffer
+static uint8_t p_rx_buffer[CC2500_BUFFER_LENGTH];
+
+// Holds pointers to all callback functions for CCR registers (and overflow)
+static uint8_t (*rx_callback)( uint8_t*, uint8_t ) = dummy_callback;
+
+// When set, packets with bad CRC are also passed to rx_callback
+static uint8_t sniffer_mode = 0;
+
+// Only packets for this node, broadcasts and joined groups get through
+// (writeRFSettings() turns address checking on)
+static uint8_t addressing = 1;
+
+#ifdef CC2500_GROUPS
+// Multicast groups this node is in. While there are any but HARDWARE_GROUP,
+// the radio accepts every address and receive_packet() filters instead.
+// A list rather than a 256 bit map: a node is in a handful of groups, so this
+// is a few bytes instead of 32, and looking through it is a few compares
+// next to the SPI reads of the same packet.
+static uint8_t groups[CC2500_GROUPS];
+static volatile uint8_t group_count = 0;
+#endif
+
+// When set, packets are sent and received with FEC and fixed length framing
+static uint8_t fec_mode = 0;
+
+// Fills fixed length frames
+static const uint8_t padding[CC2500_FEC_PACKET_LENGTH] = { 0 };
+
+// Local clock used to timestamp packets
+static uint32_t (*local_clock)( void ) = dummy_clock;
+static uint32_t rx_timestamp;
+static uint32_t tx_timestamp;
+
+// Called with the destination before every packet is sent
+static void (*tx_hook)( uint8_t ) = dummy_tx_hook;
+
+// Power state
+static volatile uint8_t radio_state = CC2500_STATE_RX;
+
+#ifdef CC2500_RESIDENCY
+// Time spent in each power state, in local clock ticks
+static uint32_t residency[CC2500_STATE_COUNT];
+static uint32_t state_since;
+#endif
+
+#ifdef CC2500_IDLE_TIMEOUT
+// Time of the last packet, in local clock ticks
+static volatile uint32_t last_activity;
+static uint32_t idle_timeout = 0;
+#endif
+
+// PATABLE is lost in SLEEP, written back by cc2500_wakeup()
+static uint8_t pa_power = 0xFB;               // 0 dBm
+
+// Address the radio checks, for the software filter in the ISR
+static uint8_t node_address = 0x01;
+
+#ifdef CC2500_SHADOW
+// Configuration registers staged in cc_shadow, but not written yet
+static uint8_t dirty_first = TI_CCxxx0_CONFIG_REGISTERS;
+static uint8_t dirty_last = 0;
+
+// FSCAL3-1 change under the radio's own calibration, so the shadow only
+// holds the right values once they've been staged. Bit n is FSCAL3 + n.
+static uint8_t fscal_staged = 0;
+#endif
+
+// TEST2-0, also lost in SLEEP
+static const uint8_t test_settings[3] = { 0x88, 0x31, 0x0B };
+
+//
+// Optimum PATABLE levels according to Table 31 on CC2500 datasheet
+//
+static const uint8_t power_table[CC2500_POWER_LEVELS] = {
+                              0x00, 0x50, 0x44, 0xC0, // -55, -30, -28, -26 dBm
+                              0x84, 0x81, 0x46, 0x93, // -24, -22, -20, -18 dBm
+                              0x55, 0x8D, 0xC6, 0x97, // -16, -14, -12, -10 dBm
+                              0x6E, 0x7F, 0xA9, 0xBB, // -8,  -6,  -4,  -2  dBm
+                              0xFE, 0xFF };           //  0,   1            dBm
+
+//
+// Modem registers that change between profiles, from SmartRF Studio's
+// recommended settings for each data rate (26MHz crystal)
+//
+static const uint8_t profile_registers[] = {
+                              TI_CCxxx0_FSCTRL1,  TI_CCxxx0_MDMCFG4,
+                              TI_CCxxx0_MDMCFG3,  TI_CCxxx0_MDMCFG2,
+                              TI_CCxxx0_DEVIATN,  TI_CCxxx0_FOCCFG,
+                              TI_CCxxx0_BSCFG,    TI_CCxxx0_AGCCTRL2,
+                              TI_CCxxx0_AGCCTRL1, TI_CCxxx0_AGCCTRL0,
+                              TI_CCxxx0_FREND1 };
+
+static const uint8_t profile_values[CC2500_PROFILES][sizeof(profile_registers)] = {
+    { 0x06, 0x86, 0x83, 0x03, 0x44, 0x16, 0x6C, 0x03, 0x40, 0x91, 0x56 },// 2.4k
+    { 0x06, 0x78, 0x93, 0x03, 0x44, 0x16, 0x6C, 0x43, 0x40, 0x91, 0x56 },// 10k
+    { 0x07, 0x2D, 0x3B, 0x73, 0x00, 0x1D, 0x1C, 0xC7, 0x00, 0xB2, 0xB6 },// 250k
+    { 0x10, 0x0E, 0x3B, 0x73, 0x00, 0x1D, 0x1C, 0xC7, 0x40, 0xB0, 0xB6 } // 500k
+};
+
+static uint8_t current_profile = CC2500_PROFILE_DEFAULT;
+
+//
+// Extended Hamming (8,4) codewords. Each nibble of a network ID picks one, so
+// the sync words of any two networks differ in at least 4 of their 16 bits
+// (8 of the 32 sent with 30/32 sync detection).
+//
+static const uint8_t network_code[16] = {
+                              0x00, 0xB1, 0xD2, 0x63, 0xE4, 0x55, 0x36, 0x87,
+                              0x78, 0xC9, 0xAA, 0x1B, 0x9C, 0x2D, 0x4E, 0xFF };
+
+static const int8_t power_dbm[CC2500_POWER_LEVELS] = {
+                              -55, -30, -28, -26, -24, -22, -20, -18,
+                              -16, -14, -12, -10,  -8,  -6,  -4,  -2,
+                                0,   1 };
+
+/*******************************************************************************
+ * @fn     void setup_radio( uint8_t (*callback)(void) )
+ * @brief  Initialize radio and register Rx Callback function
+ * ****************************************************************************/
+void setup_cc2500( uint8_t (*callback)(uint8_t*, uint8_t) )
+{
+  // Set-up rx_callback function
+  rx_callback = callback;
+
+  spi_setup();                         // Initialize SPI port
+
+  cc_powerup_reset();               // Reset CCxxxx
+
+  wait_cycles(500);  // Wait for device to reset (Not sure why this is needed)
+
+#ifdef CC2500_SHADOW
+  // Start the shadow from the reset values, writeRFSettings() doesn't set
+  // every register
+  cc_read_burst_reg( TI_CCxxx0_IOCFG2, cc_shadow, TI_CCxxx0_CONFIG_REGISTERS );
+#endif
+
+  writeRFSettings();                        // Write RF settings to config reg
+  cc_write_burst_reg( TI_CCxxx0_PATABLE, &pa_power, 1);//Write PATABLE
+
+  cc_strobe(TI_CCxxx0_SRX);           // Initialize CCxxxx in RX mode.
+                                            // When a pkt is received, it will
+                                            // signal on GDO0 and wake CPU
+
+  // Configure GDO0 port
+  GDO0_PxIES |= GDO0_PIN;       // Int on falling edge (end of pkt)
+  GDO0_PxIFG &= ~GDO0_PIN;      // Clear flag
+  GDO0_PxIE |= GDO0_PIN;        // Enable int on end of packet
+
+}
+
+/*******************************************************************************
+ * @fn     cc2500_tx( uint8_t* p_buffer, uint8_t length )
+ * @brief  Send raw message through radio
+ * ****************************************************************************/
+void cc2500_tx( uint8_t* p_buffer, uint8_t length )
+{
+  if( fec_mode && ( ( length < DATA_FIELD ) ||
+                                    ( length > CC2500_FEC_PACKET_LENGTH ) ) )
+  {
+    // Doesn't fit in a frame
+    return;
+  }
+
+  cc2500_wakeup();
+
+  if( length > ADDRESS_FIELD )
+  {
+    tx_hook( p_buffer[ADDRESS_FIELD] );
+  }
+
+  GDO0_PxIE &= ~GDO0_PIN;          // Disable interrupt
+
+  if( fec_mode )
+  {
+    write_fixed( p_buffer[ADDRESS_FIELD], &p_buffer[DATA_FIELD],
+                                                        length - DATA_FIELD );
+  }
+  else
+  {
+    cc_write_burst_reg(TI_CCxxx0_TXFIFO, p_buffer, length); // Write TX data
+  }
+
+  transmit();
+}
+
+/*******************************************************************************
+ * @fn     void transmit( void )
+ * @brief  Send whatever is in the TX FIFO and wait for it to go out. GDO0
+ *         interrupts must already be disabled.
+ * ****************************************************************************/
+static void transmit( void )
+{
+  volatile int i;
+
+  set_state( CC2500_STATE_TX );
+
+  cc_strobe(TI_CCxxx0_STX);           // Change state to TX, initiating
+                                            // data transfer
+
+// sometimes the chip hangs on while(!(GDO0_PxIN&GDO0_PIN)); line, see http://alvarop.com/2011/12/cc2500-project-part-1/#comment-467755523
+  for (i=0;i<10000 && !(GDO0_PxIN&GDO0_PIN);i++); // Wait GDO0 to go hi or timeout -> sync TX'ed
+
+  tx_timestamp = local_clock();
+
+  for (i=0;i<10000 && (GDO0_PxIN&GDO0_PIN);i++);  // Wait GDO0 to clear or timeout -> end of pkt
+//no used anymore
+//  while (!(GDO0_PxIN&GDO0_PIN));
+                                            // Wait GDO0 to go hi -> sync TX'ed
+//  while (GDO0_PxIN&GDO0_PIN);
+                                            // Wait GDO0 to clear -> end of pkt
+  GDO0_PxIFG &= ~GDO0_PIN;      // After pkt TX, this flag is set.
+                                            // Has to be cleared before existing
+
+  // Back in RX (MCSM1.TXOFF_MODE)
+  set_state( CC2500_STATE_RX );
+
+  GDO0_PxIFG &= ~GDO0_PIN;          // Clear flag
+  GDO0_PxIE |= GDO0_PIN;            // Enable interrupt
+}
+
+/*******************************************************************************
+ * @fn     void cc2500_tx_packet( uint8_t* p_buffer, uint8_t length,
+ *                                                        uint8_t destination )
+ * @brief  Send packet through radio. Takes care of adding length and
+ *         destination to packet.
+ * ****************************************************************************/
+void cc2500_tx_packet( uint8_t* p_buffer, uint8_t length, uint8_t destination )
+{
+  uint8_t header[DATA_FIELD];
+
+  if( fec_mode && ( ( length + DATA_FIELD ) > CC2500_FEC_PACKET_LENGTH ) )
+  {
+    // Doesn't fit in a frame
+    return;
+  }
+
+  // Add one to packet length account for address byte
+  header[LENGTH_FIELD] = length + 1;
+
+  // Insert destination address to buffer
+  header[ADDRESS_FIELD] = destination;
+
+  cc2500_wakeup();
+
+  tx_hook( destination );
+
+  GDO0_PxIE &= ~GDO0_PIN;          // Disable interrupt
+
+  if( fec_mode )
+  {
+    write_fixed( destination, p_buffer, length );
+  }
+  else
+  {
+    // Write the header and the message straight into the TX FIFO, one after
+    // the other, instead of copying them into a RAM buffer first
+    cc_write_burst_reg( TI_CCxxx0_TXFIFO, header, DATA_FIELD );
+    cc_write_burst_reg( TI_CCxxx0_TXFIFO, p_buffer, length );
+  }
+
+  transmit();
+}
+
+/*******************************************************************************
+ * @fn     void write_fixed( uint8_t address, uint8_t* payload, uint8_t count )
+ * @brief  Write a fixed length (FEC mode) frame to the TX FIFO:
+ *         [address][length][payload][padding]. The address goes first so
+ *         the radio's address check still works, the length counts the
+ *         address like the variable length byte does.
+ * ****************************************************************************/
+static void write_fixed( uint8_t address, uint8_t* payload, uint8_t count )
+{
+  uint8_t header[DATA_FIELD];
+
+  header[0] = address;
+  header[1] = count + 1;
+
+  cc_write_burst_reg( TI_CCxxx0_TXFIFO, header, DATA_FIELD );
+
+  if( count )
+  {
+    cc_write_burst_reg( TI_CCxxx0_TXFIFO, payload, count );
+  }
+
+  if( ( count + DATA_FIELD ) < CC2500_FEC_PACKET_LENGTH )
+  {
+    cc_write_burst_reg( TI_CCxxx0_TXFIFO, (uint8_t*)padding,
+                                  CC2500_FEC_PACKET_LENGTH - DATA_FIELD - count );
+  }
+}
+
+/*******************************************************************************
+ * @fn     cc2500_set_address( uint8_t );
+ * @brief  Set device address
+ * ****************************************************************************/
+void cc2500_set_address( uint8_t address )
+{
+  cc2500_wakeup();
+
+  cc_write_reg( TI_CCxxx0_ADDR, address );
+  node_address = address;
+}
+
+/*******************************************************************************
+ * @fn     cc2500_set_clock( uint32_t (*clock_function)( void ) );
+ * @brief  Register a function that returns the local time. Packets are
+ *         timestamped with it, see cc2500_rx_timestamp() and
+ *         cc2500_tx_timestamp(). It's called from the radio ISR.
+ * ****************************************************************************/
+void cc2500_set_clock( uint32_t (*clock_function)( void ) )
+{
+  local_clock = clock_function;
+
+  // Start counting from the new clock
+#ifdef CC2500_RESIDENCY
+  state_since = local_clock();
+#endif
+#ifdef CC2500_IDLE_TIMEOUT
+  last_activity = local_clock();
+#endif
+}
+
+/*******************************************************************************
+ * @fn     uint32_t cc2500_rx_timestamp( );
+ * @brief  Local time at which the last received packet ended. Meant to be
+ *         called from rx_callback.
+ * ****************************************************************************/
+uint32_t cc2500_rx_timestamp()
+{
+  return rx_timestamp;
+}
+
+/*******************************************************************************
+ * @fn     uint32_t cc2500_tx_timestamp( );
+ * @brief  Local time at which the sync word of the last transmitted packet
+ *         went out
+ * ****************************************************************************/
+uint32_t cc2500_tx_timestamp()
+{
+  return tx_timestamp;
+}
+
+/*******************************************************************************
+ * @fn     cc2500_set_channel( uint8_t );
+ * @brief  Set device channel
+ * ****************************************************************************/
+void cc2500_set_channel( uint8_t channel )
+{
+  cc2500_wakeup();
+
+  cc_write_reg( TI_CCxxx0_CHANNR, channel );
+}
+
+/*******************************************************************************
+ * @fn     cc2500_set_power( uint8_t );
+ * @brief  Set device transmit power. A sleeping radio gets it when it wakes
+ *         up.
+ * ****************************************************************************/
+void cc2500_set_power( uint8_t power )
+{
+  if( power == pa_power )
+  {
+    return;
+  }
+
+  pa_power = power;
+
+  if( CC2500_STATE_SLEEP != radio_state )
+  {
+    // Set TX power
+    cc_write_burst_reg(TI_CCxxx0_PATABLE, &pa_power, 1 );
+  }
+}
+
+/*******************************************************************************
+ * @fn     cc2500_set_power_level( uint8_t level );
+ * @brief  Set transmit power from the power table, 0 (-55dBm) to
+ *         CC2500_POWER_LEVELS - 1 (+1dBm)
+ * ****************************************************************************/
+void cc2500_set_power_level( uint8_t level )
+{
+  if( level >= CC2500_POWER_LEVELS )
+  {
+    level = CC2500_POWER_LEVELS - 1;
+  }
+
+  cc2500_set_power( power_table[level] );
+}
+
+/*******************************************************************************
+ * @fn     cc2500_set_power_dbm( int8_t dbm );
+ * @brief  Set the highest transmit power at or below dbm (or the lowest one)
+ * ****************************************************************************/
+void cc2500_set_power_dbm( int8_t dbm )
+{
+  uint8_t level = CC2500_POWER_LEVELS - 1;
+
+  while( level && ( power_dbm[level] > dbm ) )
+  {
+    level--;
+  }
+
+  cc2500_set_power_level( level );
+}
+
+/*******************************************************************************
+ * @fn     int8_t cc2500_power_level_dbm( uint8_t level );
+ * @brief  Output power of a power table level, in dBm
+ * ****************************************************************************/
+int8_t cc2500_power_level_dbm( uint8_t level )
+{
+  if( level >= CC2500_POWER_LEVELS )
+  {
+    level = CC2500_POWER_LEVELS - 1;
+  }
+
+  return power_dbm[level];
+}
+
+/*******************************************************************************
+ * @fn     int16_t cc2500_rssi_dbm( uint8_t rssi );
+ * @brief  Convert a raw RSSI reading (register or appended status byte) to dBm
+ * ****************************************************************************/
+int16_t cc2500_rssi_dbm( uint8_t rssi )
+{
+  return (int8_t)rssi / 2 - CC2500_RSSI_OFFSET;
+}
+
+/*******************************************************************************
+ * @fn     cc2500_set_tx_hook( void (*hook)( uint8_t destination ) );
+ * @brief  Register a function that's called with the destination address
+ *         right before each packet is sent, e.g. to pick the transmit power
+ *         for it. It may run from the radio ISR if rx_callback transmits.
+ * ****************************************************************************/
+void cc2500_set_tx_hook( void (*hook)( uint8_t ) )
+{
+  tx_hook = hook;
+}
+
+/*******************************************************************************
+ * @fn     cc2500_enable_addressing( );
+ * @brief  Enable address checking with 0x00 as a broadcast address
+ * ****************************************************************************/
+void cc2500_enable_addressing()
+{
+  addressing = 1;
+
+  update_address_check();
+}
+
+/*******************************************************************************
+ * @fn     cc2500_disable_addressing( );
+ * @brief  Disable address checking
+ * ****************************************************************************/
+void cc2500_disable_addressing()
+{
+  addressing = 0;
+
+  update_address_check();
+}
+
+#ifdef CC2500_GROUPS
+/*******************************************************************************
+ * @fn     uint8_t cc2500_join_group( uint8_t group );
+ * @brief  Also receive packets sent to group, a multicast address no node
+ *         uses as its own. Only matters with addressing enabled. Returns 0 if
+ *         the node is already in CC2500_GROUPS groups.
+ *
+ *         The radio can only check for 0xFF itself. Any other group turns its
+ *         address check off, so every packet on the channel interrupts. The
+ *         ISR reads the address byte of each and flushes the ones for other
+ *         addresses without reading the rest (see drop_unwanted()).
+ * ****************************************************************************/
+uint8_t cc2500_join_group( uint8_t group )
+{
+  if( cc2500_group_member( group ) )
+  {
+    return 1;
+  }
+
+  if( group_count >= CC2500_GROUPS )
+  {
+    return 0;
+  }
+
+  // Entry first, so the ISR never filters with the hardware check off and
+  // the group missing
+  groups[group_count] = group;
+  group_count++;
+
+  update_address_check();
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     cc2500_leave_group( uint8_t group );
+ * @brief  Stop receiving packets sent to group
+ * ****************************************************************************/
+void cc2500_leave_group( uint8_t group )
+{
+  uint8_t index;
+  uint8_t interrupts_enabled;
+
+  for( index = 0; index < group_count; index++ )
+  {
+    if( group == groups[index] )
+    {
+      break;
+    }
+  }
+
+  if( index == group_count )
+  {
+    return;
+  }
+
+  // Last entry into its place, without the ISR looking at the list halfway
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  groups[index] = groups[group_count - 1];
+  group_count--;
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+
+  update_address_check();
+}
+
+/*******************************************************************************
+ * @fn     uint8_t cc2500_group_member( uint8_t group );
+ * @brief  Nonzero if this node joined group
+ * ****************************************************************************/
+uint8_t cc2500_group_member( uint8_t group )
+{
+  uint8_t index;
+
+  for( index = 0; index < group_count; index++ )
+  {
+    if( group == groups[index] )
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+#endif
+
+/*******************************************************************************
+ * @fn     void update_address_check( void )
+ * @brief  Let the radio check addresses when only the node address,
+ *         broadcasts and HARDWARE_GROUP are wanted, otherwise accept
+ *         everything and leave the group check to receive_packet()
+ * ****************************************************************************/
+static void update_address_check( void )
+{
+  uint8_t tmp_reg;
+
+  cc2500_wakeup();
+
+  tmp_reg = ( cc2500_read_config( TI_CCxxx0_PKTCTRL1 ) & ~ADR_CHK_MASK );
+
+  if( addressing )
+  {
+#ifdef CC2500_GROUPS
+    if( 0 == group_count )
+    {
+      tmp_reg |= ADR_CHK_BROADCAST;
+    }
+    else if( ( 1 == group_count ) && ( HARDWARE_GROUP == groups[0] ) )
+    {
+      tmp_reg |= ADR_CHK_BOTH;
+    }
+#else
+    tmp_reg |= ADR_CHK_BROADCAST;
+#endif
+  }
+
+  cc_write_reg( TI_CCxxx0_PKTCTRL1, tmp_reg );
+}
+
+#ifdef CC2500_GROUPS
+/*******************************************************************************
+ * @fn     uint8_t accept_address( uint8_t address )
+ * @brief  Nonzero if a packet for address is wanted. Only needed when the
+ *         radio isn't checking addresses itself.
+ * ****************************************************************************/
+static uint8_t accept_address( uint8_t address )
+{
+  if( sniffer_mode || !addressing )
+  {
+    return 1;
+  }
+
+  return ( BROADCAST_ADDRESS == address ) ||
+          ( node_address == address ) ||
+          cc2500_group_member( address );
+}
+
+/*******************************************************************************
+ * @fn     uint8_t drop_unwanted( uint8_t* p_buffer, uint8_t rx_bytes,
+ *                                                        uint8_t remaining )
+ * @brief  Called with the address of a packet in p_buffer[0], and the rest
+ *         of it (remaining bytes, status included) still in the RX FIFO.
+ *         Returns nonzero if it's for an address this node doesn't want, once
+ *         it's gone.
+ *
+ *         The FIFO is flushed rather than read out, which is SIDLE, SFRX and
+ *         SRX without FS_AUTOCAL (the synthesizer is still calibrated for the
+ *         channel): about 130us in the ISR and 140us deaf, instead of up to
+ *         560us of SPI reads for a long packet. If another packet is behind
+ *         this one (rx_bytes, what's left in the FIFO, is more than
+ *         remaining) or coming in (GDO0 high), flushing would lose it too,
+ *         so this one is read out instead.
+ * ****************************************************************************/
+static uint8_t drop_unwanted( uint8_t* p_buffer, uint8_t rx_bytes,
+                                                            uint8_t remaining )
+{
+  uint8_t mcsm0;
+
+  if( accept_address( p_buffer[0] ) )
+  {
+    return 0;
+  }
+
+  // From the radio, the shadow might hold a value that isn't flushed yet.
+  // Read before looking at GDO0 so a sync can't slip in between that and
+  // SIDLE.
+  mcsm0 = cc_read_reg( TI_CCxxx0_MCSM0 );
+
+  if( ( rx_bytes > remaining ) || ( GDO0_PxIN & GDO0_PIN ) )
+  {
+    cc_read_burst_reg( TI_CCxxx0_RXFIFO, p_buffer, remaining );
+    return 1;
+  }
+
+  cc_strobe( TI_CCxxx0_SIDLE );
+  wait_idle();
+  cc_strobe( TI_CCxxx0_SFRX );
+
+  cc_write_reg( TI_CCxxx0_MCSM0, mcsm0 & ~FS_AUTOCAL_MASK );
+  cc_strobe( TI_CCxxx0_SRX );
+  cc_write_reg( TI_CCxxx0_MCSM0, mcsm0 );
+
+  return 1;
+}
+#endif
+
+/*******************************************************************************
+ * @fn     cc2500_enable_sniffer( );
+ * @brief  Receive every packet on the channel. Disables address checking and
+ *         CRC autoflush, so packets that fail the CRC check are passed to the
+ *         rx callback too. Check the CRC_OK bit in the appended LQI byte.
+ * ****************************************************************************/
+void cc2500_enable_sniffer()
+{
+  uint8_t tmp_reg;
+
+  cc2500_wakeup();
+
+  // Clear CRC_AUTOFLUSH and ADR_CHK
+  tmp_reg = ( cc2500_read_config( TI_CCxxx0_PKTCTRL1 ) & ~0x0B );
+
+  cc_write_reg( TI_CCxxx0_PKTCTRL1, tmp_reg );
+
+  sniffer_mode = 1;
+  addressing = 0;
+}
+
+/*******************************************************************************
+ * @fn     cc2500_disable_sniffer( );
+ * @brief  Go back to dropping packets with bad CRC. Address checking stays
+ *         disabled, call cc2500_enable_addressing() to turn it back on.
+ * ****************************************************************************/
+void cc2500_disable_sniffer()
+{
+  uint8_t tmp_reg;
+
+  cc2500_wakeup();
+
+  // Set CRC_AUTOFLUSH
+  tmp_reg = ( cc2500_read_config( TI_CCxxx0_PKTCTRL1 ) | 0x08 );
+
+  cc_write_reg( TI_CCxxx0_PKTCTRL1, tmp_reg );
+
+  sniffer_mode = 0;
+}
+
+/*******************************************************************************
+ * @fn     cc2500_stage_reg( uint8_t addr, uint8_t value );
+ * @brief  Change a configuration register in the shadow only. Staged
+ *         registers go out together with the next cc2500_flush_config().
+ *         Without CC2500_SHADOW there's nowhere to keep them, so they're
+ *         written right away.
+ * ****************************************************************************/
+void cc2500_stage_reg( uint8_t addr, uint8_t value )
+{
+#ifndef CC2500_SHADOW
+  uint8_t interrupts_enabled;
+#endif
+
+  if( addr >= TI_CCxxx0_CONFIG_REGISTERS )
+  {
+    return;
+  }
+
+#ifdef CC2500_SHADOW
+  if( ( addr >= TI_CCxxx0_FSCAL3 ) && ( addr <= TI_CCxxx0_FSCAL1 ) )
+  {
+    fscal_staged |= 1 << ( addr - TI_CCxxx0_FSCAL3 );
+  }
+  else if( cc_shadow[addr] == value )
+  {
+    // Already in the radio
+    return;
+  }
+
+  cc_shadow[addr] = value;
+
+  if( addr < dirty_first )
+  {
+    dirty_first = addr;
+  }
+
+  if( addr > dirty_last )
+  {
+    dirty_last = addr;
+  }
+#else
+  cc2500_wakeup();
+
+  // The radio ISR uses the SPI port too
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  cc_write_reg( addr, value );
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+#endif
+}
+
+/*******************************************************************************
+ * @fn     cc2500_flush_config( );
+ * @brief  Write every staged register to the radio in a single burst, from
+ *         the first one that changed to the last
+ * ****************************************************************************/
+void cc2500_flush_config( )
+{
+#ifdef CC2500_SHADOW
+  uint8_t calibration[3];
+  uint8_t in_burst = 0;
+  uint8_t index;
+
+  if( dirty_first > dirty_last )
+  {
+    return;
+  }
+
+  cc2500_wakeup();
+
+  for( index = 0; index < 3; index++ )
+  {
+    if( ( ( TI_CCxxx0_FSCAL3 + index ) >= dirty_first ) &&
+                              ( ( TI_CCxxx0_FSCAL3 + index ) <= dirty_last ) )
+    {
+      in_burst |= 1 << index;
+    }
+  }
+
+  // Calibration results caught in the middle of the burst go back as they
+  // are now, not as they were last written
+  if( in_burst & ~fscal_staged )
+  {
+    cc_read_burst_reg( TI_CCxxx0_FSCAL3, calibration, 3 );
+
+    for( index = 0; index < 3; index++ )
+    {
+      if( !( fscal_staged & ( 1 << index ) ) )
+      {
+        cc_shadow[TI_CCxxx0_FSCAL3 + index] = calibration[index];
+      }
+    }
+  }
+
+  cc_write_burst_reg( dirty_first, &cc_shadow[dirty_first],
+                                                  dirty_last - dirty_first + 1 );
+
+  dirty_first = TI_CCxxx0_CONFIG_REGISTERS;
+  dirty_last = 0;
+  fscal_staged = 0;
+#endif
+}
+
+/*******************************************************************************
+ * @fn     uint8_t cc2500_read_config( uint8_t addr );
+ * @brief  Configuration register value from the shadow, no SPI transfer.
+ *         FSCAL3-1 hold the last value written, read the radio for the
+ *         current calibration. Read from the radio without CC2500_SHADOW.
+ * ****************************************************************************/
+uint8_t cc2500_read_config( uint8_t addr )
+{
+#ifndef CC2500_SHADOW
+  uint8_t value;
+  uint8_t interrupts_enabled;
+#endif
+
+  if( addr >= TI_CCxxx0_CONFIG_REGISTERS )
+  {
+    return 0;
+  }
+
+#ifdef CC2500_SHADOW
+  return cc_shadow[addr];
+#else
+  cc2500_wakeup();
+
+  // The radio ISR uses the SPI port too
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  value = cc_read_reg( addr );
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+
+  return value;
+#endif
+}
+
+/*******************************************************************************
+ * @fn     void wait_idle( void )
+ * @brief  Wait for the radio state machine to reach IDLE, or give up after
+ *         WAIT_IDLE_POLLS reads
+ * ****************************************************************************/
+static void wait_idle( void )
+{
+  uint16_t polls = 0;
+
+  while( ( ( cc_read_status( TI_CCxxx0_MARCSTATE ) & MARCSTATE_MASK )
+                  != MARCSTATE_IDLE ) && ( ++polls < WAIT_IDLE_POLLS ) );
+}
+
+/*******************************************************************************
+ * @fn     cc2500_set_profile( uint8_t profile );
+ * @brief  Switch modem profile (data rate and modulation). The changed
+ *         registers go out in one burst and the synthesizer recalibrates on
+ *         the way back into RX. Anything being received is lost.
+ * ****************************************************************************/
+void cc2500_set_profile( uint8_t profile )
+{
+  uint8_t index;
+
+  if( ( profile >= CC2500_PROFILES ) || ( profile == current_profile ) )
+  {
+    return;
+  }
+
+  for( index = 0; index < sizeof(profile_registers); index++ )
+  {
+    cc2500_stage_reg( profile_registers[index], profile_values[profile][index] );
+  }
+
+  current_profile = profile;
+
+  apply_config();
+}
+
+/*******************************************************************************
+ * @fn     uint8_t cc2500_profile( );
+ * @brief  Modem profile in use
+ * ****************************************************************************/
+uint8_t cc2500_profile( )
+{
+  return current_profile;
+}
+
+/*******************************************************************************
+ * @fn     cc2500_enable_fec( );
+ * @brief  Send and receive with forward error correction and interleaving.
+ *         Switches to fixed length frames of CC2500_FEC_PACKET_LENGTH bytes,
+ *         the only framing the radio does FEC with. cc2500_tx() and
+ *         cc2500_tx_packet() drop packets that don't fit, rx_callback sees
+ *         the same layout as without FEC. Every node in the link has to be
+ *         in the same mode.
+ * ****************************************************************************/
+void cc2500_enable_fec( )
+{
+  cc2500_stage_reg( TI_CCxxx0_PKTLEN, CC2500_FEC_PACKET_LENGTH );
+  cc2500_stage_reg( TI_CCxxx0_PKTCTRL0,
+    ( cc2500_read_config( TI_CCxxx0_PKTCTRL0 ) & ~LENGTH_CONFIG_MASK ) |
+                                                                LENGTH_FIXED );
+  cc2500_stage_reg( TI_CCxxx0_MDMCFG1,
+                              cc2500_read_config( TI_CCxxx0_MDMCFG1 ) | FEC_EN );
+
+  fec_mode = 1;
+
+  apply_config();
+}
+
+/*******************************************************************************
+ * @fn     cc2500_disable_fec( );
+ * @brief  Back to variable length packets without FEC
+ * ****************************************************************************/
+void cc2500_disable_fec( )
+{
+  cc2500_stage_reg( TI_CCxxx0_PKTLEN, CC2500_MAX_PACKET_LENGTH );
+  cc2500_stage_reg( TI_CCxxx0_PKTCTRL0,
+    ( cc2500_read_config( TI_CCxxx0_PKTCTRL0 ) & ~LENGTH_CONFIG_MASK ) |
+                                                              LENGTH_VARIABLE );
+  cc2500_stage_reg( TI_CCxxx0_MDMCFG1,
+                            cc2500_read_config( TI_CCxxx0_MDMCFG1 ) & ~FEC_EN );
+
+  fec_mode = 0;
 
-// Holds pointers to all callback functions for CCR registers (and overflow)
-static uint8_t (*rx_callback)( uint8_t*, uint8_t ) = dummy_callback;
+  apply_config();
+}
 
-//
-// Optimum PATABLE levels according to Table 31 on CC2500 datasheet
-//
-/*static const uint8_t power_table[] = {
-                              0x00, 0x50, 0x44, 0xC0, // -55, -30, -28, -26 dBm
-                              0x84, 0x81, 0x46, 0x93, // -24, -22, -20, -18 dBm
-                              0x55, 0x8D, 0xC6, 0x97, // -16, -14, -12, -10 dBm
-                              0x6E, 0x7F, 0xA9, 0xBB, // -8,  -6,  -4,  -2  dBm
-                              0xFE, 0xFF };           //  0,   1            dBm
-*/
+/*******************************************************************************
+ * @fn     uint8_t cc2500_set_network_id( uint8_t id );
+ * @brief  Use the sync word of network id, so the radio ignores packets from
+ *         other networks on the same channel before they cause an interrupt.
+ *         Network 0 is the radio's default sync word. Returns 0 (and leaves
+ *         the sync word alone) for the few IDs whose sync word would be too
+ *         unbalanced or too close to the preamble pattern, pick another one.
+ * ****************************************************************************/
+uint8_t cc2500_set_network_id( uint8_t id )
+{
+  uint16_t sync;
+  uint16_t bits;
+  uint8_t ones = 0;
+  uint8_t preamble_distance = 0;
+
+  sync = BASE_SYNC ^ ( ( network_code[id >> 4] << 8 ) | network_code[id & 0x0F] );
+
+  for( bits = 1; bits; bits <<= 1 )
+  {
+    if( sync & bits )
+    {
+      ones++;
+    }
+
+    if( ( sync ^ PREAMBLE_BITS ) & bits )
+    {
+      preamble_distance++;
+    }
+  }
+
+  // The preamble is the same pattern shifted by one bit
+  if( preamble_distance > 8 )
+  {
+    preamble_distance = 16 - preamble_distance;
+  }
+
+  if( ( ones < 5 ) || ( ones > 11 ) || ( preamble_distance < 4 ) )
+  {
+    return 0;
+  }
+
+  cc2500_stage_reg( TI_CCxxx0_SYNC1, sync >> 8 );
+  cc2500_stage_reg( TI_CCxxx0_SYNC0, sync & 0xFF );
+
+  apply_config();
+
+  return 1;
+}
 
 /*******************************************************************************
- * @fn     void setup_radio( uint8_t (*callback)(void) )
- * @brief  Initialize radio and register Rx Callback function
+ * @fn     cc2500_enable_whitening( );
+ * @brief  Whiten packet data with the radio's PN9 sequence, so long runs of
+ *         equal bits don't upset the receiver. The seed is fixed in the
+ *         radio. Every node in the network has to do the same.
  * ****************************************************************************/
-void setup_cc2500( uint8_t (*callback)(uint8_t*, uint8_t) )
+void cc2500_enable_whitening( )
 {
-  uint8_t initial_power = 0xFB;				// 0 dBm
+  cc2500_stage_reg( TI_CCxxx0_PKTCTRL0,
+                        cc2500_read_config( TI_CCxxx0_PKTCTRL0 ) | WHITE_DATA );
 
-  // Set-up rx_callback function
-  rx_callback = callback;
+  apply_config();
+}
 
-  spi_setup();                         // Initialize SPI port
+/*******************************************************************************
+ * @fn     cc2500_disable_whitening( );
+ * @brief  Send packet data as it is
+ * ****************************************************************************/
+void cc2500_disable_whitening( )
+{
+  cc2500_stage_reg( TI_CCxxx0_PKTCTRL0,
+                      cc2500_read_config( TI_CCxxx0_PKTCTRL0 ) & ~WHITE_DATA );
 
-  cc_powerup_reset();               // Reset CCxxxx
+  apply_config();
+}
 
-  wait_cycles(500);  // Wait for device to reset (Not sure why this is needed)
+/*******************************************************************************
+ * @fn     void apply_config( void )
+ * @brief  Flush staged registers that change how packets go over the air,
+ *         from IDLE, and go back to RX (recalibrating on the way)
+ * ****************************************************************************/
+static void apply_config( void )
+{
+  cc2500_wakeup();
 
-  writeRFSettings();                        // Write RF settings to config reg
-  cc_write_burst_reg( TI_CCxxx0_PATABLE, &initial_power, 1);//Write PATABLE
+  GDO0_PxIE &= ~GDO0_PIN;          // Disable interrupt
 
-  cc_strobe(TI_CCxxx0_SRX);           // Initialize CCxxxx in RX mode.
-                                            // When a pkt is received, it will
-                                            // signal on GDO0 and wake CPU
+  cc_strobe( TI_CCxxx0_SIDLE );
+  wait_idle();
 
-  // Configure GDO0 port
-  GDO0_PxIES |= GDO0_PIN;       // Int on falling edge (end of pkt)
-  GDO0_PxIFG &= ~GDO0_PIN;      // Clear flag
-  GDO0_PxIE |= GDO0_PIN;        // Enable int on end of packet
+  cc2500_flush_config();
+
+  cc_strobe( TI_CCxxx0_SFRX );
+  cc_strobe( TI_CCxxx0_SRX );
 
+  GDO0_PxIFG &= ~GDO0_PIN;          // Clear flag
+  GDO0_PxIE |= GDO0_PIN;            // Enable interrupt
 }
 
 /*******************************************************************************
- * @fn     cc2500_tx( uint8_t* p_buffer, uint8_t length )
- * @brief  Send raw message through radio
+ * @fn     cc2500_scan_calibrate( uint8_t first_channel, uint8_t step,
+ *                                          uint8_t count, uint8_t* fscal1 )
+ * @brief  Calibrate the frequency synthesizer on every channel of a sweep
+ *         and keep the FSCAL1 results, so cc2500_scan() can hop without
+ *         calibrating each time. fscal1 must hold count bytes. FSCAL3 and
+ *         FSCAL2 are left at the values from the last calibration, which TI
+ *         recommends for hopping within the band. Calibration drifts with
+ *         temperature, so run this again every now and then.
  * ****************************************************************************/
-void cc2500_tx( uint8_t* p_buffer, uint8_t length )
+void cc2500_scan_calibrate( uint8_t first_channel, uint8_t step, uint8_t count,
+                                                              uint8_t* fscal1 )
 {
-  volatile int i;
+  uint8_t channel = first_channel;
+  uint8_t old_channel;
+  uint8_t index;
+
+  cc2500_wakeup();
+
   GDO0_PxIE &= ~GDO0_PIN;          // Disable interrupt
 
-  cc_write_burst_reg(TI_CCxxx0_TXFIFO, p_buffer, length); // Write TX data
-  cc_strobe(TI_CCxxx0_STX);           // Change state to TX, initiating
-                                            // data transfer
+  old_channel = cc2500_read_config( TI_CCxxx0_CHANNR );
 
-// sometimes the chip hangs on while(!(GDO0_PxIN&GDO0_PIN)); line, see http://alvarop.com/2011/12/cc2500-project-part-1/#comment-467755523
-  for (i=0;i<10000 && !(GDO0_PxIN&GDO0_PIN);i++); // Wait GDO0 to go hi or timeout -> sync TX'ed
+  cc_strobe( TI_CCxxx0_SIDLE );
+  wait_idle();
 
-  for (i=0;i<10000 && (GDO0_PxIN&GDO0_PIN);i++);  // Wait GDO0 to clear or timeout -> end of pkt
-//no used anymore
-//  while (!(GDO0_PxIN&GDO0_PIN));
-                                            // Wait GDO0 to go hi -> sync TX'ed
-//  while (GDO0_PxIN&GDO0_PIN);
-                                            // Wait GDO0 to clear -> end of pkt
-  GDO0_PxIFG &= ~GDO0_PIN;      // After pkt TX, this flag is set.
-                                            // Has to be cleared before existing
+  for( index = 0; index < count; index++ )
+  {
+    cc_write_reg( TI_CCxxx0_CHANNR, channel );
+    cc_strobe( TI_CCxxx0_SCAL );
+    wait_idle();
+    fscal1[index] = cc_read_reg( TI_CCxxx0_FSCAL1 );
+    channel += step;
+  }
+
+  // Back to normal operation, autocal runs again on the way into RX
+  cc_write_reg( TI_CCxxx0_CHANNR, old_channel );
+  cc_strobe( TI_CCxxx0_SFRX );
+  cc_strobe( TI_CCxxx0_SRX );
 
   GDO0_PxIFG &= ~GDO0_PIN;          // Clear flag
   GDO0_PxIE |= GDO0_PIN;            // Enable interrupt
 }
 
 /*******************************************************************************
- * @fn     void cc2500_tx_packet( uint8_t* p_buffer, uint8_t length,
- *                                                        uint8_t destination )
- * @brief  Send packet through radio. Takes care of adding length and
- *         destination to packet.
+ * @fn     cc2500_scan( uint8_t first_channel, uint8_t step, uint8_t count,
+ *                                  const uint8_t* fscal1, uint8_t* rssi )
+ * @brief  Sweep count channels, starting at first_channel, and read the raw
+ *         RSSI on each one. fscal1 comes from cc2500_scan_calibrate() with
+ *         the same channel arguments. Packet reception is off while sweeping.
  * ****************************************************************************/
-void cc2500_tx_packet( uint8_t* p_buffer, uint8_t length, uint8_t destination )
+void cc2500_scan( uint8_t first_channel, uint8_t step, uint8_t count,
+                                      const uint8_t* fscal1, uint8_t* rssi )
 {
-  // Add one to packet length account for address byte
-  p_tx_buffer[LENGTH_FIELD] = length + 1;
+  uint8_t channel = first_channel;
+  uint8_t old_channel;
+  uint8_t old_mcsm0;
+  uint8_t old_fscal1;
+  uint8_t index;
 
-  // Insert destination address to buffer
-  p_tx_buffer[ADDRESS_FIELD] = destination;
+  cc2500_wakeup();
+
+  GDO0_PxIE &= ~GDO0_PIN;          // Disable interrupt
+
+  old_channel = cc2500_read_config( TI_CCxxx0_CHANNR );
+  old_mcsm0 = cc2500_read_config( TI_CCxxx0_MCSM0 );
+  old_fscal1 = cc_read_reg( TI_CCxxx0_FSCAL1 );     // Calibration result
+
+  cc_strobe( TI_CCxxx0_SIDLE );
+  wait_idle();
 
-  // Copy message buffer into tx buffer. Add one to account for length byte
-  memcpy( &p_tx_buffer[DATA_FIELD], p_buffer, length );
+  // Use the cached calibration instead of calibrating on every IDLE->RX
+  cc_write_reg( TI_CCxxx0_MCSM0, old_mcsm0 & ~FS_AUTOCAL_MASK );
 
-  // Add DATA_FIELD to account for packet length and address bytes
-  cc2500_tx( p_tx_buffer, (length + DATA_FIELD) );
+  for( index = 0; index < count; index++ )
+  {
+    cc_write_reg( TI_CCxxx0_CHANNR, channel );
+    cc_write_reg( TI_CCxxx0_FSCAL1, fscal1[index] );
+    cc_strobe( TI_CCxxx0_SRX );
+
+    // PLL lock plus RSSI settling
+    wait_cycles( CC2500_SCAN_SETTLE_CYCLES );
+
+    rssi[index] = cc_read_status( TI_CCxxx0_RSSI );
+
+    cc_strobe( TI_CCxxx0_SIDLE );
+    wait_idle();
+    channel += step;
+  }
+
+  // Back to normal operation, autocal runs again on the way into RX
+  cc_write_reg( TI_CCxxx0_MCSM0, old_mcsm0 );
+  cc_write_reg( TI_CCxxx0_FSCAL1, old_fscal1 );
+  cc_write_reg( TI_CCxxx0_CHANNR, old_channel );
+  cc_strobe( TI_CCxxx0_SFRX );
+  cc_strobe( TI_CCxxx0_SRX );
+
+  GDO0_PxIFG &= ~GDO0_PIN;          // Clear flag
+  GDO0_PxIE |= GDO0_PIN;            // Enable interrupt
 }
 
 /*******************************************************************************
- * @fn     cc2500_set_address( uint8_t );
- * @brief  Set device address
+ * @fn     cc2500_sleep( );
+ * @brief  Set device to low power sleep mode. Nothing is received until it
+ *         wakes up again, which sending or changing a setting does on its own.
  * ****************************************************************************/
-void cc2500_set_address( uint8_t address )
+void cc2500_sleep( )
 {
-  cc_write_reg( TI_CCxxx0_ADDR, address );
+  if( CC2500_STATE_SLEEP == radio_state )
+  {
+    return;
+  }
+
+  GDO0_PxIE &= ~GDO0_PIN;          // Disable interrupt
+
+  // Set device to idle
+  cc_strobe(TI_CCxxx0_SIDLE);
+
+  // Set device to power-down (sleep) mode
+  cc_strobe(TI_CCxxx0_SPWD);
+
+  set_state( CC2500_STATE_SLEEP );
 }
 
 /*******************************************************************************
- * @fn     cc2500_set_channel( uint8_t );
- * @brief  Set device channel
+ * @fn     cc2500_wakeup( );
+ * @brief  Wake the radio up, if it's sleeping, and go back to RX. Restores
+ *         the PATABLE and TEST registers, which don't survive SLEEP.
  * ****************************************************************************/
-void cc2500_set_channel( uint8_t channel )
+void cc2500_wakeup( )
 {
-  cc_write_reg( TI_CCxxx0_CHANNR, channel );
+  if( CC2500_STATE_SLEEP != radio_state )
+  {
+    return;
+  }
+
+  // Returns once the crystal is running
+  cc_wakeup();
+
+  cc_write_burst_reg( TI_CCxxx0_PATABLE, &pa_power, 1 );
+#ifdef CC2500_SHADOW
+  cc_write_burst_reg( TI_CCxxx0_TEST2, &cc_shadow[TI_CCxxx0_TEST2], 3 );
+#else
+  cc_write_burst_reg( TI_CCxxx0_TEST2, (uint8_t*)test_settings, 3 );
+#endif
+
+  // Autocal runs on the way into RX
+  cc_strobe( TI_CCxxx0_SRX );
+
+  set_state( CC2500_STATE_RX );
+
+  GDO0_PxIFG &= ~GDO0_PIN;          // Clear flag
+  GDO0_PxIE |= GDO0_PIN;            // Enable interrupt
 }
 
 /*******************************************************************************
- * @fn     cc2500_set_power( uint8_t );
- * @brief  Set device transmit power
+ * @fn     uint8_t cc2500_state( );
+ * @brief  Current power state (CC2500_STATE_x)
  * ****************************************************************************/
-void cc2500_set_power( uint8_t power )
+uint8_t cc2500_state( )
 {
-  // Set TX power
-  cc_write_burst_reg(TI_CCxxx0_PATABLE, &power, 1 );
+  return radio_state;
 }
 
+#ifdef CC2500_IDLE_TIMEOUT
 /*******************************************************************************
- * @fn     cc2500_enable_addressing( );
- * @brief  Enable address checking with 0x00 as a broadcast address
+ * @fn     void cc2500_set_idle_timeout( uint32_t timeout );
+ * @brief  Put the radio to sleep once nothing has been sent or received for
+ *         timeout local clock ticks (see cc2500_set_clock()). Checked by
+ *         cc2500_power_poll(). 0 turns it off, which is the default.
  * ****************************************************************************/
-void cc2500_enable_addressing()
+void cc2500_set_idle_timeout( uint32_t timeout )
 {
-  uint8_t tmp_reg;
+  idle_timeout = timeout;
+}
+
+/*******************************************************************************
+ * @fn     void cc2500_power_poll( );
+ * @brief  Sleep if the idle timeout has run out. Call it from the main loop
+ *         (or a timer) every now and then.
+ * ****************************************************************************/
+void cc2500_power_poll( )
+{
+  uint8_t interrupts_enabled;
 
-  tmp_reg = ( cc_read_reg( TI_CCxxx0_PKTCTRL1  ) & ~0x03 ) | 0x02;
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
 
-  cc_write_reg( TI_CCxxx0_PKTCTRL1, tmp_reg );
+  // Interrupts are off so a packet can't come in between the check and SPWD
+  if( idle_timeout && ( CC2500_STATE_RX == radio_state ) &&
+                          ( ( local_clock() - last_activity ) >= idle_timeout ) )
+  {
+    cc2500_sleep();
+  }
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
 }
+#endif /* CC2500_IDLE_TIMEOUT */
 
+#ifdef CC2500_RESIDENCY
 /*******************************************************************************
- * @fn     cc2500_disable_addressing( );
- * @brief  Disable address checking
+ * @fn     uint32_t cc2500_residency( uint8_t state );
+ * @brief  Local clock ticks spent in a power state since the clock was set or
+ *         the counters cleared. Multiplied by the datasheet current for each
+ *         state, it gives the radio's share of the node's energy.
  * ****************************************************************************/
-void cc2500_disable_addressing()
+uint32_t cc2500_residency( uint8_t state )
 {
-  uint8_t tmp_reg;
+  uint32_t ticks;
+  uint8_t interrupts_enabled;
 
-  tmp_reg = ( cc_read_reg( TI_CCxxx0_PKTCTRL1  ) & ~0x03 );
+  if( state >= CC2500_STATE_COUNT )
+  {
+    return 0;
+  }
 
-  cc_write_reg( TI_CCxxx0_PKTCTRL1, tmp_reg );
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  ticks = residency[state];
+
+  if( state == radio_state )
+  {
+    ticks += local_clock() - state_since;
+  }
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+
+  return ticks;
 }
 
 /*******************************************************************************
- * @fn     cc2500_sleep( );
- * @brief  Set device to low power sleep mode
+ * @fn     void cc2500_clear_residency( );
+ * @brief  Start counting power state residency from zero
  * ****************************************************************************/
-void cc2500_sleep( )
+void cc2500_clear_residency( )
 {
-  // Set device to idle
-  cc_strobe(TI_CCxxx0_SIDLE);
+  uint8_t interrupts_enabled;
 
-  // Set device to power-down (sleep) mode
-  cc_strobe(TI_CCxxx0_SPWD);
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  memset( residency, 0x00, sizeof(residency) );
+  state_since = local_clock();
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+}
+#endif /* CC2500_RESIDENCY */
+
+/*******************************************************************************
+ * @fn     void set_state( uint8_t state )
+ * @brief  Change power state, adding the time spent in the old one to its
+ *         residency counter. Getting back to RX counts as activity for the
+ *         idle timeout. Safe to call from an ISR.
+ * ****************************************************************************/
+static void set_state( uint8_t state )
+{
+#if defined(CC2500_RESIDENCY) || defined(CC2500_IDLE_TIMEOUT)
+  uint32_t now;
+  uint8_t interrupts_enabled;
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  now = local_clock();
+
+#ifdef CC2500_RESIDENCY
+  residency[radio_state] += now - state_since;
+  state_since = now;
+#endif
+
+#ifdef CC2500_IDLE_TIMEOUT
+  if( CC2500_STATE_RX == state )
+  {
+    last_activity = now;
+  }
+#endif
+
+  radio_state = state;
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+#else
+  radio_state = state;
+#endif
 }
 
 /*******************************************************************************
@@ -194,6 +1402,24 @@ static uint8_t dummy_callback( uint8_t* buffer, uint8_t length )
   return 0;
 }
 
+/*******************************************************************************
+ * @fn     uint32_t dummy_clock( void )
+ * @brief  Default clock when timestamps aren't needed
+ * ****************************************************************************/
+static uint32_t dummy_clock( void )
+{
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     void dummy_tx_hook( uint8_t destination )
+ * @brief  Default tx hook, leaves the power alone
+ * ****************************************************************************/
+static void dummy_tx_hook( uint8_t destination )
+{
+  __no_operation();
+}
+
 /*******************************************************************************
  * @fn     uint8_t receive_packet( uint8_t* p_buffer, uint8_t* length )
  * @brief  Receive packet from the radio using CC2500
@@ -202,25 +1428,51 @@ uint8_t receive_packet( uint8_t* p_buffer, uint8_t* length )
 {
   uint8_t status[2];
   uint8_t packet_length;
+  uint8_t rx_bytes;
+  uint8_t read = 0;
+
+  rx_bytes = cc_read_status( TI_CCxxx0_RXBYTES ) & TI_CCxxx0_NUM_RXBYTES;
 
   // Make sure there are bytes to be read in the FIFO buffer
-  if ( ( cc_read_status( TI_CCxxx0_RXBYTES ) & TI_CCxxx0_NUM_RXBYTES ) )
+  if ( rx_bytes )
   {
+    if( fec_mode )
+    {
+      return receive_fixed( p_buffer, length, rx_bytes );
+    }
+
     // Read the first byte which contains the packet length
     packet_length = cc_read_reg( TI_CCxxx0_RXFIFO );
 
-    // Make sure the packet length is smaller than our buffer
-    if ( packet_length <= *length )
+    // Make sure the packet and the two status bytes fit in our buffer
+    if ( ( packet_length + 2 ) <= *length )
     {
-      // Read the rest of the packet
-      cc_read_burst_reg( TI_CCxxx0_RXFIFO, p_buffer, packet_length );
+#ifdef CC2500_GROUPS
+      // The radio lets every address through while we're in a group, so
+      // look at the address before reading the rest
+      if( group_count && packet_length )
+      {
+        p_buffer[0] = cc_read_reg( TI_CCxxx0_RXFIFO );
+        read = 1;
 
-      // Return packet size in length variable
-      *length = packet_length;
+        if( drop_unwanted( p_buffer, rx_bytes - 2, packet_length + 1 ) )
+        {
+          *length = 0;
+          return 0;
+        }
+      }
+#endif
+
+      // Read the rest of the packet
+      cc_read_burst_reg( TI_CCxxx0_RXFIFO, &p_buffer[read],
+                                                      packet_length - read );
 
       // Read two byte status
       cc_read_burst_reg( TI_CCxxx0_RXFIFO, status, 2 );
 
+      // Return packet size in length variable
+      *length = packet_length;
+
       // Append status bytes to buffer
       memcpy( &p_buffer[packet_length], status, 2 );
 
@@ -243,6 +1495,64 @@ uint8_t receive_packet( uint8_t* p_buffer, uint8_t* length )
   return 0;
 }
 
+/*******************************************************************************
+ * @fn     uint8_t receive_fixed( uint8_t* p_buffer, uint8_t* length,
+ *                                                        uint8_t rx_bytes )
+ * @brief  Read a fixed length (FEC mode) frame and take the length byte out,
+ *         so it looks like a variable length packet to the caller. rx_bytes
+ *         is what RXBYTES said was in the FIFO.
+ * ****************************************************************************/
+static uint8_t receive_fixed( uint8_t* p_buffer, uint8_t* length,
+                                                              uint8_t rx_bytes )
+{
+  uint8_t status[2];
+  uint8_t packet_length;
+  uint8_t read = 0;
+
+  if( ( CC2500_FEC_PACKET_LENGTH + 2 ) > *length )
+  {
+    cc_strobe(TI_CCxxx0_SFRX);      // Flush RXFIFO
+    *length = CC2500_FEC_PACKET_LENGTH;
+    return 0;
+  }
+
+#ifdef CC2500_GROUPS
+  if( group_count )
+  {
+    p_buffer[0] = cc_read_reg( TI_CCxxx0_RXFIFO );
+    read = 1;
+
+    if( drop_unwanted( p_buffer, rx_bytes - 1, CC2500_FEC_PACKET_LENGTH + 1 ) )
+    {
+      *length = 0;
+      return 0;
+    }
+  }
+#endif
+
+  // [address][length][payload][padding], then the two status bytes
+  cc_read_burst_reg( TI_CCxxx0_RXFIFO, &p_buffer[read],
+                                          CC2500_FEC_PACKET_LENGTH - read );
+  cc_read_burst_reg( TI_CCxxx0_RXFIFO, status, 2 );
+
+  packet_length = p_buffer[1];
+
+  if( ( packet_length < 1 ) || ( packet_length >= CC2500_FEC_PACKET_LENGTH ) )
+  {
+    // Corrupted beyond what FEC could fix
+    *length = 0;
+    return 0;
+  }
+
+  memmove( &p_buffer[1], &p_buffer[2], packet_length - 1 );
+
+  *length = packet_length;
+
+  memcpy( &p_buffer[packet_length], status, 2 );
+
+  return ( status[TI_CCxxx0_LQI_RX] & TI_CCxxx0_CRC_OK );
+}
+
 // Product = CC2500
 // Crystal accuracy = 40 ppm
 // X-tal frequency = 26 MHz
@@ -273,42 +1583,45 @@ uint8_t receive_packet( uint8_t* p_buffer, uint8_t* length )
 void writeRFSettings(void)
 {
 
-  // Write register settings
-  cc_write_reg(TI_CCxxx0_IOCFG2,   0x0E);  // GDO2 output pin config.
-  cc_write_reg(TI_CCxxx0_IOCFG0,   0x06);  // GDO0 output pin config.
-  cc_write_reg(TI_CCxxx0_PKTLEN,   0x3D);  // Packet length.
-  cc_write_reg(TI_CCxxx0_PKTCTRL1, 0x0E);  // Packet automation control.
-  cc_write_reg(TI_CCxxx0_PKTCTRL0, 0x05);  // Packet automation control.
-  cc_write_reg(TI_CCxxx0_ADDR,     0x01);  // Device address.
-  cc_write_reg(TI_CCxxx0_CHANNR,   0x00); // Channel number.
-  cc_write_reg(TI_CCxxx0_FSCTRL1,  0x07); // Freq synthesizer control.
-  cc_write_reg(TI_CCxxx0_FSCTRL0,  0x00); // Freq synthesizer control.
-  cc_write_reg(TI_CCxxx0_FREQ2,    0x5D); // Freq control word, high byte
-  cc_write_reg(TI_CCxxx0_FREQ1,    0x93); // Freq control word, mid byte.
-  cc_write_reg(TI_CCxxx0_FREQ0,    0xB1); // Freq control word, low byte.
-  cc_write_reg(TI_CCxxx0_MDMCFG4,  0x2D); // Modem configuration.
-  cc_write_reg(TI_CCxxx0_MDMCFG3,  0x3B); // Modem configuration.
-  cc_write_reg(TI_CCxxx0_MDMCFG2,  0x73); // Modem configuration.
-  cc_write_reg(TI_CCxxx0_MDMCFG1,  0x22); // Modem configuration.
-  cc_write_reg(TI_CCxxx0_MDMCFG0,  0xF8); // Modem configuration.
-  cc_write_reg(TI_CCxxx0_DEVIATN,  0x00); // Modem dev (when FSK mod en)
-  cc_write_reg(TI_CCxxx0_MCSM1 ,   0x2F); //MainRadio Cntrl State Machine
-  cc_write_reg(TI_CCxxx0_MCSM0 ,   0x18); //MainRadio Cntrl State Machine
-  cc_write_reg(TI_CCxxx0_FOCCFG,   0x1D); // Freq Offset Compens. Config
-  cc_write_reg(TI_CCxxx0_BSCFG,    0x1C); //  Bit synchronization config.
-  cc_write_reg(TI_CCxxx0_AGCCTRL2, 0xC7); // AGC control.
-  cc_write_reg(TI_CCxxx0_AGCCTRL1, 0x00); // AGC control.
-  cc_write_reg(TI_CCxxx0_AGCCTRL0, 0xB2); // AGC control.
-  cc_write_reg(TI_CCxxx0_FREND1,   0xB6); // Front end RX configuration.
-  cc_write_reg(TI_CCxxx0_FREND0,   0x10); // Front end RX configuration.
-  cc_write_reg(TI_CCxxx0_FSCAL3,   0xEA); // Frequency synthesizer cal.
-  cc_write_reg(TI_CCxxx0_FSCAL2,   0x0A); // Frequency synthesizer cal.
-  cc_write_reg(TI_CCxxx0_FSCAL1,   0x00); // Frequency synthesizer cal.
-  cc_write_reg(TI_CCxxx0_FSCAL0,   0x11); // Frequency synthesizer cal.
-  cc_write_reg(TI_CCxxx0_FSTEST,   0x59); // Frequency synthesizer cal.
-  cc_write_reg(TI_CCxxx0_TEST2,    0x88); // Various test settings.
-  cc_write_reg(TI_CCxxx0_TEST1,    0x31); // Various test settings.
-  cc_write_reg(TI_CCxxx0_TEST0,    0x0B);  // Various test settings.
+  // Stage register settings, they all go out in one burst (or one at a time
+  // without CC2500_SHADOW)
+  cc2500_stage_reg(TI_CCxxx0_IOCFG2,   0x0E);  // GDO2 output pin config.
+  cc2500_stage_reg(TI_CCxxx0_IOCFG0,   0x06);  // GDO0 output pin config.
+  cc2500_stage_reg(TI_CCxxx0_PKTLEN,   CC2500_MAX_PACKET_LENGTH);  // Packet length.
+  cc2500_stage_reg(TI_CCxxx0_PKTCTRL1, 0x0E);  // Packet automation control.
+  cc2500_stage_reg(TI_CCxxx0_PKTCTRL0, 0x05);  // Packet automation control.
+  cc2500_stage_reg(TI_CCxxx0_ADDR,     0x01);  // Device address.
+  cc2500_stage_reg(TI_CCxxx0_CHANNR,   0x00); // Channel number.
+  cc2500_stage_reg(TI_CCxxx0_FSCTRL1,  0x07); // Freq synthesizer control.
+  cc2500_stage_reg(TI_CCxxx0_FSCTRL0,  0x00); // Freq synthesizer control.
+  cc2500_stage_reg(TI_CCxxx0_FREQ2,    0x5D); // Freq control word, high byte
+  cc2500_stage_reg(TI_CCxxx0_FREQ1,    0x93); // Freq control word, mid byte.
+  cc2500_stage_reg(TI_CCxxx0_FREQ0,    0xB1); // Freq control word, low byte.
+  cc2500_stage_reg(TI_CCxxx0_MDMCFG4,  0x2D); // Modem configuration.
+  cc2500_stage_reg(TI_CCxxx0_MDMCFG3,  0x3B); // Modem configuration.
+  cc2500_stage_reg(TI_CCxxx0_MDMCFG2,  0x73); // Modem configuration.
+  cc2500_stage_reg(TI_CCxxx0_MDMCFG1,  0x22); // Modem configuration.
+  cc2500_stage_reg(TI_CCxxx0_MDMCFG0,  0xF8); // Modem configuration.
+  cc2500_stage_reg(TI_CCxxx0_DEVIATN,  0x00); // Modem dev (when FSK mod en)
+  cc2500_stage_reg(TI_CCxxx0_MCSM1 ,   0x2F); //MainRadio Cntrl State Machine
+  cc2500_stage_reg(TI_CCxxx0_MCSM0 ,   0x18); //MainRadio Cntrl State Machine
+  cc2500_stage_reg(TI_CCxxx0_FOCCFG,   0x1D); // Freq Offset Compens. Config
+  cc2500_stage_reg(TI_CCxxx0_BSCFG,    0x1C); //  Bit synchronization config.
+  cc2500_stage_reg(TI_CCxxx0_AGCCTRL2, 0xC7); // AGC control.
+  cc2500_stage_reg(TI_CCxxx0_AGCCTRL1, 0x00); // AGC control.
+  cc2500_stage_reg(TI_CCxxx0_AGCCTRL0, 0xB2); // AGC control.
+  cc2500_stage_reg(TI_CCxxx0_FREND1,   0xB6); // Front end RX configuration.
+  cc2500_stage_reg(TI_CCxxx0_FREND0,   0x10); // Front end RX configuration.
+  cc2500_stage_reg(TI_CCxxx0_FSCAL3,   0xEA); // Frequency synthesizer cal.
+  cc2500_stage_reg(TI_CCxxx0_FSCAL2,   0x0A); // Frequency synthesizer cal.
+  cc2500_stage_reg(TI_CCxxx0_FSCAL1,   0x00); // Frequency synthesizer cal.
+  cc2500_stage_reg(TI_CCxxx0_FSCAL0,   0x11); // Frequency synthesizer cal.
+  cc2500_stage_reg(TI_CCxxx0_FSTEST,   0x59); // Frequency synthesizer cal.
+  cc2500_stage_reg(TI_CCxxx0_TEST2,    test_settings[0]); // Various test settings.
+  cc2500_stage_reg(TI_CCxxx0_TEST1,    test_settings[1]); // Various test settings.
+  cc2500_stage_reg(TI_CCxxx0_TEST0,    test_settings[2]); // Various test settings.
+
+  cc2500_flush_config();
 }
 
 /*******************************************************************************
@@ -323,18 +1636,49 @@ __interrupt void port2_isr(void) // CHANGE
   // Check to see if this interrupt was caused by the GDO0 pin from the CC2500
   if ( GDO0_PxIFG & GDO0_PIN )
   {
+      // End of packet, before anything else adds latency
+      rx_timestamp = local_clock();
+#ifdef CC2500_IDLE_TIMEOUT
+      last_activity = rx_timestamp;
+#endif
+
+#ifdef CC2500_NESTED_RX_ISR
+      // Only mask this pin while the packet is handled, so nothing else has
+      // to wait for the SPI transfers and the callback
+      GDO0_PxIE &= ~GDO0_PIN;
+      GDO0_PxIFG &= ~GDO0_PIN;
+      __enable_interrupt();
+#else
+      // Cleared before reading, so a packet that ends while this one is
+      // read or dropped runs the ISR again instead of waiting in the FIFO
+      GDO0_PxIFG &= ~GDO0_PIN;
+#endif
+
       if( receive_packet(p_rx_buffer,&length) )
       {
         // Successful packet receive, now send data to callback function
         if( rx_callback( p_rx_buffer, length ) )
         {
           // If rx_callback returns nonzero, wakeup the processor
-          __bic_SR_register_on_exit(LPM1_bits);
+          __bic_SR_register_on_exit(CC2500_WAKE_BITS);
         }
 
         // Clear the buffer
         memset( p_rx_buffer, 0x00, sizeof(p_rx_buffer) );
       }
+      else if( sniffer_mode && length &&
+                                ( length <= ( CC2500_BUFFER_LENGTH - 2 ) ) )
+      {
+        // Bad CRC, but the packet was read out of the FIFO. The sniffer wants
+        // it anyway (CRC_OK is clear in the appended LQI byte). A length of 0
+        // means nothing usable was read (FEC frame with a corrupt length).
+        if( rx_callback( p_rx_buffer, length ) )
+        {
+          __bic_SR_register_on_exit(CC2500_WAKE_BITS);
+        }
+
+        memset( p_rx_buffer, 0x00, sizeof(p_rx_buffer) );
+      }
       else
       {
         // A failed receive can occur due to bad CRC or (if address checking is
@@ -343,8 +1687,13 @@ __interrupt void port2_isr(void) // CHANGE
         //uart_write("CRC NOK\r\n", 9);
       }
 
+#ifdef CC2500_NESTED_RX_ISR
+      // A packet that ended in the meantime left the flag set, so this
+      // interrupt runs again right away
+      __disable_interrupt();
+      GDO0_PxIE |= GDO0_PIN;
+#endif
   }
-  GDO0_PxIFG &= ~GDO0_PIN;  // Clear interrupt flag
 
   // Only needed if radio is configured to return to IDLE after transmission
   // Check register MCSM1.TXOFF_MODE
@@ -0,0 +1,36 @@
+/** @file clock.h
+*
+* @brief Clock setup, on demand SMCLK and low power sleep
+*
+* @author Alvaro Prieto
+*/
+#ifndef _CLOCK_H
+#define _CLOCK_H
+
+#include <stdint.h>
+
+// ACLK comes from the VLO (nominally 12kHz, measured at startup) unless
+// CLOCK_LFXT1 is defined for a 32768Hz watch crystal
+#ifdef CLOCK_LFXT1
+#define CLOCK_LFXT1_HZ    (32768)
+#endif
+
+// Low power mode clock_sleep() uses when nothing needs SMCLK. LPM3 keeps ACLK
+// running for timekeeping, LPM4 stops it too.
+#ifndef CLOCK_SLEEP_BITS
+#define CLOCK_SLEEP_BITS  (LPM3_bits)
+#endif
+
+// What an ISR clears on exit to wake the main loop up, whichever mode it was
+// sleeping in
+#define CLOCK_WAKE_BITS   (LPM4_bits)
+
+void clock_setup( void );
+uint32_t clock_aclk_hz( void );
+
+void clock_smclk_request( void );
+void clock_smclk_release( void );
+
+void clock_sleep( void );
+
+#endif /* _CLOCK_H */
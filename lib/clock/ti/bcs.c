@@ -0,0 +1,180 @@
+/** @file bcs.c
+*
+* @brief Clock setup and low power sleep for the Basic Clock Module+
+*
+* MCLK and SMCLK run from the DCO at 16MHz and ACLK from the VLO or a watch
+* crystal. The VLO can be anywhere from 4kHz to 20kHz, so its actual rate is
+* measured against the calibrated DCO at startup with a Timer_A capture.
+*
+* Between events the CPU sleeps in CLOCK_SLEEP_BITS, with only ACLK running.
+* Anything that needs SMCLK while the CPU sleeps (a UART receiving, an SMCLK
+* timer) calls clock_smclk_request(), and clock_sleep() stays in LPM1 until
+* it's released. ISRs always run with every clock on, so SPI transfers in the
+* radio ISR don't need a request.
+*
+* @author Alvaro Prieto
+*/
+#include "clock.h"
+#include "device.h"
+
+// Timer_A capture input tied to ACLK. CCI2B on the F2xx parts, CCI0B on the
+// G2xx ones.
+#ifdef __MSP430F2274__
+#define ACLK_CCTL TACCTL2
+#define ACLK_CCR TACCR2
+#else
+#define ACLK_CCTL TACCTL0
+#define ACLK_CCR TACCR0
+#endif
+
+#define SMCLK_HZ (16000000L)
+
+// ACLK periods the VLO measurement averages over. Fits in 16 bits of SMCLK
+// cycles down to a 2kHz VLO.
+#define MEASURE_PERIODS (8)
+
+static uint32_t aclk_hz;
+static volatile uint8_t smclk_users = 0;
+
+#ifndef CLOCK_LFXT1
+static uint16_t capture_aclk( void );
+#endif
+
+/*******************************************************************************
+ * @fn     void clock_setup( void )
+ * @brief  Run MCLK and SMCLK at 16MHz and start ACLK. Uses Timer0_A to measure
+ *         the VLO, so call it before anything else sets the timer up.
+ * ****************************************************************************/
+void clock_setup( void )
+{
+#ifndef CLOCK_LFXT1
+  uint16_t start;
+  uint8_t period;
+#endif
+
+  // Setup oscillator for 16MHz operation
+  BCSCTL1 = CALBC1_16MHZ;
+  DCOCTL = CALDCO_16MHZ;
+
+  // Wait for changes to take effect
+  __delay_cycles(4000);
+
+#ifdef CLOCK_LFXT1
+  BCSCTL3 = LFXT1S_0 + XCAP_3;        // 32768Hz crystal, 12.5pF
+
+  // Wait for the crystal to start
+  do
+  {
+    IFG1 &= ~OFIFG;
+    __delay_cycles(16000);
+  } while( IFG1 & OFIFG );
+
+  aclk_hz = CLOCK_LFXT1_HZ;
+#else
+  BCSCTL3 = LFXT1S_2;                 // VLO
+
+  // Count SMCLK cycles over MEASURE_PERIODS ACLK periods
+  ACLK_CCTL = CM_1 + CCIS_1 + SCS + CAP;  // Capture rising edges of ACLK
+  TACTL = TASSEL_2 + MC_2 + TACLR;
+
+  start = capture_aclk();
+  for( period = 1; period < MEASURE_PERIODS; period++ )
+  {
+    capture_aclk();
+  }
+
+  aclk_hz = ( SMCLK_HZ * MEASURE_PERIODS ) /
+                                      (uint16_t)( capture_aclk() - start );
+
+  ACLK_CCTL = 0;
+  TACTL = TACLR;
+#endif
+}
+
+/*******************************************************************************
+ * @fn     uint32_t clock_aclk_hz( void )
+ * @brief  ACLK rate, as measured by clock_setup()
+ * ****************************************************************************/
+uint32_t clock_aclk_hz( void )
+{
+  return aclk_hz;
+}
+
+/*******************************************************************************
+ * @fn     void clock_smclk_request( void )
+ * @brief  Keep SMCLK running while the CPU sleeps, until a matching
+ *         clock_smclk_release(). Safe to call from an ISR.
+ * ****************************************************************************/
+void clock_smclk_request( void )
+{
+  uint8_t interrupts_enabled;
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  smclk_users++;
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+}
+
+/*******************************************************************************
+ * @fn     void clock_smclk_release( void )
+ * @brief  Done with SMCLK. Safe to call from an ISR.
+ * ****************************************************************************/
+void clock_smclk_release( void )
+{
+  uint8_t interrupts_enabled;
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  if( smclk_users )
+  {
+    smclk_users--;
+  }
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+}
+
+/*******************************************************************************
+ * @fn     void clock_sleep( void )
+ * @brief  Sleep until an ISR wakes the main loop up, in LPM1 if something
+ *         needs SMCLK, CLOCK_SLEEP_BITS otherwise. Call with interrupts
+ *         disabled, right after checking there's nothing left to do, so
+ *         nothing can slip in between. Returns with interrupts enabled.
+ * ****************************************************************************/
+void clock_sleep( void )
+{
+  if( smclk_users )
+  {
+    __bis_SR_register( LPM1_bits + GIE );
+  }
+  else
+  {
+    __bis_SR_register( CLOCK_SLEEP_BITS + GIE );
+  }
+
+  // An ISR that only cleared some of the bits would leave SMCLK off
+  __bic_SR_register( CLOCK_WAKE_BITS );
+}
+
+#ifndef CLOCK_LFXT1
+/*******************************************************************************
+ * @fn     uint16_t capture_aclk( void )
+ * @brief  Wait for the next ACLK rising edge and return the SMCLK count at it
+ * ****************************************************************************/
+static uint16_t capture_aclk( void )
+{
+  ACLK_CCTL &= ~( CCIFG + COV );
+
+  while( !( ACLK_CCTL & CCIFG ) );
+
+  return ACLK_CCR;
+}
+#endif
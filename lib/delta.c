@@ -0,0 +1,390 @@
+/** @file delta.c
+*
+* @brief Delta and run length compressed streaming of fixed size frames
+*
+* Every encoded frame starts with a header byte: bit 7 set for a keyframe,
+* bit 6 set for plain values, bits 0-5 a sequence number.
+*
+* A keyframe carries every channel. A delta frame carries a bitmap of the
+* channels that changed since the previous frame (bit n of byte n/8 for
+* channel n), followed by the new values of just those channels. Either way
+* the values are run length coded:
+*
+*   0x00-0x7F  literal, the next (token + 1) bytes are values
+*   0x80-0xFF  run, the next byte repeats (token - 0x80 + 3) times
+*
+* unless that would make them longer, as it does for a few channels that all
+* change every frame. Then they're sent as they are, one byte per channel.
+*
+* Deltas only apply on top of the frame right before them, so a receiver that
+* misses one ignores everything until the next keyframe.
+*
+* Decoding is a couple of passes over a packet sized buffer with no copies,
+* cheap enough for an RX callback.
+*
+* @author Alvaro Prieto
+*/
+#include <string.h>
+#include "delta.h"
+
+#define KEYFRAME_FLAG (0x80)
+#define PLAIN_FLAG    (0x40)
+#define SEQUENCE_MASK (0x3F)
+
+#define RUN_FLAG (0x80)
+#define MIN_RUN (3)
+#define MAX_RUN (0x7F + MIN_RUN)
+#define MAX_LITERAL (0x80)
+
+#define BITMAP_LENGTH( channels ) ( ( (channels) + 7 ) / 8 )
+
+static uint8_t encode_values( const uint8_t*, uint8_t, uint8_t*, uint8_t* );
+static uint8_t rle_encode( const uint8_t*, uint8_t, uint8_t* );
+static uint8_t rle_decode( const uint8_t*, uint8_t, uint8_t*, uint8_t,
+                                                const uint8_t*, uint8_t );
+
+/*******************************************************************************
+ * @fn     void delta_encoder_init( delta_encoder_t* encoder, uint8_t* previous,
+ *                                                        uint8_t channels )
+ * @brief  Set up an encoder. previous holds a copy of the last frame sent and
+ *         must be channels bytes long. The first frame is a keyframe.
+ * ****************************************************************************/
+void delta_encoder_init( delta_encoder_t* encoder, uint8_t* previous,
+                                                            uint8_t channels )
+{
+  encoder->previous = previous;
+  encoder->channels = channels;
+  encoder->sequence = 0;
+  encoder->since_keyframe = DELTA_KEYFRAME_INTERVAL;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t delta_encode( delta_encoder_t* encoder,
+ *                                        const uint8_t* frame, uint8_t* out )
+ * @brief  Encode the next frame into out, which must hold
+ *         DELTA_MAX_ENCODED_LENGTH(channels) bytes. Returns the encoded
+ *         length, or 0 if nothing changed and there's nothing to send.
+ * ****************************************************************************/
+uint8_t delta_encode( delta_encoder_t* encoder, const uint8_t* frame,
+                                                                uint8_t* out )
+{
+  uint8_t* bitmap = &out[1];
+  uint8_t bitmap_length = BITMAP_LENGTH( encoder->channels );
+  uint8_t channel;
+  uint8_t changed = 0;
+  uint8_t length;
+
+  if( encoder->since_keyframe < DELTA_KEYFRAME_INTERVAL )
+  {
+    encoder->since_keyframe++;
+
+    memset( bitmap, 0, bitmap_length );
+    for( channel = 0; channel < encoder->channels; channel++ )
+    {
+      if( frame[channel] != encoder->previous[channel] )
+      {
+        bitmap[channel >> 3] |= 1 << ( channel & 7 );
+
+        // previous isn't needed past this channel anymore, so it holds the
+        // changed values until they're encoded
+        encoder->previous[changed++] = frame[channel];
+      }
+    }
+
+    if( 0 == changed )
+    {
+      return 0;
+    }
+
+    // Only worth it if the bitmap and the changed channels are smaller than
+    // every channel. Keyframes win ties, they resync receivers.
+    if( ( bitmap_length + changed ) < encoder->channels )
+    {
+      out[0] = encoder->sequence;
+      length = 1 + bitmap_length;
+      length += encode_values( encoder->previous, changed, &out[length],
+                                                                    &out[0] );
+
+      memcpy( encoder->previous, frame, encoder->channels );
+      encoder->sequence = ( encoder->sequence + 1 ) & SEQUENCE_MASK;
+
+      return length;
+    }
+  }
+
+  // Keyframe
+  encoder->since_keyframe = 1;
+
+  out[0] = KEYFRAME_FLAG | encoder->sequence;
+  length = 1 + encode_values( frame, encoder->channels, &out[1], &out[0] );
+
+  memcpy( encoder->previous, frame, encoder->channels );
+  encoder->sequence = ( encoder->sequence + 1 ) & SEQUENCE_MASK;
+
+  return length;
+}
+
+/*******************************************************************************
+ * @fn     void delta_decoder_init( delta_decoder_t* decoder, uint8_t* values,
+ *                                                        uint8_t channels )
+ * @brief  Set up a decoder. values receives the decoded frames and must be
+ *         channels bytes long. Nothing is decoded until the first keyframe.
+ * ****************************************************************************/
+void delta_decoder_init( delta_decoder_t* decoder, uint8_t* values,
+                                                            uint8_t channels )
+{
+  decoder->values = values;
+  decoder->channels = channels;
+  decoder->sequence = 0;
+  decoder->synced = 0;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t delta_decode( delta_decoder_t* decoder, const uint8_t* in,
+ *                                                          uint8_t length )
+ * @brief  Apply an encoded frame to the decoder's values. Returns nonzero if
+ *         they were updated, 0 if the frame was dropped (malformed, out of
+ *         sequence or waiting for a keyframe). Values are left untouched when
+ *         a frame is dropped.
+ * ****************************************************************************/
+uint8_t delta_decode( delta_decoder_t* decoder, const uint8_t* in,
+                                                              uint8_t length )
+{
+  const uint8_t* bitmap = 0;
+  uint8_t header;
+  uint8_t changed;
+  uint8_t channel;
+
+  if( length < 2 )
+  {
+    return 0;
+  }
+
+  header = *in++;
+  length--;
+
+  if( header & KEYFRAME_FLAG )
+  {
+    changed = decoder->channels;
+  }
+  else
+  {
+    // A delta needs the frame right before it
+    if( !decoder->synced || ( ( header & SEQUENCE_MASK ) != decoder->sequence ) )
+    {
+      decoder->synced = 0;
+      return 0;
+    }
+
+    bitmap = in;
+    if( length <= BITMAP_LENGTH( decoder->channels ) )
+    {
+      return 0;
+    }
+    in += BITMAP_LENGTH( decoder->channels );
+    length -= BITMAP_LENGTH( decoder->channels );
+
+    changed = 0;
+    for( channel = 0; channel < decoder->channels; channel++ )
+    {
+      if( bitmap[channel >> 3] & ( 1 << ( channel & 7 ) ) )
+      {
+        changed++;
+      }
+    }
+  }
+
+  if( header & PLAIN_FLAG )
+  {
+    // One byte for each selected channel
+    if( length != changed )
+    {
+      return 0;
+    }
+
+    for( channel = 0; channel < decoder->channels; channel++ )
+    {
+      if( !bitmap || ( bitmap[channel >> 3] & ( 1 << ( channel & 7 ) ) ) )
+      {
+        decoder->values[channel] = *in++;
+      }
+    }
+  }
+  else
+  {
+    // Check first, so a bad frame doesn't leave half of the values changed
+    if( rle_decode( in, length, 0, decoder->channels, bitmap, 0 ) != changed )
+    {
+      return 0;
+    }
+
+    rle_decode( in, length, decoder->values, decoder->channels, bitmap, 1 );
+  }
+
+  decoder->sequence = ( ( header & SEQUENCE_MASK ) + 1 ) & SEQUENCE_MASK;
+  decoder->synced = 1;
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t encode_values( const uint8_t* in, uint8_t length,
+ *                                          uint8_t* out, uint8_t* header )
+ * @brief  Run length code length bytes, or copy them if that's shorter and
+ *         set PLAIN_FLAG in header. Returns the encoded length, at most
+ *         length.
+ * ****************************************************************************/
+static uint8_t encode_values( const uint8_t* in, uint8_t length, uint8_t* out,
+                                                              uint8_t* header )
+{
+  uint8_t encoded = rle_encode( in, length, out );
+
+  if( encoded > length )
+  {
+    memcpy( out, in, length );
+    *header |= PLAIN_FLAG;
+    encoded = length;
+  }
+
+  return encoded;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t rle_encode( const uint8_t* in, uint8_t length, uint8_t* out )
+ * @brief  Run length code length bytes. Returns the encoded length, at most
+ *         length + (length + 127) / 128.
+ * ****************************************************************************/
+static uint8_t rle_encode( const uint8_t* in, uint8_t length, uint8_t* out )
+{
+  uint8_t* start = out;
+  uint8_t index = 0;
+  uint8_t literal_start = 0;
+  uint8_t run;
+
+  while( index < length )
+  {
+    // Length of the run starting here
+    for( run = 1; ( ( index + run ) < length ) && ( run < MAX_RUN ) &&
+                                ( in[index + run] == in[index] ); run++ );
+
+    if( ( run < MIN_RUN ) && ( ( index + run ) < length ) )
+    {
+      // Too short to bother, it goes in with the literals
+      index += run;
+      continue;
+    }
+
+    if( run < MIN_RUN )
+    {
+      // End of the input, flush it as literals too
+      index += run;
+      run = 0;
+    }
+
+    // Literals before the run, in chunks of up to MAX_LITERAL
+    while( literal_start < index )
+    {
+      uint8_t count = index - literal_start;
+
+      if( count > MAX_LITERAL )
+      {
+        count = MAX_LITERAL;
+      }
+
+      *out++ = count - 1;
+      memcpy( out, &in[literal_start], count );
+      out += count;
+      literal_start += count;
+    }
+
+    if( run )
+    {
+      *out++ = RUN_FLAG | ( run - MIN_RUN );
+      *out++ = in[index];
+      index += run;
+      literal_start = index;
+    }
+  }
+
+  return out - start;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t rle_decode( const uint8_t* in, uint8_t length, uint8_t* out,
+ *                          uint8_t channels, const uint8_t* bitmap,
+ *                          uint8_t write )
+ * @brief  Decode run length coded values into the channels selected by
+ *         bitmap (all of them if it's null). Only writes to out if write is
+ *         set. Returns the number of values decoded, or 0xFF if the input is
+ *         malformed or runs past the last channel.
+ * ****************************************************************************/
+static uint8_t rle_decode( const uint8_t* in, uint8_t length, uint8_t* out,
+              uint8_t channels, const uint8_t* bitmap, uint8_t write )
+{
+  const uint8_t* end = in + length;
+  uint8_t channel = 0;
+  uint8_t decoded = 0;
+  uint8_t token;
+  uint8_t count;
+  uint8_t repeat;
+
+  while( in < end )
+  {
+    token = *in++;
+
+    if( token & RUN_FLAG )
+    {
+      count = ( token & ~RUN_FLAG ) + MIN_RUN;
+      repeat = 1;
+    }
+    else
+    {
+      count = token + 1;
+      repeat = 0;
+    }
+
+    // Run value, or all of the literals, must be there
+    if( ( end - in ) < ( repeat ? 1 : count ) )
+    {
+      return 0xFF;
+    }
+
+    while( count-- )
+    {
+      // Next selected channel
+      if( bitmap )
+      {
+        while( ( channel < channels ) &&
+                        !( bitmap[channel >> 3] & ( 1 << ( channel & 7 ) ) ) )
+        {
+          channel++;
+        }
+      }
+
+      if( channel >= channels )
+      {
+        return 0xFF;
+      }
+
+      if( write )
+      {
+        out[channel] = *in;
+      }
+
+      channel++;
+      decoded++;
+
+      if( !repeat )
+      {
+        in++;
+      }
+    }
+
+    if( repeat )
+    {
+      in++;
+    }
+  }
+
+  return decoded;
+}
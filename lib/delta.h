@@ -0,0 +1,48 @@
+/** @file delta.h
+*
+* @brief Delta and run length compressed streaming of fixed size frames
+*
+* @author Alvaro Prieto
+*/
+#ifndef _DELTA_H
+#define _DELTA_H
+
+#include <stdint.h>
+
+// Largest frame, in channels (one byte each)
+#ifndef DELTA_MAX_CHANNELS
+#define DELTA_MAX_CHANNELS (32)
+#endif
+
+// A keyframe goes out at least every this many frames, so receivers that
+// missed something (or just started) catch up
+#ifndef DELTA_KEYFRAME_INTERVAL
+#define DELTA_KEYFRAME_INTERVAL (32)
+#endif
+
+// Worst case encoded size of a frame with n channels
+#define DELTA_MAX_ENCODED_LENGTH( n ) ( 1 + (n) + ( (n) + 127 ) / 128 )
+
+typedef struct
+{
+  uint8_t* previous;        // Last frame sent, channels bytes
+  uint8_t channels;
+  uint8_t sequence;
+  uint8_t since_keyframe;
+} delta_encoder_t;
+
+typedef struct
+{
+  uint8_t* values;          // Current frame, channels bytes
+  uint8_t channels;
+  uint8_t sequence;         // Sequence number of the next delta frame
+  uint8_t synced;           // Set once a keyframe has been received
+} delta_decoder_t;
+
+void delta_encoder_init( delta_encoder_t*, uint8_t*, uint8_t );
+uint8_t delta_encode( delta_encoder_t*, const uint8_t*, uint8_t* );
+
+void delta_decoder_init( delta_decoder_t*, uint8_t*, uint8_t );
+uint8_t delta_decode( delta_decoder_t*, const uint8_t*, uint8_t );
+
+#endif /* _DELTA_H */
@@ -0,0 +1,244 @@
+/** @file dispatch.c
+*
+* @brief Packet type dispatch table, used as the radio's rx_callback
+*
+* Pass dispatch_callback() to setup_cc2500() and register a handler per
+* packet type instead of switching on the type byte in every project. The
+* type (the byte after the address) indexes the table directly, so every
+* packet costs the same to dispatch.
+*
+* Handlers take the same arguments as an rx_callback: the packet from the
+* address byte on, its length, and the RSSI and LQI bytes right after it.
+* DISPATCH_ISR handlers run in the radio ISR and their return value wakes
+* the processor, so keep them short (control packets, timestamps).
+* DISPATCH_DEFERRED handlers get a copy of the packet from dispatch_poll(),
+* called from the main loop, so bulk data doesn't hold up the ISR. Their
+* return value is ignored. The copy goes in one of DISPATCH_QUEUE_LENGTH
+* slots of DISPATCH_PAYLOAD bytes, packets that find them full or don't fit
+* are dropped.
+*
+* @author Alvaro Prieto
+*/
+#include "dispatch.h"
+#include "cc2500.h"
+#include "device.h"
+#include <string.h>
+
+// Packet byte with the type, after the address
+#define TYPE_FIELD (1)
+
+// Address byte before the payload
+#define ADDRESS_LENGTH (1)
+
+// RSSI and LQI after the packet
+#define STATUS_LENGTH (2)
+
+typedef struct
+{
+  uint8_t (*handler)( uint8_t*, uint8_t );
+  uint8_t flags;
+  uint16_t count;
+} entry_t;
+
+typedef struct
+{
+  uint8_t type;
+  uint8_t length;
+  uint8_t buffer[ADDRESS_LENGTH + DISPATCH_PAYLOAD + STATUS_LENGTH];
+} slot_t;
+
+static entry_t table[DISPATCH_TYPES];
+
+static slot_t queue[DISPATCH_QUEUE_LENGTH];
+static volatile uint8_t queue_head = 0;
+static volatile uint8_t queue_count = 0;
+
+static uint16_t unhandled = 0;
+static uint16_t dropped = 0;
+
+/*******************************************************************************
+ * @fn     void dispatch_setup( void )
+ * @brief  Remove every handler, empty the queue and clear the counters
+ * ****************************************************************************/
+void dispatch_setup( void )
+{
+  uint8_t interrupts_enabled;
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  memset( table, 0x00, sizeof(table) );
+  queue_head = 0;
+  queue_count = 0;
+  unhandled = 0;
+  dropped = 0;
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+}
+
+/*******************************************************************************
+ * @fn     void dispatch_register( uint8_t type,
+ *                      uint8_t (*handler)( uint8_t*, uint8_t ), uint8_t flags )
+ * @brief  Call handler for packets of type, from the ISR or deferred
+ *         depending on flags. A null handler removes the entry.
+ * ****************************************************************************/
+void dispatch_register( uint8_t type, uint8_t (*handler)( uint8_t*, uint8_t ),
+                                                                uint8_t flags )
+{
+  uint8_t interrupts_enabled;
+
+  if( type >= DISPATCH_TYPES )
+  {
+    return;
+  }
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  table[type].handler = handler;
+  table[type].flags = flags;
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t dispatch_callback( uint8_t* buffer, uint8_t length )
+ * @brief  Radio rx_callback. Runs ISR handlers right away and queues packets
+ *         for deferred ones, waking the processor so dispatch_poll() runs.
+ * ****************************************************************************/
+uint8_t dispatch_callback( uint8_t* buffer, uint8_t length )
+{
+  entry_t* entry;
+  slot_t* slot;
+
+  if( ( length <= TYPE_FIELD ) || ( buffer[TYPE_FIELD] >= DISPATCH_TYPES ) )
+  {
+    unhandled++;
+    return 0;
+  }
+
+  entry = &table[buffer[TYPE_FIELD]];
+
+  if( 0 == entry->handler )
+  {
+    unhandled++;
+    return 0;
+  }
+
+  entry->count++;
+
+  if( !( entry->flags & DISPATCH_DEFERRED ) )
+  {
+    return entry->handler( buffer, length );
+  }
+
+  if( ( DISPATCH_QUEUE_LENGTH == queue_count ) ||
+      ( length > ( ADDRESS_LENGTH + DISPATCH_PAYLOAD ) ) )
+  {
+    dropped++;
+    return 1;
+  }
+
+  slot = &queue[( queue_head + queue_count ) % DISPATCH_QUEUE_LENGTH];
+  slot->type = buffer[TYPE_FIELD];
+  slot->length = length;
+  memcpy( slot->buffer, buffer, length + STATUS_LENGTH );
+
+  queue_count++;
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     void dispatch_poll( void )
+ * @brief  Call the deferred handlers of every queued packet. Call it from the
+ *         main loop whenever rx_callback wakes the processor up.
+ * ****************************************************************************/
+void dispatch_poll( void )
+{
+  slot_t* slot;
+  uint8_t (*handler)( uint8_t*, uint8_t );
+
+  while( queue_count )
+  {
+    // The ISR only adds slots behind the head one, so it can be used in place
+    slot = &queue[queue_head];
+    handler = table[slot->type].handler;
+
+    if( handler )
+    {
+      handler( slot->buffer, slot->length );
+    }
+
+    __disable_interrupt();
+    queue_head = ( queue_head + 1 ) % DISPATCH_QUEUE_LENGTH;
+    queue_count--;
+    __enable_interrupt();
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint16_t dispatch_count( uint8_t type )
+ * @brief  Packets of type received since the last clear, handled or queued
+ * ****************************************************************************/
+uint16_t dispatch_count( uint8_t type )
+{
+  if( type >= DISPATCH_TYPES )
+  {
+    return 0;
+  }
+
+  return table[type].count;
+}
+
+/*******************************************************************************
+ * @fn     uint16_t dispatch_unhandled( void )
+ * @brief  Packets without a handler for their type
+ * ****************************************************************************/
+uint16_t dispatch_unhandled( void )
+{
+  return unhandled;
+}
+
+/*******************************************************************************
+ * @fn     uint16_t dispatch_dropped( void )
+ * @brief  Packets for deferred handlers lost because the queue was full or
+ *         they were longer than DISPATCH_PAYLOAD (also included in their
+ *         type's count)
+ * ****************************************************************************/
+uint16_t dispatch_dropped( void )
+{
+  return dropped;
+}
+
+/*******************************************************************************
+ * @fn     void dispatch_clear_counts( void )
+ * @brief  Start counting from zero
+ * ****************************************************************************/
+void dispatch_clear_counts( void )
+{
+  uint8_t type;
+  uint8_t interrupts_enabled;
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  for( type = 0; type < DISPATCH_TYPES; type++ )
+  {
+    table[type].count = 0;
+  }
+
+  unhandled = 0;
+  dropped = 0;
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+}
@@ -0,0 +1,49 @@
+/** @file dispatch.h
+*
+* @brief Packet type dispatch table, used as the radio's rx_callback
+*
+* @author Alvaro Prieto
+*/
+#ifndef _DISPATCH_H
+#define _DISPATCH_H
+
+#include <stdint.h>
+#include "packet.h"
+
+// RAM, on the MSP430: 6 bytes per type for the table, plus
+// DISPATCH_QUEUE_LENGTH * ( DISPATCH_PAYLOAD + 5 ) for the deferred packets,
+// plus 6 for the queue and counters. The defaults take 81 bytes, raise them
+// only on parts with more than 256 bytes of RAM.
+
+// Packet types with a table entry (0 to DISPATCH_TYPES - 1). Others count as
+// unhandled. The default covers the types in packet.h.
+#ifndef DISPATCH_TYPES
+#define DISPATCH_TYPES (AGGREGATE + 1)
+#endif
+
+// Packets waiting for dispatch_poll(), at most
+#ifndef DISPATCH_QUEUE_LENGTH
+#define DISPATCH_QUEUE_LENGTH (1)
+#endif
+
+// Longest packet a deferred handler takes, without the length and address
+// bytes. Longer ones are dropped.
+#ifndef DISPATCH_PAYLOAD
+#define DISPATCH_PAYLOAD (16)
+#endif
+
+// Handler flags for dispatch_register()
+#define DISPATCH_ISR      (0x00)    // Called from the radio ISR
+#define DISPATCH_DEFERRED (0x01)    // Copied and called from dispatch_poll()
+
+void dispatch_setup( void );
+void dispatch_register( uint8_t, uint8_t (*)( uint8_t*, uint8_t ), uint8_t );
+uint8_t dispatch_callback( uint8_t*, uint8_t );
+void dispatch_poll( void );
+
+uint16_t dispatch_count( uint8_t );
+uint16_t dispatch_unhandled( void );
+uint16_t dispatch_dropped( void );
+void dispatch_clear_counts( void );
+
+#endif /* _DISPATCH_H */
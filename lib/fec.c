@@ -0,0 +1,167 @@
+/** @file fec.c
+*
+* @brief Software forward error correction (interleaved extended Hamming
+*        8,4) for links that can't use the radio's own FEC
+*
+* The radio only does FEC with fixed length packets (cc2500_enable_fec()).
+* This is for variable length links: every nibble becomes an 8-bit extended
+* Hamming codeword, which corrects any one bit error and detects two. The
+* codewords of a block are bit interleaved, so a burst of errors shorter than
+* the number of codewords costs each codeword at most one bit.
+*
+* The radio drops packets that fail the CRC before anything can correct
+* them, so the receiver has to run with cc2500_enable_sniffer() and trust
+* fec_decode() instead. The length byte isn't covered.
+*
+* @author Alvaro Prieto
+*/
+#include "fec.h"
+#include <string.h>
+
+// Decode table flags. The low nibble is the data.
+#define CORRECTED       (0x10)
+#define UNCORRECTABLE   (0x80)
+
+// Codeword for each nibble: data in bits 0-3, Hamming parity in 4-6 and
+// overall parity in 7
+static const uint8_t encode_table[16] = {
+                              0x00, 0xB1, 0xD2, 0x63, 0xE4, 0x55, 0x36, 0x87,
+                              0x78, 0xC9, 0xAA, 0x1B, 0x9C, 0x2D, 0x4E, 0xFF };
+
+// Nearest codeword's nibble for every received byte, or UNCORRECTABLE if two
+// are equally near (two bit errors)
+static const uint8_t decode_table[256] = {
+    0x00, 0x10, 0x10, 0x80, 0x10, 0x80, 0x80, 0x17,
+    0x10, 0x80, 0x80, 0x1B, 0x80, 0x1D, 0x1E, 0x80,
+    0x10, 0x80, 0x80, 0x1B, 0x80, 0x15, 0x16, 0x80,
+    0x80, 0x1B, 0x1B, 0x0B, 0x1C, 0x80, 0x80, 0x1B,
+    0x10, 0x80, 0x80, 0x13, 0x80, 0x1D, 0x16, 0x80,
+    0x80, 0x1D, 0x1A, 0x80, 0x1D, 0x0D, 0x80, 0x1D,
+    0x80, 0x11, 0x16, 0x80, 0x16, 0x80, 0x06, 0x16,
+    0x18, 0x80, 0x80, 0x1B, 0x80, 0x1D, 0x16, 0x80,
+    0x10, 0x80, 0x80, 0x13, 0x80, 0x15, 0x1E, 0x80,
+    0x80, 0x19, 0x1E, 0x80, 0x1E, 0x80, 0x0E, 0x1E,
+    0x80, 0x15, 0x12, 0x80, 0x15, 0x05, 0x80, 0x15,
+    0x18, 0x80, 0x80, 0x1B, 0x80, 0x15, 0x1E, 0x80,
+    0x80, 0x13, 0x13, 0x03, 0x14, 0x80, 0x80, 0x13,
+    0x18, 0x80, 0x80, 0x13, 0x80, 0x1D, 0x1E, 0x80,
+    0x18, 0x80, 0x80, 0x13, 0x80, 0x15, 0x16, 0x80,
+    0x08, 0x18, 0x18, 0x80, 0x18, 0x80, 0x80, 0x1F,
+    0x10, 0x80, 0x80, 0x17, 0x80, 0x17, 0x17, 0x07,
+    0x80, 0x19, 0x1A, 0x80, 0x1C, 0x80, 0x80, 0x17,
+    0x80, 0x11, 0x12, 0x80, 0x1C, 0x80, 0x80, 0x17,
+    0x1C, 0x80, 0x80, 0x1B, 0x0C, 0x1C, 0x1C, 0x80,
+    0x80, 0x11, 0x1A, 0x80, 0x14, 0x80, 0x80, 0x17,
+    0x1A, 0x80, 0x0A, 0x1A, 0x80, 0x1D, 0x1A, 0x80,
+    0x11, 0x01, 0x80, 0x11, 0x80, 0x11, 0x16, 0x80,
+    0x80, 0x11, 0x1A, 0x80, 0x1C, 0x80, 0x80, 0x1F,
+    0x80, 0x19, 0x12, 0x80, 0x14, 0x80, 0x80, 0x17,
+    0x19, 0x09, 0x80, 0x19, 0x80, 0x19, 0x1E, 0x80,
+    0x12, 0x80, 0x02, 0x12, 0x80, 0x15, 0x12, 0x80,
+    0x80, 0x19, 0x12, 0x80, 0x1C, 0x80, 0x80, 0x1F,
+    0x14, 0x80, 0x80, 0x13, 0x04, 0x14, 0x14, 0x80,
+    0x80, 0x19, 0x1A, 0x80, 0x14, 0x80, 0x80, 0x1F,
+    0x80, 0x11, 0x12, 0x80, 0x14, 0x80, 0x80, 0x1F,
+    0x18, 0x80, 0x80, 0x1F, 0x80, 0x1F, 0x1F, 0x0F };
+
+/*******************************************************************************
+ * @fn     uint8_t fec_encode( const uint8_t* data, uint8_t length,
+ *                                                          uint8_t* encoded )
+ * @brief  Encode length bytes of data into FEC_ENCODED_LENGTH( length ) bytes.
+ *         Returns the encoded length, 0 if it's over FEC_MAX_ENCODED_LENGTH.
+ * ****************************************************************************/
+uint8_t fec_encode( const uint8_t* data, uint8_t length, uint8_t* encoded )
+{
+  uint8_t words;
+  uint8_t word;
+  uint8_t bit;
+  uint8_t code;
+  uint16_t position;
+
+  // Checked before doubling, 128 and up would wrap around in a uint8_t
+  if( length > FEC_MAX_ENCODED_LENGTH / 2 )
+  {
+    return 0;
+  }
+
+  words = FEC_ENCODED_LENGTH( length );
+
+  memset( encoded, 0x00, words );
+
+  for( word = 0; word < words; word++ )
+  {
+    if( word & 1 )
+    {
+      code = encode_table[data[word >> 1] >> 4];
+    }
+    else
+    {
+      code = encode_table[data[word >> 1] & 0x0F];
+    }
+
+    // Bit n of every codeword goes out before bit n + 1 of any of them
+    for( bit = 0, position = word; bit < 8; bit++, position += words )
+    {
+      if( code & ( 1 << bit ) )
+      {
+        encoded[position >> 3] |= 0x80 >> ( position & 7 );
+      }
+    }
+  }
+
+  return words;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t fec_decode( const uint8_t* encoded, uint8_t length,
+ *                                                              uint8_t* data )
+ * @brief  Decode length encoded bytes into length / 2 bytes of data,
+ *         correcting what it can. Returns the number of codewords that had
+ *         too many errors to correct, 0 when data can be trusted.
+ * ****************************************************************************/
+uint8_t fec_decode( const uint8_t* encoded, uint8_t length, uint8_t* data )
+{
+  uint8_t words = length & ~1;
+  uint8_t word;
+  uint8_t bit;
+  uint8_t code;
+  uint8_t nibble;
+  uint8_t failed = 0;
+  uint16_t position;
+
+  if( words > FEC_MAX_ENCODED_LENGTH )
+  {
+    return words;
+  }
+
+  for( word = 0; word < words; word++ )
+  {
+    code = 0;
+
+    for( bit = 0, position = word; bit < 8; bit++, position += words )
+    {
+      if( encoded[position >> 3] & ( 0x80 >> ( position & 7 ) ) )
+      {
+        code |= 1 << bit;
+      }
+    }
+
+    nibble = decode_table[code];
+
+    if( nibble & UNCORRECTABLE )
+    {
+      failed++;
+    }
+
+    if( word & 1 )
+    {
+      data[word >> 1] |= ( nibble & 0x0F ) << 4;
+    }
+    else
+    {
+      data[word >> 1] = nibble & 0x0F;
+    }
+  }
+
+  return failed;
+}
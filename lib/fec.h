@@ -0,0 +1,22 @@
+/** @file fec.h
+*
+* @brief Software forward error correction (interleaved extended Hamming
+*        8,4) for links that can't use the radio's own FEC
+*
+* @author Alvaro Prieto
+*/
+#ifndef _FEC_H
+#define _FEC_H
+
+#include <stdint.h>
+
+// Encoded size of length bytes of data
+#define FEC_ENCODED_LENGTH( length ) ( (length) * 2 )
+
+// Largest encoded block, in bytes (fits a whole packet)
+#define FEC_MAX_ENCODED_LENGTH (60)
+
+uint8_t fec_encode( const uint8_t*, uint8_t, uint8_t* );
+uint8_t fec_decode( const uint8_t*, uint8_t, uint8_t* );
+
+#endif /* _FEC_H */
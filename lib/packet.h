@@ -0,0 +1,97 @@
+/** @file packet.h
+*
+* @brief Packet header and packet types, shared by the firmware and the host
+*        tools
+*
+* Limits that depend on the radio (CC2500_MAX_PACKET_LENGTH) come from
+* cc2500.h, where they're used.
+*
+* @author Alvaro Prieto
+*/
+#ifndef _PACKET_H
+#define _PACKET_H
+
+#include <stdint.h>
+
+/**
+ * Packet header structure. The packet length byte is omitted, since the receive
+ * function strips it away. Also, the cc2500_tx_packet function inserts it
+ * automatically.
+ */
+typedef struct
+{
+  uint8_t destination;  // Packet destination
+  uint8_t source;       // Packet source
+  uint8_t type;         // Packet Type
+  uint8_t flags;        // Misc flags
+} packet_header_t;
+
+//
+// Packet Type Definitions (todo)
+//
+#define IO_CHANGE (0x01)
+#define RGB_UNIVERSE (0x02)
+#define TIME_BEACON (0x03)
+#define RGB_SCENE (0x04)
+#define DELTA_STREAM (0x05)
+#define SERVO_COMMAND (0x06)
+#define RATE_SWITCH (0x07)
+#define AGGREGATE (0x08)
+
+//
+// RGB_UNIVERSE packets are broadcast and carry the colors of many fixtures:
+// [RGB_UNIVERSE][first fixture][r g b][r g b]...
+// Each fixture picks the triplet for its own index, if it's in the packet.
+//
+#define RGB_UNIVERSE_HEADER_LENGTH (2)
+#define RGB_UNIVERSE_MAX_FIXTURES ( ( CC2500_MAX_PACKET_LENGTH - 1 - \
+                                          RGB_UNIVERSE_HEADER_LENGTH ) / 3 )
+
+//
+// TIME_BEACON packets are broadcast by the coordinator to keep node clocks in
+// step (see timesync.h): [TIME_BEACON][sequence][network time, 4 bytes]
+// The time is when the sync word of the beacon before this one went out.
+//
+#define TIME_BEACON_LENGTH (6)
+
+//
+// RGB_SCENE packets are RGB_UNIVERSE packets with a network time at which
+// every fixture should switch to the new colors:
+// [RGB_SCENE][apply time, 4 bytes][first fixture][r g b][r g b]...
+//
+#define RGB_SCENE_HEADER_LENGTH (6)
+#define RGB_SCENE_MAX_FIXTURES ( ( CC2500_MAX_PACKET_LENGTH - 1 - \
+                                          RGB_SCENE_HEADER_LENGTH ) / 3 )
+
+//
+// DELTA_STREAM packets are broadcast and carry one delta.h encoded RGB frame:
+// [DELTA_STREAM][encoded frame]
+//
+#define DELTA_STREAM_CHANNELS (3)
+
+//
+// SERVO_COMMAND packets move one or more servos (see servo.h):
+// [SERVO_COMMAND][servo][position][speed][acceleration]...
+// Position is the pulse width in us (0 turns the servo off), speed and
+// acceleration the ramp limits for servo_set_ramp(). All 16-bit little endian.
+//
+#define SERVO_RECORD_LENGTH (7)
+
+//
+// RATE_SWITCH packets move both ends of a link to another modem profile
+// (see rate.h): [RATE_SWITCH][source][RATE_REQUEST or RATE_ACCEPT][profile]
+// They're always sent on the profile the link is on now.
+//
+#define RATE_SWITCH_LENGTH (4)
+#define RATE_REQUEST (0x00)
+#define RATE_ACCEPT (0x01)
+
+//
+// AGGREGATE packets carry several short messages for the same destination
+// (see aggregate.h): [AGGREGATE][length][message][length][message]...
+// Each message starts with its own type byte, like a packet without the
+// address.
+//
+#define AGGREGATE_HEADER_LENGTH (1)
+
+#endif /* _PACKET_H */
@@ -0,0 +1,51 @@
+/** @file pwm.h
+*
+* @brief Software PWM for LEDs on plain GPIO pins
+*
+* Each file in pwm/ implements this interface, and a project links one:
+*   - pwm/ti/timera_bcm.c: binary code modulation, gamma corrected 12-bit.
+*     Used by wireless_rgb_led and spwm_test.
+*   - pwm/ti/timera.c: edge scheduled 8-bit pwm, at most PWM_CHANNELS + 1
+*     interrupts per period. No project links it right now. It's kept as the
+*     alternative for parts or pins where the BCM frame interrupts don't fit,
+*     and host/test/pwm_sim.c keeps it tested.
+*
+* @author Alvaro Prieto
+*/
+#ifndef _PWM_H
+#define _PWM_H
+
+#include <stdint.h>
+
+// Number of channels and their pins. All channels must be on the same port.
+// Defaults match the RGB LED wiring used by wireless_rgb_led and spwm_test.
+#ifndef PWM_CHANNELS
+#define PWM_CHANNELS      3
+#endif
+
+#ifndef PWM_PxOUT
+#define PWM_PxOUT         P2OUT
+#define PWM_PxDIR         P2DIR
+#endif
+
+#ifndef PWM_PINS
+#define PWM_PINS          { BIT0, BIT1, BIT2 }
+#endif
+
+// LEDs are wired so that a low pin turns them on. Undefine for active high.
+#ifndef PWM_ACTIVE_HIGH
+#define PWM_ACTIVE_LOW
+#endif
+
+void pwm_setup( void );
+void pwm_set( uint8_t, uint8_t );
+void pwm_update( void );
+
+// Local clock in SMCLK cycles, kept by the pwm timer
+uint32_t pwm_timestamp( void );
+
+// Like pwm_update(), but the new values show up at the given pwm_timestamp()
+// time, and the pwm period restarts there so fixtures stay in phase
+void pwm_latch_at( uint32_t );
+
+#endif /* _PWM_H */
@@ -0,0 +1,399 @@
+/** @file timera.c
+*
+* @brief Edge scheduled software PWM using Timer_A
+*
+* Instead of interrupting at a fixed rate and comparing a counter against
+* every channel, the duty cycles are sorted into a list of edges. CCR0 starts
+* each period and turns every active channel on, then CCR1 is moved from edge
+* to edge, turning channels off. That is at most PWM_CHANNELS + 1 interrupts
+* per period, no matter the resolution.
+*
+* New values are written into a second schedule and swapped in at the start
+* of a period, so a period is never drawn with half old, half new values.
+* pwm_latch_at() swaps them in at an exact time instead, and restarts the
+* period there so nodes latching at the same time stay in phase.
+*
+* Uses Timer0_A CCR0, CCR1 and CCR2 in up mode, clocked from SMCLK.
+*
+* @author Alvaro Prieto
+*/
+#include <string.h>
+#include "pwm.h"
+#include "device.h"
+
+// Period in SMCLK cycles. 16384 at 16MHz is ~977Hz
+#define PWM_PERIOD (16384)
+
+// 8-bit value to timer ticks
+#define PWM_SHIFT (6)
+
+// An edge closer than this to the current timer value is handled right away,
+// since CCR1 would already have passed it by the time it was written
+#define PWM_EDGE_MARGIN (48)
+
+#ifdef PWM_ACTIVE_LOW
+#define CHANNELS_ON( mask )   ( PWM_PxOUT &= ~(mask) )
+#define CHANNELS_OFF( mask )  ( PWM_PxOUT |= (mask) )
+#else
+#define CHANNELS_ON( mask )   ( PWM_PxOUT |= (mask) )
+#define CHANNELS_OFF( mask )  ( PWM_PxOUT &= ~(mask) )
+#endif
+
+typedef struct
+{
+  uint16_t time;    // Timer value at which the channels turn off
+  uint8_t mask;     // Pins that turn off at this time
+} pwm_edge_t;
+
+typedef struct
+{
+  pwm_edge_t edges[PWM_CHANNELS];
+  uint8_t total_edges;
+  uint8_t on_mask;  // Pins turned on at the start of the period
+} pwm_schedule_t;
+
+static const uint8_t pwm_pins[PWM_CHANNELS] = PWM_PINS;
+
+static uint8_t pwm_values[PWM_CHANNELS];
+static uint8_t all_pins;
+
+static pwm_schedule_t schedules[2];
+static volatile uint8_t active_schedule = 0;
+static volatile uint8_t schedule_pending = 0;
+
+// Next edge in the active schedule
+static uint8_t edge_index;
+
+// pwm_timestamp() at the start of the current period
+static uint32_t period_start = 0;
+
+// Pending pwm_latch_at(). CCR2 is only armed in the period the latch time
+// falls in.
+static uint32_t latch_time;
+static uint8_t latch_armed = 0;
+
+static void build_schedule( void );
+static void arm_latch( void );
+static void latch( void );
+static void start_period( void );
+static void run_edges( void );
+
+/*******************************************************************************
+ * @fn     void pwm_setup( void )
+ * @brief  Configure pins and start the timer with every channel off
+ * ****************************************************************************/
+void pwm_setup( void )
+{
+  uint8_t channel;
+
+  for( channel = 0; channel < PWM_CHANNELS; channel++ )
+  {
+    all_pins |= pwm_pins[channel];
+  }
+
+  CHANNELS_OFF( all_pins );
+  PWM_PxDIR |= all_pins;
+
+  // SMCLK, up mode
+  TA0CCR0 = PWM_PERIOD - 1;
+  TA0CCTL0 = CCIE;
+  TA0CCTL1 = 0;
+  TA0CCTL2 = 0;
+  TA0CTL = TASSEL_2 + MC_1 + TACLR;
+}
+
+/*******************************************************************************
+ * @fn     void pwm_set( uint8_t channel, uint8_t value )
+ * @brief  Set a channel's brightness (0-255). Takes effect on pwm_update().
+ * ****************************************************************************/
+void pwm_set( uint8_t channel, uint8_t value )
+{
+  if( channel < PWM_CHANNELS )
+  {
+    pwm_values[channel] = value;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void pwm_update( void )
+ * @brief  Build a new edge schedule from the current values. It's swapped in
+ *         at the start of the next period. Cancels a pending pwm_latch_at().
+ *         Safe to call from an ISR.
+ * ****************************************************************************/
+void pwm_update( void )
+{
+  uint8_t interrupts_enabled;
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  latch_armed = 0;
+  TA0CCTL2 = 0;
+
+  build_schedule();
+  schedule_pending = 1;
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+}
+
+/*******************************************************************************
+ * @fn     void pwm_latch_at( uint32_t time )
+ * @brief  Build a new edge schedule from the current values and show it at
+ *         pwm_timestamp() time, starting a new period there. A time that has
+ *         already gone by latches right away. Calling this or pwm_update()
+ *         again before the latch replaces it. Safe to call from an ISR.
+ * ****************************************************************************/
+void pwm_latch_at( uint32_t time )
+{
+  uint8_t interrupts_enabled;
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  TA0CCTL2 = 0;
+
+  build_schedule();
+  schedule_pending = 0;
+
+  latch_time = time;
+  latch_armed = 1;
+  arm_latch();
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint32_t pwm_timestamp( void )
+ * @brief  Current time in SMCLK cycles. Wraps every 2^32 cycles (~268s at
+ *         16MHz), so compare times by subtracting them. Safe to call from an
+ *         ISR.
+ * ****************************************************************************/
+uint32_t pwm_timestamp( void )
+{
+  uint32_t time;
+  uint16_t count;
+  uint8_t interrupts_enabled;
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  count = TA0R;
+  time = period_start + count;
+
+  // A new period started, but the interrupt hasn't counted it yet
+  if( ( TA0CCTL0 & CCIFG ) && ( count < ( PWM_PERIOD / 2 ) ) )
+  {
+    time += PWM_PERIOD;
+  }
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+
+  return time;
+}
+
+/*******************************************************************************
+ * @fn     void build_schedule( void )
+ * @brief  Fill the schedule the timer isn't using from pwm_values. Interrupts
+ *         must be disabled.
+ * ****************************************************************************/
+static void build_schedule( void )
+{
+  pwm_schedule_t* schedule;
+  uint16_t time;
+  uint8_t channel;
+  uint8_t index;
+
+  // Whichever schedule the timer isn't using
+  schedule = &schedules[active_schedule ^ 1];
+  schedule->total_edges = 0;
+  schedule->on_mask = 0;
+
+  for( channel = 0; channel < PWM_CHANNELS; channel++ )
+  {
+    if( 0 == pwm_values[channel] )
+    {
+      continue;
+    }
+
+    time = (uint16_t)pwm_values[channel] << PWM_SHIFT;
+    schedule->on_mask |= pwm_pins[channel];
+
+    // Insertion sort, merging channels that turn off at the same time
+    for( index = 0; index < schedule->total_edges; index++ )
+    {
+      if( schedule->edges[index].time >= time )
+      {
+        break;
+      }
+    }
+
+    if( ( index < schedule->total_edges ) &&
+                                    ( schedule->edges[index].time == time ) )
+    {
+      schedule->edges[index].mask |= pwm_pins[channel];
+      continue;
+    }
+
+    memmove( &schedule->edges[index + 1], &schedule->edges[index],
+                  ( schedule->total_edges - index ) * sizeof(pwm_edge_t) );
+    schedule->edges[index].time = time;
+    schedule->edges[index].mask = pwm_pins[channel];
+    schedule->total_edges++;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void arm_latch( void )
+ * @brief  Latch now if the latch time is here, or set CCR2 for it if it's in
+ *         this period. Otherwise the next period start tries again. Interrupts
+ *         must be disabled.
+ * ****************************************************************************/
+static void arm_latch( void )
+{
+  uint32_t offset;
+
+  if( (int32_t)( latch_time - pwm_timestamp() ) < PWM_EDGE_MARGIN )
+  {
+    latch();
+    return;
+  }
+
+  // Period start pending, period_start is about to move
+  if( TA0CCTL0 & CCIFG )
+  {
+    return;
+  }
+
+  offset = latch_time - period_start;
+  if( offset < PWM_PERIOD )
+  {
+    TA0CCR2 = offset;
+    TA0CCTL2 = CCIE;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void latch( void )
+ * @brief  Swap in the latched schedule and restart the period right away.
+ *         Interrupts must be disabled.
+ * ****************************************************************************/
+static void latch( void )
+{
+  uint16_t count;
+
+  latch_armed = 0;
+  TA0CCTL2 = 0;
+
+  // Restart the timer, keeping pwm_timestamp() going. The few cycles between
+  // reading and clearing are lost, the next beacon makes up for them.
+  count = TA0R;
+  TA0CTL |= TACLR;
+  if( TA0CCTL0 & CCIFG )
+  {
+    // Period start that never got serviced
+    TA0CCTL0 &= ~CCIFG;
+    period_start += PWM_PERIOD;
+  }
+  period_start += count;
+
+  CHANNELS_OFF( all_pins );
+  schedule_pending = 1;
+  start_period();
+}
+
+/*******************************************************************************
+ * @fn     void start_period( void )
+ * @brief  Swap in a new schedule if there is one and turn the active channels
+ *         on
+ * ****************************************************************************/
+static void start_period( void )
+{
+  if( schedule_pending )
+  {
+    active_schedule ^= 1;
+    schedule_pending = 0;
+  }
+
+  CHANNELS_ON( schedules[active_schedule].on_mask );
+  edge_index = 0;
+
+  run_edges();
+}
+
+/*******************************************************************************
+ * @fn     void run_edges( void )
+ * @brief  Turn off every channel whose edge is due and program CCR1 for the
+ *         next one
+ * ****************************************************************************/
+static void run_edges( void )
+{
+  pwm_schedule_t* schedule = &schedules[active_schedule];
+
+  while( edge_index < schedule->total_edges )
+  {
+    if( schedule->edges[edge_index].time > ( TA0R + PWM_EDGE_MARGIN ) )
+    {
+      TA0CCR1 = schedule->edges[edge_index].time;
+      TA0CCTL1 = CCIE;
+      return;
+    }
+
+    // Wait for the exact edge if it's close, then turn the channels off
+    while( TA0R < schedule->edges[edge_index].time );
+    CHANNELS_OFF( schedule->edges[edge_index].mask );
+    edge_index++;
+  }
+
+  // No more edges this period
+  TA0CCTL1 = 0;
+}
+
+/*******************************************************************************
+ * @fn     void pwm_period_isr( void )
+ * @brief  Start of a period. Swap in a new schedule if there is one and turn
+ *         the active channels on.
+ * ****************************************************************************/
+#pragma vector=TIMER0_A0_VECTOR
+__interrupt void pwm_period_isr(void)
+{
+  period_start += PWM_PERIOD;
+
+  start_period();
+
+  // Latch time might be in this period
+  if( latch_armed && !( TA0CCTL2 & CCIE ) )
+  {
+    arm_latch();
+  }
+}
+
+/*******************************************************************************
+ * @fn     void pwm_edge_isr( void )
+ * @brief  CCR1 match (next edge(s) due) or CCR2 match (latch time)
+ * ****************************************************************************/
+#pragma vector=TIMER0_A1_VECTOR
+__interrupt void pwm_edge_isr(void)
+{
+  switch( TA0IV )
+  {
+    case TA0IV_TACCR1:
+      run_edges();
+      break;
+
+    case TA0IV_TACCR2:
+      latch();
+      break;
+
+    default:
+      break;
+  }
+}
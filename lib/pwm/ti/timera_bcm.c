@@ -0,0 +1,464 @@
+/** @file timera_bcm.c
+*
+* @brief Binary code modulation (BCM) software PWM using Timer_A
+*
+* Each frame is split into BCM_BITS bit planes, plane n lasting twice as long
+* as plane n-1. During plane n, a channel is on if bit n of its brightness is
+* set, so over a whole frame it's on for exactly <brightness> base periods.
+* The outputs only change at plane boundaries, so a frame takes one interrupt
+* per plane instead of one per brightness step, no matter the depth.
+*
+* 8-bit brightness values go through a gamma table to 12-bit plane values.
+* Most of the 12 bits are spent on the dark end, where linear 8-bit PWM
+* visibly steps.
+*
+* A frame is shown as BCM_SLOTS slots: the short planes first, then the long
+* ones, with the top plane split in two so no slot is longer than the signed
+* 16-bit timer differences can handle (the halves also spread the brightest
+* part of the frame out, which flickers less). The first BCM_INLINE_SLOTS are
+* too short to wait for with an interrupt, so the frame start interrupt times
+* them by polling the timer. That makes 10 interrupts per frame, 12 with the
+* two timer overflows, and about 1.4% of the CPU counting the early wake ups.
+*
+* run_planes() costs, counted from the MSP430 instruction timings for the
+* code below (registers for the locals, as -O2 builds it):
+*   - interrupt accept 6, ISR pushes about 24, TA0IV dispatch about 10, and
+*     loading the locals and the new frame check about 35: 75 cycles from the
+*     CCR1 compare to the first boundary poll. BCM_EARLY_TICKS is 128 to
+*     cover that with room to spare.
+*   - each pass of the inner loop: boundary poll 6 (which is also the jitter
+*     on every boundary), port update 12, next boundary from the table 5,
+*     loop test 5. About 28 cycles, under the 32 cycle shortest plane. The
+*     port is always written the same number of cycles after the boundary,
+*     so the offset cancels out of the plane lengths.
+* Boundaries are still late by however long interrupts are held off, the
+* radio ISR or pwm_update() running with them disabled.
+*
+* New values are written into a second set of planes and swapped in at the
+* start of a frame, or at an exact time with pwm_latch_at(). A latch also
+* starts a new frame, so nodes latching at the same time stay in phase.
+*
+* Uses Timer0_A CCR1 and CCR2 in continuous mode, clocked from SMCLK. The
+* timer overflow extends it to the 32-bit pwm_timestamp() clock. Implements
+* the same interface as timera.c, so only one of them can be linked.
+*
+* @author Alvaro Prieto
+*/
+#include "pwm.h"
+#include "device.h"
+
+#define BCM_BITS (12)
+
+// Length of the shortest plane in SMCLK cycles, no shorter than one pass of
+// the inline loop in run_planes(). The frame is BCM_BASE_TICKS * 4095
+// cycles long, 131040 is ~122Hz at 16MHz.
+#define BCM_BASE_TICKS (32)
+
+// Slots per frame, the top plane takes two
+#define BCM_SLOTS (BCM_BITS + 1)
+
+// Slots 0-2 (32, 64 and 128 cycles) are timed inline from the frame start
+// interrupt
+#define BCM_INLINE_SLOTS (3)
+
+// CCR1 fires this early so that the interrupt latency can be waited out and
+// the slot boundary hit to within a few cycles. Must be more than the 75
+// cycles from the compare to the first poll, and well under the shortest
+// slot timed by interrupt (256 cycles).
+#define BCM_EARLY_TICKS (128)
+
+// Delay from pwm_setup() to the first frame
+#define BCM_START_TICKS (256)
+
+// The frame after a latch starts this long after the latch time, enough to
+// get from the CCR2 interrupt to the first slot
+#define BCM_LATCH_TICKS (256)
+
+// Which plane each slot shows, and for how long
+static const uint8_t slot_planes[BCM_SLOTS] = {
+  0, 1, 2, 11, 3, 4, 5, 6, 7, 8, 9, 10, 11
+};
+
+static const uint16_t slot_ticks[BCM_SLOTS] = {
+  BCM_BASE_TICKS << 0, BCM_BASE_TICKS << 1, BCM_BASE_TICKS << 2,
+  BCM_BASE_TICKS << 10,
+  BCM_BASE_TICKS << 3, BCM_BASE_TICKS << 4, BCM_BASE_TICKS << 5,
+  BCM_BASE_TICKS << 6, BCM_BASE_TICKS << 7, BCM_BASE_TICKS << 8,
+  BCM_BASE_TICKS << 9, BCM_BASE_TICKS << 10,
+  BCM_BASE_TICKS << 10
+};
+
+// 8-bit brightness to 12-bit plane value, gamma 2.2
+static const uint16_t gamma_table[256] = {
+     0,    0,    0,    0,    0,    1,    1,    2,
+     2,    3,    3,    4,    5,    6,    7,    8,
+     9,   11,   12,   14,   15,   17,   19,   21,
+    23,   25,   27,   29,   32,   34,   37,   40,
+    43,   46,   49,   52,   55,   59,   62,   66,
+    70,   73,   77,   82,   86,   90,   95,   99,
+   104,  109,  114,  119,  124,  129,  135,  140,
+   146,  152,  158,  164,  170,  176,  182,  189,
+   196,  202,  209,  216,  224,  231,  238,  246,
+   254,  261,  269,  277,  286,  294,  302,  311,
+   320,  328,  337,  347,  356,  365,  375,  384,
+   394,  404,  414,  424,  435,  445,  456,  467,
+   477,  488,  500,  511,  522,  534,  545,  557,
+   569,  581,  594,  606,  619,  631,  644,  657,
+   670,  683,  697,  710,  724,  738,  752,  766,
+   780,  794,  809,  823,  838,  853,  868,  884,
+   899,  914,  930,  946,  962,  978,  994, 1011,
+  1027, 1044, 1061, 1078, 1095, 1112, 1130, 1147,
+  1165, 1183, 1201, 1219, 1237, 1256, 1274, 1293,
+  1312, 1331, 1350, 1370, 1389, 1409, 1429, 1449,
+  1469, 1489, 1509, 1530, 1551, 1572, 1593, 1614,
+  1635, 1657, 1678, 1700, 1722, 1744, 1766, 1789,
+  1811, 1834, 1857, 1880, 1903, 1926, 1950, 1974,
+  1997, 2021, 2045, 2070, 2094, 2119, 2143, 2168,
+  2193, 2219, 2244, 2270, 2295, 2321, 2347, 2373,
+  2400, 2426, 2453, 2479, 2506, 2534, 2561, 2588,
+  2616, 2644, 2671, 2700, 2728, 2756, 2785, 2813,
+  2842, 2871, 2900, 2930, 2959, 2989, 3019, 3049,
+  3079, 3109, 3140, 3170, 3201, 3232, 3263, 3295,
+  3326, 3358, 3390, 3421, 3454, 3486, 3518, 3551,
+  3584, 3617, 3650, 3683, 3716, 3750, 3784, 3818,
+  3852, 3886, 3920, 3955, 3990, 4025, 4060, 4095
+};
+
+static const uint8_t pwm_pins[PWM_CHANNELS] = PWM_PINS;
+
+static uint8_t pwm_values[PWM_CHANNELS];
+static uint8_t all_pins;
+
+// Port value for each slot, already adjusted for polarity
+static uint8_t planes[2][BCM_SLOTS];
+static volatile uint8_t active_planes = 0;
+static volatile uint8_t planes_pending = 0;
+
+// Slot shown at the next boundary, and when that boundary is
+static uint8_t slot;
+static uint16_t next_boundary;
+
+// Upper 16 bits of pwm_timestamp(), counted on timer overflow
+static volatile uint16_t overflows = 0;
+
+// Pending pwm_latch_at(). CCR2 is only armed in the overflow period that the
+// latch time falls in.
+static uint32_t latch_time;
+static uint8_t latch_armed = 0;
+
+static void build_planes( void );
+static void arm_latch( void );
+static void latch( void );
+static void run_planes( void );
+
+/*******************************************************************************
+ * @fn     void pwm_setup( void )
+ * @brief  Configure pins and start the timer with every channel off
+ * ****************************************************************************/
+void pwm_setup( void )
+{
+  uint8_t channel;
+
+  for( channel = 0; channel < PWM_CHANNELS; channel++ )
+  {
+    all_pins |= pwm_pins[channel];
+  }
+
+  // Zeroed planes would turn active low channels on, so build real ones.
+  // The first frame picks them up.
+  build_planes();
+  planes_pending = 1;
+
+#ifdef PWM_ACTIVE_LOW
+  PWM_PxOUT |= all_pins;
+#else
+  PWM_PxOUT &= ~all_pins;
+#endif
+  PWM_PxDIR |= all_pins;
+
+  // Start with a new frame
+  slot = 0;
+  next_boundary = BCM_START_TICKS;
+
+  // SMCLK, continuous mode, overflow interrupt for the timestamp
+  TA0CCR1 = next_boundary - BCM_EARLY_TICKS;
+  TA0CCTL1 = CCIE;
+  TA0CCTL2 = 0;
+  TA0CTL = TASSEL_2 + MC_2 + TAIE + TACLR;
+}
+
+/*******************************************************************************
+ * @fn     void pwm_set( uint8_t channel, uint8_t value )
+ * @brief  Set a channel's brightness (0-255). Takes effect on pwm_update().
+ * ****************************************************************************/
+void pwm_set( uint8_t channel, uint8_t value )
+{
+  if( channel < PWM_CHANNELS )
+  {
+    pwm_values[channel] = value;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void pwm_update( void )
+ * @brief  Build new bit planes from the current values. They're swapped in at
+ *         the start of the next frame. Cancels a pending pwm_latch_at(). Safe
+ *         to call from an ISR.
+ * ****************************************************************************/
+void pwm_update( void )
+{
+  uint8_t interrupts_enabled;
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  latch_armed = 0;
+  TA0CCTL2 = 0;
+
+  build_planes();
+  planes_pending = 1;
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+}
+
+/*******************************************************************************
+ * @fn     void pwm_latch_at( uint32_t time )
+ * @brief  Build new bit planes from the current values and show them at
+ *         pwm_timestamp() time, starting a new frame there. A time that has
+ *         already gone by latches right away. Calling this or pwm_update()
+ *         again before the latch replaces it. Safe to call from an ISR.
+ * ****************************************************************************/
+void pwm_latch_at( uint32_t time )
+{
+  uint8_t interrupts_enabled;
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  TA0CCTL2 = 0;
+
+  build_planes();
+  planes_pending = 0;
+
+  latch_time = time;
+  latch_armed = 1;
+  arm_latch();
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint32_t pwm_timestamp( void )
+ * @brief  Current time in SMCLK cycles. Wraps every 2^32 cycles (~268s at
+ *         16MHz), so compare times by subtracting them. Safe to call from an
+ *         ISR.
+ * ****************************************************************************/
+uint32_t pwm_timestamp( void )
+{
+  uint16_t high;
+  uint16_t low;
+  uint8_t interrupts_enabled;
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  low = TA0R;
+  high = overflows;
+
+  // The timer wrapped, but the interrupt hasn't counted it yet
+  if( ( TA0CTL & TAIFG ) && !( low & 0x8000 ) )
+  {
+    high++;
+  }
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+
+  return ( (uint32_t)high << 16 ) | low;
+}
+
+/*******************************************************************************
+ * @fn     void build_planes( void )
+ * @brief  Fill the set of planes the timer isn't using from pwm_values.
+ *         Interrupts must be disabled.
+ * ****************************************************************************/
+static void build_planes( void )
+{
+  uint8_t* next_planes;
+  uint8_t bit_planes[BCM_BITS];
+  uint16_t value;
+  uint8_t channel;
+  uint8_t bit;
+
+  // Whichever set the timer isn't using
+  next_planes = planes[active_planes ^ 1];
+
+  for( bit = 0; bit < BCM_BITS; bit++ )
+  {
+    bit_planes[bit] = 0;
+  }
+
+  for( channel = 0; channel < PWM_CHANNELS; channel++ )
+  {
+    value = gamma_table[pwm_values[channel]];
+
+    for( bit = 0; bit < BCM_BITS; bit++ )
+    {
+      if( value & 1 )
+      {
+        bit_planes[bit] |= pwm_pins[channel];
+      }
+      value >>= 1;
+    }
+  }
+
+  for( bit = 0; bit < BCM_SLOTS; bit++ )
+  {
+#ifdef PWM_ACTIVE_LOW
+    next_planes[bit] = bit_planes[slot_planes[bit]] ^ all_pins;
+#else
+    next_planes[bit] = bit_planes[slot_planes[bit]];
+#endif
+  }
+}
+
+/*******************************************************************************
+ * @fn     void arm_latch( void )
+ * @brief  Latch now if the latch time is here, or set CCR2 for it if it's in
+ *         this overflow period. Otherwise the overflow interrupt tries again.
+ *         Interrupts must be disabled.
+ * ****************************************************************************/
+static void arm_latch( void )
+{
+  uint32_t now = pwm_timestamp();
+
+  if( (int32_t)( latch_time - now ) < BCM_LATCH_TICKS )
+  {
+    latch_time = now;
+    latch();
+  }
+  else if( (uint16_t)( latch_time >> 16 ) == (uint16_t)( now >> 16 ) )
+  {
+    TA0CCR2 = (uint16_t)latch_time;
+    TA0CCTL2 = CCIE;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void latch( void )
+ * @brief  Swap in the latched planes and start a new frame. Interrupts must
+ *         be disabled.
+ * ****************************************************************************/
+static void latch( void )
+{
+  active_planes ^= 1;
+  planes_pending = 0;
+  latch_armed = 0;
+  TA0CCTL2 = 0;
+
+  // Drop whatever is left of the current frame. Writing CCTL1 also clears a
+  // compare that might be pending for it.
+  slot = 0;
+  next_boundary = (uint16_t)latch_time + BCM_LATCH_TICKS;
+  TA0CCR1 = next_boundary - BCM_EARLY_TICKS;
+  TA0CCTL1 = CCIE;
+
+  // Held up long enough to miss the compare, start the frame now
+  if( (int16_t)( TA0R - TA0CCR1 ) >= 0 )
+  {
+    run_planes();
+  }
+}
+
+/*******************************************************************************
+ * @fn     void run_planes( void )
+ * @brief  Show the next slot exactly at its boundary, and the short ones after
+ *         it at the start of a frame, then program CCR1 for the next boundary
+ * ****************************************************************************/
+static void run_planes( void )
+{
+  const uint8_t* values;
+  uint16_t boundary;
+  uint8_t index;
+  uint8_t keep;
+
+  for(;;)
+  {
+    // New frame, pick up new values. Done before the boundary, so it's not
+    // in the way of the short slots after it.
+    if( ( 0 == slot ) && planes_pending )
+    {
+      active_planes ^= 1;
+      planes_pending = 0;
+    }
+
+    values = planes[active_planes];
+    keep = ~all_pins;
+    boundary = next_boundary;
+    index = slot;
+
+    // One pass for a long slot, BCM_INLINE_SLOTS + 1 at the start of a frame.
+    // Keep this loop short, see the cycle counts at the top.
+    do
+    {
+      // Wait out the early wake up (wrap safe)
+      while( (int16_t)( TA0R - boundary ) < 0 );
+
+      PWM_PxOUT = ( PWM_PxOUT & keep ) | values[index];
+      boundary += slot_ticks[index];
+    } while( index++ < BCM_INLINE_SLOTS );
+
+    slot = ( BCM_SLOTS == index ) ? 0 : index;
+    next_boundary = boundary;
+    TA0CCR1 = boundary - BCM_EARLY_TICKS;
+
+    // Unless a long interrupt held this one up past the compare time, which
+    // would then only come around after the timer wraps
+    if( (int16_t)( TA0R - TA0CCR1 ) < 0 )
+    {
+      return;
+    }
+    TA0CCTL1 &= ~CCIFG;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void pwm_plane_isr( void )
+ * @brief  CCR1 match (a plane boundary is coming up), CCR2 match (latch time)
+ *         or timer overflow
+ * ****************************************************************************/
+#pragma vector=TIMER0_A1_VECTOR
+__interrupt void pwm_plane_isr(void)
+{
+  switch( TA0IV )
+  {
+    case TA0IV_TACCR1:
+      run_planes();
+      break;
+
+    case TA0IV_TACCR2:
+      latch();
+      break;
+
+    case TA0IV_TAIFG:
+      overflows++;
+
+      // Latch time might be in this overflow period
+      if( latch_armed && !( TA0CCTL2 & CCIE ) )
+      {
+        arm_latch();
+      }
+      break;
+
+    default:
+      break;
+  }
+}
@@ -0,0 +1,481 @@
+/** @file rate.c
+*
+* @brief Per neighbor data rate selection from delivery history and RSSI,
+*        switched with a RATE_SWITCH handshake
+*
+* Works like Minstrel, with the radio's modem profiles as the rates. Each
+* neighbor keeps a delivery probability per profile (a moving average over
+* windows of RATE_WINDOW ACK results), and the expected throughput of a
+* profile is that probability times its bit rate. Profiles only count once
+* the neighbor's RSSI is RATE_MARGIN_DB over their sensitivity, and ones that
+* aren't in use slowly drift back to full probability, so a rate that failed
+* once gets tried again later instead of being written off.
+*
+* Both ends of a link have to be on the same profile, so changes go through
+* a handshake on the old profile: the node that wants the change sends a
+* RATE_REQUEST, the other end answers with RATE_ACCEPT and switches, and the
+* first node switches when the answer arrives. If the answer is lost, the
+* node that accepted never hears the RATE_ACCEPT the first node repeats on
+* the new profile, and goes back. A neighbor that goes quiet for
+* RATE_SILENCE_POLLS sends both ends back to CC2500_PROFILE_DEFAULT, where
+* they can always find each other.
+*
+* The radio is on one profile at a time, so the last switch applies to every
+* link. It's meant for nodes that mostly talk to one peer (a remote and the
+* fixture it drives), not for hubs with neighbors at different ranges.
+*
+* @author Alvaro Prieto
+*/
+#include "device.h"
+#include "rate.h"
+#include "cc2500.h"
+
+// Delivery probability scale (255 is always delivered)
+#define PROB_ONE (255)
+
+// Switch when another profile looks this much better, as a shift (2 is 25%)
+#define HYSTERESIS_SHIFT (2)
+
+// Moving average weight of a new window (1/4)
+#define EWMA_WEIGHT (4)
+
+// Link states
+#define LINK_STABLE     (0)
+#define LINK_REQUESTED  (1)   // Sent RATE_REQUEST, waiting for RATE_ACCEPT
+#define LINK_ACCEPTING  (2)   // Got RATE_REQUEST, RATE_ACCEPT not sent yet
+#define LINK_CONFIRMING (3)   // Switched on a request, waiting to hear back
+
+typedef struct
+{
+  uint8_t address;
+  uint8_t used;
+  uint8_t profile;
+  uint8_t previous;
+  volatile uint8_t pending;
+  volatile uint8_t state;
+  volatile uint8_t accepted;
+  volatile uint8_t heard;
+  volatile uint8_t silence;
+  uint8_t polls;
+  uint8_t decide;
+  uint8_t rssi_known;
+  int16_t rssi;               // Moving average, times EWMA_WEIGHT
+  uint8_t attempts;
+  uint8_t successes;
+  uint8_t prob[CC2500_PROFILES];
+} neighbor_t;
+
+// Bit rate of each profile in 100bps units
+static const uint16_t profile_rate[CC2500_PROFILES] = { 24, 100, 2500, 5000 };
+
+// Approximate datasheet sensitivity of each profile, in dBm
+static const int8_t profile_sensitivity[CC2500_PROFILES] = { -104, -99, -89,
+                                                                        -82 };
+
+static neighbor_t neighbors[RATE_NEIGHBORS];
+static uint8_t next_neighbor = 0;
+
+static neighbor_t* find_neighbor( uint8_t );
+static neighbor_t* add_neighbor( uint8_t );
+static uint32_t throughput( neighbor_t*, uint8_t );
+static uint8_t best_profile( neighbor_t* );
+static void send_switch( uint8_t, uint8_t, uint8_t );
+static void use_profile( neighbor_t*, uint8_t );
+
+/*******************************************************************************
+ * @fn     void rate_setup( void )
+ * @brief  Forget every neighbor and go back to the default profile
+ * ****************************************************************************/
+void rate_setup( void )
+{
+  uint8_t index;
+
+  for( index = 0; index < RATE_NEIGHBORS; index++ )
+  {
+    neighbors[index].used = 0;
+  }
+
+  next_neighbor = 0;
+
+  cc2500_set_profile( CC2500_PROFILE_DEFAULT );
+}
+
+/*******************************************************************************
+ * @fn     void rate_rx_status( uint8_t address, uint8_t* status )
+ * @brief  A packet from address came in with these appended status bytes
+ *         (RSSI, LQI). Call it from rx_callback for every packet with a known
+ *         source.
+ * ****************************************************************************/
+void rate_rx_status( uint8_t address, uint8_t* status )
+{
+  neighbor_t* neighbor = add_neighbor( address );
+  int16_t rssi = cc2500_rssi_dbm( status[0] );
+
+  if( neighbor->rssi_known )
+  {
+    neighbor->rssi += rssi - neighbor->rssi / EWMA_WEIGHT;
+  }
+  else
+  {
+    neighbor->rssi = rssi * EWMA_WEIGHT;
+    neighbor->rssi_known = 1;
+  }
+
+  neighbor->heard = 1;
+  neighbor->silence = 0;
+}
+
+/*******************************************************************************
+ * @fn     void rate_tx_result( uint8_t address, uint8_t delivered )
+ * @brief  A packet to address was acknowledged (delivered nonzero) or not
+ * ****************************************************************************/
+void rate_tx_result( uint8_t address, uint8_t delivered )
+{
+  neighbor_t* neighbor = add_neighbor( address );
+  uint8_t profile;
+  int16_t sample;
+
+  neighbor->attempts++;
+
+  if( delivered )
+  {
+    neighbor->successes++;
+  }
+
+  if( neighbor->attempts < RATE_WINDOW )
+  {
+    return;
+  }
+
+  for( profile = 0; profile < CC2500_PROFILES; profile++ )
+  {
+    if( profile == neighbor->profile )
+    {
+      sample = ( neighbor->successes * PROB_ONE ) / neighbor->attempts;
+      neighbor->prob[profile] = ( neighbor->prob[profile] *
+                                ( EWMA_WEIGHT - 1 ) + sample ) / EWMA_WEIGHT;
+    }
+    else
+    {
+      // Unused profiles drift back up, so they get another try
+      neighbor->prob[profile] += ( PROB_ONE - neighbor->prob[profile] ) >>
+                                                            RATE_RECOVER_SHIFT;
+    }
+  }
+
+  neighbor->attempts = 0;
+  neighbor->successes = 0;
+  neighbor->decide = 1;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t rate_handle_packet( uint8_t* buffer, uint8_t length )
+ * @brief  Call from rx_callback with every packet. Returns 1 if it was a
+ *         RATE_SWITCH packet, which needs nothing else done with it.
+ * ****************************************************************************/
+uint8_t rate_handle_packet( uint8_t* buffer, uint8_t length )
+{
+  neighbor_t* neighbor;
+  uint8_t profile;
+
+  // [address][RATE_SWITCH][source][operation][profile]
+  if( ( length < ( 1 + RATE_SWITCH_LENGTH ) ) || ( RATE_SWITCH != buffer[1] ) )
+  {
+    return 0;
+  }
+
+  neighbor = add_neighbor( buffer[2] );
+  profile = buffer[4];
+
+  rate_rx_status( buffer[2], &buffer[length] );
+
+  if( profile >= CC2500_PROFILES )
+  {
+    return 1;
+  }
+
+  if( RATE_REQUEST == buffer[3] )
+  {
+    // Answered from rate_poll(), not the radio ISR. If both ends asked at
+    // once, the lower address gets its way.
+    if( ( LINK_REQUESTED != neighbor->state ) || ( DEVICE_ADDRESS > buffer[2] ) )
+    {
+      neighbor->pending = profile;
+      neighbor->state = LINK_ACCEPTING;
+    }
+  }
+  else if( ( RATE_ACCEPT == buffer[3] ) && ( LINK_REQUESTED == neighbor->state )
+                                          && ( profile == neighbor->pending ) )
+  {
+    neighbor->accepted = 1;
+  }
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     void rate_poll( void )
+ * @brief  Run the handshakes and pick new profiles. Call it from the main
+ *         loop at a steady pace (every 100ms or so), the timeouts count calls.
+ * ****************************************************************************/
+void rate_poll( void )
+{
+  neighbor_t* neighbor;
+  uint8_t index;
+  uint8_t profile;
+
+  for( index = 0; index < RATE_NEIGHBORS; index++ )
+  {
+    neighbor = &neighbors[index];
+
+    if( !neighbor->used )
+    {
+      continue;
+    }
+
+    if( neighbor->silence < RATE_SILENCE_POLLS )
+    {
+      neighbor->silence++;
+    }
+    else if( CC2500_PROFILE_DEFAULT != neighbor->profile )
+    {
+      // Lost each other, meet on the default profile
+      use_profile( neighbor, CC2500_PROFILE_DEFAULT );
+      neighbor->state = LINK_STABLE;
+      continue;
+    }
+
+    switch( neighbor->state )
+    {
+      case LINK_ACCEPTING:
+        send_switch( neighbor->address, RATE_ACCEPT, neighbor->pending );
+        neighbor->previous = neighbor->profile;
+        use_profile( neighbor, neighbor->pending );
+        neighbor->heard = 0;
+        neighbor->polls = 0;
+        neighbor->state = LINK_CONFIRMING;
+        break;
+
+      case LINK_CONFIRMING:
+        if( neighbor->heard )
+        {
+          neighbor->state = LINK_STABLE;
+        }
+        else if( ++neighbor->polls >= RATE_CONFIRM_POLLS )
+        {
+          // The other end never switched
+          use_profile( neighbor, neighbor->previous );
+          neighbor->state = LINK_STABLE;
+        }
+        break;
+
+      case LINK_REQUESTED:
+        if( neighbor->accepted )
+        {
+          use_profile( neighbor, neighbor->pending );
+          neighbor->state = LINK_STABLE;
+
+          // Let the other end know it worked, on the new profile
+          send_switch( neighbor->address, RATE_ACCEPT, neighbor->profile );
+        }
+        else if( ++neighbor->polls >= RATE_CONFIRM_POLLS )
+        {
+          // No answer, don't ask for this profile again right away
+          neighbor->prob[neighbor->pending] = 0;
+          neighbor->state = LINK_STABLE;
+        }
+        break;
+
+      default:
+        if( !neighbor->decide )
+        {
+          break;
+        }
+
+        neighbor->decide = 0;
+        profile = best_profile( neighbor );
+
+        if( profile != neighbor->profile )
+        {
+          neighbor->pending = profile;
+          neighbor->accepted = 0;
+          neighbor->polls = 0;
+          neighbor->state = LINK_REQUESTED;
+          send_switch( neighbor->address, RATE_REQUEST, profile );
+        }
+        break;
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t rate_profile( uint8_t address )
+ * @brief  Profile the link to address is on
+ * ****************************************************************************/
+uint8_t rate_profile( uint8_t address )
+{
+  neighbor_t* neighbor = find_neighbor( address );
+
+  if( 0 == neighbor )
+  {
+    return CC2500_PROFILE_DEFAULT;
+  }
+
+  return neighbor->profile;
+}
+
+/*******************************************************************************
+ * @fn     neighbor_t* find_neighbor( uint8_t address )
+ * @brief  Entry for address, 0 if there isn't one
+ * ****************************************************************************/
+static neighbor_t* find_neighbor( uint8_t address )
+{
+  uint8_t index;
+
+  for( index = 0; index < RATE_NEIGHBORS; index++ )
+  {
+    if( neighbors[index].used && ( address == neighbors[index].address ) )
+    {
+      return &neighbors[index];
+    }
+  }
+
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     neighbor_t* add_neighbor( uint8_t address )
+ * @brief  Entry for address, taking over the oldest one if it's new. New
+ *         neighbors are on the radio's current profile and trust every
+ *         profile until they've tried it. Called from the radio ISR and from
+ *         the main loop, so the lookup and takeover run with interrupts off.
+ * ****************************************************************************/
+static neighbor_t* add_neighbor( uint8_t address )
+{
+  neighbor_t* neighbor;
+  uint8_t profile;
+  uint8_t interrupts_enabled;
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  neighbor = find_neighbor( address );
+
+  if( 0 == neighbor )
+  {
+    neighbor = &neighbors[next_neighbor];
+    next_neighbor = ( next_neighbor + 1 ) % RATE_NEIGHBORS;
+
+    neighbor->used = 0;
+    neighbor->address = address;
+    neighbor->profile = cc2500_profile();
+    neighbor->previous = neighbor->profile;
+    neighbor->state = LINK_STABLE;
+    neighbor->accepted = 0;
+    neighbor->heard = 0;
+    neighbor->silence = 0;
+    neighbor->polls = 0;
+    neighbor->decide = 0;
+    neighbor->rssi_known = 0;
+    neighbor->attempts = 0;
+    neighbor->successes = 0;
+
+    for( profile = 0; profile < CC2500_PROFILES; profile++ )
+    {
+      neighbor->prob[profile] = PROB_ONE;
+    }
+
+    neighbor->used = 1;
+  }
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+
+  return neighbor;
+}
+
+/*******************************************************************************
+ * @fn     uint32_t throughput( neighbor_t* neighbor, uint8_t profile )
+ * @brief  Expected throughput to a neighbor on a profile (arbitrary units),
+ *         0 if its RSSI is too low for it
+ * ****************************************************************************/
+static uint32_t throughput( neighbor_t* neighbor, uint8_t profile )
+{
+  if( ( profile != neighbor->profile ) && ( neighbor->rssi <
+            ( profile_sensitivity[profile] + RATE_MARGIN_DB ) * EWMA_WEIGHT ) )
+  {
+    return 0;
+  }
+
+  return (uint32_t)neighbor->prob[profile] * profile_rate[profile];
+}
+
+/*******************************************************************************
+ * @fn     uint8_t best_profile( neighbor_t* neighbor )
+ * @brief  Profile with the best expected throughput, if it beats the current
+ *         one by enough to be worth a switch
+ * ****************************************************************************/
+static uint8_t best_profile( neighbor_t* neighbor )
+{
+  uint32_t current;
+  uint32_t best_throughput;
+  uint32_t candidate;
+  uint8_t best;
+  uint8_t profile;
+
+  if( !neighbor->rssi_known )
+  {
+    return neighbor->profile;
+  }
+
+  current = throughput( neighbor, neighbor->profile );
+  best = neighbor->profile;
+  best_throughput = current + ( current >> HYSTERESIS_SHIFT );
+
+  for( profile = 0; profile < CC2500_PROFILES; profile++ )
+  {
+    candidate = throughput( neighbor, profile );
+
+    if( candidate > best_throughput )
+    {
+      best = profile;
+      best_throughput = candidate;
+    }
+  }
+
+  return best;
+}
+
+/*******************************************************************************
+ * @fn     void send_switch( uint8_t address, uint8_t operation,
+ *                                                          uint8_t profile )
+ * @brief  Send a RATE_SWITCH packet on the current profile
+ * ****************************************************************************/
+static void send_switch( uint8_t address, uint8_t operation, uint8_t profile )
+{
+  uint8_t packet[RATE_SWITCH_LENGTH];
+
+  packet[0] = RATE_SWITCH;
+  packet[1] = DEVICE_ADDRESS;
+  packet[2] = operation;
+  packet[3] = profile;
+
+  cc2500_tx_packet( packet, RATE_SWITCH_LENGTH, address );
+}
+
+/*******************************************************************************
+ * @fn     void use_profile( neighbor_t* neighbor, uint8_t profile )
+ * @brief  Move the link (and the radio) to a profile, starting a fresh
+ *         statistics window
+ * ****************************************************************************/
+static void use_profile( neighbor_t* neighbor, uint8_t profile )
+{
+  neighbor->profile = profile;
+  neighbor->attempts = 0;
+  neighbor->successes = 0;
+  neighbor->silence = 0;
+
+  cc2500_set_profile( profile );
+}
@@ -0,0 +1,53 @@
+/** @file rate.h
+*
+* @brief Per neighbor data rate selection from delivery history and RSSI,
+*        switched with a RATE_SWITCH handshake
+*
+* @author Alvaro Prieto
+*/
+#ifndef _RATE_H
+#define _RATE_H
+
+#include <stdint.h>
+
+// Neighbors with their own rate statistics
+#ifndef RATE_NEIGHBORS
+#define RATE_NEIGHBORS (4)
+#endif
+
+// Delivery results (rate_tx_result() calls) per statistics update
+#ifndef RATE_WINDOW
+#define RATE_WINDOW (16)
+#endif
+
+// Profiles are only tried once the RSSI is this far over their
+// sensitivity, in dB
+#ifndef RATE_MARGIN_DB
+#define RATE_MARGIN_DB (6)
+#endif
+
+// How fast a profile that stopped being used is trusted again, as a shift
+// (4 is 1/16th of the way back to full delivery per window)
+#ifndef RATE_RECOVER_SHIFT
+#define RATE_RECOVER_SHIFT (4)
+#endif
+
+// rate_poll() calls to wait for the other end of a switch
+#ifndef RATE_CONFIRM_POLLS
+#define RATE_CONFIRM_POLLS (10)
+#endif
+
+// rate_poll() calls without hearing a neighbor before giving up on its
+// profile and going back to CC2500_PROFILE_DEFAULT
+#ifndef RATE_SILENCE_POLLS
+#define RATE_SILENCE_POLLS (100)
+#endif
+
+void rate_setup( void );
+void rate_rx_status( uint8_t, uint8_t* );
+void rate_tx_result( uint8_t, uint8_t );
+uint8_t rate_handle_packet( uint8_t*, uint8_t );
+void rate_poll( void );
+uint8_t rate_profile( uint8_t );
+
+#endif /* _RATE_H */
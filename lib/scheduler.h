@@ -0,0 +1,38 @@
+/** @file scheduler.h
+*
+* @brief Software timers and deferred work, sleeping in between
+*
+* @author Alvaro Prieto
+*/
+#ifndef _SCHEDULER_H
+#define _SCHEDULER_H
+
+#include <stdint.h>
+
+// Deferred functions waiting to run, at most
+#ifndef SCHEDULER_QUEUE_LENGTH
+#define SCHEDULER_QUEUE_LENGTH (8)
+#endif
+
+typedef struct scheduler_timer
+{
+  struct scheduler_timer* next;
+  uint32_t expires;         // Scheduler time, in ACLK ticks
+  uint32_t period;          // In ACLK ticks, 0 for one shot timers
+  void (*callback)( void );
+  uint8_t running;
+} scheduler_timer_t;
+
+void scheduler_setup( void );
+void scheduler_run( void );
+
+uint8_t scheduler_defer( void (*)( void ) );
+
+void scheduler_timer_init( scheduler_timer_t*, void (*)( void ) );
+void scheduler_timer_start( scheduler_timer_t*, uint32_t, uint32_t );
+void scheduler_timer_stop( scheduler_timer_t* );
+
+uint32_t scheduler_time( void );
+uint32_t scheduler_ms_to_ticks( uint32_t );
+
+#endif /* _SCHEDULER_H */
@@ -0,0 +1,408 @@
+/** @file timera.c
+*
+* @brief Tickless software timers and deferred work using Timer_A on ACLK
+*
+* Timers are kept in a list sorted by expiry time, and CCR0 is only set for
+* the first one. There is no periodic tick, the CPU wakes up when a timer is
+* due or when the 16-bit timer overflows (every ~5.5s from the VLO, 2s from a
+* crystal) to extend the time to 32 bits.
+*
+* Timer callbacks don't run in the ISR. They go in the same queue as the
+* functions ISRs hand to scheduler_defer(), and scheduler_run() calls them
+* one at a time from the main loop, sleeping with clock_sleep() whenever the
+* queue is empty.
+*
+* scheduler_defer() wakes the main loop up by setting CCR1's interrupt flag
+* (CCR1 is in capture mode with no input, so nothing else sets it). That way
+* any ISR can defer work without having to clear the low power mode bits on
+* its own exit.
+*
+* Uses all of Timer0_A in continuous mode, clocked from ACLK, so it can't be
+* linked together with pwm/ or servo/. clock_setup() picks the ACLK source and
+* must be called first.
+*
+* @author Alvaro Prieto
+*/
+#include "scheduler.h"
+#include "clock.h"
+#include "device.h"
+
+// Older devices only have the Timer_A vector names
+#ifndef TIMER0_A0_VECTOR
+#define TIMER0_A0_VECTOR TIMERA0_VECTOR
+#define TIMER0_A1_VECTOR TIMERA1_VECTOR
+#endif
+
+// Timers due this soon (in ticks) are run right away, CCR0 could be past
+// them by the time it's written
+#define MIN_TICKS (2)
+
+static scheduler_timer_t* timers = 0;
+
+// Upper 16 bits of the scheduler time
+static volatile uint16_t overflows = 0;
+
+static void (*queue[SCHEDULER_QUEUE_LENGTH])( void );
+static volatile uint8_t queue_head = 0;
+static volatile uint8_t queue_count = 0;
+
+static uint32_t aclk_hz;
+
+static uint16_t read_timer( void );
+static void insert_timer( scheduler_timer_t* );
+static void remove_timer( scheduler_timer_t* );
+static void arm_timer( void );
+static void expire_timers( void );
+
+/*******************************************************************************
+ * @fn     void scheduler_setup( void )
+ * @brief  Start the timer. ACLK must already be running (clock_setup()).
+ * ****************************************************************************/
+void scheduler_setup( void )
+{
+  aclk_hz = clock_aclk_hz();
+
+  TACCTL0 = 0;
+  TACCTL1 = CAP + CM_0 + CCIE;  // Only set by scheduler_defer()
+
+  // ACLK, continuous mode, interrupt on overflow
+  TACTL = TASSEL_1 + MC_2 + TAIE + TACLR;
+}
+
+/*******************************************************************************
+ * @fn     void scheduler_run( void )
+ * @brief  Run deferred functions and expired timer callbacks as they come,
+ *         sleeping in between. Never returns.
+ * ****************************************************************************/
+void scheduler_run( void )
+{
+  void (*function)( void );
+
+  for(;;)
+  {
+    __disable_interrupt();
+
+    if( 0 == queue_count )
+    {
+      // Enables interrupts and sleeps in one go, so nothing queued since the
+      // check can be missed
+      clock_sleep();
+      continue;
+    }
+
+    function = queue[queue_head];
+    queue_head = ( queue_head + 1 ) % SCHEDULER_QUEUE_LENGTH;
+    queue_count--;
+
+    __enable_interrupt();
+
+    function();
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t scheduler_defer( void (*function)( void ) )
+ * @brief  Queue a function to run from scheduler_run(). Returns 0 if the
+ *         queue is full. Safe to call from an ISR.
+ * ****************************************************************************/
+uint8_t scheduler_defer( void (*function)( void ) )
+{
+  uint8_t interrupts_enabled;
+  uint8_t queued = 0;
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  if( queue_count < SCHEDULER_QUEUE_LENGTH )
+  {
+    queue[( queue_head + queue_count ) % SCHEDULER_QUEUE_LENGTH] = function;
+    queue_count++;
+    queued = 1;
+
+    // Wake scheduler_run() up
+    TACCTL1 |= CCIFG;
+  }
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+
+  return queued;
+}
+
+/*******************************************************************************
+ * @fn     void scheduler_timer_init( scheduler_timer_t* timer,
+ *                                                  void (*callback)( void ) )
+ * @brief  Set up a timer that calls callback (from scheduler_run()) when it
+ *         expires
+ * ****************************************************************************/
+void scheduler_timer_init( scheduler_timer_t* timer, void (*callback)( void ) )
+{
+  timer->next = 0;
+  timer->callback = callback;
+  timer->running = 0;
+}
+
+/*******************************************************************************
+ * @fn     void scheduler_timer_start( scheduler_timer_t* timer,
+ *                                        uint32_t delay, uint32_t period )
+ * @brief  Expire delay milliseconds from now, then every period milliseconds
+ *         if period isn't 0. Restarts a running timer. Safe to call from an
+ *         ISR.
+ * ****************************************************************************/
+void scheduler_timer_start( scheduler_timer_t* timer, uint32_t delay,
+                                                              uint32_t period )
+{
+  uint8_t interrupts_enabled;
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  if( timer->running )
+  {
+    remove_timer( timer );
+  }
+
+  timer->expires = scheduler_time() + scheduler_ms_to_ticks( delay );
+  timer->period = scheduler_ms_to_ticks( period );
+  insert_timer( timer );
+  arm_timer();
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+}
+
+/*******************************************************************************
+ * @fn     void scheduler_timer_stop( scheduler_timer_t* timer )
+ * @brief  Stop a timer. A callback that was already queued still runs. Safe
+ *         to call from an ISR.
+ * ****************************************************************************/
+void scheduler_timer_stop( scheduler_timer_t* timer )
+{
+  uint8_t interrupts_enabled;
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  if( timer->running )
+  {
+    remove_timer( timer );
+    arm_timer();
+  }
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint32_t scheduler_time( void )
+ * @brief  Current time in ACLK ticks. Safe to call from an ISR.
+ * ****************************************************************************/
+uint32_t scheduler_time( void )
+{
+  uint16_t low;
+  uint16_t high;
+  uint8_t interrupts_enabled;
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  low = read_timer();
+  high = overflows;
+
+  // The timer overflowed, but the overflow interrupt hasn't run yet
+  if( ( TACTL & TAIFG ) && ( low < 0x8000 ) )
+  {
+    high++;
+  }
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+
+  return ( (uint32_t)high << 16 ) | low;
+}
+
+/*******************************************************************************
+ * @fn     uint32_t scheduler_ms_to_ticks( uint32_t ms )
+ * @brief  Milliseconds to ACLK ticks, rounded up
+ * ****************************************************************************/
+uint32_t scheduler_ms_to_ticks( uint32_t ms )
+{
+  return ( ms / 1000 ) * aclk_hz + ( ( ms % 1000 ) * aclk_hz + 999 ) / 1000;
+}
+
+/*******************************************************************************
+ * @fn     uint16_t read_timer( void )
+ * @brief  Read TAR. ACLK isn't in step with MCLK, so a read can catch the
+ *         counter changing. Two reads that agree can't.
+ * ****************************************************************************/
+static uint16_t read_timer( void )
+{
+  uint16_t first;
+  uint16_t second;
+
+  do
+  {
+    first = TAR;
+    second = TAR;
+  } while( first != second );
+
+  return first;
+}
+
+/*******************************************************************************
+ * @fn     void insert_timer( scheduler_timer_t* timer )
+ * @brief  Add a timer to the list, in expiry order. Interrupts must be
+ *         disabled.
+ * ****************************************************************************/
+static void insert_timer( scheduler_timer_t* timer )
+{
+  scheduler_timer_t** link = &timers;
+
+  while( *link && ( (int32_t)( (*link)->expires - timer->expires ) <= 0 ) )
+  {
+    link = &(*link)->next;
+  }
+
+  timer->next = *link;
+  *link = timer;
+  timer->running = 1;
+}
+
+/*******************************************************************************
+ * @fn     void remove_timer( scheduler_timer_t* timer )
+ * @brief  Take a running timer out of the list. Interrupts must be disabled.
+ * ****************************************************************************/
+static void remove_timer( scheduler_timer_t* timer )
+{
+  scheduler_timer_t** link = &timers;
+
+  while( *link && ( *link != timer ) )
+  {
+    link = &(*link)->next;
+  }
+
+  if( *link )
+  {
+    *link = timer->next;
+  }
+
+  timer->next = 0;
+  timer->running = 0;
+}
+
+/*******************************************************************************
+ * @fn     void arm_timer( void )
+ * @brief  Set CCR0 for the first timer, if it's due before the timer wraps
+ *         around. Otherwise the overflow interrupt tries again. Interrupts
+ *         must be disabled.
+ * ****************************************************************************/
+static void arm_timer( void )
+{
+  int32_t remaining;
+
+  if( 0 == timers )
+  {
+    TACCTL0 = 0;
+    return;
+  }
+
+  remaining = timers->expires - scheduler_time();
+
+  if( remaining < MIN_TICKS )
+  {
+    // Run the interrupt now
+    TACCTL0 = CCIE + CCIFG;
+  }
+  else if( remaining < 0x10000L )
+  {
+    TACCR0 = (uint16_t)timers->expires;
+    TACCTL0 = CCIE;
+  }
+  else
+  {
+    TACCTL0 = 0;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void expire_timers( void )
+ * @brief  Queue the callbacks of every timer that's due and restart the
+ *         periodic ones. Interrupts must be disabled.
+ * ****************************************************************************/
+static void expire_timers( void )
+{
+  scheduler_timer_t* timer;
+  uint32_t now = scheduler_time();
+
+  while( timers && ( (int32_t)( timers->expires - now ) < MIN_TICKS ) )
+  {
+    timer = timers;
+    timers = timer->next;
+    timer->next = 0;
+    timer->running = 0;
+
+    scheduler_defer( timer->callback );
+
+    if( timer->period )
+    {
+      timer->expires += timer->period;
+
+      // Don't try to catch up on missed periods
+      if( (int32_t)( timer->expires - now ) < MIN_TICKS )
+      {
+        timer->expires = now + timer->period;
+      }
+
+      insert_timer( timer );
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void scheduler_timer_isr( void )
+ * @brief  CCR0 match, the first timer is due
+ * ****************************************************************************/
+#pragma vector=TIMER0_A0_VECTOR
+__interrupt void scheduler_timer_isr(void)
+{
+  expire_timers();
+  arm_timer();
+
+  if( queue_count )
+  {
+    __bic_SR_register_on_exit( CLOCK_WAKE_BITS );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void scheduler_overflow_isr( void )
+ * @brief  Timer overflow (extend the time, maybe arm CCR0) or CCR1 flag set by
+ *         scheduler_defer()
+ * ****************************************************************************/
+#pragma vector=TIMER0_A1_VECTOR
+__interrupt void scheduler_overflow_isr(void)
+{
+  switch( TAIV )
+  {
+    case TAIV_TAIFG:
+      overflows++;
+      arm_timer();
+      break;
+
+    default:
+      break;
+  }
+
+  if( queue_count )
+  {
+    __bic_SR_register_on_exit( CLOCK_WAKE_BITS );
+  }
+}
@@ -0,0 +1,47 @@
+/** @file servo.h
+*
+* @brief Hobby servo pulses on plain GPIO pins, many servos on one timer
+*
+* @author Alvaro Prieto
+*/
+#ifndef _SERVO_H
+#define _SERVO_H
+
+#include <stdint.h>
+
+// Servo pins can be on port 1, port 2 or both. Each entry in SERVO_PINS is
+// SERVO_P1(pins) or SERVO_P2(pins).
+#define SERVO_P1( pins )  ( (uint16_t)(pins) )
+#define SERVO_P2( pins )  ( (uint16_t)(pins) << 8 )
+
+// Number of servos and their pins. Each servo costs 14 bytes of RAM (its
+// ramp state and its edge), so the default of 4 is what fits next to the
+// radio driver on the 256 byte G2412 boards used by servotest. Up to 16 work,
+// parts with more RAM can use the 8 pins the radio leaves free:
+//   SERVO_P1( BIT1 ), SERVO_P1( BIT2 ), SERVO_P1( BIT4 ), SERVO_P2( BIT0 ),
+//   SERVO_P2( BIT1 ), SERVO_P2( BIT2 ), SERVO_P2( BIT3 ), SERVO_P2( BIT6 )
+#ifndef SERVO_CHANNELS
+#define SERVO_CHANNELS    4
+#endif
+
+#ifndef SERVO_PINS
+#define SERVO_PINS        { SERVO_P1( BIT1 ), SERVO_P1( BIT2 ), \
+                            SERVO_P1( BIT4 ), SERVO_P2( BIT0 ) }
+#endif
+
+// Pulse width limits, in microseconds
+#ifndef SERVO_MIN_US
+#define SERVO_MIN_US      (500)
+#endif
+
+#ifndef SERVO_MAX_US
+#define SERVO_MAX_US      (2500)
+#endif
+
+void servo_setup( void );
+void servo_set( uint8_t, uint16_t );
+void servo_set_ramp( uint8_t, uint16_t, uint16_t );
+void servo_disable( uint8_t );
+uint16_t servo_position( uint8_t );
+
+#endif /* _SERVO_H */
@@ -0,0 +1,461 @@
+/** @file timera.c
+*
+* @brief Multiplexed servo pulses using Timer_A
+*
+* Every 20ms frame, all enabled servos go high together and CCR1 is then
+* moved from edge to edge, in sorted order, turning each one off when its
+* pulse width is up. Servos with the same width share an edge, so a frame is
+* at most SERVO_CHANNELS + 1 interrupts, with 0.5us resolution.
+*
+* Each interrupt is requested SERVO_EARLY_TICKS ahead of its edge and then
+* polls the timer for the exact tick, so interrupt latency doesn't show up as
+* pulse jitter as long as it's shorter than that. Anything that keeps
+* interrupts off for longer (like a long radio ISR) does. Build cc2500.c with
+* CC2500_NESTED_RX_ISR so packets can't.
+*
+* Positions can ramp with a speed and acceleration limit. Ramps are stepped
+* once per frame, after the last edge, and the edge schedule rebuilt right
+* there, so it never changes in the middle of a frame.
+*
+* Uses Timer0_A CCR1 in up mode, clocked from SMCLK / 8. SMCLK must be 16MHz.
+*
+* @author Alvaro Prieto
+*/
+#include "servo.h"
+#include "device.h"
+
+// Frame length in timer ticks (0.5us), 20ms
+#define SERVO_FRAME_TICKS (40000)
+
+// Pulses start this far into the frame, so the first interrupt can be early
+#define SERVO_START_TICKS (100)
+
+// Interrupts are requested this many ticks before their edge (16us)
+#define SERVO_EARLY_TICKS (32)
+
+// Positions and speeds are kept in 1/16us. Ticks are 1/2us.
+#define POSITION_SHIFT (4)
+#define TICK_SHIFT (3)
+
+// Keeps speed^2 and 2 * acceleration * distance within 32 bits
+#define MAX_RATE (0x7FFF)
+
+#define PINS_ON( mask )   ( P1OUT |= (uint8_t)(mask), P2OUT |= (mask) >> 8 )
+#define PINS_OFF( mask )  ( P1OUT &= ~(uint8_t)(mask), \
+                                                  P2OUT &= ~( (mask) >> 8 ) )
+
+typedef struct
+{
+  uint16_t position;      // Current position, 1/16us
+  uint16_t target;        // 1/16us
+  int16_t velocity;       // 1/16us per frame
+  uint16_t speed;         // Limit, 1/16us per frame. 0 moves right away.
+  uint16_t acceleration;  // Limit, 1/16us per frame^2. 0 is unlimited.
+} servo_t;
+
+typedef struct
+{
+  uint16_t time;          // Timer value at which the pins go low
+  uint16_t mask;          // Pins that go low at this time
+} servo_edge_t;
+
+static const uint16_t servo_pins[SERVO_CHANNELS] = SERVO_PINS;
+
+static servo_t servos[SERVO_CHANNELS];
+static uint16_t enabled_mask = 0;
+
+static servo_edge_t edges[SERVO_CHANNELS];
+static uint8_t total_edges = 0;
+static uint16_t on_mask = 0;
+
+// Progress through the current frame
+static uint8_t frame_started = 0;
+static uint8_t edge_index;
+
+// Set when a servo was changed and the schedule needs to be rebuilt
+static uint8_t schedule_dirty = 0;
+
+static uint8_t wait_for( uint16_t );
+static uint8_t step_ramp( servo_t* );
+static void build_schedule( void );
+static void end_frame( void );
+static void run_edges( void );
+
+/*******************************************************************************
+ * @fn     void servo_setup( void )
+ * @brief  Configure pins and start the timer. Every servo is off (no pulses)
+ *         until it gets a position.
+ * ****************************************************************************/
+void servo_setup( void )
+{
+  uint16_t all_pins = 0;
+  uint8_t channel;
+
+  for( channel = 0; channel < SERVO_CHANNELS; channel++ )
+  {
+    all_pins |= servo_pins[channel];
+  }
+
+  PINS_OFF( all_pins );
+  P1SEL &= ~(uint8_t)all_pins;
+  P2SEL &= ~( all_pins >> 8 );
+  P1DIR |= (uint8_t)all_pins;
+  P2DIR |= all_pins >> 8;
+
+  // SMCLK / 8, up mode
+  TA0CCR0 = SERVO_FRAME_TICKS - 1;
+  TA0CCR1 = SERVO_START_TICKS - SERVO_EARLY_TICKS;
+  TA0CCTL1 = CCIE;
+  TA0CTL = TASSEL_2 + ID_3 + MC_1 + TACLR;
+}
+
+/*******************************************************************************
+ * @fn     void servo_set( uint8_t channel, uint16_t position )
+ * @brief  Move a servo to position (pulse width in us), at its ramp rates.
+ *         The first position a servo gets is taken right away. Safe to call
+ *         from an ISR.
+ * ****************************************************************************/
+void servo_set( uint8_t channel, uint16_t position )
+{
+  servo_t* servo;
+  uint8_t interrupts_enabled;
+
+  if( channel >= SERVO_CHANNELS )
+  {
+    return;
+  }
+  servo = &servos[channel];
+
+  if( position < SERVO_MIN_US )
+  {
+    position = SERVO_MIN_US;
+  }
+  else if( position > SERVO_MAX_US )
+  {
+    position = SERVO_MAX_US;
+  }
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  servo->target = position << POSITION_SHIFT;
+
+  if( !( enabled_mask & servo_pins[channel] ) )
+  {
+    // Nothing to ramp from
+    servo->position = servo->target;
+    servo->velocity = 0;
+    enabled_mask |= servo_pins[channel];
+  }
+
+  schedule_dirty = 1;
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+}
+
+/*******************************************************************************
+ * @fn     void servo_set_ramp( uint8_t channel, uint16_t speed,
+ *                                                    uint16_t acceleration )
+ * @brief  Limit how fast a servo moves, in 1/16us of pulse width per 20ms
+ *         frame (speed) and per frame per frame (acceleration). A speed of 0
+ *         jumps straight to new positions, an acceleration of 0 starts and
+ *         stops at full speed. Safe to call from an ISR.
+ * ****************************************************************************/
+void servo_set_ramp( uint8_t channel, uint16_t speed, uint16_t acceleration )
+{
+  uint8_t interrupts_enabled;
+
+  if( channel >= SERVO_CHANNELS )
+  {
+    return;
+  }
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  servos[channel].speed = ( speed > MAX_RATE ) ? MAX_RATE : speed;
+  servos[channel].acceleration = ( acceleration > MAX_RATE ) ?
+                                                      MAX_RATE : acceleration;
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+}
+
+/*******************************************************************************
+ * @fn     void servo_disable( uint8_t channel )
+ * @brief  Stop sending pulses to a servo, which lets most of them go limp.
+ *         Safe to call from an ISR.
+ * ****************************************************************************/
+void servo_disable( uint8_t channel )
+{
+  uint8_t interrupts_enabled;
+
+  if( channel >= SERVO_CHANNELS )
+  {
+    return;
+  }
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  enabled_mask &= ~servo_pins[channel];
+  schedule_dirty = 1;
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint16_t servo_position( uint8_t channel )
+ * @brief  Pulse width a servo is getting right now (it's somewhere between
+ *         its last two targets while ramping), in us
+ * ****************************************************************************/
+uint16_t servo_position( uint8_t channel )
+{
+  uint16_t position;
+  uint8_t interrupts_enabled;
+
+  if( channel >= SERVO_CHANNELS )
+  {
+    return 0;
+  }
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  position = servos[channel].position >> POSITION_SHIFT;
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+
+  return position;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t wait_for( uint16_t time )
+ * @brief  If time is close, wait for it and return 0. Otherwise set CCR1 to
+ *         come back a little before it and return nonzero.
+ * ****************************************************************************/
+static uint8_t wait_for( uint16_t time )
+{
+  if( time > ( TA0R + SERVO_EARLY_TICKS ) )
+  {
+    TA0CCR1 = time - SERVO_EARLY_TICKS;
+    return 1;
+  }
+
+  while( TA0R < time );
+
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t step_ramp( servo_t* servo )
+ * @brief  Move a servo one frame closer to its target. Returns nonzero if its
+ *         position changed.
+ * ****************************************************************************/
+static uint8_t step_ramp( servo_t* servo )
+{
+  int32_t distance = (int32_t)servo->target - servo->position;
+  int32_t velocity = servo->velocity;
+  uint32_t remaining;
+
+  if( ( 0 == distance ) && ( 0 == velocity ) )
+  {
+    return 0;
+  }
+
+  remaining = ( distance < 0 ) ? -distance : distance;
+
+  if( 0 == servo->speed )
+  {
+    velocity = distance;
+  }
+  else if( 0 == servo->acceleration )
+  {
+    velocity = ( distance < 0 ) ? -(int32_t)servo->speed : servo->speed;
+  }
+  else if( ( ( velocity < 0 ) == ( distance < 0 ) ) &&
+           ( (uint32_t)( velocity * velocity ) >=
+                                  2 * (uint32_t)servo->acceleration * remaining ) )
+  {
+    // Heading to the target and just about able to stop, slow down
+    if( ( ( velocity < 0 ) ? -velocity : velocity ) <= servo->acceleration )
+    {
+      velocity = 0;
+    }
+    else
+    {
+      velocity += ( velocity < 0 ) ? servo->acceleration :
+                                                      -servo->acceleration;
+    }
+  }
+  else
+  {
+    velocity += ( distance < 0 ) ? -servo->acceleration : servo->acceleration;
+
+    if( velocity > servo->speed )
+    {
+      velocity = servo->speed;
+    }
+    else if( velocity < -(int32_t)servo->speed )
+    {
+      velocity = -(int32_t)servo->speed;
+    }
+  }
+
+  if( ( ( velocity < 0 ) == ( distance < 0 ) ) &&
+      ( ( ( velocity < 0 ) ? -velocity : velocity ) >= (int32_t)remaining ) )
+  {
+    // Gets there this frame
+    servo->position = servo->target;
+    servo->velocity = 0;
+  }
+  else
+  {
+    servo->position += velocity;
+    servo->velocity = velocity;
+  }
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     void build_schedule( void )
+ * @brief  Sort the enabled servos' pulse ends into edges. Only called between
+ *         frames.
+ * ****************************************************************************/
+static void build_schedule( void )
+{
+  uint16_t time;
+  uint8_t channel;
+  uint8_t index;
+  uint8_t move;
+
+  total_edges = 0;
+  on_mask = enabled_mask;
+
+  for( channel = 0; channel < SERVO_CHANNELS; channel++ )
+  {
+    if( !( enabled_mask & servo_pins[channel] ) )
+    {
+      continue;
+    }
+
+    time = SERVO_START_TICKS +
+                  ( ( servos[channel].position + 4 ) >> TICK_SHIFT );
+
+    // Insertion sort, merging servos that end at the same time
+    for( index = 0; index < total_edges; index++ )
+    {
+      if( edges[index].time >= time )
+      {
+        break;
+      }
+    }
+
+    if( ( index < total_edges ) && ( edges[index].time == time ) )
+    {
+      edges[index].mask |= servo_pins[channel];
+      continue;
+    }
+
+    for( move = total_edges; move > index; move-- )
+    {
+      edges[move] = edges[move - 1];
+    }
+    edges[index].time = time;
+    edges[index].mask = servo_pins[channel];
+    total_edges++;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void end_frame( void )
+ * @brief  Every pulse in this frame is done. Step the ramps, rebuild the
+ *         schedule if anything moved and set CCR1 for the next frame.
+ * ****************************************************************************/
+static void end_frame( void )
+{
+  uint8_t channel;
+
+  for( channel = 0; channel < SERVO_CHANNELS; channel++ )
+  {
+    if( ( enabled_mask & servo_pins[channel] ) &&
+                                              step_ramp( &servos[channel] ) )
+    {
+      schedule_dirty = 1;
+    }
+  }
+
+  if( schedule_dirty )
+  {
+    schedule_dirty = 0;
+    build_schedule();
+  }
+
+  frame_started = 0;
+  edge_index = 0;
+
+  // Already past it, so this is in the next frame
+  TA0CCR1 = SERVO_START_TICKS - SERVO_EARLY_TICKS;
+}
+
+/*******************************************************************************
+ * @fn     void run_edges( void )
+ * @brief  Start the pulses and end every one that's due, until the next edge
+ *         is far enough away to wait for with CCR1
+ * ****************************************************************************/
+static void run_edges( void )
+{
+  if( !frame_started )
+  {
+    if( wait_for( SERVO_START_TICKS ) )
+    {
+      return;
+    }
+
+    PINS_ON( on_mask );
+    frame_started = 1;
+  }
+
+  while( edge_index < total_edges )
+  {
+    if( wait_for( edges[edge_index].time ) )
+    {
+      return;
+    }
+
+    PINS_OFF( edges[edge_index].mask );
+    edge_index++;
+  }
+
+  end_frame();
+}
+
+/*******************************************************************************
+ * @fn     void servo_edge_isr( void )
+ * @brief  CCR1 match, an edge is coming up
+ * ****************************************************************************/
+#pragma vector=TIMER0_A1_VECTOR
+__interrupt void servo_edge_isr(void)
+{
+  switch( TA0IV )
+  {
+    case TA0IV_TACCR1:
+      run_edges();
+      break;
+
+    default:
+      break;
+  }
+}
@@ -18,6 +18,7 @@ void cc_read_burst_reg(uint8_t, uint8_t *, uint8_t);
 uint8_t cc_read_status(uint8_t);
 void cc_strobe(uint8_t);
 void cc_powerup_reset(void);
+void cc_wakeup(void);
 
 // Configuration Registers
 #define TI_CCxxx0_IOCFG2       0x00        // GDO2 output pin configuration
@@ -67,6 +68,18 @@ void cc_powerup_reset(void);
 #define TI_CCxxx0_TEST2        0x2C        // Various test settings
 #define TI_CCxxx0_TEST1        0x2D        // Various test settings
 #define TI_CCxxx0_TEST0        0x2E        // Various test settings
+#define TI_CCxxx0_CONFIG_REGISTERS  47     // IOCFG2 to TEST0
+
+// Define CC2500_SHADOW (for the whole project) to keep the last value
+// written to each configuration register by cc_write_reg() or
+// cc_write_burst_reg(), so they don't have to be read back over SPI, and to
+// batch the writes of cc2500_stage_reg(). Costs 50 bytes of RAM, so only
+// projects with that much to spare use it (doorbell does, with the radio
+// asleep between presses). host/test/shadow_sim.c checks it against writing
+// each register right away.
+#ifdef CC2500_SHADOW
+extern uint8_t cc_shadow[TI_CCxxx0_CONFIG_REGISTERS];
+#endif
 
 // Strobe commands
 #define TI_CCxxx0_SRES         0x30        // Reset chip.
@@ -11,6 +11,11 @@
 #error This serial library was written for device with USI
 #endif
 
+// Copy of the configuration registers, see spi.h
+#ifdef CC2500_SHADOW
+uint8_t cc_shadow[TI_CCxxx0_CONFIG_REGISTERS];
+#endif
+
 void wait_cycles(uint16_t cycles)
 {
   while(cycles>15)                          // 15 cycles consumed by overhead
@@ -40,6 +45,11 @@ void spi_setup(void)
  * ****************************************************************************/
 void cc_write_reg(uint8_t addr, uint8_t value)
 {
+#ifdef CC2500_SHADOW
+  if (addr < TI_CCxxx0_CONFIG_REGISTERS)
+    cc_shadow[addr] = value;                // Keep a copy
+#endif
+
   CSn_PxOUT &= ~CSn_PIN;        // /CS enable
   while (SPI_USI_PxIN&SPI_USI_SOMI);// Wait for CCxxxx ready
   USISRL = addr;                            // Load address
@@ -59,6 +69,11 @@ void cc_write_burst_reg(uint8_t addr, uint8_t *buffer, uint8_t count)
 {
   uint16_t i;
 
+#ifdef CC2500_SHADOW
+  for (i = 0; (i < count) && ((addr + i) < TI_CCxxx0_CONFIG_REGISTERS); i++)
+    cc_shadow[addr + i] = buffer[i];        // Keep a copy
+#endif
+
   CSn_PxOUT &= ~CSn_PIN;        // /CS enable
   while (SPI_USI_PxIN&SPI_USI_SOMI);// Wait for CCxxxx ready
   USISRL = addr | TI_CCxxx0_WRITE_BURST;    // Load address
@@ -174,3 +189,15 @@ void cc_powerup_reset(void)
   while (SPI_USI_PxIN&SPI_USI_SOMI);  // Wait until the device has reset
   CSn_PxOUT |= CSn_PIN;
 }
+
+/*******************************************************************************
+ * @fn void cc_wakeup()
+ * @brief Wake radio up from SLEEP. Returns as soon as CHIP_RDYn goes low
+ *        (crystal running), instead of waiting a fixed time.
+ * ****************************************************************************/
+void cc_wakeup(void)
+{
+  CSn_PxOUT &= ~CSn_PIN;        // /CS enable
+  while (SPI_USI_PxIN&SPI_USI_SOMI);  // Wait for CHIP_RDYn
+  CSn_PxOUT |= CSn_PIN;         // /CS disable
+}
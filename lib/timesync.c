@@ -0,0 +1,181 @@
+/** @file timesync.c
+*
+* @brief Follow a coordinator's clock from its TIME_BEACON packets
+*
+* The coordinator broadcasts numbered beacons. Each one carries the time at
+* which the previous beacon's sync word went out, since that's only known
+* after sending it. Nodes keep the local time at which they received each
+* beacon, so when beacon n arrives they have a (network, local) pair for
+* beacon n-1.
+*
+* Each pair moves the anchor used for conversions, and the change in offset
+* between two pairs gives the clock rate difference (skew) between the node
+* and the coordinator, which is averaged over a few beacons. Converting
+* network time to local time is then a linear extrapolation from the anchor.
+*
+* Receive timestamps can be late (the radio interrupt held off by another
+* one) but never early. Once synced, a pair that lands more than
+* TIMESYNC_MAX_LATE (plus a little for the time since the last pair) after
+* where the current estimate puts it is mostly latency, so the anchor only
+* moves that far towards it. Genuine drift is far less than that per beacon,
+* and early pairs are always taken.
+*
+* The coordinator timestamps the start of the beacon and nodes the end, so
+* every node is behind by the same beacon air time. That doesn't matter when
+* the goal is for nodes to agree with each other.
+*
+* Nothing here touches hardware. Times are in whatever ticks the two clocks
+* use, as long as they're nominally the same rate.
+*
+* @author Alvaro Prieto
+*/
+#include "timesync.h"
+
+// Skew needs pairs at least this far apart, in ticks
+#define MIN_SKEW_INTERVAL (0x10000L)
+
+// On top of TIMESYNC_MAX_LATE, late pairs may move the anchor by 1/2^n of
+// the time since the last one (122ppm), for rate changes between beacons
+#define MAX_LATE_SHIFT (13)
+
+// Sync states
+#define NOT_SYNCED  (0)
+#define OFFSET_ONLY (1)
+#define SYNCED      (2)
+
+static uint8_t state = NOT_SYNCED;
+
+// Last (network time, local time) pair
+static uint32_t anchor_network;
+static uint32_t anchor_local;
+
+// (local rate / network rate - 1) * 65536
+static int16_t skew;
+
+// Last beacon received, waiting for its transmit time in the next one
+static uint8_t beacon_valid = 0;
+static uint8_t beacon_sequence;
+static uint32_t beacon_rx_time;
+
+/*******************************************************************************
+ * @fn     void timesync_reset( void )
+ * @brief  Forget everything learned from beacons so far
+ * ****************************************************************************/
+void timesync_reset( void )
+{
+  state = NOT_SYNCED;
+  beacon_valid = 0;
+}
+
+/*******************************************************************************
+ * @fn     void timesync_update( uint32_t network_time, uint32_t local_time )
+ * @brief  Add a pair of times at which the same event happened on the
+ *         coordinator and on this node
+ * ****************************************************************************/
+void timesync_update( uint32_t network_time, uint32_t local_time )
+{
+  int32_t network_elapsed;
+  int32_t local_elapsed;
+  int32_t drift;
+  int32_t max_drift;
+  int32_t measured_skew;
+  uint32_t predicted;
+  int32_t late;
+
+  if( NOT_SYNCED != state )
+  {
+    network_elapsed = network_time - anchor_network;
+
+    if( ( SYNCED == state ) && ( network_elapsed > 0 ) &&
+                              ( network_elapsed <= TIMESYNC_MAX_HORIZON ) )
+    {
+      predicted = timesync_to_local( network_time );
+      late = TIMESYNC_MAX_LATE + ( network_elapsed >> MAX_LATE_SHIFT );
+      if( (int32_t)( local_time - predicted ) > late )
+      {
+        local_time = predicted + late;
+      }
+    }
+
+    local_elapsed = local_time - anchor_local;
+
+    if( ( network_elapsed <= 0 ) || ( network_elapsed > TIMESYNC_MAX_HORIZON ) )
+    {
+      // Lost track for too long (or the coordinator restarted), start over
+      state = NOT_SYNCED;
+    }
+    else if( network_elapsed >= MIN_SKEW_INTERVAL )
+    {
+      drift = local_elapsed - network_elapsed;
+      max_drift = ( ( network_elapsed >> 8 ) * TIMESYNC_MAX_SKEW ) >> 8;
+
+      if( ( drift > max_drift ) || ( drift < -max_drift ) )
+      {
+        // Bad timestamp, keep the old anchor
+        return;
+      }
+
+      // Shifts keep this in 32 bits for anything within the horizon
+      measured_skew = ( drift << 8 ) / ( network_elapsed >> 8 );
+
+      if( OFFSET_ONLY == state )
+      {
+        skew = measured_skew;
+        state = SYNCED;
+      }
+      else
+      {
+        skew += ( measured_skew - skew ) / 4;
+      }
+    }
+  }
+
+  anchor_network = network_time;
+  anchor_local = local_time;
+
+  if( NOT_SYNCED == state )
+  {
+    state = OFFSET_ONLY;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void timesync_beacon( uint8_t sequence, uint32_t previous_tx_time,
+ *                                                        uint32_t rx_time )
+ * @brief  Process a TIME_BEACON. previous_tx_time is the network time carried
+ *         by the beacon, rx_time the local time at which it was received.
+ * ****************************************************************************/
+void timesync_beacon( uint8_t sequence, uint32_t previous_tx_time,
+                                                            uint32_t rx_time )
+{
+  // The time in this beacon belongs to the previous one, if we got it
+  if( beacon_valid && ( (uint8_t)( beacon_sequence + 1 ) == sequence ) )
+  {
+    timesync_update( previous_tx_time, beacon_rx_time );
+  }
+
+  beacon_sequence = sequence;
+  beacon_rx_time = rx_time;
+  beacon_valid = 1;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t timesync_synced( void )
+ * @brief  Returns nonzero once both offset and skew are known
+ * ****************************************************************************/
+uint8_t timesync_synced( void )
+{
+  return ( SYNCED == state );
+}
+
+/*******************************************************************************
+ * @fn     uint32_t timesync_to_local( uint32_t network_time )
+ * @brief  Local time at which the coordinator's clock reads network_time.
+ *         Only meaningful within TIMESYNC_MAX_HORIZON of the last beacon.
+ * ****************************************************************************/
+uint32_t timesync_to_local( uint32_t network_time )
+{
+  int32_t elapsed = network_time - anchor_network;
+
+  return anchor_local + elapsed + ( ( ( elapsed >> 8 ) * skew ) >> 8 );
+}
@@ -0,0 +1,36 @@
+/** @file timesync.h
+*
+* @brief Follow a coordinator's clock from its TIME_BEACON packets
+*
+* @author Alvaro Prieto
+*/
+#ifndef _TIMESYNC_H
+#define _TIMESYNC_H
+
+#include <stdint.h>
+
+// Largest clock rate difference accepted between a node and the coordinator,
+// in 1/65536ths (4096 is 6.25%). Calibrated DCOs are within a few percent.
+#ifndef TIMESYNC_MAX_SKEW
+#define TIMESYNC_MAX_SKEW (4096)
+#endif
+
+// Conversions further than this from the last beacon pair are not trusted,
+// in ticks (2^26 ticks is ~4s at 16MHz)
+#ifndef TIMESYNC_MAX_HORIZON
+#define TIMESYNC_MAX_HORIZON (0x4000000L)
+#endif
+
+// Once synced, a beacon received later than expected only moves the clock
+// this far, in ticks (160 is 10us at 16MHz)
+#ifndef TIMESYNC_MAX_LATE
+#define TIMESYNC_MAX_LATE (160)
+#endif
+
+void timesync_reset( void );
+void timesync_update( uint32_t, uint32_t );
+void timesync_beacon( uint8_t, uint32_t, uint32_t );
+uint8_t timesync_synced( void );
+uint32_t timesync_to_local( uint32_t );
+
+#endif /* _TIMESYNC_H */
@@ -0,0 +1,238 @@
+/** @file txpower.c
+*
+* @brief Per destination transmit power, lowered until the link margin is
+*        just enough
+*
+* Every destination starts at full power. Each time it reports the RSSI it
+* received one of our packets at (in an ACK or a reply), the power for it
+* moves towards the level that leaves exactly the configured margin above
+* the radio's sensitivity. Lost ACKs step it back up. The level is set from
+* the radio's tx hook, right before each packet goes out, so callers just
+* send as usual. Broadcasts always go out at full power.
+*
+* @author Alvaro Prieto
+*/
+#include "txpower.h"
+#include "cc2500.h"
+
+#define FULL_POWER (CC2500_POWER_LEVELS - 1)
+
+// LQI without the CRC_OK bit
+#define LQI_MASK (0x7F)
+
+typedef struct
+{
+  uint8_t address;
+  uint8_t level;
+  uint8_t misses;
+  uint8_t used;
+} neighbor_t;
+
+static neighbor_t neighbors[TXPOWER_NEIGHBORS];
+
+// Replaced when a new destination doesn't fit
+static uint8_t next_neighbor = 0;
+
+// Wanted RSSI at the destination, in dBm
+static int16_t target_rssi;
+
+static neighbor_t* find_neighbor( uint8_t );
+static neighbor_t* add_neighbor( uint8_t );
+static uint8_t level_at_least( int16_t );
+static void set_destination_power( uint8_t );
+
+/*******************************************************************************
+ * @fn     void txpower_setup( int8_t margin )
+ * @brief  Forget every destination and start controlling the power, keeping
+ *         margin dB over the receiver's sensitivity
+ * ****************************************************************************/
+void txpower_setup( int8_t margin )
+{
+  uint8_t index;
+
+  target_rssi = TXPOWER_SENSITIVITY_DBM + margin;
+
+  for( index = 0; index < TXPOWER_NEIGHBORS; index++ )
+  {
+    neighbors[index].used = 0;
+  }
+
+  next_neighbor = 0;
+
+  cc2500_set_tx_hook( set_destination_power );
+}
+
+/*******************************************************************************
+ * @fn     void txpower_report( uint8_t address, int16_t rssi, uint8_t lqi )
+ * @brief  address received our last packet at rssi dBm, with that LQI
+ * ****************************************************************************/
+void txpower_report( uint8_t address, int16_t rssi, uint8_t lqi )
+{
+  neighbor_t* neighbor;
+  int16_t excess;
+  int16_t power;
+
+  if( BROADCAST_ADDRESS == address )
+  {
+    return;
+  }
+
+  neighbor = add_neighbor( address );
+  neighbor->misses = 0;
+
+  excess = rssi - target_rssi;
+  power = cc2500_power_level_dbm( neighbor->level );
+
+  if( excess < 0 )
+  {
+    neighbor->level = level_at_least( power - excess );
+  }
+  else if( ( lqi & LQI_MASK ) > TXPOWER_MAX_LQI )
+  {
+    // Strong but distorted (multipath, interference), RSSI overstates the
+    // margin. Hold the level, raising it on every such report would walk
+    // it up to full power on a link that's loud enough.
+  }
+  else if( excess > TXPOWER_HYSTERESIS_DB )
+  {
+    if( excess > TXPOWER_MAX_STEP_DOWN_DB )
+    {
+      excess = TXPOWER_MAX_STEP_DOWN_DB;
+    }
+
+    neighbor->level = level_at_least( power - excess );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void txpower_reply( uint8_t address, int16_t rssi, uint8_t lqi,
+ *                                                              int8_t power )
+ * @brief  We received a reply from address at rssi dBm, sent at power dBm.
+ *         Assumes the link loses as much both ways.
+ * ****************************************************************************/
+void txpower_reply( uint8_t address, int16_t rssi, uint8_t lqi, int8_t power )
+{
+  txpower_report( address, rssi + txpower_dbm( address ) - power, lqi );
+}
+
+/*******************************************************************************
+ * @fn     void txpower_missed( uint8_t address )
+ * @brief  A packet to address wasn't acknowledged
+ * ****************************************************************************/
+void txpower_missed( uint8_t address )
+{
+  neighbor_t* neighbor = find_neighbor( address );
+
+  if( 0 == neighbor )
+  {
+    return;
+  }
+
+  neighbor->misses++;
+
+  if( neighbor->misses > 1 )
+  {
+    neighbor->level = FULL_POWER;
+  }
+  else
+  {
+    neighbor->level = level_at_least(
+            cc2500_power_level_dbm( neighbor->level ) + TXPOWER_MISS_STEP_DB );
+  }
+}
+
+/*******************************************************************************
+ * @fn     int8_t txpower_dbm( uint8_t address )
+ * @brief  Power packets to address go out at, in dBm
+ * ****************************************************************************/
+int8_t txpower_dbm( uint8_t address )
+{
+  neighbor_t* neighbor = find_neighbor( address );
+
+  if( 0 == neighbor )
+  {
+    return cc2500_power_level_dbm( FULL_POWER );
+  }
+
+  return cc2500_power_level_dbm( neighbor->level );
+}
+
+/*******************************************************************************
+ * @fn     neighbor_t* find_neighbor( uint8_t address )
+ * @brief  Entry for address, 0 if there isn't one
+ * ****************************************************************************/
+static neighbor_t* find_neighbor( uint8_t address )
+{
+  uint8_t index;
+
+  for( index = 0; index < TXPOWER_NEIGHBORS; index++ )
+  {
+    if( neighbors[index].used && ( address == neighbors[index].address ) )
+    {
+      return &neighbors[index];
+    }
+  }
+
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     neighbor_t* add_neighbor( uint8_t address )
+ * @brief  Entry for address, taking over the oldest one if it's new
+ * ****************************************************************************/
+static neighbor_t* add_neighbor( uint8_t address )
+{
+  neighbor_t* neighbor = find_neighbor( address );
+
+  if( neighbor )
+  {
+    return neighbor;
+  }
+
+  neighbor = &neighbors[next_neighbor];
+  next_neighbor = ( next_neighbor + 1 ) % TXPOWER_NEIGHBORS;
+
+  neighbor->address = address;
+  neighbor->level = FULL_POWER;
+  neighbor->misses = 0;
+  neighbor->used = 1;
+
+  return neighbor;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t level_at_least( int16_t dbm )
+ * @brief  Lowest power level of at least dbm (full power if there isn't one)
+ * ****************************************************************************/
+static uint8_t level_at_least( int16_t dbm )
+{
+  uint8_t level;
+
+  for( level = 0; level < FULL_POWER; level++ )
+  {
+    if( cc2500_power_level_dbm( level ) >= dbm )
+    {
+      break;
+    }
+  }
+
+  return level;
+}
+
+/*******************************************************************************
+ * @fn     void set_destination_power( uint8_t destination )
+ * @brief  Radio tx hook, set the power for the packet about to go out
+ * ****************************************************************************/
+static void set_destination_power( uint8_t destination )
+{
+  neighbor_t* neighbor = find_neighbor( destination );
+
+  if( ( BROADCAST_ADDRESS == destination ) || ( 0 == neighbor ) )
+  {
+    cc2500_set_power_level( FULL_POWER );
+  }
+  else
+  {
+    cc2500_set_power_level( neighbor->level );
+  }
+}
@@ -0,0 +1,52 @@
+/** @file txpower.h
+*
+* @brief Per destination transmit power, lowered until the link margin is
+*        just enough
+*
+* @author Alvaro Prieto
+*/
+#ifndef _TXPOWER_H
+#define _TXPOWER_H
+
+#include <stdint.h>
+
+// Destinations with their own power level. Others get full power.
+#ifndef TXPOWER_NEIGHBORS
+#define TXPOWER_NEIGHBORS (8)
+#endif
+
+// Weakest signal the radio reliably receives, in dBm (about -89dBm for 1%
+// PER at 250kbps)
+#ifndef TXPOWER_SENSITIVITY_DBM
+#define TXPOWER_SENSITIVITY_DBM (-88)
+#endif
+
+// Power only goes down once the margin is this much more than needed, in
+// dB, so it doesn't bounce between two levels
+#ifndef TXPOWER_HYSTERESIS_DB
+#define TXPOWER_HYSTERESIS_DB (3)
+#endif
+
+// Largest step down per report, in dB. Steps up aren't limited.
+#ifndef TXPOWER_MAX_STEP_DOWN_DB
+#define TXPOWER_MAX_STEP_DOWN_DB (6)
+#endif
+
+// Step up after a missed ACK or reply, in dB. Two in a row go to full power.
+#ifndef TXPOWER_MISS_STEP_DB
+#define TXPOWER_MISS_STEP_DB (6)
+#endif
+
+// Reports with a worse (higher) LQI than this never lower the power. They
+// still raise it if the RSSI is below the target.
+#ifndef TXPOWER_MAX_LQI
+#define TXPOWER_MAX_LQI (40)
+#endif
+
+void txpower_setup( int8_t );
+void txpower_report( uint8_t, int16_t, uint8_t );
+void txpower_reply( uint8_t, int16_t, uint8_t, int8_t );
+void txpower_missed( uint8_t );
+int8_t txpower_dbm( uint8_t );
+
+#endif /* _TXPOWER_H */
@@ -0,0 +1,255 @@
+/** @file txqueue.c
+*
+* @brief Transmit queue with priority classes, where a newer message with
+*        the same key replaces the queued one
+*
+* txqueue_send() copies a message into the queue, from the main loop or an
+* ISR, and txqueue_poll() sends them with cc2500_tx_packet(). Sending waits
+* for each packet to go out, so txqueue_poll() picks the next message only
+* once the last one is done: the most urgent class first, oldest first
+* within a class. A doorbell event queued while a batch of RGB frames is
+* going out only waits for the frame on the air.
+*
+* Messages with a key (anything but TXQUEUE_NO_KEY) replace a queued message
+* with the same destination and key, in its place in the line. A new color
+* for a fixture overwrites the one that hasn't gone out yet instead of
+* queueing behind it. The replacement keeps the more urgent of the two
+* classes, so a bulk message never demotes an urgent one. When the queue is
+* full, the newest message of a less urgent class makes room, otherwise the
+* new message is dropped.
+*
+* @author Alvaro Prieto
+*/
+#include "txqueue.h"
+#include "cc2500.h"
+#include "device.h"
+#include <string.h>
+
+typedef struct
+{
+  uint8_t used;
+  uint8_t destination;
+  uint8_t key;
+  uint8_t priority;
+  uint8_t order;            // Queue order within the class, wraps around
+  uint8_t length;
+  uint8_t payload[TXQUEUE_PAYLOAD];
+} message_t;
+
+static message_t messages[TXQUEUE_LENGTH];
+
+static uint8_t next_order = 0;
+static uint16_t dropped = 0;
+
+static message_t* find_slot( uint8_t, uint8_t, uint8_t );
+static message_t* next_message( void );
+
+/*******************************************************************************
+ * @fn     uint8_t txqueue_send( uint8_t* buffer, uint8_t length,
+ *                  uint8_t destination, uint8_t priority, uint8_t key )
+ * @brief  Queue a message for destination. Returns 0 if it was dropped (too
+ *         long, or the queue is full of messages at least as urgent). Safe
+ *         to call from an ISR.
+ * ****************************************************************************/
+uint8_t txqueue_send( uint8_t* buffer, uint8_t length, uint8_t destination,
+                                              uint8_t priority, uint8_t key )
+{
+  message_t* message;
+  uint8_t interrupts_enabled;
+
+  if( priority >= TXQUEUE_PRIORITIES )
+  {
+    priority = TXQUEUE_BULK;
+  }
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  message = ( length <= TXQUEUE_PAYLOAD ) ?
+                              find_slot( destination, priority, key ) : 0;
+
+  if( message )
+  {
+    if( message->used && ( message->priority < priority ) )
+    {
+      // Replacing a more urgent message, keep its class and place
+      priority = message->priority;
+    }
+
+    if( !message->used || ( message->priority != priority ) )
+    {
+      // New message, or replacing one in another class: back of the line
+      message->order = next_order++;
+    }
+
+    message->used = 1;
+    message->destination = destination;
+    message->key = key;
+    message->priority = priority;
+    message->length = length;
+    memcpy( message->payload, buffer, length );
+  }
+  else
+  {
+    dropped++;
+  }
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+
+  return ( message != 0 );
+}
+
+/*******************************************************************************
+ * @fn     void txqueue_poll( void )
+ * @brief  Send every queued message, most urgent first. Call it from the
+ *         main loop.
+ * ****************************************************************************/
+void txqueue_poll( void )
+{
+  message_t* message;
+  uint8_t payload[TXQUEUE_PAYLOAD];
+  uint8_t destination;
+  uint8_t length;
+
+  for(;;)
+  {
+    // Take the message out first, an ISR could replace it while it's sent
+    __disable_interrupt();
+
+    message = next_message();
+
+    if( message )
+    {
+      destination = message->destination;
+      length = message->length;
+      memcpy( payload, message->payload, length );
+      message->used = 0;
+    }
+
+    __enable_interrupt();
+
+    if( 0 == message )
+    {
+      break;
+    }
+
+    cc2500_tx_packet( payload, length, destination );
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t txqueue_count( void )
+ * @brief  Messages waiting to go out
+ * ****************************************************************************/
+uint8_t txqueue_count( void )
+{
+  uint8_t index;
+  uint8_t count = 0;
+
+  for( index = 0; index < TXQUEUE_LENGTH; index++ )
+  {
+    if( messages[index].used )
+    {
+      count++;
+    }
+  }
+
+  return count;
+}
+
+/*******************************************************************************
+ * @fn     uint16_t txqueue_dropped( void )
+ * @brief  Messages that didn't fit, or were pushed out by more urgent ones
+ * ****************************************************************************/
+uint16_t txqueue_dropped( void )
+{
+  return dropped;
+}
+
+/*******************************************************************************
+ * @fn     message_t* find_slot( uint8_t destination, uint8_t priority,
+ *                                                              uint8_t key )
+ * @brief  Queued message with the same destination and key, a free slot, or
+ *         the newest less urgent message, in that order. 0 if there's none.
+ *         Interrupts must be disabled.
+ * ****************************************************************************/
+static message_t* find_slot( uint8_t destination, uint8_t priority,
+                                                                  uint8_t key )
+{
+  uint8_t index;
+  message_t* free_slot = 0;
+  message_t* victim = 0;
+  message_t* message;
+
+  for( index = 0; index < TXQUEUE_LENGTH; index++ )
+  {
+    message = &messages[index];
+
+    if( !message->used )
+    {
+      free_slot = message;
+    }
+    else if( ( TXQUEUE_NO_KEY != key ) && ( key == message->key ) &&
+                                    ( destination == message->destination ) )
+    {
+      return message;
+    }
+    else if( message->priority > priority )
+    {
+      // Least urgent class, and newest within it
+      if( ( 0 == victim ) || ( message->priority > victim->priority ) ||
+              ( ( message->priority == victim->priority ) &&
+                ( (int8_t)( message->order - victim->order ) > 0 ) ) )
+      {
+        victim = message;
+      }
+    }
+  }
+
+  if( free_slot )
+  {
+    return free_slot;
+  }
+
+  if( victim )
+  {
+    victim->used = 0;
+    dropped++;
+  }
+
+  return victim;
+}
+
+/*******************************************************************************
+ * @fn     message_t* next_message( void )
+ * @brief  Oldest message of the most urgent class, 0 if the queue is empty.
+ *         Interrupts must be disabled.
+ * ****************************************************************************/
+static message_t* next_message( void )
+{
+  uint8_t index;
+  message_t* next = 0;
+  message_t* message;
+
+  for( index = 0; index < TXQUEUE_LENGTH; index++ )
+  {
+    message = &messages[index];
+
+    if( !message->used )
+    {
+      continue;
+    }
+
+    if( ( 0 == next ) || ( message->priority < next->priority ) ||
+            ( ( message->priority == next->priority ) &&
+              ( (int8_t)( message->order - next->order ) < 0 ) ) )
+    {
+      next = message;
+    }
+  }
+
+  return next;
+}
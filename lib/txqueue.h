@@ -0,0 +1,42 @@
+/** @file txqueue.h
+*
+* @brief Transmit queue with priority classes, where a newer message with
+*        the same key replaces the queued one
+*
+* @author Alvaro Prieto
+*/
+#ifndef _TXQUEUE_H
+#define _TXQUEUE_H
+
+#include <stdint.h>
+
+// RAM, on the MSP430: TXQUEUE_LENGTH * ( TXQUEUE_PAYLOAD + 6 ) for the
+// queue and 4 for the counters, plus TXQUEUE_PAYLOAD of stack in
+// txqueue_poll() for the message being sent. The defaults take 48 bytes and
+// 16 of stack, raise them only on parts with more than 256 bytes of RAM.
+
+// Queued messages, at most
+#ifndef TXQUEUE_LENGTH
+#define TXQUEUE_LENGTH (2)
+#endif
+
+// Longest message, without the length and address bytes
+#ifndef TXQUEUE_PAYLOAD
+#define TXQUEUE_PAYLOAD (16)
+#endif
+
+// Priority classes, most urgent first
+#define TXQUEUE_URGENT     (0)      // Events someone is waiting on (doorbell)
+#define TXQUEUE_NORMAL     (1)
+#define TXQUEUE_BULK       (2)      // State that's resent anyway (RGB frames)
+#define TXQUEUE_PRIORITIES (3)
+
+// Key for messages that never replace each other
+#define TXQUEUE_NO_KEY (0)
+
+uint8_t txqueue_send( uint8_t*, uint8_t, uint8_t, uint8_t, uint8_t );
+void txqueue_poll( void );
+uint8_t txqueue_count( void );
+uint16_t txqueue_dropped( void );
+
+#endif /* _TXQUEUE_H */
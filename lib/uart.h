@@ -13,6 +13,14 @@
 #define START_BYTE 0x7E
 #define END_BYTE 0x7F
 
+// Status register bits cleared when the rx callback asks to wake the
+// processor. Everything by default, so it wakes from any low power mode.
+// The UART is clocked from SMCLK, so it only receives in LPM3/4 if SMCLK is
+// kept on (clock_smclk_request()).
+#ifndef UART_WAKE_BITS
+#define UART_WAKE_BITS (LPM4_bits)
+#endif
+
 void setup_uart( void );
 
 void uart_put_char( uint8_t );
@@ -142,7 +142,7 @@ __interrupt void uart_rx_isr(void) // CHANGE
     if( uart_rx_callback( UCA0RXBUF ) )
     {
       // If function returns something nonzero, wakeup the processor
-      __bic_SR_register_on_exit(LPM1_bits);
+      __bic_SR_register_on_exit(UART_WAKE_BITS);
     }
   }
   // Process incoming byte from SPI
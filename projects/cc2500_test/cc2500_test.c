@@ -2,13 +2,19 @@
 *
 * @brief Fade between RGB colors and send out via radio
 *
+* Colors go out as RGB_UNIVERSE broadcasts for TEST_FIXTURES fixtures, each
+* fixture getting the colors rotated by its index so they can be told apart.
+*
 * @author Alvaro Prieto
 */
 #include <stdint.h>
 #include "device.h"
 #include "cc2500.h"
 
-uint8_t txBuffer[6];
+// Fixtures in the test universe, starting at fixture 0
+#define TEST_FIXTURES (3)
+
+uint8_t txBuffer[RGB_UNIVERSE_HEADER_LENGTH + 3 * TEST_FIXTURES];
 static uint8_t rgb[3] = {128, 128, 128};
 
 uint8_t rx_callback( uint8_t*, uint8_t );
@@ -16,6 +22,8 @@ uint8_t rx_callback( uint8_t*, uint8_t );
 int main(void)
 {
   int8_t r, g ,b;
+  uint8_t fixture;
+  uint8_t* color;
   r = 2;
   g = -3;
   b = 1;
@@ -74,11 +82,15 @@ int main(void)
     rgb[2] += b;
 
     //Build packet
-    txBuffer[0] = 4;            // Packet length
-    txBuffer[1] = 0x01;         // Packet address
-    txBuffer[2] = rgb[0];       // red
-    txBuffer[3] = rgb[1];       // green
-    txBuffer[4] = rgb[2];       // blue
+    txBuffer[0] = RGB_UNIVERSE;
+    txBuffer[1] = 0;            // First fixture
+    color = &txBuffer[RGB_UNIVERSE_HEADER_LENGTH];
+    for( fixture = 0; fixture < TEST_FIXTURES; fixture++ )
+    {
+      *color++ = rgb[fixture % 3];        // red
+      *color++ = rgb[(fixture + 1) % 3];  // green
+      *color++ = rgb[(fixture + 2) % 3];  // blue
+    }
 
     __delay_cycles(100000);
     __delay_cycles(100000);
@@ -86,8 +98,8 @@ int main(void)
     __delay_cycles(100000);
     __delay_cycles(100000);
 
-    // Send message to LED controller!
-    cc2500_tx(txBuffer, 5);
+    // Send message to every LED controller!
+    cc2500_tx_packet(txBuffer, sizeof(txBuffer), BROADCAST_ADDRESS);
 
     // Toggle local LED to signal transmission
     LED_PxOUT ^= 0x03;
@@ -30,7 +30,7 @@ void main(void) {
 	setup_cc2500(cc2500_rx_callback);
 
   // Turn radio off to save power
-	void cc2500_sleep();
+	cc2500_sleep();
 
   // Set P1.0 as an output
 	P1OUT &= ~(BIT0);
@@ -87,7 +87,7 @@ void main(void) {
       cc2500_tx(tx_buffer, sizeof(packet_header_t)+1);
       ringing = 0;
       // Turn off the radio to save power
-      void cc2500_sleep( );
+      cc2500_sleep( );
 
       // Enter LPM1, sleeeep
       __bis_SR_register(LPM3_bits);
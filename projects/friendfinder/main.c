@@ -4,12 +4,17 @@
 #include <stdint.h>
 #include "device.h"
 #include "cc2500.h"
+#include "clock.h"
+#include "scheduler.h"
 
 uint8_t rx_callback( uint8_t*, uint8_t );
-void delay_ms(uint32_t);
+static void heartbeat( void );
+static void buzzer_timeout( void );
+
+static scheduler_timer_t heartbeat_timer;
+static scheduler_timer_t buzzer_timer;
 
 int16_t rssi_threshold = -60;
-int16_t rssi_rx = -60;
 
 inline void buzzer_on() {
   LED_PxOUT |= LED2;
@@ -42,89 +47,56 @@ void main(void) {
 
   WDTCTL = WDTPW + WDTHOLD;                 // Stop WDT
 
-  // Setup oscillator for 8MHz operation
-  BCSCTL1 = CALBC1_16MHZ;
-  DCOCTL = CALDCO_16MHZ;
-
-  // Wait for changes to take effect
-  __delay_cycles(4000);
+  // 16MHz DCO, ACLK from the VLO (measured, for the scheduler)
+  clock_setup();
 
   // Initialize cc2500 and register callback function to process incoming data
   setup_cc2500(rx_callback);
 
-  // Wait a bit for radio
-  delay_ms(10);
+  // Wait a bit for radio (10ms)
+  __delay_cycles(160000);
 
   LED_PxOUT &= ~(LED1+LED2);
   LED_PxDIR |= (LED1+LED2);
 
-  // SMCLK/8, up mode, enable interrupt,
-  TA0CTL = TASSEL_2 + ID_3+ MC_1 + TAIE + TACLR;
-  TACCR0 = 33333; // 16MHz/8/33333 ~ 60Hz
-
-  __bis_SR_register(LPM1_bits +GIE);       // Enter LPM1, enable interrupts
-
-  for(;;) {
-
-    // Compute delay from incoming rssi
-    int16_t delay = (rssi_rx-rssi_threshold) * 5;
+  scheduler_setup();
 
-    // Wait before turning off the buzzer
-    delay_ms(delay);
+  // Say hi about once a second
+  scheduler_timer_init( &heartbeat_timer, heartbeat );
+  scheduler_timer_start( &heartbeat_timer, 1000, 1000 );
 
-    buzzer_off();
+  scheduler_timer_init( &buzzer_timer, buzzer_timeout );
 
-    // Reset to no delay
-    rssi_rx = rssi_threshold;
-
-    __bis_SR_register(LPM1_bits + GIE);       // Enter LPM1, enable interrupts
-  }
+  // Sleeps in LPM3 until a timer or a packet needs something done
+  scheduler_run();
 }
 
 // This function is called to process the received packet
 uint8_t rx_callback( uint8_t* buffer, uint8_t length )
 {
-  // If the incoming RSSI is above the threshold, turn on the buffer
-  if(rssi_to_dbm(buffer[length]) > rssi_threshold)
+  int16_t rssi = rssi_to_dbm(buffer[length]);
+
+  // If the incoming RSSI is above the threshold, turn on the buzzer, for
+  // longer the closer the friend is
+  if(rssi > rssi_threshold)
   {
-    // Convert received RSSI to dbm and store it
-    rssi_rx = rssi_to_dbm(buffer[length]);
     buzzer_on();
-    return 1; //wake up
+    scheduler_timer_start( &buzzer_timer, (rssi - rssi_threshold) * 5, 0 );
   }
 
   // Don't wake up the processor
   return 0;
 }
 
-void delay_ms(uint32_t delay_ms) {
-  uint32_t delay;
-  for(delay=0; delay < delay_ms; delay++)
-  {
-    __delay_cycles(16000);
-  }
+static void buzzer_timeout( void )
+{
+  buzzer_off();
 }
 
-// Timer A isr
-#pragma vector=TIMERA0_VECTOR
-__interrupt void TA0_ISR (void)
+static void heartbeat( void )
 {
-  static uint8_t counter;
-
-  // Increase virtual timer counter
-  counter++;
-
-  if(counter == 60)
-  {
-    cc2500_tx_packet((uint8_t*)"go!", 3, 0x00);
-    // Toggle LED
-    LED_PxOUT = LED_PxOUT ^ LED1;
-
-    counter = 0;
-  }
-
-
-  // Clear interrupt flag
-  TA0IV &= ~TAIV_TAIFG;
+  cc2500_tx_packet((uint8_t*)"go!", 3, 0x00);
 
+  // Toggle LED
+  LED_PxOUT = LED_PxOUT ^ LED1;
 }
@@ -4,6 +4,7 @@
 #include "device.h"
 #include <stdint.h>
 #include "cc2500.h"
+#include "delta.h"
 
 #define RGB_MIN (40)
 
@@ -14,15 +15,51 @@ uint8_t cc2500_rx_callback( uint8_t*, uint8_t );
 
 #define TOTAL_SAMPLES (7)
 
-volatile uint8_t samples[TOTAL_SAMPLES];
-volatile uint8_t sample_index = 0;
+// Timer A runs at 2MHz. Every period the strobe (TA0.1) goes high for
+// STROBE_PULSE ticks, then low, which moves the MSGEQ7 to the next band.
+// TA0.2 goes high SAMPLE_DELAY ticks later, once the output has settled, and
+// triggers an ADC10 conversion.
+#define STROBE_PERIOD (400)   // 200uS per band (72uS minimum)
+#define STROBE_PULSE (40)     // 20uS (18uS minimum)
+#define SAMPLE_DELAY (100)    // 50uS (36uS settling time)
+
+// Every band is sampled OVERSAMPLE times per ADC block. The DTC writes two
+// blocks of 7 * OVERSAMPLE words, so each one costs 28 bytes of RAM. With the
+// radio driver and an 80 byte stack, a 256 byte part only has room for one.
+#ifndef OVERSAMPLE
+#define OVERSAMPLE (1)
+#endif
+
+#define BLOCK_SAMPLES (TOTAL_SAMPLES * OVERSAMPLE)
+
+// Blocks averaged into each packet. 24 blocks of 1 is ~30 packets per second.
+// The sums are 16-bit, so this can go up to 257.
+#ifndef BLOCKS_PER_PACKET
+#define BLOCKS_PER_PACKET (24)
+#endif
+
+// Filled by the ADC10 DTC, one block while the other is being read
+uint16_t adc_blocks[2][BLOCK_SAMPLES];
+volatile uint8_t ready_block = 0;
 
 volatile uint8_t new_data = 0;
 
-uint8_t txBuffer[6];
-uint8_t rgb[3];
+// Per band sums of the blocks since the last packet, then their averages
+static uint16_t band_sums[TOTAL_SAMPLES];
+static uint8_t total_blocks = 0;
+
+uint8_t txBuffer[1 + DELTA_MAX_ENCODED_LENGTH( DELTA_STREAM_CHANNELS )];
+uint8_t rgb[DELTA_STREAM_CHANNELS];
+
+// Colors are sent as a delta stream, mostly only the ones that changed
+static delta_encoder_t encoder;
+static uint8_t previous_rgb[DELTA_STREAM_CHANNELS];
+
+static void add_block( void );
 
 void main(void) {
+  uint8_t length;
+  uint8_t band;
 
   WDTCTL = WDTPW + WDTHOLD;                 // Stop WDT
 
@@ -40,38 +77,62 @@ void main(void) {
   P1DIR |= (STROBE_PIN+RESET_PIN + BIT3);
   P1SEL |= (STROBE_PIN);
 
-  // Pulse the reset pin for 1uS
+  // Pulse the reset pin (100nS minimum)
   P1OUT |= RESET_PIN;
-  __delay_cycles(16);
   P1OUT &= ~RESET_PIN;
 
-  ADC10CTL1 = INCH_0;   // P1.0
+  // P1.0, one conversion on every TA0.2 rising edge
+  ADC10CTL1 = INCH_0 + SHS_3 + CONSEQ_2;
   ADC10CTL0 = ADC10SHT_2 + ADC10ON + ADC10IE;
+  ADC10AE0 = BIT0;
+
+  // DTC alternates between the two blocks, interrupting when one is full
+  ADC10DTC0 = ADC10TB + ADC10CT;
+  ADC10DTC1 = BLOCK_SAMPLES;
+  ADC10SA = (uint16_t)adc_blocks;
+  ADC10CTL0 |= ENC;
 
   // Setup timer A
 
-  TACCTL1 = OUTMOD_7;
-  TA0CCR0 = 9524; // 9524/2MHz = 4.762 ms strobe period
-  TACCR1 = 524;   // 262uS strobe pulse
+  TACCTL1 = OUTMOD_7;             // Strobe high from CCR0 to CCR1
+  TA0CCR0 = STROBE_PERIOD - 1;
+  TACCR1 = STROBE_PULSE;
 
-  TA0CCR2 = (TA0CCR0>>1); // Trigger ADC measurement halfway through the period
-  TACCTL2 = CCIE;
+  TACCTL2 = OUTMOD_3;             // ADC trigger rises at CCR2
+  TA0CCR2 = STROBE_PULSE + SAMPLE_DELAY;
 
   // SMCLK, up mode
-  TA0CTL = TASSEL_2 + MC_1 + ID_3 + TAIE + TACLR;
+  TA0CTL = TASSEL_2 + MC_1 + ID_3 + TACLR;
 
-  txBuffer[0] = 4;         // Packet length
-  txBuffer[1] = 0x01;      // Packet address
+  txBuffer[0] = DELTA_STREAM;
+  delta_encoder_init( &encoder, previous_rgb, DELTA_STREAM_CHANNELS );
 
   for(;;) {
     __bis_SR_register( LPM1_bits + GIE );   // Enable interrupts and sleep
     if(new_data)
     {
+      new_data = 0;
+
+      add_block();
+      if( total_blocks < BLOCKS_PER_PACKET )
+      {
+        continue;
+      }
+
+      for( band = 0; band < TOTAL_SAMPLES; band++ )
+      {
+        band_sums[band] /= total_blocks;
+      }
+      total_blocks = 0;
 
+      rgb[0] = (uint8_t)band_sums[0] + (uint8_t)band_sums[1];
+      rgb[1] = (uint8_t)band_sums[2] + (uint8_t)band_sums[3];
+      rgb[2] = (uint8_t)band_sums[4] + (uint8_t)band_sums[5];
 
-      rgb[0] = samples[0] + samples[1];
-      rgb[1] = samples[2] + samples[3];
-      rgb[2] = samples[4] + samples[5];
+      for( band = 0; band < TOTAL_SAMPLES; band++ )
+      {
+        band_sums[band] = 0;
+      }
 
       if(rgb[0] < RGB_MIN ) {
         rgb[0]=0;
@@ -83,17 +144,37 @@ void main(void) {
         rgb[2]=0;
       }
 
-      txBuffer[2] = rgb[0];       // red
-      txBuffer[3] = rgb[1];       // green
-      txBuffer[4] = rgb[2];       // blue
-
-      // Send out packet with RGB values
-      cc2500_tx(txBuffer, 5);
-      new_data = 0;
+      // Send out packet with RGB values, unless nothing changed
+      length = delta_encode( &encoder, rgb, &txBuffer[1] );
+      if( length )
+      {
+        cc2500_tx_packet( txBuffer, 1 + length, BROADCAST_ADDRESS );
+      }
+    }
+  }
+}
 
+// Add the last ADC block to the band sums, as 8-bit averages. Has to be done
+// before the DTC comes back around to it, BLOCK_SAMPLES strobe periods later.
+static void add_block( void )
+{
+  uint16_t* block = adc_blocks[ready_block];
+  uint16_t sum;
+  uint8_t band;
+  uint8_t index;
 
+  for( band = 0; band < TOTAL_SAMPLES; band++ )
+  {
+    sum = 0;
+    for( index = band; index < BLOCK_SAMPLES; index += TOTAL_SAMPLES )
+    {
+      sum += block[index];
     }
+
+    band_sums[band] += ( sum / OVERSAMPLE ) >> 2;
   }
+
+  total_blocks++;
 }
 
 // This function is called to process the received packet
@@ -103,39 +184,21 @@ uint8_t cc2500_rx_callback( uint8_t* buffer, uint8_t length )
   return 0;
 }
 
-// Timer A isr
-#pragma vector=TIMER0_A1_VECTOR
-__interrupt void TA1_ISR (void)
-{
-  // Start ADC conversion
-  ADC10CTL0 |= ENC + ADC10SC;
-
-  // Clear interrupt flag
-  TA0IV &= ~TA0IV_TAIFG;
-
-}
-
-// ADC10 isr
+// ADC10 isr, a block of samples is ready
 #pragma vector=ADC10_VECTOR
 __interrupt void ADC10_ISR(void) {
 
-  // Store sample
-  samples[sample_index++] = (ADC10MEM >> 2) & 0xFF;
-
-  if(sample_index == TOTAL_SAMPLES)
-  {
-    // Send message?
-    sample_index = 0;
+  // The block that was just filled
+  ready_block = ( ADC10DTC0 & ADC10B1 ) ? 0 : 1;
 
-    new_data = 1;
+  new_data = 1;
 
-    // Pulse the reset pin for 1uS
-    P1OUT |= RESET_PIN;
-    __delay_cycles(16);
-    P1OUT &= ~RESET_PIN;
+  // Back to the first band, in case a strobe was missed. The next strobe is
+  // well over 72uS away, and two writes at 16MHz are over 100nS apart.
+  P1OUT |= RESET_PIN;
+  P1OUT &= ~RESET_PIN;
 
-    // Wakeup
-    __bic_SR_register_on_exit(LPM1_bits);
-  }
+  // Wakeup
+  __bic_SR_register_on_exit(LPM1_bits);
 
 }
@@ -1,20 +1,51 @@
 /** @file rgb_controller.c
 *
-* @brief Get RGB data via 19200 baud serial connection and send out via radio
+* @brief Get RGB data via serial connection and send out via radio
+*
+* Serial frames use the same escaping as the bridge (START_BYTE, END_BYTE,
+* ESCAPE_BYTE) and carry the colors for a run of fixtures:
+* [first fixture][r g b][r g b]...
+*
+* They're sent out as broadcast RGB_SCENE packets, RGB_SCENE_MAX_FIXTURES
+* fixtures at a time, instead of one packet per fixture. Every packet from the
+* same serial frame has the same apply time, SCENE_LEAD_TICKS after the frame
+* started, so all fixtures switch together even if the frame takes a few
+* packets (or retries) to get out.
+*
+* This is also the time coordinator. Timer_A counts SMCLK cycles as the
+* network time and a TIME_BEACON goes out about every 100ms.
 *
 * @author Alvaro Prieto
 */
 #include <stdint.h>
+#include <string.h>
 #include "device.h"
 #include "uart.h"
 #include "cc2500.h"
 
-uint8_t txBuffer[6];
-uint8_t buffer_index;
-static uint8_t rgb[3] = {0, 0, 0};
+#define SCENE_PACKET_LENGTH ( RGB_SCENE_HEADER_LENGTH + \
+                                                3 * RGB_SCENE_MAX_FIXTURES )
+
+// Time from the start of a serial frame until the fixtures show it. Enough
+// for the frame to arrive and go out in a few packets (30ms at 16MHz).
+#define SCENE_LEAD_TICKS (480000L)
+
+// Timer overflows (65536 cycles, ~4ms at 16MHz) between beacons
+#define BEACON_OVERFLOWS (24)
+
+// One packet is filled from the uart while the other one is sent
+static uint8_t scene_packets[2][SCENE_PACKET_LENGTH];
+static volatile uint8_t packet_length[2];
+static uint8_t sending_packet = 0;
+
+// Upper 16 bits of the network time, incremented on every timer overflow
+static volatile uint16_t timer_overflows = 0;
+static volatile uint8_t beacon_due = 0;
 
 uint8_t cc2500_rx_callback( uint8_t*, uint8_t );
 uint8_t uart_rx_callback( uint8_t );
+static uint32_t network_time( void );
+static void send_beacon( void );
 
 void main(void)
 {
@@ -43,16 +74,32 @@ void main(void)
    LED_PxOUT &= ~(LED1); //Outputs
    LED_PxDIR = LED1; //Outputs
 
+   // SMCLK, continuous mode, interrupt on overflow for the network time
+   TA0CTL = TASSEL_2 + MC_2 + TAIE + TACLR;
 
-   // Build packet
-   txBuffer[0] = 4;         // Packet length
-   txBuffer[1] = 0x01;      // Packet address
-   buffer_index = 0;
+   // Timestamp beacons with the network time
+   cc2500_set_clock( network_time );
 
    for(;;)
    {
      __bis_SR_register( LPM1_bits + GIE );   // Enable interrupts and sleep
 
+     if( beacon_due )
+     {
+       beacon_due = 0;
+       send_beacon();
+     }
+
+     // Send whatever the uart has finished, oldest first
+     while( packet_length[sending_packet] )
+     {
+       cc2500_tx_packet( scene_packets[sending_packet],
+                          packet_length[sending_packet], BROADCAST_ADDRESS );
+       LED_PxOUT ^= LED1;
+
+       packet_length[sending_packet] = 0;
+       sending_packet ^= 1;
+     }
    }
 
 }
@@ -64,30 +111,169 @@ uint8_t cc2500_rx_callback( uint8_t* buffer, uint8_t length )
   return 0;
 }
 
+/*******************************************************************************
+ * @fn     void send_beacon( void )
+ * @brief  Broadcast a TIME_BEACON with the time at which the previous one
+ *         went out
+ * ****************************************************************************/
+static void send_beacon( void )
+{
+  static uint8_t sequence = 0;
+  static uint32_t last_beacon_time = 0;
+  uint8_t beacon[TIME_BEACON_LENGTH];
+
+  beacon[0] = TIME_BEACON;
+  beacon[1] = sequence++;
+  memcpy( &beacon[2], &last_beacon_time, sizeof(last_beacon_time) );
+
+  cc2500_tx_packet( beacon, sizeof(beacon), BROADCAST_ADDRESS );
+
+  last_beacon_time = cc2500_tx_timestamp();
+}
+
+/*******************************************************************************
+ * @fn     uint32_t network_time( void )
+ * @brief  32-bit Timer_A time in SMCLK cycles. Safe to call from an ISR.
+ * ****************************************************************************/
+static uint32_t network_time( void )
+{
+  uint16_t low;
+  uint16_t high;
+  uint8_t interrupts_enabled;
+
+  interrupts_enabled = __get_SR_register() & GIE;
+  __disable_interrupt();
+
+  low = TA0R;
+  high = timer_overflows;
+
+  // The timer overflowed, but the overflow interrupt hasn't run yet
+  if( ( TA0CTL & TAIFG ) && ( low < 0x8000 ) )
+  {
+    high++;
+  }
+
+  if( interrupts_enabled )
+  {
+    __enable_interrupt();
+  }
+
+  return ( (uint32_t)high << 16 ) | low;
+}
+
+// Timer A isr
+#pragma vector=TIMER0_A1_VECTOR
+__interrupt void TA1_ISR (void)
+{
+  static uint8_t overflows_since_beacon;
+
+  switch( TA0IV )
+  {
+    case TA0IV_TAIFG:
+      timer_overflows++;
+
+      if( ++overflows_since_beacon == BEACON_OVERFLOWS )
+      {
+        overflows_since_beacon = 0;
+        beacon_due = 1;
+        __bic_SR_register_on_exit(LPM1_bits);
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
 //
-// Get 3 bytes of data from uart and send RGB values over radio
-// This does not check incoming data. If a byte is missed, all of the
-// colors will be shifted. I will fix this later...
+// Decode serial frames and split them into scene packets. A full packet
+// is handed to the main loop as soon as it's ready, so long frames are sent
+// while the rest is still arriving. If the main loop falls behind, the rest
+// of the frame is dropped.
 //
 uint8_t uart_rx_callback( uint8_t rx_byte )
 {
-  // Fill up buffer as we receive each color
-  rgb[buffer_index++] = rx_byte;
+  static uint8_t receiving_packet;
+  static uint8_t escape_next_character;
+  static uint8_t filling_packet;
+  static uint8_t buffer_index;
+  static uint8_t next_fixture;
+  static uint32_t apply_time;
+  uint8_t* packet = scene_packets[filling_packet];
+  uint8_t wake_up = 0;
 
-  // Once all three colors have been received, build and send message
-  if(buffer_index == 3)
+  if( START_BYTE == rx_byte )
   {
+    // Skip the frame if the main loop is still sending both packets
+    receiving_packet = !packet_length[filling_packet];
+    escape_next_character = 0;
     buffer_index = 0;
+    apply_time = network_time() + SCENE_LEAD_TICKS;
+    return 0;
+  }
 
-    // Modify packet in buffer RGB data
-    txBuffer[2] = rgb[0];       // red
-    txBuffer[3] = rgb[1];       // green
-    txBuffer[4] = rgb[2];       // blue
-    LED_PxOUT ^= 0x01;
+  if( !receiving_packet )
+  {
+    return 0;
+  }
 
-    // Send out packet with RGB values
-    cc2500_tx(txBuffer, 5);
+  if( ESCAPE_BYTE == rx_byte )
+  {
+    escape_next_character = 1;
+    return 0;
   }
 
-  return 0;
+  if( END_BYTE == rx_byte )
+  {
+    // Drop any incomplete color at the end
+    if( buffer_index > RGB_SCENE_HEADER_LENGTH )
+    {
+      buffer_index -= ( buffer_index - RGB_SCENE_HEADER_LENGTH ) % 3;
+    }
+    receiving_packet = 0;
+  }
+  else
+  {
+    if( escape_next_character )
+    {
+      escape_next_character = 0;
+      rx_byte ^= 0x20;
+    }
+
+    // First byte of the frame is the first fixture, the rest are colors
+    if( 0 == buffer_index )
+    {
+      next_fixture = rx_byte;
+      buffer_index = RGB_SCENE_HEADER_LENGTH;
+      return 0;
+    }
+
+    packet[buffer_index++] = rx_byte;
+    if( buffer_index < SCENE_PACKET_LENGTH )
+    {
+      return 0;
+    }
+  }
+
+  // Packet full or frame over, hand it to the main loop
+  if( buffer_index > RGB_SCENE_HEADER_LENGTH )
+  {
+    packet[0] = RGB_SCENE;
+    memcpy( &packet[1], &apply_time, sizeof(apply_time) );
+    packet[5] = next_fixture;
+    packet_length[filling_packet] = buffer_index;
+    next_fixture += RGB_SCENE_MAX_FIXTURES;
+    filling_packet ^= 1;
+    wake_up = 1;
+  }
+
+  buffer_index = RGB_SCENE_HEADER_LENGTH;
+
+  // Still sending the other packet
+  if( packet_length[filling_packet] )
+  {
+    receiving_packet = 0;
+  }
+
+  return wake_up;
 }
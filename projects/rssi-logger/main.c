@@ -1,13 +1,139 @@
-/** @file rgb_controller.c
+/** @file main.c
 *
-* @brief Get RGB data via 19200 baud serial connection and send out via radio
+* @brief RSSI logger, packet sniffer and spectrum scanner for the bridge
+*        hardware
+*
+* Logs the RSSI of every received packet. Each packet becomes an 8 byte
+* rssi_record_t (timestamp, source, RSSI, LQI). Records are buffered in RAM and
+* sent over the UART in batches, one escaped frame per batch, from the main
+* loop. host/rssi/rssi_stats turns the stream into per-node time series.
+*
+* Define SNIFFER_MODE in the project settings to build the promiscuous
+* sniffer instead. It captures every frame on SNIFFER_CHANNEL (including
+* frames with bad CRC) and streams them over the UART as escaped
+* sniffer_record_t frames. host/sniffer/sniff2pcap converts the stream to pcap.
+*
+* Define SCANNER_MODE to build a spectrum scanner. It sweeps the band
+* continuously using cached synthesizer calibration and sends one escaped
+* sweep frame per sweep. host/scan/scan2csv turns the sweeps into CSV.
 *
 * @author Alvaro Prieto
 */
 #include <stdint.h>
+#include <string.h>
 #include "device.h"
 #include "uart.h"
 #include "cc2500.h"
+#include "spi.h"
+
+#ifdef SNIFFER_MODE
+
+#define SNIFFER_CHANNEL (0)
+
+// Bytes of each frame that are kept. Longer frames are truncated, but the
+// record still has the original length. There isn't enough RAM on the
+// smaller parts to hold a full 61 byte frame.
+#define SNIFFER_SNAPLEN (32)
+
+#define RECORD_PACKET ('P')
+
+/**
+ * Sniffed packet record. Sent over the UART in an escaped frame
+ * (uart_write_escaped), followed by min(length, SNIFFER_SNAPLEN) frame bytes
+ * starting at the address byte.
+ */
+typedef struct
+{
+  uint8_t type;         // RECORD_PACKET
+  uint8_t channel;      // Channel the frame was heard on
+  uint8_t rssi;         // Raw RSSI status byte
+  uint8_t lqi;          // LQI in bits 6:0, CRC_OK in bit 7
+  uint32_t timestamp;   // Timer_A ticks (SMCLK/8 = 0.5us) at end of frame
+  uint8_t length;       // Frame length on air (address + payload)
+  uint8_t dropped;      // Records lost before this one (saturates at 255)
+} sniffer_record_t;
+
+static uint8_t record_buffer[sizeof(sniffer_record_t) + SNIFFER_SNAPLEN];
+static volatile uint8_t record_length = 0;
+static uint8_t records_dropped = 0;
+
+#elif defined(SCANNER_MODE)
+
+// Sweep every 8th channel (1.6 MHz apart) across all 256 channels. Both the
+// calibration cache and the sweep frame take SCANNER_POINTS bytes of RAM, so
+// parts with more RAM can lower the step.
+#define SCANNER_FIRST_CHANNEL (0)
+#define SCANNER_STEP (8)
+#define SCANNER_POINTS (32)
+
+// Recalibrate after this many sweeps to follow temperature drift
+#define SCANNER_CALIBRATION_SWEEPS (1000)
+
+#define RECORD_SWEEP ('S')
+
+/**
+ * Sweep frame header. Sent in an escaped frame, followed by count raw RSSI
+ * bytes.
+ */
+typedef struct
+{
+  uint8_t type;         // RECORD_SWEEP
+  uint8_t first;        // First channel
+  uint8_t step;         // Channel step between points
+  uint8_t count;        // Number of points
+} sweep_header_t;
+
+static uint8_t fscal1_cache[SCANNER_POINTS];
+static uint8_t sweep_buffer[sizeof(sweep_header_t) + SCANNER_POINTS];
+
+#else
+
+// Number of records in the ring buffer (must be a power of 2)
+#define RSSI_LOG_RECORDS (8)
+
+// Send as soon as this many records are waiting
+#define RSSI_LOG_BATCH (4)
+
+// Otherwise send whatever is waiting after this many timer overflows
+// (32.768 ms each)
+#define RSSI_LOG_FLUSH_OVERFLOWS (8)
+
+// Source field offset when the payload starts with a packet_header_t
+#define SOURCE_FIELD (1)
+
+/**
+ * RSSI log record. Batches of these are sent back to back, little endian, in
+ * one escaped UART frame.
+ */
+typedef struct
+{
+  uint32_t timestamp;   // Timer_A ticks (SMCLK/8 = 0.5us) at end of packet
+  uint8_t source;       // packet_header_t source, 0 if the packet is too short
+  uint8_t rssi;         // Raw RSSI status byte
+  uint8_t lqi;          // LQI in bits 6:0, CRC_OK in bit 7
+  uint8_t dropped;      // Records lost before this one (saturates at 255)
+} rssi_record_t;
+
+static rssi_record_t rssi_log[RSSI_LOG_RECORDS];
+
+// Written only by the radio ISR
+static volatile uint8_t rssi_log_head = 0;
+
+// Written only by the main loop
+static volatile uint8_t rssi_log_tail = 0;
+
+static uint8_t records_dropped = 0;
+static volatile uint8_t flush_requested = 0;
+
+#endif /* SNIFFER_MODE */
+
+// Upper 16 bits of the timestamp, incremented on every timer overflow
+static volatile uint16_t timer_overflows = 0;
+
+static uint32_t timestamp( void );
+#if !defined(SNIFFER_MODE) && !defined(SCANNER_MODE)
+static void rssi_log_flush( void );
+#endif
 
 uint8_t cc2500_rx_callback( uint8_t*, uint8_t );
 uint8_t uart_rx_callback( uint8_t );
@@ -39,34 +165,233 @@ void main(void)
    LED_PxOUT &= ~(LED1); //Outputs
    LED_PxDIR = LED1; //Outputs
 
+#ifdef SNIFFER_MODE
+   cc2500_set_channel( SNIFFER_CHANNEL );
+   cc2500_enable_sniffer();
+#endif
+
+#ifdef SCANNER_MODE
+   sweep_header_t* sweep = (sweep_header_t*)sweep_buffer;
+   uint16_t sweeps = SCANNER_CALIBRATION_SWEEPS;
+
+   sweep->type = RECORD_SWEEP;
+   sweep->first = SCANNER_FIRST_CHANNEL;
+   sweep->step = SCANNER_STEP;
+   sweep->count = SCANNER_POINTS;
+
+   __bis_SR_register( GIE );
+
+   // Sweep as fast as the UART keeps up, no sleeping
+   for(;;)
+   {
+     if( sweeps++ == SCANNER_CALIBRATION_SWEEPS )
+     {
+       cc2500_scan_calibrate( SCANNER_FIRST_CHANNEL, SCANNER_STEP,
+                                              SCANNER_POINTS, fscal1_cache );
+       sweeps = 0;
+     }
+
+     cc2500_scan( SCANNER_FIRST_CHANNEL, SCANNER_STEP, SCANNER_POINTS,
+                      fscal1_cache, &sweep_buffer[sizeof(sweep_header_t)] );
+
+     uart_write_escaped( sweep_buffer, sizeof(sweep_buffer) );
+     LED_PxOUT ^= LED1;
+   }
+#endif
+
+   // SMCLK/8, continuous mode, interrupt on overflow for the timestamp
+   TA0CTL = TASSEL_2 + ID_3 + MC_2 + TAIE + TACLR;
 
    for(;;)
    {
      __bis_SR_register( LPM1_bits + GIE );   // Enable interrupts and sleep
 
+#ifdef SNIFFER_MODE
+     // Send the record outside of the radio ISR so the next packet isn't
+     // held up by the UART
+     if( record_length )
+     {
+       uart_write_escaped( record_buffer, record_length );
+       record_length = 0;
+       LED_PxOUT ^= LED1;
+     }
+#elif !defined(SCANNER_MODE)
+     rssi_log_flush();
+#endif
    }
 
 }
 
+/*******************************************************************************
+ * @fn     uint32_t timestamp( void )
+ * @brief  32-bit Timer_A time. Must be called with interrupts disabled.
+ * ****************************************************************************/
+static uint32_t timestamp( void )
+{
+  uint16_t low = TA0R;
+  uint16_t high = timer_overflows;
+
+  // The timer overflowed, but the overflow interrupt hasn't run yet
+  if( ( TA0CTL & TAIFG ) && ( low < 0x8000 ) )
+  {
+    high++;
+  }
+
+  return ( (uint32_t)high << 16 ) | low;
+}
+
+// Timer A isr
+#pragma vector=TIMER0_A1_VECTOR
+__interrupt void TA1_ISR (void)
+{
+#if !defined(SNIFFER_MODE) && !defined(SCANNER_MODE)
+  static uint8_t overflows_since_flush;
+
+  // Don't let a few records sit in the buffer forever at low packet rates
+  if( ++overflows_since_flush == RSSI_LOG_FLUSH_OVERFLOWS )
+  {
+    overflows_since_flush = 0;
+    if( rssi_log_head != rssi_log_tail )
+    {
+      flush_requested = 1;
+      __bic_SR_register_on_exit(LPM1_bits);
+    }
+  }
+#endif
+
+  timer_overflows++;
+
+  // Clear interrupt flag
+  TA0IV &= ~TA0IV_TAIFG;
+}
+
+#ifdef SNIFFER_MODE
+
 // This function is called to process the received packet
 uint8_t cc2500_rx_callback( uint8_t* buffer, uint8_t length )
 {
+  sniffer_record_t* record = (sniffer_record_t*)record_buffer;
+  uint8_t capture_length;
 
-  // The RSSI byte is AFTER the message, which is why I'm
-  // going one byte more than the actual 'length'
-  uart_put_char(buffer[length]);
-  uart_put_char('\r');
-  uart_put_char('\n');
+  // Main loop hasn't sent the last record yet
+  if( record_length )
+  {
+    if( records_dropped < 0xFF )
+    {
+      records_dropped++;
+    }
+    return 0;
+  }
 
-  // Currently not used
+  capture_length = ( length < SNIFFER_SNAPLEN ) ? length : SNIFFER_SNAPLEN;
+
+  record->type = RECORD_PACKET;
+  record->channel = SNIFFER_CHANNEL;
+  record->timestamp = timestamp();
+  record->rssi = buffer[length];
+  record->lqi = buffer[length + TI_CCxxx0_LQI_RX];
+  record->length = length;
+  record->dropped = records_dropped;
+  memcpy( &record_buffer[sizeof(sniffer_record_t)], buffer, capture_length );
+
+  records_dropped = 0;
+  record_length = sizeof(sniffer_record_t) + capture_length;
+
+  // Wake up the main loop to send it
+  return 1;
+}
+
+#elif defined(SCANNER_MODE)
+
+// This function is called to process the received packet
+uint8_t cc2500_rx_callback( uint8_t* buffer, uint8_t length )
+{
+  // Packets are ignored while scanning
   return 0;
 }
 
+#else
+
+// This function is called to process the received packet
+uint8_t cc2500_rx_callback( uint8_t* buffer, uint8_t length )
+{
+  rssi_record_t* record;
+  uint8_t pending;
+
+  pending = (uint8_t)( rssi_log_head - rssi_log_tail );
+
+  if( pending == RSSI_LOG_RECORDS )
+  {
+    if( records_dropped < 0xFF )
+    {
+      records_dropped++;
+    }
+    return 1;
+  }
+
+  record = &rssi_log[rssi_log_head & (RSSI_LOG_RECORDS - 1)];
+
+  // The RSSI and LQI bytes are AFTER the message, which is why I'm
+  // going past the actual 'length'
+  record->timestamp = timestamp();
+  record->source = ( length > SOURCE_FIELD ) ? buffer[SOURCE_FIELD] : 0;
+  record->rssi = buffer[length];
+  record->lqi = buffer[length + TI_CCxxx0_LQI_RX];
+  record->dropped = records_dropped;
+
+  records_dropped = 0;
+  rssi_log_head++;
+
+  // Only wake up the main loop once a full batch is waiting
+  return ( ( pending + 1 ) >= RSSI_LOG_BATCH );
+}
+
+/*******************************************************************************
+ * @fn     void rssi_log_flush( void )
+ * @brief  Send waiting records over the UART. Called from the main loop. A
+ *         batch is every record up to the end of the ring buffer, so it can be
+ *         sent straight out of it.
+ * ****************************************************************************/
+static void rssi_log_flush( void )
+{
+  uint8_t pending;
+  uint8_t start;
+
+  pending = (uint8_t)( rssi_log_head - rssi_log_tail );
+
+  if( ( pending < RSSI_LOG_BATCH ) && !flush_requested )
+  {
+    return;
+  }
+  flush_requested = 0;
+
+  while( pending )
+  {
+    start = rssi_log_tail & (RSSI_LOG_RECORDS - 1);
+    if( ( start + pending ) > RSSI_LOG_RECORDS )
+    {
+      pending = RSSI_LOG_RECORDS - start;
+    }
+
+    uart_write_escaped( (uint8_t*)&rssi_log[start],
+                                            pending * sizeof(rssi_record_t) );
+    rssi_log_tail += pending;
+    LED_PxOUT ^= LED1;
+
+    pending = (uint8_t)( rssi_log_head - rssi_log_tail );
+  }
+}
+
+#endif /* SNIFFER_MODE */
+
 //
-// Get 3 bytes of data from uart and send RGB values over radio
-// This does not check incoming data. If a byte is missed, all of the
-// colors will be shifted. I will fix this later...
-//
+/*******************************************************************************
+ * @fn     uint8_t uart_rx_callback( uint8_t rx_byte )
+ * @brief  UART receive callback. None of the modes take commands: the RSSI
+ *         log batches, sniffer records and scanner sweeps only go out, and
+ *         the channel, snaplen and sweep range are build time settings. Bytes
+ *         from the host are dropped, and the CPU is left asleep.
+ * ****************************************************************************/
 uint8_t uart_rx_callback( uint8_t rx_byte )
 {
 
@@ -1,48 +1,77 @@
-/*
- * main.c
- */
+/** @file main.c
+*
+* @brief Drive up to SERVO_CHANNELS servos from SERVO_COMMAND packets
+*
+* Every servo is off until a command gives it a position. Build cc2500.c with
+* CC2500_NESTED_RX_ISR so receiving packets doesn't delay servo edges.
+*
+* @author Alvaro Prieto
+*/
 #include "device.h"
 #include <stdint.h>
+#include "cc2500.h"
+#include "servo.h"
+
+uint8_t rx_callback( uint8_t*, uint8_t );
 
 void main(void) {
 
   WDTCTL = WDTPW + WDTHOLD;                 // Stop WDT
 
-  // Setup oscillator for 8MHz operation
+  // Setup oscillator for 16MHz operation
   BCSCTL1 = CALBC1_16MHZ;
   DCOCTL = CALDCO_16MHZ;
 
   // Wait for changes to take effect
   __delay_cycles(4000);
 
-  P1DIR |= BIT2;
-  P1SEL |= BIT2;
+  // Initialize cc2500 and register callback function to process incoming data
+  setup_cc2500(rx_callback);
+
+  cc2500_set_address(DEVICE_ADDRESS);
+
+  cc2500_enable_addressing();
 
-  // Setup timer A
-  // SMCLK, up mode
-  TA0CTL = TASSEL_2 + MC_3 + ID_3 + TACLR;
+  LED_PxOUT &= ~(LED1 + LED2);
+  LED_PxDIR |= LED1 + LED2; //Outputs
 
-  TA0CCR0 = 50000; // 100000/2MHz = 25 ms * 2 =~ 50ms (up-down)
+  servo_setup();
 
-  TACCR1 = 47550;
-  TACCTL1 = OUTMOD_7;
-  uint32_t delay;
   for(;;) {
-    TACCR1 = 47550;
+    __bis_SR_register( LPM1_bits + GIE );   // Enable interrupts and sleep
+  }
+}
 
-    for(delay=0; delay < ((10/*-ish seconds*/) * 1000); delay++)
-    {
-      __delay_cycles(16000);
+// This function is called to process the received packet
+uint8_t rx_callback( uint8_t* buffer, uint8_t length )
+{
+  uint8_t* record;
+  uint16_t position;
 
-    }
+  if( ( length < 2 ) || ( SERVO_COMMAND != buffer[1] ) )
+  {
+    return 0;
+  }
 
-    TACCR1 = 46500;
+  // [address][SERVO_COMMAND][servo][position][speed][acceleration]...
+  for( record = &buffer[2]; ( record + SERVO_RECORD_LENGTH ) <= &buffer[length];
+                                                record += SERVO_RECORD_LENGTH )
+  {
+    position = record[1] | ( record[2] << 8 );
 
-    for(delay=0; delay < ((10/*-ish seconds*/) * 1000); delay++)
+    if( 0 == position )
     {
-      __delay_cycles(16000);
-
+      servo_disable( record[0] );
+      continue;
     }
 
+    servo_set_ramp( record[0], record[3] | ( record[4] << 8 ),
+                                                record[5] | ( record[6] << 8 ) );
+    servo_set( record[0], position );
   }
+
+  LED_PxOUT ^= LED1; // Toggle LED on command received
+
+  // Don't wake up the processor
+  return 0;
 }
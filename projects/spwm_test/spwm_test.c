@@ -1,18 +1,19 @@
 //
 // spwm_test
-// This is a hybrid hardware/software PWM implementation. Since this msp430
-// only has 2 TimerA capture/compare outputs, it must be expanded by software
-// to drive 3 pwm outputs (for an RGB LED controller)
+// Software PWM on three pins (for an RGB LED controller). Since this msp430
+// only has 2 TimerA capture/compare outputs, the pwm is done in software.
 //
-// A hardware timer is used to set a base clock by calling the ISR at a set
-// interval. Within the ISR, a "software" timer is generated by counting up
-// a variable and soft interrupts are implemented with a simple if statement
+// The pwm driver is lib/pwm/ti/timera_bcm.c, which uses binary code
+// modulation with gamma corrected 12-bit values, so slow fades stay smooth
+// all the way down to off. Link lib/pwm/ti/timera.c instead to compare with
+// plain edge scheduled 8-bit pwm.
 //
 // This example fades each color in and out in R-G-B order and then repeats
 //
 
-#include <msp430.h>
 #include <stdint.h>
+#include "device.h"
+#include "pwm.h"
 
 // Determines LED brightness from 0 to 255 for each color { red, green, blue }
 static uint8_t rgb[3] = {0, 0, 0};
@@ -31,14 +32,8 @@ int main(void)
   // Wait for changes to take effect
   __delay_cycles(4000);
 
-  // Configure ports -- switch inputs, LEDs, GDO0 to RX packet info from CCxxxx
-  P2OUT |= (BIT0 | BIT1 | BIT2);
-  P2DIR |= BIT0 | BIT1 | BIT2;
-
-  // Setup timer A
-  // SMCLK, up mode, enable interrupt
-  TA0CTL = TASSEL_2 + MC_1 + TAIE + TACLR;
-  TA0CCR0 = 512; // 512/16MHz = ~32us
+  // RGB LED on P2.0-P2.2
+  pwm_setup();
 
   __bis_SR_register(GIE);       // Enter LPM3, enable interrupts
 
@@ -65,50 +60,11 @@ int main(void)
         }
       }
     }
-  }
-
-}
-
-// Timer A isr
-#pragma vector=TIMER0_A1_VECTOR
-__interrupt void TA1_ISR (void)
-{
-  static uint8_t counter;
 
-  // Increase virtual timer counter
-  counter++;
-
-  // Process red
-  if ( counter >= rgb[0] )
-  {
-    P2OUT |= 0x01;
+    pwm_set( 0, rgb[0] );
+    pwm_set( 1, rgb[1] );
+    pwm_set( 2, rgb[2] );
+    pwm_update();
   }
-  else
-  {
-    P2OUT &= ~0x01;
-  }
-
-  // Process green
-  if ( counter >= rgb[1] )
-  {
-    P2OUT |= 0x02;
-  }
-  else
-  {
-    P2OUT &= ~0x02;
-  }
-
-  // process blue
-  if ( counter >= rgb[2] )
-  {
-    P2OUT |= 0x04;
-  }
-  else
-  {
-    P2OUT &= ~0x04;
-  }
-
-  // Clear interrupt flag
-  TA0IV &= ~TA0IV_TAIFG;
 
 }
@@ -2,15 +2,44 @@
 *
 * @brief Receive RGB colors from radio and use soft PWM to display them
 *
+* RGB_SCENE colors are held until their apply time, converted to local time
+* with the coordinator's TIME_BEACONs, so every fixture switches together.
+* DELTA_STREAM frames (from msgeq7_interface) are shown by every fixture.
+*
 * @author Alvaro Prieto
 */
 #include <stdint.h>
+#include <string.h>
 #include "device.h"
 #include "cc2500.h"
+#include "pwm.h"
+#include "timesync.h"
+#include "delta.h"
 
-uint8_t rx_callback( uint8_t*, uint8_t );
+// This fixture's slot in RGB_UNIVERSE packets. Fixtures are numbered from
+// FIXTURE_BASE_ADDRESS up, so 0x30 is fixture 0, 0x31 is fixture 1...
+#ifndef FIXTURE_BASE_ADDRESS
+#define FIXTURE_BASE_ADDRESS (0x30)
+#endif
+
+#define FIXTURE_INDEX ( (uint8_t)( DEVICE_ADDRESS - FIXTURE_BASE_ADDRESS ) )
+
+// Old single fixture packets: [address][r][g][b]
+// There's no type byte, so they're only recognized when the first byte isn't
+// a known packet type. A legacy red value that collides with one (1-8, all
+// but off) is dropped.
+#define LEGACY_PACKET_LENGTH (4)
+
+// Scenes further in the future than this are assumed to be bogus and shown
+// right away (1s at 16MHz)
+#define SCENE_MAX_DELAY (16000000L)
 
-static uint8_t rgb[3] = {0, 0, 0};
+// Last color decoded from DELTA_STREAM packets
+static delta_decoder_t stream_decoder;
+static uint8_t stream_color[DELTA_STREAM_CHANNELS];
+
+uint8_t rx_callback( uint8_t*, uint8_t );
+static uint8_t* fixture_color( uint8_t*, uint8_t );
 
 int main(void)
 {
@@ -23,6 +52,8 @@ int main(void)
   // Wait for changes to take effect
   __delay_cycles(4000);
 
+  delta_decoder_init( &stream_decoder, stream_color, DELTA_STREAM_CHANNELS );
+
   // Initialize cc2500 and register callback function to process incoming data
   setup_cc2500(rx_callback);
 
@@ -33,14 +64,11 @@ int main(void)
   LED_PxOUT &= ~(LED1 + LED2); //Outputs
   LED_PxDIR = LED1 + LED2; //Outputs
 
-  // Configure ports -- switch inputs, LEDs, GDO0 to RX packet info from CCxxxx
-   P2OUT |= (BIT0 | BIT1 | BIT2);
-   P2DIR |= BIT0 | BIT1 | BIT2;
+  // RGB LED on P2.0-P2.2, all off until the first color arrives
+  pwm_setup();
 
-  // Setup timer A
-  // SMCLK, up mode, enable interrupt
-  TA0CTL = TASSEL_2 + MC_1 + TAIE + TACLR;
-  TA0CCR0 = 512; // 512/16MHz = ~32us
+  // The pwm timer doubles as the clock for packet timestamps
+  cc2500_set_clock( pwm_timestamp );
 
   __bis_SR_register(LPM1_bits + GIE);       // Enter LPM3, enable interrupts
 
@@ -49,57 +77,114 @@ int main(void)
 // This function is called to process the received packet
 uint8_t rx_callback( uint8_t* buffer, uint8_t length )
 {
-  // copy colors from buffer
-  rgb[0] = buffer[1]; // Copy red
-  rgb[1] = buffer[2]; // Copy green
-  rgb[2] = buffer[3]; // Copy blue
-
-  LED_PxOUT ^= 0x01; // Toggle LED on message received
-
-  // Don't wake up the processor
-  return 0;
-}
-
-// Timer A isr
-#pragma vector=TIMER0_A1_VECTOR
-__interrupt void TA1_ISR (void)
-{
-  static uint8_t counter;
-
-  // Increase virtual timer counter
-  counter++;
+  uint8_t* color = 0;
+  uint8_t scene = 0;
+  uint32_t time;
+  int32_t delay = 0;
 
-  // Process red
-  if ( counter >= rgb[0] )
+  if( length < 2 )
   {
-    P2OUT |= 0x01;
-  }
-  else
-  {
-    P2OUT &= ~0x01;
+    return 0;
   }
 
-  // Process green
-  if ( counter >= rgb[1] )
+  // Typed packets first, a malformed one is dropped rather than being taken
+  // for a legacy color
+  switch( buffer[1] )
   {
-    P2OUT |= 0x02;
+    case TIME_BEACON:
+      if( ( 1 + TIME_BEACON_LENGTH ) == length )
+      {
+        memcpy( &time, &buffer[3], sizeof(time) );
+        timesync_beacon( buffer[2], time, cc2500_rx_timestamp() );
+      }
+      break;
+
+    case RGB_UNIVERSE:
+      if( length > ( 1 + RGB_UNIVERSE_HEADER_LENGTH ) )
+      {
+        color = fixture_color( &buffer[RGB_UNIVERSE_HEADER_LENGTH],
+                                    length - 1 - RGB_UNIVERSE_HEADER_LENGTH );
+      }
+      break;
+
+    case RGB_SCENE:
+      if( length > ( 1 + RGB_SCENE_HEADER_LENGTH ) )
+      {
+        color = fixture_color( &buffer[RGB_SCENE_HEADER_LENGTH],
+                                      length - 1 - RGB_SCENE_HEADER_LENGTH );
+
+        // Apply time in local time
+        memcpy( &time, &buffer[2], sizeof(time) );
+        time = timesync_to_local( time );
+        delay = time - pwm_timestamp();
+        scene = 1;
+      }
+      break;
+
+    case DELTA_STREAM:
+      if( ( length > 2 ) &&
+                  delta_decode( &stream_decoder, &buffer[2], length - 2 ) )
+      {
+        color = stream_color;
+      }
+      break;
+
+    case SERVO_COMMAND:
+    case RATE_SWITCH:
+    case AGGREGATE:
+      // Not for fixtures
+      break;
+
+    default:
+      if( LEGACY_PACKET_LENGTH == length )
+      {
+        color = &buffer[1];
+      }
+      break;
   }
-  else
+
+  if( 0 == color )
   {
-    P2OUT &= ~0x02;
+    return 0;
   }
 
-  // process blue
-  if ( counter >= rgb[2] )
+  // copy colors from buffer
+  pwm_set( 0, color[0] ); // Red
+  pwm_set( 1, color[1] ); // Green
+  pwm_set( 2, color[2] ); // Blue
+
+  // Scenes wait for their apply time, as long as the clock can be trusted.
+  // Everything else is shown from the next pwm period on.
+  if( scene && timesync_synced() && ( delay > 0 ) && ( delay < SCENE_MAX_DELAY ) )
   {
-    P2OUT |= 0x04;
+    pwm_latch_at( time );
   }
   else
   {
-    P2OUT &= ~0x04;
+    pwm_update();
   }
 
-  // Clear interrupt flag
-  TA0IV &= ~TA0IV_TAIFG;
+  LED_PxOUT ^= 0x01; // Toggle LED on message received
+
+  // Don't wake up the processor
+  return 0;
+}
+
+//
+// Find this fixture's color in a run of fixtures: [first fixture][r g b]...
+// length covers the colors only. Returns 0 if it's not in there.
+//
+static uint8_t* fixture_color( uint8_t* fixtures, uint8_t length )
+{
+  uint8_t first_fixture = fixtures[0];
+  uint8_t total_fixtures = length / 3;
+
+  // Not in this packet, some other part of the universe
+  if( ( FIXTURE_INDEX < first_fixture ) ||
+      ( ( FIXTURE_INDEX - first_fixture ) >= total_fixtures ) )
+  {
+    return 0;
+  }
 
+  return &fixtures[1 + 3 * ( FIXTURE_INDEX - first_fixture )];
 }